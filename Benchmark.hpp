@@ -0,0 +1,205 @@
+#pragma once
+// Benchmark support: camera replay files and per-frame statistics.
+// Does not depend on Vulkan. A replay file is plain text, one entry per line:
+//   # comment
+//   cam <t> <x> <y> <z> <yaw> <pitch>   camera key (seconds, position, radians)
+//   event <t> <name>                    application action, e.g. "drawer" or "lamp"
+// Keys must be in time order. --record writes the same format from a live session.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+struct CameraKey {
+	float t;
+	glm::vec3 pos;
+	float yaw, pitch;
+};
+
+struct ReplayEvent {
+	float t;
+	std::string name;
+};
+
+class Replay {
+public:
+	std::vector<CameraKey> keys;
+	std::vector<ReplayEvent> events;
+
+	bool load(const std::string& file) {
+		std::ifstream in(file);
+		if (!in) {
+			std::cout << "Replay: cannot read <" << file << ">\n";
+			return false;
+		}
+		keys.clear();
+		events.clear();
+
+		std::string line;
+		int lineNumber = 0;
+		while (std::getline(in, line)) {
+			lineNumber++;
+			std::istringstream ls(line);
+			std::string kind;
+			if (!(ls >> kind) || kind[0] == '#') continue;
+
+			if (kind == "cam") {
+				CameraKey k;
+				if (ls >> k.t >> k.pos.x >> k.pos.y >> k.pos.z >> k.yaw >> k.pitch) {
+					keys.push_back(k);
+					continue;
+				}
+			}
+			else if (kind == "event") {
+				ReplayEvent e;
+				if (ls >> e.t >> e.name) {
+					events.push_back(e);
+					continue;
+				}
+			}
+			std::cout << "Replay: " << file << ":" << lineNumber << ": bad line <" << line << ">\n";
+		}
+		std::stable_sort(events.begin(), events.end(),
+			[](const ReplayEvent& a, const ReplayEvent& b) { return a.t < b.t; });
+
+		if (keys.empty()) {
+			std::cout << "Replay: <" << file << "> has no camera keys\n";
+			return false;
+		}
+		std::cout << "Replay: " << keys.size() << " camera keys, " << events.size()
+			<< " events, " << duration() << " s\n";
+		return true;
+	}
+
+	float duration() const {
+		return keys.empty() ? 0.0f : keys.back().t;
+	}
+
+	// Camera at time t, linearly interpolated between the surrounding keys
+	CameraKey sample(float t) const {
+		auto next = std::upper_bound(keys.begin(), keys.end(), t,
+			[](float v, const CameraKey& k) { return v < k.t; });
+		if (next == keys.begin()) return keys.front();
+		if (next == keys.end()) return keys.back();
+
+		const CameraKey& a = *(next - 1);
+		const CameraKey& b = *next;
+		const float f = b.t > a.t ? (t - a.t) / (b.t - a.t) : 1.0f;
+		return { t, glm::mix(a.pos, b.pos, f), glm::mix(a.yaw, b.yaw, f), glm::mix(a.pitch, b.pitch, f) };
+	}
+
+	// Events with from < t <= to
+	template <class F>
+	void forEachEvent(float from, float to, F f) const {
+		for (const ReplayEvent& e : events) {
+			if (e.t > from && e.t <= to) f(e.name);
+		}
+	}
+};
+
+class ReplayRecorder {
+public:
+	bool open(const std::string& file) {
+		out.open(file);
+		if (!out) {
+			std::cout << "Record: cannot write <" << file << ">\n";
+			return false;
+		}
+		out << std::setprecision(9) << "# cam t x y z yaw pitch / event t name\n";
+		return true;
+	}
+
+	bool isOpen() const {
+		return out.is_open();
+	}
+
+	void key(float t, glm::vec3 pos, float yaw, float pitch) {
+		if (!out.is_open()) return;
+		out << "cam " << t << " " << pos.x << " " << pos.y << " " << pos.z << " " << yaw << " " << pitch << "\n";
+	}
+
+	void event(float t, const std::string& name) {
+		if (!out.is_open()) return;
+		out << "event " << t << " " << name << "\n";
+	}
+
+private:
+	std::ofstream out;
+};
+
+// Commands recorded in one command buffer
+struct CommandStats {
+	uint32_t draws = 0;
+	uint32_t pipelineBinds = 0;
+	uint32_t descriptorSetBinds = 0;
+	uint32_t vertexBufferBinds = 0;
+};
+
+// Frame times and command counts of a run, written as JSON at the end
+class FrameStats {
+public:
+	void add(double cpuMs, double gpuMs, double frameMs, const CommandStats& commands) {
+		cpu.push_back(cpuMs);
+		if (gpuMs > 0.0) gpu.push_back(gpuMs);
+		if (frameMs > 0.0) frame.push_back(frameMs);
+		draws.push_back(commands.draws);
+		pipelineBinds.push_back(commands.pipelineBinds);
+		descriptorSetBinds.push_back(commands.descriptorSetBinds);
+		vertexBufferBinds.push_back(commands.vertexBufferBinds);
+	}
+
+	size_t frames() const {
+		return cpu.size();
+	}
+
+	// info: extra "key": value pairs, already formatted as JSON
+	bool writeJSON(const std::string& file, const std::vector<std::pair<std::string, std::string>>& info) const {
+		std::ofstream out(file);
+		if (!out) {
+			std::cout << "Benchmark: cannot write <" << file << ">\n";
+			return false;
+		}
+		out << std::fixed << std::setprecision(4) << "{\n";
+		for (const auto& i : info) {
+			out << "  \"" << i.first << "\": " << i.second << ",\n";
+		}
+		out << "  \"frames\": " << frames() << ",\n";
+		writeSeries(out, "cpuMs", cpu, ",");
+		writeSeries(out, "gpuMs", gpu, ",");
+		writeSeries(out, "frameMs", frame, ",");
+		writeSeries(out, "draws", draws, ",");
+		writeSeries(out, "pipelineBinds", pipelineBinds, ",");
+		writeSeries(out, "descriptorSetBinds", descriptorSetBinds, ",");
+		writeSeries(out, "vertexBufferBinds", vertexBufferBinds, "");
+		out << "}\n";
+
+		std::cout << "Benchmark: " << frames() << " frames written to <" << file << ">\n";
+		return true;
+	}
+
+private:
+	std::vector<double> cpu, gpu, frame;
+	std::vector<double> draws, pipelineBinds, descriptorSetBinds, vertexBufferBinds;
+
+	// Nearest rank on a sorted copy
+	static double percentile(const std::vector<double>& sorted, double p) {
+		if (sorted.empty()) return 0.0;
+		size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+		return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+	}
+
+	static void writeSeries(std::ostream& out, const char* name, std::vector<double> v, const char* sep) {
+		std::sort(v.begin(), v.end());
+		double sum = 0.0;
+		for (double x : v) sum += x;
+		out << "  \"" << name << "\": {\"avg\": " << (v.empty() ? 0.0 : sum / v.size())
+			<< ", \"p50\": " << percentile(v, 50) << ", \"p95\": " << percentile(v, 95)
+			<< ", \"p99\": " << percentile(v, 99) << ", \"max\": " << (v.empty() ? 0.0 : v.back())
+			<< "}" << sep << "\n";
+	}
+};
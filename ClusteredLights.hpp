@@ -0,0 +1,272 @@
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include <glm/glm.hpp>
+#include "MatrixKernels.hpp"
+
+// Clustered forward lighting. The view frustum is split into a grid of froxels:
+// TILES_X x TILES_Y screen tiles times SLICES depth slices, exponentially spaced
+// between the near and the far plane. Every frame bin() tests the bounding sphere
+// of each point and spot light against the froxels its screen rectangle and depth
+// range cover, four froxels of a row at a time with SSE2, and writes per froxel
+// the (offset, count) of its run in one list of light indices. The fragment
+// shader finds its froxel from gl_FragCoord and its view depth and loops only
+// over that run.
+
+// One light as the shaders read it (std430). Point lights have an outer cosine
+// of -2, so their cone term is always 1.
+struct ClusterLight {
+	glm::vec4 posRadius;	// world space position, radius of influence
+	glm::vec4 color;		// color times intensity, w: cosine of the inner cone angle
+	glm::vec4 direction;	// spot direction, w: cosine of the outer cone angle
+};
+
+inline ClusterLight pointLight(glm::vec3 pos, float radius, glm::vec3 color) {
+	return { glm::vec4(pos, radius), glm::vec4(color, -1.0f), glm::vec4(0.0f, -1.0f, 0.0f, -2.0f) };
+}
+
+// inner, outer: half angles of the cone, in radians
+inline ClusterLight spotLight(glm::vec3 pos, glm::vec3 dir, float radius, glm::vec3 color,
+	float inner, float outer) {
+	return { glm::vec4(pos, radius), glm::vec4(color, std::cos(inner)),
+		glm::vec4(glm::normalize(dir), std::cos(outer)) };
+}
+
+// n lights scattered in a box, one spot light pointing down for every three
+// point lights. The seed fixes the scene, so that benchmark runs compare.
+inline std::vector<ClusterLight> randomLights(uint32_t n, glm::vec3 boxMin, glm::vec3 boxMax, uint32_t seed = 1) {
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> U(0.0f, 1.0f);
+	std::vector<ClusterLight> L;
+	for (uint32_t i = 0; i < n; i++) {
+		const glm::vec3 pos = glm::mix(boxMin, boxMax, glm::vec3(U(rng), U(rng), U(rng)));
+		const glm::vec3 color = glm::mix(glm::vec3(0.3f), glm::vec3(1.0f), glm::vec3(U(rng), U(rng), U(rng))) * 1.5f;
+		const float radius = glm::mix(1.0f, 2.0f, U(rng));
+		L.push_back(i % 4 == 3 ?
+			spotLight(pos, glm::vec3(0.0f, -1.0f, 0.0f), radius * 1.5f, color * 2.0f, glm::radians(25.0f), glm::radians(35.0f)) :
+			pointLight(pos, radius, color));
+	}
+	return L;
+}
+
+// Grid of the frame: froxel = (floor(fragCoord.xy * scale.xy), floor(log(depth) * scale.z + scale.w))
+struct ClusterUniformBlock {
+	alignas(16) glm::uvec4 grid;	// tiles x, tiles y, slices, lights
+	alignas(16) glm::vec4 scale;
+};
+
+class LightClusters {
+public:
+	static constexpr uint32_t TILES_X = 16;		// a multiple of 4, for the SIMD rows
+	static constexpr uint32_t TILES_Y = 9;
+	static constexpr uint32_t SLICES = 24;
+	static constexpr uint32_t CLUSTERS = TILES_X * TILES_Y * SLICES;
+	static constexpr uint32_t MAX_LIGHTS = 1024;
+	static constexpr uint32_t MAX_REFS = 1 << 17;	// light indices over all the froxels
+
+	// Filled by the application; lights past MAX_LIGHTS are ignored
+	std::vector<ClusterLight> lights;
+
+	// Last bin()
+	struct {
+		uint32_t visible;	// lights touching at least one froxel
+		uint32_t refs;		// entries of the index list
+		uint32_t dropped;	// entries beyond MAX_REFS, lost
+		double ms;
+	} stats = {};
+
+	// view, prj: camera of the frame (prj with the Vulkan y flip), zNear and zFar
+	// its clip planes, width x height the framebuffer. Writes the uniform block,
+	// the lights, the (offset, count) of every froxel and the index list.
+	void bin(const glm::mat4& view, const glm::mat4& prj, float zNear, float zFar,
+		uint32_t width, uint32_t height, ClusterUniformBlock* params, ClusterLight* gpuLights,
+		glm::uvec2* ranges, uint32_t* indices) {
+		PROFILE_ZONE("Light binning");
+		const auto start = std::chrono::steady_clock::now();
+		const uint32_t n = static_cast<uint32_t>(std::min<size_t>(lights.size(), MAX_LIGHTS));
+
+		updateBounds(prj[0][0], prj[1][1], zNear, zFar);
+		const float sliceScale = SLICES / std::log(zFar / zNear);
+		const float sliceBias = -std::log(zNear) * sliceScale;
+
+		params->grid = glm::uvec4(TILES_X, TILES_Y, SLICES, n);
+		params->scale = glm::vec4((float)TILES_X / width, (float)TILES_Y / height, sliceScale, sliceBias);
+		std::copy(lights.begin(), lights.begin() + n, gpuLights);
+
+		// Froxels of each light: refCluster[refEnd[l - 1] .. refEnd[l]]
+		refEnd.resize(n);
+		uint32_t total = 0;
+		stats = {};
+		for (uint32_t l = 0; l < n; l++) {
+			const uint32_t before = total;
+			total = binLight(l, total, view, prj, zNear, zFar, sliceScale, sliceBias);
+			refEnd[l] = total;
+			if (total > before) stats.visible++;
+		}
+
+		// Counting sort by froxel; lights keep their order inside a froxel
+		counts.assign(CLUSTERS, 0);
+		for (uint32_t i = 0; i < total; i++) counts[refCluster[i]]++;
+		uint32_t offset = 0;
+		for (uint32_t c = 0; c < CLUSTERS; c++) {
+			const uint32_t count = std::min(counts[c], MAX_REFS - offset);
+			ranges[c] = glm::uvec2(offset, count);
+			counts[c] = offset;
+			offset += count;
+		}
+		for (uint32_t l = 0, i = 0; l < n; l++) {
+			for (; i < refEnd[l]; i++) {
+				const uint32_t c = refCluster[i];
+				if (counts[c] < ranges[c].x + ranges[c].y) {
+					indices[counts[c]++] = l;
+				}
+			}
+		}
+		stats.refs = offset;
+		stats.dropped = total - offset;
+		stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+private:
+	// View space bounds of the froxels (x, y, depth), structure of arrays
+	std::vector<float> minX, maxX, minY, maxY, minZ, maxZ;
+	glm::vec4 boundsKey = glm::vec4(0.0f);
+	std::vector<uint32_t> refCluster, refEnd, counts;
+
+	static uint32_t index(uint32_t x, uint32_t y, uint32_t z) {
+		return (z * TILES_Y + y) * TILES_X + x;
+	}
+
+	// The bounds depend only on the projection: rebuilt when it changes (resize)
+	void updateBounds(float p00, float p11, float zNear, float zFar) {
+		const glm::vec4 key(p00, p11, zNear, zFar);
+		if (key == boundsKey) return;
+		boundsKey = key;
+		for (auto* v : { &minX, &maxX, &minY, &maxY, &minZ, &maxZ }) v->resize(CLUSTERS);
+
+		for (uint32_t z = 0; z < SLICES; z++) {
+			const float d0 = zNear * std::pow(zFar / zNear, (float)z / SLICES);
+			const float d1 = zNear * std::pow(zFar / zNear, (float)(z + 1) / SLICES);
+			for (uint32_t y = 0; y < TILES_Y; y++) {
+				const float ny0 = 2.0f * y / TILES_Y - 1.0f, ny1 = 2.0f * (y + 1) / TILES_Y - 1.0f;
+				for (uint32_t x = 0; x < TILES_X; x++) {
+					const float nx0 = 2.0f * x / TILES_X - 1.0f, nx1 = 2.0f * (x + 1) / TILES_X - 1.0f;
+					// A point at depth d and NDC (nx, ny) is (nx d / p00, ny d / p11, -d)
+					const float xs[4] = { nx0 * d0 / p00, nx1 * d0 / p00, nx0 * d1 / p00, nx1 * d1 / p00 };
+					const float ys[4] = { ny0 * d0 / p11, ny1 * d0 / p11, ny0 * d1 / p11, ny1 * d1 / p11 };
+					const uint32_t c = index(x, y, z);
+					minX[c] = std::min(std::min(xs[0], xs[1]), std::min(xs[2], xs[3]));
+					maxX[c] = std::max(std::max(xs[0], xs[1]), std::max(xs[2], xs[3]));
+					minY[c] = std::min(std::min(ys[0], ys[1]), std::min(ys[2], ys[3]));
+					maxY[c] = std::max(std::max(ys[0], ys[1]), std::max(ys[2], ys[3]));
+					minZ[c] = d0;
+					maxZ[c] = d1;
+				}
+			}
+		}
+	}
+
+	// Froxel range of the light's bounding box, then a sphere - box test per
+	// froxel. Appends the froxels touched to refCluster from "count" on and
+	// returns the new count.
+	uint32_t binLight(uint32_t l, uint32_t count, const glm::mat4& view, const glm::mat4& prj, float zNear, float zFar,
+		float sliceScale, float sliceBias) {
+		const glm::vec4& pr = lights[l].posRadius;
+		const glm::vec3 c = glm::vec3(view * glm::vec4(glm::vec3(pr), 1.0f));
+		const float r = pr.w, d = -c.z;
+		if (d + r < zNear || d - r > zFar) return count;
+
+		auto slice = [&](float depth) {
+			const float s = std::floor(std::log(std::max(depth, zNear)) * sliceScale + sliceBias);
+			return (uint32_t)std::min(std::max(s, 0.0f), (float)(SLICES - 1));
+		};
+		const uint32_t z0 = slice(d - r), z1 = slice(d + r);
+
+		// Screen rectangle of the box around the sphere, the whole screen if it
+		// crosses the near plane
+		uint32_t x0 = 0, x1 = TILES_X - 1, y0 = 0, y1 = TILES_Y - 1;
+		if (d - r > zNear) {
+			float nx0 = FLT_MAX, nx1 = -FLT_MAX, ny0 = FLT_MAX, ny1 = -FLT_MAX;
+			for (float dd : { d - r, d + r }) {
+				for (float s : { -r, r }) {
+					const float nx = prj[0][0] * (c.x + s) / dd, ny = prj[1][1] * (c.y + s) / dd;
+					nx0 = std::min(nx0, nx); nx1 = std::max(nx1, nx);
+					ny0 = std::min(ny0, ny); ny1 = std::max(ny1, ny);
+				}
+			}
+			if (nx1 < -1.0f || nx0 > 1.0f || ny1 < -1.0f || ny0 > 1.0f) return count;
+			auto tile = [](float ndc, uint32_t tiles) {
+				const float t = std::floor((ndc + 1.0f) * 0.5f * tiles);
+				return (uint32_t)std::min(std::max(t, 0.0f), (float)(tiles - 1));
+			};
+			x0 = tile(nx0, TILES_X); x1 = tile(nx1, TILES_X);
+			y0 = tile(ny0, TILES_Y); y1 = tile(ny1, TILES_Y);
+		}
+
+		// Room for every froxel of the range, so the rows append without checks
+		const size_t worst = count + (size_t)(z1 - z0 + 1) * (y1 - y0 + 1) * TILES_X;
+		if (refCluster.size() < worst) refCluster.resize(worst * 2);
+
+		uint32_t* out = refCluster.data();
+		const bool simd = MatrixKernels::activeISA() != MATRIX_ISA_SCALAR;
+		for (uint32_t z = z0; z <= z1; z++) {
+			for (uint32_t y = y0; y <= y1; y++) {
+#ifdef MK_X86
+				if (simd) {
+					count = testRowSSE2(out, count, index(0, y, z), x0, x1, c.x, c.y, d, r);
+					continue;
+				}
+#endif
+				count = testRowScalar(out, count, index(0, y, z), x0, x1, c.x, c.y, d, r);
+			}
+		}
+		(void)simd;
+		return count;
+	}
+
+	uint32_t testRowScalar(uint32_t* out, uint32_t count, uint32_t row, uint32_t x0, uint32_t x1,
+		float cx, float cy, float cz, float r) const {
+		for (uint32_t x = x0; x <= x1; x++) {
+			const uint32_t i = row + x;
+			const float dx = std::max(0.0f, std::max(minX[i] - cx, cx - maxX[i]));
+			const float dy = std::max(0.0f, std::max(minY[i] - cy, cy - maxY[i]));
+			const float dz = std::max(0.0f, std::max(minZ[i] - cz, cz - maxZ[i]));
+			out[count] = i;
+			count += dx * dx + dy * dy + dz * dz <= r * r;
+		}
+		return count;
+	}
+
+#ifdef MK_X86
+	// Four froxels per step: squared distance from the sphere center to each
+	// box, then a branchless append of the lanes inside the sphere and the range
+	MK_TARGET("sse2") uint32_t testRowSSE2(uint32_t* out, uint32_t count, uint32_t row, uint32_t x0, uint32_t x1,
+		float cx, float cy, float cz, float r) const {
+		const __m128 vx = _mm_set1_ps(cx), vy = _mm_set1_ps(cy), vz = _mm_set1_ps(cz);
+		const __m128 r2 = _mm_set1_ps(r * r), zero = _mm_setzero_ps();
+		for (uint32_t x = x0 & ~3u; x <= x1; x += 4) {
+			const uint32_t i = row + x;
+			__m128 dx = _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minX[i]), vx), _mm_sub_ps(vx, _mm_loadu_ps(&maxX[i])));
+			__m128 dy = _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minY[i]), vy), _mm_sub_ps(vy, _mm_loadu_ps(&maxY[i])));
+			__m128 dz = _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minZ[i]), vz), _mm_sub_ps(vz, _mm_loadu_ps(&maxZ[i])));
+			dx = _mm_max_ps(dx, zero);
+			dy = _mm_max_ps(dy, zero);
+			dz = _mm_max_ps(dz, zero);
+			const __m128 dist2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+			int mask = _mm_movemask_ps(_mm_cmple_ps(dist2, r2));
+			if (x < x0) mask &= 0xF << (x0 - x);
+			if (x + 3 > x1) mask &= 0xF >> (x + 3 - x1);
+			for (uint32_t lane = 0; lane < 4; lane++) {
+				out[count] = i + lane;
+				count += (mask >> lane) & 1;
+			}
+		}
+		return count;
+	}
+#endif
+};
@@ -0,0 +1,158 @@
+#pragma once
+// Frame pacing: frame-rate cap, input-to-present latency and, when frames are
+// rendered on demand, idle time statistics.
+// Does not depend on Vulkan: BaseProject tells the pacer when input was sampled,
+// when a frame was submitted (with its timeline value) and when the GPU finished it.
+// "Present" latency is measured up to the moment the image is ready to present;
+// the wait for the next vblank in FIFO modes is not visible without
+// present-timing extensions.
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <deque>
+
+class FramePacer {
+	using Clock = std::chrono::steady_clock;
+	using Seconds = std::chrono::duration<double>;
+
+public:
+	bool printStats = false;
+
+	// 0 disables the cap
+	void setFpsCap(float fps) {
+		period = fps > 0.0f ? 1.0 / fps : 0.0;
+		nextFrame = Clock::now();
+	}
+
+	float getFpsCap() const {
+		return period > 0.0 ? (float)(1.0 / period) : 0.0f;
+	}
+
+	// Blocks until the next frame is due. The OS sleep is too coarse for this
+	// (up to 15 ms on Windows), so we sleep until shortly before the deadline and
+	// spin for the rest. The spin margin follows the measured oversleep.
+	void waitForNextFrame() {
+		Clock::time_point now = Clock::now();
+		frameStart = now;
+		if (period <= 0.0) return;
+
+		const Clock::time_point sleepUntil = nextFrame -
+			std::chrono::duration_cast<Clock::duration>(Seconds(spinMargin));
+		if (now < sleepUntil) {
+			std::this_thread::sleep_until(sleepUntil);
+			now = Clock::now();
+			const double overshoot = Seconds(now - sleepUntil).count();
+			spinMargin = std::min(0.016, std::max(0.0002, 0.875 * spinMargin + 0.125 * 1.5 * overshoot));
+		}
+		while (now < nextFrame) {
+			std::this_thread::yield();
+			now = Clock::now();
+		}
+		frameStart = now;
+
+		// Keep the cadence, but do not try to catch up after a long stall
+		nextFrame += std::chrono::duration_cast<Clock::duration>(Seconds(period));
+		if (nextFrame < now) {
+			nextFrame = now;
+		}
+	}
+
+	// Called whenever the application reads the input devices
+	void inputSampled() {
+		inputTime = Clock::now();
+		inputThisFrame = true;
+	}
+
+	// The frame signalling timelineValue has been submitted and queued for present
+	void frameSubmitted(uint64_t timelineValue) {
+		const Clock::time_point now = Clock::now();
+		const Clock::time_point sample = inputThisFrame ? inputTime : frameStart;
+		inputThisFrame = false;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		pending.push_back({ timelineValue, sample });
+		acc.submit += Seconds(now - sample).count();
+		acc.frames++;
+	}
+
+	// Called from the timeline watcher thread when the GPU reaches timelineValue
+	void frameCompleted(uint64_t timelineValue) {
+		const Clock::time_point now = Clock::now();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		while (!pending.empty() && pending.front().value <= timelineValue) {
+			const double latency = Seconds(now - pending.front().input).count();
+			acc.latency += latency;
+			acc.maxLatency = std::max(acc.maxLatency, latency);
+			acc.completed++;
+			pending.pop_front();
+		}
+	}
+
+	// Render on demand: the loop blocked for this long, having found skipped
+	// frames that would have repeated the last one
+	void idled(double seconds, uint64_t skipped) {
+		std::lock_guard<std::mutex> lock(mutex);
+		acc.idle += seconds;
+		acc.skipped += skipped;
+	}
+
+	// Prints once per second when enabled
+	void report(const char* presentMode, int framesInFlight) {
+		const Clock::time_point now = Clock::now();
+		const double elapsed = Seconds(now - lastReport).count();
+		if (elapsed < 1.0) return;
+		lastReport = now;
+
+		Stats s;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			s = acc;
+			acc = Stats();
+		}
+		if (!printStats || s.frames == 0) return;
+
+		std::cout << "Pacing: " << presentMode << ", " << framesInFlight << " in flight";
+		if (period > 0.0) std::cout << ", cap " << getFpsCap() << " fps";
+		std::cout << " | " << s.frames / elapsed << " fps"
+			<< " | input->submit " << 1000.0 * s.submit / s.frames << " ms";
+		if (s.completed > 0) {
+			std::cout << " | input->present avg " << 1000.0 * s.latency / s.completed
+				<< " ms, max " << 1000.0 * s.maxLatency << " ms";
+		}
+		if (s.skipped > 0) {
+			std::cout << " | idle " << 100.0 * s.idle / elapsed << "%, " << s.skipped << " skipped";
+		}
+		std::cout << "\n";
+	}
+
+private:
+	struct Pending {
+		uint64_t value;
+		Clock::time_point input;
+	};
+	struct Stats {
+		uint64_t frames = 0;
+		uint64_t completed = 0;
+		double submit = 0.0;
+		double latency = 0.0;
+		double maxLatency = 0.0;
+		double idle = 0.0;
+		uint64_t skipped = 0;
+	};
+
+	double period = 0.0;
+	double spinMargin = 0.002;
+	Clock::time_point nextFrame = Clock::now();
+	Clock::time_point frameStart = Clock::now();
+	Clock::time_point inputTime = Clock::now();
+	Clock::time_point lastReport = Clock::now();
+	bool inputThisFrame = false;
+
+	std::mutex mutex;
+	std::deque<Pending> pending;
+	Stats acc;
+};
@@ -0,0 +1,484 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// Batch matrix kernels working on arrays of glm::mat4 (column major, 16 floats).
+//   batchMul(A, B, C, n)            C[i] = A[i] * B[i]
+//   batchMVP(VP, M, C, n)           C[i] = VP * M[i]
+//   batchAffineInverse(M, C, n)     C[i] = inverse(M[i]), M[i] affine
+//   batchInverseTranspose3(M, C, n) C[i] = mat4(inverse(transpose(mat3(M[i]))))
+// The output may alias the input. The instruction set is picked at run time
+// (AVX-512F, AVX2+FMA, SSE2) with a scalar glm fallback for other CPUs.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MK_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define MK_TARGET(isa)
+#else
+#include <cpuid.h>
+#define MK_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+enum MatrixISA { MATRIX_ISA_SCALAR, MATRIX_ISA_SSE2, MATRIX_ISA_AVX2, MATRIX_ISA_AVX512 };
+
+namespace MatrixKernels {
+
+	inline const char* isaName(MatrixISA isa) {
+		switch (isa) {
+		case MATRIX_ISA_SSE2: return "SSE2";
+		case MATRIX_ISA_AVX2: return "AVX2";
+		case MATRIX_ISA_AVX512: return "AVX-512";
+		default: return "scalar";
+		}
+	}
+
+	// Scalar reference, also used for the tails of the SIMD loops
+	inline void mulScalar(const glm::mat4* A, const glm::mat4* B, glm::mat4* C, size_t n) {
+		for (size_t i = 0; i < n; i++) C[i] = A[i] * B[i];
+	}
+
+	inline void mvpScalar(const glm::mat4& VP, const glm::mat4* M, glm::mat4* C, size_t n) {
+		for (size_t i = 0; i < n; i++) C[i] = VP * M[i];
+	}
+
+	inline void affineInverseScalar(const glm::mat4* M, glm::mat4* C, size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			const glm::mat3 L = glm::inverse(glm::mat3(M[i]));
+			const glm::vec3 t = -(L * glm::vec3(M[i][3]));
+			C[i] = glm::mat4(L);
+			C[i][3] = glm::vec4(t, 1.0f);
+		}
+	}
+
+	inline void inverseTranspose3Scalar(const glm::mat4* M, glm::mat4* C, size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			C[i] = glm::mat4(glm::inverse(glm::transpose(glm::mat3(M[i]))));
+		}
+	}
+
+#ifdef MK_X86
+	// The inverse transpose of the upper 3x3 block has the cross products of its
+	// columns as columns, divided by the determinant: (c1 x c2, c2 x c0, c0 x c1) / det.
+	// The affine inverse is its transpose, with translation -L^-1 t.
+	// Every SIMD width runs the same per 128 bit lane code, on 1, 2 or 4 matrices at once.
+
+	////////////////////////////////// SSE2 //////////////////////////////////
+
+	MK_TARGET("sse2") inline __m128 yzx128(__m128 a) {
+		return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+	}
+
+	MK_TARGET("sse2") inline __m128 cross128(__m128 a, __m128 b) {
+		__m128 r = _mm_sub_ps(_mm_mul_ps(a, yzx128(b)), _mm_mul_ps(yzx128(a), b));
+		return yzx128(r);
+	}
+
+	MK_TARGET("sse2") inline __m128 hsum128(__m128 v) {
+		__m128 s = _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_add_ps(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 0, 3, 2)));
+	}
+
+	MK_TARGET("sse2") inline void mul128(__m128 a0, __m128 a1, __m128 a2, __m128 a3,
+		const float* b, float* c) {
+		for (int j = 0; j < 4; j++) {
+			__m128 bj = _mm_loadu_ps(b + 4 * j);
+			__m128 r = _mm_mul_ps(a0, _mm_shuffle_ps(bj, bj, 0x00));
+			r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_shuffle_ps(bj, bj, 0x55)));
+			r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(bj, bj, 0xAA)));
+			r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_shuffle_ps(bj, bj, 0xFF)));
+			_mm_storeu_ps(c + 4 * j, r);
+		}
+	}
+
+	MK_TARGET("sse2") inline void mulSSE2(const glm::mat4* A, const glm::mat4* B, glm::mat4* C, size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			const float* a = &A[i][0][0];
+			mul128(_mm_loadu_ps(a), _mm_loadu_ps(a + 4), _mm_loadu_ps(a + 8), _mm_loadu_ps(a + 12),
+				&B[i][0][0], &C[i][0][0]);
+		}
+	}
+
+	MK_TARGET("sse2") inline void mvpSSE2(const glm::mat4& VP, const glm::mat4* M, glm::mat4* C, size_t n) {
+		const float* a = &VP[0][0];
+		const __m128 a0 = _mm_loadu_ps(a), a1 = _mm_loadu_ps(a + 4);
+		const __m128 a2 = _mm_loadu_ps(a + 8), a3 = _mm_loadu_ps(a + 12);
+		for (size_t i = 0; i < n; i++) {
+			mul128(a0, a1, a2, a3, &M[i][0][0], &C[i][0][0]);
+		}
+	}
+
+	MK_TARGET("sse2") inline void cofactors128(__m128 c0, __m128 c1, __m128 c2,
+		__m128& n0, __m128& n1, __m128& n2) {
+		n0 = cross128(c1, c2);
+		n1 = cross128(c2, c0);
+		n2 = cross128(c0, c1);
+		const __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), hsum128(_mm_mul_ps(c0, n0)));
+		n0 = _mm_mul_ps(n0, invDet);
+		n1 = _mm_mul_ps(n1, invDet);
+		n2 = _mm_mul_ps(n2, invDet);
+	}
+
+	MK_TARGET("sse2") inline void inverseTranspose3SSE2(const glm::mat4* M, glm::mat4* C, size_t n) {
+		const __m128 e3 = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+		for (size_t i = 0; i < n; i++) {
+			const float* m = &M[i][0][0];
+			float* c = &C[i][0][0];
+			__m128 n0, n1, n2;
+			cofactors128(_mm_loadu_ps(m), _mm_loadu_ps(m + 4), _mm_loadu_ps(m + 8), n0, n1, n2);
+			_mm_storeu_ps(c, n0);
+			_mm_storeu_ps(c + 4, n1);
+			_mm_storeu_ps(c + 8, n2);
+			_mm_storeu_ps(c + 12, e3);
+		}
+	}
+
+	MK_TARGET("sse2") inline void affineInverseSSE2(const glm::mat4* M, glm::mat4* C, size_t n) {
+		const __m128 e3 = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+		for (size_t i = 0; i < n; i++) {
+			const float* m = &M[i][0][0];
+			float* c = &C[i][0][0];
+			const __m128 t = _mm_loadu_ps(m + 12);
+			__m128 l0, l1, l2, l3 = _mm_setzero_ps();
+			cofactors128(_mm_loadu_ps(m), _mm_loadu_ps(m + 4), _mm_loadu_ps(m + 8), l0, l1, l2);
+			_MM_TRANSPOSE4_PS(l0, l1, l2, l3);
+			__m128 r = _mm_mul_ps(l0, _mm_shuffle_ps(t, t, 0x00));
+			r = _mm_add_ps(r, _mm_mul_ps(l1, _mm_shuffle_ps(t, t, 0x55)));
+			r = _mm_add_ps(r, _mm_mul_ps(l2, _mm_shuffle_ps(t, t, 0xAA)));
+			_mm_storeu_ps(c, l0);
+			_mm_storeu_ps(c + 4, l1);
+			_mm_storeu_ps(c + 8, l2);
+			_mm_storeu_ps(c + 12, _mm_sub_ps(e3, r));
+		}
+	}
+
+	////////////////////////////////// AVX2 //////////////////////////////////
+
+	MK_TARGET("avx2,fma") inline __m256 yzx256(__m256 a) {
+		return _mm256_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+	}
+
+	MK_TARGET("avx2,fma") inline __m256 cross256(__m256 a, __m256 b) {
+		return yzx256(_mm256_fmsub_ps(a, yzx256(b), _mm256_mul_ps(yzx256(a), b)));
+	}
+
+	MK_TARGET("avx2,fma") inline __m256 hsum256(__m256 v) {
+		__m256 s = _mm256_add_ps(v, _mm256_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm256_add_ps(s, _mm256_shuffle_ps(s, s, _MM_SHUFFLE(1, 0, 3, 2)));
+	}
+
+	// Column k of two consecutive matrices, one per lane
+	MK_TARGET("avx2,fma") inline __m256 load2(const float* m, int k) {
+		return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(m + 4 * k)),
+			_mm_loadu_ps(m + 16 + 4 * k), 1);
+	}
+
+	MK_TARGET("avx2,fma") inline void store2(float* c, int k, __m256 v) {
+		_mm_storeu_ps(c + 4 * k, _mm256_castps256_ps128(v));
+		_mm_storeu_ps(c + 16 + 4 * k, _mm256_extractf128_ps(v, 1));
+	}
+
+	// Two columns of the product per vector
+	MK_TARGET("avx2,fma") inline void mul256(__m256 a0, __m256 a1, __m256 a2, __m256 a3,
+		const float* b, float* c) {
+		for (int j = 0; j < 4; j += 2) {
+			__m256 bj = _mm256_loadu_ps(b + 4 * j);
+			__m256 r = _mm256_mul_ps(a0, _mm256_shuffle_ps(bj, bj, 0x00));
+			r = _mm256_fmadd_ps(a1, _mm256_shuffle_ps(bj, bj, 0x55), r);
+			r = _mm256_fmadd_ps(a2, _mm256_shuffle_ps(bj, bj, 0xAA), r);
+			r = _mm256_fmadd_ps(a3, _mm256_shuffle_ps(bj, bj, 0xFF), r);
+			_mm256_storeu_ps(c + 4 * j, r);
+		}
+	}
+
+	MK_TARGET("avx2,fma") inline void mulAVX2(const glm::mat4* A, const glm::mat4* B, glm::mat4* C, size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			const float* a = &A[i][0][0];
+			mul256(_mm256_broadcast_ps((const __m128*)a), _mm256_broadcast_ps((const __m128*)(a + 4)),
+				_mm256_broadcast_ps((const __m128*)(a + 8)), _mm256_broadcast_ps((const __m128*)(a + 12)),
+				&B[i][0][0], &C[i][0][0]);
+		}
+	}
+
+	MK_TARGET("avx2,fma") inline void mvpAVX2(const glm::mat4& VP, const glm::mat4* M, glm::mat4* C, size_t n) {
+		const float* a = &VP[0][0];
+		const __m256 a0 = _mm256_broadcast_ps((const __m128*)a);
+		const __m256 a1 = _mm256_broadcast_ps((const __m128*)(a + 4));
+		const __m256 a2 = _mm256_broadcast_ps((const __m128*)(a + 8));
+		const __m256 a3 = _mm256_broadcast_ps((const __m128*)(a + 12));
+		for (size_t i = 0; i < n; i++) {
+			mul256(a0, a1, a2, a3, &M[i][0][0], &C[i][0][0]);
+		}
+	}
+
+	MK_TARGET("avx2,fma") inline void cofactors256(__m256 c0, __m256 c1, __m256 c2,
+		__m256& n0, __m256& n1, __m256& n2) {
+		n0 = cross256(c1, c2);
+		n1 = cross256(c2, c0);
+		n2 = cross256(c0, c1);
+		const __m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), hsum256(_mm256_mul_ps(c0, n0)));
+		n0 = _mm256_mul_ps(n0, invDet);
+		n1 = _mm256_mul_ps(n1, invDet);
+		n2 = _mm256_mul_ps(n2, invDet);
+	}
+
+	MK_TARGET("avx2,fma") inline void inverseTranspose3AVX2(const glm::mat4* M, glm::mat4* C, size_t n) {
+		const __m256 e3 = _mm256_set_ps(1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f);
+		size_t i = 0;
+		for (; i + 2 <= n; i += 2) {
+			const float* m = &M[i][0][0];
+			float* c = &C[i][0][0];
+			__m256 n0, n1, n2;
+			cofactors256(load2(m, 0), load2(m, 1), load2(m, 2), n0, n1, n2);
+			store2(c, 0, n0);
+			store2(c, 1, n1);
+			store2(c, 2, n2);
+			store2(c, 3, e3);
+		}
+		inverseTranspose3SSE2(M + i, C + i, n - i);
+	}
+
+	MK_TARGET("avx2,fma") inline void affineInverseAVX2(const glm::mat4* M, glm::mat4* C, size_t n) {
+		const __m256 e3 = _mm256_set_ps(1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f);
+		const __m256 zero = _mm256_setzero_ps();
+		size_t i = 0;
+		for (; i + 2 <= n; i += 2) {
+			const float* m = &M[i][0][0];
+			float* c = &C[i][0][0];
+			const __m256 t = load2(m, 3);
+			__m256 r0, r1, r2;
+			cofactors256(load2(m, 0), load2(m, 1), load2(m, 2), r0, r1, r2);
+			// Rows (r0, r1, r2, 0) to columns, per lane
+			const __m256 t0 = _mm256_unpacklo_ps(r0, r1), t1 = _mm256_unpacklo_ps(r2, zero);
+			const __m256 t2 = _mm256_unpackhi_ps(r0, r1), t3 = _mm256_unpackhi_ps(r2, zero);
+			const __m256 l0 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+			const __m256 l1 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+			const __m256 l2 = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+			__m256 r = _mm256_mul_ps(l0, _mm256_shuffle_ps(t, t, 0x00));
+			r = _mm256_fmadd_ps(l1, _mm256_shuffle_ps(t, t, 0x55), r);
+			r = _mm256_fmadd_ps(l2, _mm256_shuffle_ps(t, t, 0xAA), r);
+			store2(c, 0, l0);
+			store2(c, 1, l1);
+			store2(c, 2, l2);
+			store2(c, 3, _mm256_sub_ps(e3, r));
+		}
+		affineInverseSSE2(M + i, C + i, n - i);
+	}
+
+	///////////////////////////////// AVX-512 /////////////////////////////////
+
+	MK_TARGET("avx512f") inline __m512 yzx512(__m512 a) {
+		return _mm512_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+	}
+
+	MK_TARGET("avx512f") inline __m512 cross512(__m512 a, __m512 b) {
+		return yzx512(_mm512_fmsub_ps(a, yzx512(b), _mm512_mul_ps(yzx512(a), b)));
+	}
+
+	MK_TARGET("avx512f") inline __m512 hsum512(__m512 v) {
+		__m512 s = _mm512_add_ps(v, _mm512_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm512_add_ps(s, _mm512_shuffle_ps(s, s, _MM_SHUFFLE(1, 0, 3, 2)));
+	}
+
+	// Column k of four consecutive matrices, one per lane
+	MK_TARGET("avx512f") inline __m512 load4(const float* m, int k) {
+		__m512 v = _mm512_castps128_ps512(_mm_loadu_ps(m + 4 * k));
+		v = _mm512_insertf32x4(v, _mm_loadu_ps(m + 16 + 4 * k), 1);
+		v = _mm512_insertf32x4(v, _mm_loadu_ps(m + 32 + 4 * k), 2);
+		return _mm512_insertf32x4(v, _mm_loadu_ps(m + 48 + 4 * k), 3);
+	}
+
+	MK_TARGET("avx512f") inline void store4(float* c, int k, __m512 v) {
+		_mm_storeu_ps(c + 4 * k, _mm512_castps512_ps128(v));
+		_mm_storeu_ps(c + 16 + 4 * k, _mm512_extractf32x4_ps(v, 1));
+		_mm_storeu_ps(c + 32 + 4 * k, _mm512_extractf32x4_ps(v, 2));
+		_mm_storeu_ps(c + 48 + 4 * k, _mm512_extractf32x4_ps(v, 3));
+	}
+
+	// The whole product in one vector
+	MK_TARGET("avx512f") inline void mul512(__m512 a0, __m512 a1, __m512 a2, __m512 a3,
+		const float* b, float* c) {
+		const __m512 bv = _mm512_loadu_ps(b);
+		__m512 r = _mm512_mul_ps(a0, _mm512_permute_ps(bv, 0x00));
+		r = _mm512_fmadd_ps(a1, _mm512_permute_ps(bv, 0x55), r);
+		r = _mm512_fmadd_ps(a2, _mm512_permute_ps(bv, 0xAA), r);
+		r = _mm512_fmadd_ps(a3, _mm512_permute_ps(bv, 0xFF), r);
+		_mm512_storeu_ps(c, r);
+	}
+
+	MK_TARGET("avx512f") inline void mulAVX512(const glm::mat4* A, const glm::mat4* B, glm::mat4* C, size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			const float* a = &A[i][0][0];
+			mul512(_mm512_broadcast_f32x4(_mm_loadu_ps(a)), _mm512_broadcast_f32x4(_mm_loadu_ps(a + 4)),
+				_mm512_broadcast_f32x4(_mm_loadu_ps(a + 8)), _mm512_broadcast_f32x4(_mm_loadu_ps(a + 12)),
+				&B[i][0][0], &C[i][0][0]);
+		}
+	}
+
+	MK_TARGET("avx512f") inline void mvpAVX512(const glm::mat4& VP, const glm::mat4* M, glm::mat4* C, size_t n) {
+		const float* a = &VP[0][0];
+		const __m512 a0 = _mm512_broadcast_f32x4(_mm_loadu_ps(a));
+		const __m512 a1 = _mm512_broadcast_f32x4(_mm_loadu_ps(a + 4));
+		const __m512 a2 = _mm512_broadcast_f32x4(_mm_loadu_ps(a + 8));
+		const __m512 a3 = _mm512_broadcast_f32x4(_mm_loadu_ps(a + 12));
+		for (size_t i = 0; i < n; i++) {
+			mul512(a0, a1, a2, a3, &M[i][0][0], &C[i][0][0]);
+		}
+	}
+
+	MK_TARGET("avx512f") inline void cofactors512(__m512 c0, __m512 c1, __m512 c2,
+		__m512& n0, __m512& n1, __m512& n2) {
+		n0 = cross512(c1, c2);
+		n1 = cross512(c2, c0);
+		n2 = cross512(c0, c1);
+		const __m512 invDet = _mm512_div_ps(_mm512_set1_ps(1.0f), hsum512(_mm512_mul_ps(c0, n0)));
+		n0 = _mm512_mul_ps(n0, invDet);
+		n1 = _mm512_mul_ps(n1, invDet);
+		n2 = _mm512_mul_ps(n2, invDet);
+	}
+
+	MK_TARGET("avx512f") inline void inverseTranspose3AVX512(const glm::mat4* M, glm::mat4* C, size_t n) {
+		const __m512 e3 = _mm512_broadcast_f32x4(_mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f));
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4) {
+			const float* m = &M[i][0][0];
+			float* c = &C[i][0][0];
+			__m512 n0, n1, n2;
+			cofactors512(load4(m, 0), load4(m, 1), load4(m, 2), n0, n1, n2);
+			store4(c, 0, n0);
+			store4(c, 1, n1);
+			store4(c, 2, n2);
+			store4(c, 3, e3);
+		}
+		inverseTranspose3SSE2(M + i, C + i, n - i);
+	}
+
+	MK_TARGET("avx512f") inline void affineInverseAVX512(const glm::mat4* M, glm::mat4* C, size_t n) {
+		const __m512 e3 = _mm512_broadcast_f32x4(_mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f));
+		const __m512 zero = _mm512_setzero_ps();
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4) {
+			const float* m = &M[i][0][0];
+			float* c = &C[i][0][0];
+			const __m512 t = load4(m, 3);
+			__m512 r0, r1, r2;
+			cofactors512(load4(m, 0), load4(m, 1), load4(m, 2), r0, r1, r2);
+			const __m512 t0 = _mm512_unpacklo_ps(r0, r1), t1 = _mm512_unpacklo_ps(r2, zero);
+			const __m512 t2 = _mm512_unpackhi_ps(r0, r1), t3 = _mm512_unpackhi_ps(r2, zero);
+			const __m512 l0 = _mm512_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+			const __m512 l1 = _mm512_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+			const __m512 l2 = _mm512_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+			__m512 r = _mm512_mul_ps(l0, _mm512_permute_ps(t, 0x00));
+			r = _mm512_fmadd_ps(l1, _mm512_permute_ps(t, 0x55), r);
+			r = _mm512_fmadd_ps(l2, _mm512_permute_ps(t, 0xAA), r);
+			store4(c, 0, l0);
+			store4(c, 1, l1);
+			store4(c, 2, l2);
+			store4(c, 3, _mm512_sub_ps(e3, r));
+		}
+		affineInverseSSE2(M + i, C + i, n - i);
+	}
+
+	//////////////////////////////// DISPATCH /////////////////////////////////
+
+	inline void cpuid(int out[4], int leaf, int sub) {
+#if defined(_MSC_VER)
+		__cpuidex(out, leaf, sub);
+#else
+		unsigned int a, b, c, d;
+		__cpuid_count(leaf, sub, a, b, c, d);
+		out[0] = (int)a; out[1] = (int)b; out[2] = (int)c; out[3] = (int)d;
+#endif
+	}
+
+	inline uint64_t xgetbv0() {
+#if defined(_MSC_VER)
+		return _xgetbv(0);
+#else
+		uint32_t lo, hi;
+		__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+		return ((uint64_t)hi << 32) | lo;
+#endif
+	}
+#endif
+
+	// Best instruction set supported by both the CPU and the OS
+	inline MatrixISA detectISA() {
+#ifdef MK_X86
+		int r[4];
+		cpuid(r, 0, 0);
+		const int maxLeaf = r[0];
+		cpuid(r, 1, 0);
+		const bool osxsave = (r[2] >> 27) & 1, avx = (r[2] >> 28) & 1, fma = (r[2] >> 12) & 1;
+		if (!osxsave || !avx || maxLeaf < 7) return MATRIX_ISA_SSE2;
+		const uint64_t xcr0 = xgetbv0();
+		cpuid(r, 7, 0);
+		const bool avx2 = (r[1] >> 5) & 1, avx512f = (r[1] >> 16) & 1;
+		if (avx512f && fma && (xcr0 & 0xE6) == 0xE6) return MATRIX_ISA_AVX512;
+		if (avx2 && fma && (xcr0 & 0x6) == 0x6) return MATRIX_ISA_AVX2;
+		return MATRIX_ISA_SSE2;
+#else
+		return MATRIX_ISA_SCALAR;
+#endif
+	}
+
+	inline MatrixISA& activeISA() {
+		static MatrixISA isa = detectISA();
+		return isa;
+	}
+
+	// Forces a lower instruction set (e.g. for benchmarking); requests above
+	// what the machine supports are clamped. Returns the one actually selected.
+	inline MatrixISA setISA(MatrixISA isa) {
+		const MatrixISA best = detectISA();
+		activeISA() = isa > best ? best : isa;
+		return activeISA();
+	}
+}
+
+inline void batchMul(const glm::mat4* A, const glm::mat4* B, glm::mat4* C, size_t n) {
+	switch (MatrixKernels::activeISA()) {
+#ifdef MK_X86
+	case MATRIX_ISA_AVX512: MatrixKernels::mulAVX512(A, B, C, n); break;
+	case MATRIX_ISA_AVX2: MatrixKernels::mulAVX2(A, B, C, n); break;
+	case MATRIX_ISA_SSE2: MatrixKernels::mulSSE2(A, B, C, n); break;
+#endif
+	default: MatrixKernels::mulScalar(A, B, C, n);
+	}
+}
+
+inline void batchMVP(const glm::mat4& VP, const glm::mat4* M, glm::mat4* C, size_t n) {
+	switch (MatrixKernels::activeISA()) {
+#ifdef MK_X86
+	case MATRIX_ISA_AVX512: MatrixKernels::mvpAVX512(VP, M, C, n); break;
+	case MATRIX_ISA_AVX2: MatrixKernels::mvpAVX2(VP, M, C, n); break;
+	case MATRIX_ISA_SSE2: MatrixKernels::mvpSSE2(VP, M, C, n); break;
+#endif
+	default: MatrixKernels::mvpScalar(VP, M, C, n);
+	}
+}
+
+inline void batchAffineInverse(const glm::mat4* M, glm::mat4* C, size_t n) {
+	switch (MatrixKernels::activeISA()) {
+#ifdef MK_X86
+	case MATRIX_ISA_AVX512: MatrixKernels::affineInverseAVX512(M, C, n); break;
+	case MATRIX_ISA_AVX2: MatrixKernels::affineInverseAVX2(M, C, n); break;
+	case MATRIX_ISA_SSE2: MatrixKernels::affineInverseSSE2(M, C, n); break;
+#endif
+	default: MatrixKernels::affineInverseScalar(M, C, n);
+	}
+}
+
+inline void batchInverseTranspose3(const glm::mat4* M, glm::mat4* C, size_t n) {
+	switch (MatrixKernels::activeISA()) {
+#ifdef MK_X86
+	case MATRIX_ISA_AVX512: MatrixKernels::inverseTranspose3AVX512(M, C, n); break;
+	case MATRIX_ISA_AVX2: MatrixKernels::inverseTranspose3AVX2(M, C, n); break;
+	case MATRIX_ISA_SSE2: MatrixKernels::inverseTranspose3SSE2(M, C, n); break;
+#endif
+	default: MatrixKernels::inverseTranspose3Scalar(M, C, n);
+	}
+}
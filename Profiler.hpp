@@ -0,0 +1,244 @@
+#pragma once
+// CPU profiler: scoped zones, counters and frame markers, exported as a Chrome
+// trace (open it in chrome://tracing or https://ui.perfetto.dev).
+//
+//   PROFILE_ZONE("name");           times the enclosing scope
+//   PROFILE_FUNCTION();             same, named after the function
+//   PROFILE_COUNTER("name", value); plots a value over time
+//   PROFILE_FRAME();                marks the start of a new frame
+//
+// Every thread records into its own ring buffer, so recording takes no lock: the
+// owning thread is the only writer, and each slot is a seqlock, so an export
+// running meanwhile drops the events overwritten while it copies them instead
+// of reading them torn. When a ring is full the oldest events are overwritten.
+// Only the pointer of a name is stored: names must be string literals, or come
+// from PROFILE_INTERN("..."), which keeps a copy until the program exits.
+//
+// Compile with TSP_PROFILER=0 to turn the macros into nothing.
+
+#ifndef TSP_PROFILER
+#define TSP_PROFILER 1
+#endif
+
+#if TSP_PROFILER
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Profiler {
+
+	enum EventType : uint8_t { ZONE, COUNTER, FRAME };
+
+	struct Event {
+		const char* name;
+		uint64_t start;		// ns since the profiler epoch
+		uint64_t duration;	// ns, zones only
+		double value;		// counters and frame numbers
+		EventType type;
+	};
+
+	const size_t RING_SIZE = 1 << 16;	// events per thread, a power of two
+
+	// An event in a ring. seq is odd while event h is being written and
+	// 2 * h + 2 once it is complete; the fields are relaxed atomics, so that a
+	// concurrent read is not a data race, only possibly stale.
+	struct Slot {
+		std::atomic<uint64_t> seq{ 0 };
+		std::atomic<const char*> name{ nullptr };
+		std::atomic<uint64_t> start{ 0 };
+		std::atomic<uint64_t> duration{ 0 };
+		std::atomic<double> value{ 0.0 };
+		std::atomic<uint8_t> type{ ZONE };
+	};
+
+	struct ThreadRing {
+		uint32_t threadId;
+		std::atomic<uint64_t> head{ 0 };	// events ever written
+		std::unique_ptr<Slot[]> slots = std::make_unique<Slot[]>(RING_SIZE);
+
+		void push(const Event& e) {
+			const uint64_t h = head.load(std::memory_order_relaxed);
+			Slot& s = slots[h & (RING_SIZE - 1)];
+			s.seq.store(2 * h + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			s.name.store(e.name, std::memory_order_relaxed);
+			s.start.store(e.start, std::memory_order_relaxed);
+			s.duration.store(e.duration, std::memory_order_relaxed);
+			s.value.store(e.value, std::memory_order_relaxed);
+			s.type.store(e.type, std::memory_order_relaxed);
+			s.seq.store(2 * h + 2, std::memory_order_release);
+			head.store(h + 1, std::memory_order_release);
+		}
+
+		// Event i, unless the owner has overwritten it or is writing it
+		bool read(uint64_t i, Event& e) const {
+			const Slot& s = slots[i & (RING_SIZE - 1)];
+			const uint64_t before = s.seq.load(std::memory_order_acquire);
+			e.name = s.name.load(std::memory_order_relaxed);
+			e.start = s.start.load(std::memory_order_relaxed);
+			e.duration = s.duration.load(std::memory_order_relaxed);
+			e.value = s.value.load(std::memory_order_relaxed);
+			e.type = (EventType)s.type.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return before == 2 * i + 2 && s.seq.load(std::memory_order_relaxed) == before;
+		}
+	};
+
+	// Rings outlive their threads, so events of finished threads are still exported
+	struct Registry {
+		std::mutex mutex;
+		std::vector<std::unique_ptr<ThreadRing>> rings;
+		const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+		std::atomic<uint64_t> frame{ 0 };
+		std::vector<std::unique_ptr<std::string>> names;	// interned, never freed
+	};
+
+	inline Registry& registry() {
+		static Registry r;
+		return r;
+	}
+
+	inline uint64_t now() {
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - registry().epoch).count();
+	}
+
+	// A name that outlives every export, for names built at run time
+	inline const char* intern(const std::string& name) {
+		Registry& r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		for (const auto& n : r.names) {
+			if (*n == name) return n->c_str();
+		}
+		r.names.push_back(std::make_unique<std::string>(name));
+		return r.names.back()->c_str();
+	}
+
+	// The lock is taken once per thread, on its first event
+	inline ThreadRing& threadRing() {
+		thread_local ThreadRing* ring = nullptr;
+		if (ring == nullptr) {
+			Registry& r = registry();
+			std::lock_guard<std::mutex> lock(r.mutex);
+			r.rings.push_back(std::make_unique<ThreadRing>());
+			ring = r.rings.back().get();
+			ring->threadId = (uint32_t)r.rings.size() - 1;
+		}
+		return *ring;
+	}
+
+	struct Zone {
+		const char* name;
+		uint64_t start;
+
+		explicit Zone(const char* n) : name(n), start(now()) {}
+		~Zone() {
+			const uint64_t end = now();
+			threadRing().push({ name, start, end - start, 0.0, ZONE });
+		}
+	};
+
+	inline void counter(const char* name, double value) {
+		threadRing().push({ name, now(), 0, value, COUNTER });
+	}
+
+	inline void frame() {
+		const uint64_t f = registry().frame.fetch_add(1, std::memory_order_relaxed);
+		threadRing().push({ "Frame", now(), 0, (double)f, FRAME });
+	}
+
+	inline void writeEscaped(std::ostream& out, const char* s) {
+		for (; *s; s++) {
+			if (*s == '"' || *s == '\\') out << '\\';
+			out << *s;
+		}
+	}
+
+	// Writes everything still in the rings. Safe to call while other threads
+	// record: events overwritten or being written during the copy are dropped.
+	inline bool exportChromeTrace(const std::string& file) {
+		std::vector<std::pair<uint32_t, std::vector<Event>>> snapshot;
+		{
+			Registry& r = registry();
+			std::lock_guard<std::mutex> lock(r.mutex);
+			for (auto& ring : r.rings) {
+				const uint64_t head = ring->head.load(std::memory_order_acquire);
+				const uint64_t first = head > RING_SIZE ? head - RING_SIZE : 0;
+				std::vector<Event> events;
+				events.reserve((size_t)(head - first));
+				Event e;
+				for (uint64_t i = first; i < head; i++) {
+					if (ring->read(i, e)) events.push_back(e);
+				}
+				snapshot.push_back({ ring->threadId, std::move(events) });
+			}
+		}
+
+		std::ofstream out(file);
+		if (!out) {
+			std::cout << "Profiler: cannot write <" << file << ">\n";
+			return false;
+		}
+
+		out << std::fixed << std::setprecision(3);
+		out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		bool firstEvent = true;
+		size_t count = 0;
+		for (auto& t : snapshot) {
+			out << (firstEvent ? "" : ",\n") << "{\"ph\":\"M\",\"pid\":0,\"tid\":" << t.first
+				<< ",\"name\":\"thread_name\",\"args\":{\"name\":\""
+				<< (t.first == 0 ? "Main" : "Thread ") << (t.first == 0 ? "" : std::to_string(t.first)) << "\"}}";
+			firstEvent = false;
+
+			for (const Event& e : t.second) {
+				out << ",\n{\"pid\":0,\"tid\":" << t.first << ",\"ts\":" << e.start / 1000.0 << ",\"name\":\"";
+				writeEscaped(out, e.name);
+				out << "\"";
+				switch (e.type) {
+				case ZONE:
+					out << ",\"ph\":\"X\",\"dur\":" << e.duration / 1000.0 << "}";
+					break;
+				case COUNTER:
+					out << ",\"ph\":\"C\",\"args\":{\"value\":" << e.value << "}}";
+					break;
+				case FRAME:
+					out << ",\"ph\":\"i\",\"s\":\"g\",\"args\":{\"frame\":" << (uint64_t)e.value << "}}";
+					break;
+				}
+				count++;
+			}
+		}
+		out << "\n]}\n";
+
+		std::cout << "Profiler: " << count << " events written to <" << file << ">\n";
+		return true;
+	}
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) Profiler::Zone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_ZONE(__func__)
+#define PROFILE_COUNTER(name, value) Profiler::counter(name, (double)(value))
+#define PROFILE_FRAME() Profiler::frame()
+#define PROFILE_EXPORT(file) Profiler::exportChromeTrace(file)
+#define PROFILE_INTERN(name) Profiler::intern(name)
+
+#else
+
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_FUNCTION() ((void)0)
+#define PROFILE_COUNTER(name, value) ((void)0)
+#define PROFILE_FRAME() ((void)0)
+#define PROFILE_EXPORT(file) false
+#define PROFILE_INTERN(name) ""
+
+#endif
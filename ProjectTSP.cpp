@@ -11,6 +11,15 @@ struct GlobalUniformBufferObject {
 	alignas(16) glm::vec3 eyePos;
 };
 
+// Camera, rewritten just before submit (late latch)
+struct CameraUniformBlock {
+	alignas(16) glm::mat4 viewPrj;
+	alignas(16) glm::mat4 view;
+	alignas(16) glm::vec3 eyePos;
+	alignas(16) glm::mat4 invViewPrj;	// deferred: world position from the depth
+	alignas(16) glm::vec4 screen;		// width, height, 1 / width, 1 / height
+};
+
 // Spot Light
 struct SpotUniformBufferObject {
 	alignas(4) float on;
@@ -18,6 +27,7 @@ struct SpotUniformBufferObject {
 	alignas(16) glm::vec3 lightDir;
 	alignas(16) glm::vec4 lightColor;
 	alignas(16) glm::vec3 eyePos;
+	alignas(16) glm::mat4 shadowViewPrj;
 };
 
 // Mesh Data
@@ -56,6 +66,12 @@ struct VertexOverlay {
 	glm::vec2 UV;
 };
 
+#include "Scene.hpp"
+#include "ClusteredLights.hpp"
+#include "ShadowMap.hpp"
+#include "SecondaryView.hpp"
+#include "TextOverlay.hpp"
+
 
 class ProjectTSP;
 
@@ -65,33 +81,84 @@ class ProjectTSP : public BaseProject {
 	// Here you list all the Vulkan objects you need:
 	
 	// Descriptor Layouts [what will be passed to the shaders]
-	DescriptorSetLayout DSLGubo, DSLSpotLight, DSLMesh, DSLProcedural, DSLOverlay;
+	DescriptorSetLayout DSLGubo, DSLLights, DSLMesh, DSLOverlay;
+	DescriptorSetLayout DSLBindless;
 
 	// Vertex formats
 	VertexDescriptor VMesh;
 	VertexDescriptor VOverlay;
+	VertexDescriptor VPosition;		// position stream of the depth pre-pass
 
 	// Pipelines [Shader couples]
 	Pipeline PMesh, PProcedural;
+	Pipeline PMeshBindless;		// PMesh with the bindless set, when supported
 	Pipeline POverlay, POverlayX;
+	// Deferred path: PMesh and PMeshBindless writing the G-buffer, and the
+	// full screen lighting pass. M switches renderer (--renderer=deferred).
+	Pipeline PGBuffer, PGBufferBindless, PLighting;
+	bool deferredAvailable = false;
+	bool deferred = false;
+	// The lighting subpass reads the G-buffer per sample: the single sample
+	// anti-aliasing tiers draw forward
+	bool deferredNow() const {
+		return deferred && msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+	}
+	// Depth pre-pass (--depth-prepass): the props write only their depth first,
+	// in the forward subpass or in the G-buffer one, then are shaded with
+	// VK_COMPARE_OP_EQUAL, so each covered sample runs the fragment shader once
+	Pipeline PPrepass, PPrepassGBuffer;
+	bool depthPrepass = false;
 
-	// Models, textures and Descriptors (values assigned to the uniforms)
-	Model<VertexMesh> MTSP, MDrawer, MClock, MArm, MChair, MPainting, MPaperTray1, MPaperTray2, MSharpener, MLamp, MPencil, MProcedural;
-	Model<VertexMesh> MComputer1, MComputer2;
-	Model<VertexOverlay> MTitle, MPressX;
+	// Props: meshes, textures, materials and transforms live in the scene arrays
+	Scene scene;
+	uint32_t spMesh, spProcedural;
+	uint32_t eDrawer, eArmPivot, eArm, eLamp, eComputer;
+
+	// Clustered point and spot lights, besides the lamp (--lights=N)
+	LightClusters lightClusters;
+	std::vector<glm::vec3> lightOrigins;
 
-	Texture TTSP, TDrawer, TClock, TArm, TChair, TPainting, TPaperTray1, TPaperTray2, TSharpener, TLamp, TPencil, TProcedural, TTitle, TPressX;
-	Texture TComputer1, TComputer2;
-	Texture TMeshEmit, TComputerEmit1, TComputerEmit2;
+	// Shadows of the lamp, rendered again only when a caster in its cone moves
+	ShadowMap spotShadow;
 
-	DescriptorSet DSGubo, DSSpotLight, DSTSP, DSDrawer, DSClock, DSArm, DSChair, DSPainting, DSPaperTray1, DSPaperTray2, DSSharpener, DSLamp, DSPencil, DSProcedural, DSTitle, DSPressX;
-	DescriptorSet DSComputer1, DSComputer2;
+	// Security camera shown on the computer screen, rendered at a reduced size
+	// every few frames while something in it changes
+	SecondaryView monitorView;
+
+	// Overlays
+	Model<VertexOverlay> MTitle, MPressX;
+	Texture TTitle, TPressX;
+
+	DescriptorSet DSGubo, DSLights, DSTitle, DSPressX;
+
+	// GPU timings, shown with G
+	uint32_t gpShadow, gpMonitor, gpPrepass, gpMeshes, gpLighting, gpProcedural, gpOverlays;
+	TextOverlay statsText;
+	// Shading rate of the props over the ideal one: fragment invocations of the
+	// Meshes and Procedural mug passes over width x height x the invocations per
+	// pixel of the anti-aliasing tier. 1 means every pixel is shaded once.
+	double overdraw = 0.0;
+	double overdrawSum = 0.0;
+	uint32_t overdrawFrames = 0;
+	// Dynamic resolution: average render scale of a replay
+	double renderScaleSum = 0.0;
+	uint32_t renderScaleFrames = 0;
+	bool showStats = false;
+	float lastStatsPrint = 0.0f;
+
+	// Benchmark (Benchmark.hpp): --replay=file moves the camera along a recorded
+	// path with a fixed time step and writes the frame statistics to --bench-out.
+	// --record=file writes such a path, with the L and X toggles, from a live session.
+	Replay replay;
+	ReplayRecorder recorder;
+	bool replaying = false;
+	float benchTime = 0.0f;
+	float benchDt = 1.0f / 60.0f;
+	std::string replayFile, benchOut;
 
 	// C++ storage for uniform variables
 	GlobalUniformBufferObject gubo;
 	SpotUniformBufferObject uboSpot;
-	MeshUniformBlock uboTSP, uboDrawer, uboClock, uboArm, uboChair, uboPainting, uboPaperTray1, uboPaperTray2, uboSharpener, uboLamp, uboPencil, uboProcedural;
-	MeshUniformBlock uboComputer;
 	OverlayUniformBlock uboTitle;
 	OverlayXUniformBlock uboPressX;
 
@@ -109,6 +176,8 @@ class ProjectTSP : public BaseProject {
 	// Rotation and motion speed
 	const float ROT_SPEED = glm::radians(50.0f);
 	const float MOVE_SPEED = 3.0f;
+	// Position of the lamp object, also used by the spot light
+	const glm::vec3 lampPos = glm::vec3(4.5f, 4.1f, -2.5f);
 
 	// TODO CHANGE POSITION OF THIS CODE, MIMIC A16
 	// Other application parameters
@@ -139,11 +208,6 @@ class ProjectTSP : public BaseProject {
     	windowResizable = GLFW_TRUE;
 		initialBackgroundColor = {0.075f, 0.075f, 0.075f, 1.0f};
 		
-		// Descriptor pool sizes
-		uniformBlocksInPool = 30;
-		texturesInPool = 30;
-		setsInPool = 30;
-		
 		Ar = (float) windowWidth / windowHeight;
 	}
 	
@@ -158,6 +222,9 @@ class ProjectTSP : public BaseProject {
 	// Here you load and setup all your Vulkan Models and Texutures.
 	// Here you also create your Descriptor set layouts and load the shaders for the pipelines
 	void localInit() {
+		PROFILE_FUNCTION();
+		initBenchmark();
+		initLights();
 
 		// Descriptor Layouts [what will be passed to the shaders]
 		DSLGubo.init(this, {
@@ -165,11 +232,17 @@ class ProjectTSP : public BaseProject {
 			// first  element : the binding number
 			// second element : the type of element (buffer or texture)
 			// third  element : the pipeline stage where it will be used
-			{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT}            // Gubo
+			{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT},           // Gubo
+			{1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS}            // Camera
 			});
 
-		DSLSpotLight.init(this, {
-			{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT}            // Spot Light
+		DSLLights.init(this, {
+			{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT},           // Spot Light
+			{1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT},           // Cluster grid
+			{2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT},           // Clustered lights
+			{3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT},           // Froxel ranges
+			{4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT},           // Light indices
+			{5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT}    // Spot shadow map
 			});
 
 		DSLMesh.init(this, {
@@ -178,11 +251,6 @@ class ProjectTSP : public BaseProject {
 			{2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT}   // Emission Texture
 			});
 
-		DSLProcedural.init(this, {
-			{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS},          // Mesh Ubo
-			{1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT},  // Mesh Texture
-			});
-
 		DSLOverlay.init(this, {
 					{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS},
 					{1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT}
@@ -238,173 +306,277 @@ class ProjectTSP : public BaseProject {
 		// Pipelines [Shader couples]
 		// The last array, is a vector of pointer to the layouts of the sets that will
 		// be used in this pipeline. The first element will be set 0, and so on...
-		PMesh.init(this, &VMesh, "shaders/MeshVert.spv", "shaders/MeshFrag.spv", { &DSLGubo, &DSLSpotLight, &DSLMesh });
-		PProcedural.init(this, &VMesh, "shaders/ProceduralVert.spv", "shaders/ProceduralFrag.spv", { &DSLGubo, &DSLSpotLight, &DSLProcedural });
+		PMesh.init(this, &VMesh, "shaders/MeshVert.spv", "shaders/MeshFrag.spv", { &DSLGubo, &DSLLights, &DSLMesh });
+		PMesh.setVariants(VARIANT_ALL);
+		// The mug is a mesh without emission and with a narrower, stronger spot
+		PProcedural.init(this, &VMesh, "shaders/MeshVert.spv", "shaders/MeshFrag.spv", { &DSLGubo, &DSLLights, &DSLMesh });
+		PProcedural.setConstants({ {0, 0}, {5, 10.0f}, {6, 0.85f}, {7, 0.95f} });
+		PProcedural.setVariants(VARIANT_SPOT | VARIANT_SPECULAR | VARIANT_LIGHTS);
 		POverlay.init(this, &VOverlay, "shaders/OverlayVert.spv", "shaders/OverlayFrag.spv", { &DSLOverlay });
 		POverlay.setAdvancedFeatures(VK_COMPARE_OP_LESS_OR_EQUAL, VK_POLYGON_MODE_FILL,
 			VK_CULL_MODE_NONE, true);
+		POverlay.setOverlay();
 		POverlayX.init(this, &VOverlay, "shaders/OverlayXVert.spv", "shaders/OverlayXFrag.spv", { &DSLOverlay });
 		POverlayX.setAdvancedFeatures(VK_COMPARE_OP_LESS_OR_EQUAL, VK_POLYGON_MODE_FILL,
 			VK_CULL_MODE_NONE, true);
+		POverlayX.setOverlay();
 
-		// Models, textures and Descriptors (values assigned to the uniforms)
-		MTSP.init(this, &VMesh, "models/Room/TheStanleyParablev12.obj", OBJ);
-		MDrawer.init(this, &VMesh, "models/Room/Drawer.obj", OBJ);
-		MClock.init(this, &VMesh, "models/Room/Objects/Clock.obj", OBJ);
-		MArm.init(this, &VMesh, "models/Room/Objects/ClockArm.obj", OBJ);
-		MChair.init(this, &VMesh, "models/Room/Objects/Chair.obj", OBJ);
-		MPencil.init(this, &VMesh, "models/Room/Objects/Pencil.obj", OBJ);
-		MPainting.init(this, &VMesh, "models/Room/Objects/Painting.obj", OBJ);
-		MPaperTray1.init(this, &VMesh, "models/Room/Objects/PaperTray1.obj", OBJ);
-		MPaperTray2.init(this, &VMesh, "models/Room/Objects/PaperTray2.obj", OBJ);
-		MSharpener.init(this, &VMesh, "models/Room/Objects/Sharpener.obj", OBJ);
-		MLamp.init(this, &VMesh, "models/Room/Objects/Lamp.obj", OBJ);
-
-		// Title Overlay
+		// Overlays
 		MTitle.vertices = { {{-1.0f, -1.0f}, {0.0f, 0.0f}}, {{1.0f, -1.0f}, {1.0f, 0.0f}},
 						 {{ -1.0f, 1.0f}, {0.0f, 1.0f}}, {{1.0f, 1.0f}, {1.0f, 1.0f}} };
 		MTitle.indices = { 0, 2, 1, 1, 3, 2};
 		MTitle.initMesh(this, &VOverlay);
 
-		// Press X Overlay
 		MPressX.vertices = { {{-1.0f, -1.0f}, {0.0f, 0.0f}}, {{1.0f, -1.0f}, {1.0f, 0.0f}},
 						 {{ -1.0f, 1.0f}, {0.0f, 1.0f}}, {{1.0f, 1.0f}, {1.0f, 1.0f}} };
 		MPressX.indices = { 0, 2, 1, 1, 3, 2 };
 		MPressX.initMesh(this, &VOverlay);
 
-		// Computers
-		MComputer1.init(this, &VMesh, "models/Room/Objects/ComputerV2.obj", OBJ);
-		MComputer2.init(this, &VMesh, "models/Room/Objects/ComputerV2.obj", OBJ);
-
-		// Procedural
-		createProcedural(MProcedural.vertices, MProcedural.indices);
-		MProcedural.initMesh(this, &VMesh);
-
-		TClock.init(this, "textures/clock.png");
-		TArm.init(this, "textures/PaperTray1.png");
-		TChair.init(this, "textures/ChairTexture.png");
-		TTSP.init(this, "textures/RoomTexture2.png");
-		TDrawer.init(this, "textures/RoomTexture2.png");
-		TPainting.init(this, "textures/Painting.png");
-		TPaperTray1.init(this, "textures/PaperTray1.png");
-		TPaperTray2.init(this, "textures/PaperTray2.png");
-		TSharpener.init(this, "textures/Sharpener.png");
-		TLamp.init(this, "textures/steel.jpg");
-		TPencil.init(this, "textures/TexturesCity.png");
-		TProcedural.init(this, "textures/Mug.png");
-
 		TTitle.init(this, "textures/Title.png");
 		TPressX.init(this, "textures/OverlayInteraction.png");
 
-		// Computers
-		TComputer1.init(this, "textures/Computer1.png");
-		TComputer2.init(this, "textures/Computer2.png");
+		// Scene: sets 0 and 1 (global and lights) are shared by every prop
+		scene.init(this, &VMesh, { &DSGubo, &DSLights });
+		spMesh = scene.addPipeline(&PMesh, &DSLMesh, true, &PMeshBindless);
+		spProcedural = scene.addPipeline(&PProcedural, &DSLMesh, false);
+
+		uint32_t mRoom = scene.addMesh("models/Room/TheStanleyParablev12.obj");
+		uint32_t mDrawer = scene.addMesh("models/Room/Drawer.obj");
+		uint32_t mClock = scene.addMesh("models/Room/Objects/Clock.obj");
+		uint32_t mArm = scene.addMesh("models/Room/Objects/ClockArm.obj");
+		uint32_t mChair = scene.addMesh("models/Room/Objects/Chair.obj");
+		uint32_t mPencil = scene.addMesh("models/Room/Objects/Pencil.obj");
+		uint32_t mPainting = scene.addMesh("models/Room/Objects/Painting.obj");
+		uint32_t mPaperTray1 = scene.addMesh("models/Room/Objects/PaperTray1.obj");
+		uint32_t mPaperTray2 = scene.addMesh("models/Room/Objects/PaperTray2.obj");
+		uint32_t mSharpener = scene.addMesh("models/Room/Objects/Sharpener.obj");
+		uint32_t mLamp = scene.addMesh("models/Room/Objects/Lamp.obj");
+		uint32_t mComputer = scene.addMesh("models/Room/Objects/ComputerV2.obj");
+
+		std::vector<VertexMesh> vProcedural;
+		std::vector<uint32_t> iProcedural;
+		createProcedural(vProcedural, iProcedural);
+		uint32_t mProcedural = scene.addMesh(vProcedural, iProcedural);
+
+		uint32_t tRoom = scene.addTexture("textures/RoomTexture2.png");
+		uint32_t tClock = scene.addTexture("textures/clock.png");
+		uint32_t tPaperTray1 = scene.addTexture("textures/PaperTray1.png");
+		uint32_t tPaperTray2 = scene.addTexture("textures/PaperTray2.png");
+		uint32_t tChair = scene.addTexture("textures/ChairTexture.png");
+		uint32_t tPainting = scene.addTexture("textures/Painting.png");
+		uint32_t tSharpener = scene.addTexture("textures/Sharpener.png");
+		uint32_t tLamp = scene.addTexture("textures/steel.jpg");
+		uint32_t tPencil = scene.addTexture("textures/TexturesCity.png");
+		uint32_t tProcedural = scene.addTexture("textures/Mug.png");
+		// Computer screens: two frames, by default swapped every half second
+		const float screenFps = std::max(0.01f, getOptionFloat("screen-fps", 2.0f));
+		uint32_t tComputer = scene.addFlipbook({ "textures/Computer1.png", "textures/Computer2.png" }, screenFps);
+		uint32_t tComputerStill = scene.addTexture("textures/Computer1.png");
 
 		// Emitting Textures
-		TMeshEmit.init(this, "textures/MeshEmit.png");
-		TComputerEmit1.init(this, "textures/ComputerEmit1.png");
-		TComputerEmit2.init(this, "textures/ComputerEmit2.png");
+		uint32_t tMeshEmit = scene.addTexture("textures/MeshEmit.png");
+		uint32_t tComputerEmit = scene.addFlipbook({ "textures/ComputerEmit1.png", "textures/ComputerEmit2.png" }, screenFps);
+
+		const glm::vec3 X(1, 0, 0), Y(0, 1, 0), Z(0, 0, 1);
+		auto R = [](float deg, glm::vec3 axis) { return glm::angleAxis(glm::radians(deg), axis); };
+
+		scene.addEntity(mRoom, tRoom, tMeshEmit, spMesh, glm::vec3(0.0f));
+		eDrawer = scene.addEntity(mDrawer, tRoom, tMeshEmit, spMesh, glm::vec3(6.36f, 1.58f, 2.07f),
+			R(90.0f, X) * R(90.0f, Z), glm::vec3(1.03f, 0.99f, 1.0f));
+		scene.addEntity(mClock, tClock, tMeshEmit, spMesh, glm::vec3(-6.2f, 6.1f, 2.3f),
+			R(40.0f, X) * R(-90.0f, Z), glm::vec3(2.0f), 1.0f, 180.0f, glm::vec3(1.0f));
+		// The arm spins around a pivot node: only the pivot rotation changes, once per second
+		eArmPivot = scene.addNode(glm::vec3(-6.15f, 6.1f, 2.3f));
+		eArm = scene.addEntity(mArm, tPaperTray1, tMeshEmit, spMesh, glm::vec3(0.0f),
+			R(-90.0f, Z), glm::vec3(7.0f, 7.0f, 5.0f), 1.0f, 180.0f, glm::vec3(1.0f), eArmPivot);
+		scene.addEntity(mChair, tChair, tMeshEmit, spMesh, glm::vec3(-3.75f, 0.6f, -0.6f),
+			R(-75.0f, Y), glm::vec3(2.7f), 1.0f, 10000.0f);
+		scene.addEntity(mPencil, tPencil, tMeshEmit, spMesh, glm::vec3(0.7f, 2.06f, -1.8f),
+			R(40.0f, Y), glm::vec3(4.5f));
+		scene.addEntity(mPainting, tPainting, tMeshEmit, spMesh, glm::vec3(-3.2f, 5.6f, -3.45f),
+			R(180.0f, Y), glm::vec3(1.5f), 1.0f, 180.0f, glm::vec3(1.0f));
+		scene.addEntity(mPaperTray1, tPaperTray1, tMeshEmit, spMesh, glm::vec3(-1.5f, 2.2f, -2.5f),
+			R(-90.0f, Y), glm::vec3(1.5f));
+		scene.addEntity(mPaperTray2, tPaperTray2, tMeshEmit, spMesh, glm::vec3(-0.7f, 2.2f, -2.5f),
+			R(-90.0f, Y), glm::vec3(1.5f));
+		scene.addEntity(mSharpener, tSharpener, tMeshEmit, spMesh, glm::vec3(1.5f, 2.1f, -2.1f),
+			R(-115.0f, Y), glm::vec3(1.5f), 1.0f, 180.0f, glm::vec3(1.0f));
+		eLamp = scene.addEntity(mLamp, tLamp, tMeshEmit, spMesh, lampPos,
+			R(-90.0f, Y), glm::vec3(2.5f), 1.0f, 180.0f, glm::vec3(1.0f));
+
+		// Computer: one prop, the screens are flipbook frames
+		eComputer = scene.addEntity(mComputer, tComputer, tComputerEmit, spMesh, glm::vec3(-5.0f, 2.3f, -2.4f),
+			R(-55.0f, Y), glm::vec3(2.0f), 1.0f, 32.0f, glm::vec3(1.0f));
+
+		// Procedural
+		scene.addEntity(mProcedural, tProcedural, NO_TEXTURE, spProcedural, glm::vec3(-3.35f, 2.23f, -2.25f),
+			glm::quat(1, 0, 0, 0), glm::vec3(1.0f), 1.0f, 180.0f, glm::vec3(1.0f));
+
+		// Bindless: the meshes take their textures from one array and their
+		// uniform blocks from one buffer, with the indices in push constants
+		const bool bindlessShaders = std::ifstream("shaders/MeshBindlessVert.spv").good() &&
+			std::ifstream("shaders/MeshBindlessFrag.spv").good();
+		if (!bindlessShaders) {
+			std::cout << "Bindless textures disabled, drawing with per prop descriptor sets: compile shaders/MeshBindless.vert "
+				"and shaders/MeshBindless.frag to shaders/MeshBindlessVert.spv and shaders/MeshBindlessFrag.spv with glslc\n";
+		}
+		else if (scene.enableBindless(&DSLBindless)) {
+			DSLBindless.init(this, {
+				{0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS},
+				{1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, maxBindlessTextures,
+					VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT}
+				});
+			PMeshBindless.init(this, &VMesh, "shaders/MeshBindlessVert.spv", "shaders/MeshBindlessFrag.spv",
+				{ &DSLGubo, &DSLLights, &DSLBindless });
+			PMeshBindless.setPushConstants(VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+				sizeof(BindlessDraw));
+			PMeshBindless.setVariants(VARIANT_ALL);
+		}
+		// Live view on the computer screen: the screen is the rectangle at (499, 0),
+		// 524x439 pixels, of the 1926x1024 emission map, which the view replaces;
+		// the albedo stops blinking its cursor
+		if (getOptionBool("monitor-view", true)) {
+			monitorView.init(this, &scene, &VMesh, &DSLMesh, glm::uvec2(1926, 1024), glm::uvec4(499, 0, 524, 439),
+				static_cast<uint32_t>(std::max(16, getOptionInt("monitor-size", 256))),
+				static_cast<uint32_t>(std::max(1, getOptionInt("monitor-rate", 4))));
+		}
+		if (monitorView.available) {
+			monitorView.setCamera(glm::vec3(7.2f, 7.0f, 3.3f), glm::vec3(-3.0f, 1.5f, -1.5f), glm::radians(70.0f));
+			monitorView.setSurface(eComputer);
+			scene.texture[eComputer] = tComputerStill;
+			scene.emission[eComputer] = monitorView.texture;
+		}
+
+		// Spot shadows: the drawer and the clock arm move, the lamp holds the light
+		spotShadow.init(this, &scene, &VMesh, static_cast<uint32_t>(std::max(64, getOptionInt("shadow-size", 2048))));
+		spotShadow.setDynamic(eDrawer);
+		spotShadow.setDynamic(eArm);
+		spotShadow.setNoShadow(eLamp);
+
+		scene.packMaxSize = static_cast<uint32_t>(std::max(0, getOptionInt("pack-max", 1024)));
+		scene.loadTextures();
+
+		// Deferred: the props go through the G-buffer, then one lighting pass; the
+		// mug and the overlays stay in the forward subpass
+		const bool deferredShaders = std::ifstream("shaders/GBufferFrag.spv").good() &&
+			std::ifstream("shaders/DeferredLightVert.spv").good() &&
+			std::ifstream("shaders/DeferredLightFrag.spv").good() &&
+			(!scene.bindless || std::ifstream("shaders/GBufferBindlessFrag.spv").good());
+		if (deferredSupported && !deferredShaders) {
+			std::cout << "Deferred shading disabled: compile shaders/GBuffer.frag (also with -DBINDLESS), "
+				"shaders/DeferredLight.vert and shaders/DeferredLight.frag with glslc\n";
+		}
+		else if (deferredSupported) {
+			deferredAvailable = true;
+			PGBuffer.init(this, &VMesh, "shaders/MeshVert.spv", "shaders/GBufferFrag.spv", { &DSLGubo, &DSLLights, &DSLMesh });
+			PGBuffer.setSubpass(0, 1 + GBUFFER_ATTACHMENTS);
+			PGBuffer.setVariants(VARIANT_EMISSION);
+			if (scene.bindless) {
+				PGBufferBindless.init(this, &VMesh, "shaders/MeshBindlessVert.spv", "shaders/GBufferBindlessFrag.spv",
+					{ &DSLGubo, &DSLLights, &DSLBindless });
+				PGBufferBindless.setPushConstants(VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+					sizeof(BindlessDraw));
+				PGBufferBindless.setSubpass(0, 1 + GBUFFER_ATTACHMENTS);
+				PGBufferBindless.setVariants(VARIANT_EMISSION);
+			}
+			scene.setDeferred(spMesh, &PGBuffer, scene.bindless ? &PGBufferBindless : nullptr);
+
+			PLighting.init(this, nullptr, "shaders/DeferredLightVert.spv", "shaders/DeferredLightFrag.spv",
+				{ &DSLGubo, &DSLLights, &gbufferDSL });
+			PLighting.setAdvancedFeatures(VK_COMPARE_OP_LESS, VK_POLYGON_MODE_FILL,
+				VK_CULL_MODE_NONE, false);
+			PLighting.setSubpass(1, 1, true);
+			PLighting.setVariants(VARIANT_SPOT | VARIANT_SPECULAR | VARIANT_LIGHTS);
+		}
+		deferred = deferredAvailable && getOption("renderer", "forward") == "deferred";
+
+		// Depth pre-pass: fixed at startup, since it changes how the pipelines
+		// above are built
+		const bool prepassShaders = std::ifstream("shaders/DepthPrepassVert.spv").good() &&
+			std::ifstream("shaders/ShadowFrag.spv").good();
+		depthPrepass = getOptionBool("depth-prepass", false);
+		if (depthPrepass && !prepassShaders) {
+			std::cout << "Depth pre-pass disabled: compile shaders/DepthPrepass.vert and shaders/Shadow.frag with glslc\n";
+			depthPrepass = false;
+		}
+		if (depthPrepass) {
+			VPosition.init(this, {
+				{0, sizeof(glm::vec3), VK_VERTEX_INPUT_RATE_VERTEX}
+				}, {
+				{0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0, sizeof(glm::vec3), POSITION}
+				});
+			scene.createPositionStreams();
+
+			PPrepass.init(this, &VPosition, "shaders/DepthPrepassVert.spv", "shaders/ShadowFrag.spv", { &DSLGubo });
+			PPrepass.setPushConstants(VK_SHADER_STAGE_VERTEX_BIT, sizeof(glm::mat4));
+			PPrepass.setWriteMasks(true, false);
+			if (deferredAvailable) {
+				PPrepassGBuffer.init(this, &VPosition, "shaders/DepthPrepassVert.spv", "shaders/ShadowFrag.spv", { &DSLGubo });
+				PPrepassGBuffer.setPushConstants(VK_SHADER_STAGE_VERTEX_BIT, sizeof(glm::mat4));
+				PPrepassGBuffer.setSubpass(0, 1 + GBUFFER_ATTACHMENTS);
+				PPrepassGBuffer.setWriteMasks(true, false);
+			}
+
+			// The shading pipelines keep the depth of the pre-pass
+			std::vector<Pipeline*> shaded = { &PMesh, &PProcedural };
+			if (scene.bindless) shaded.push_back(&PMeshBindless);
+			if (deferredAvailable) {
+				shaded.push_back(&PGBuffer);
+				if (scene.bindless) shaded.push_back(&PGBufferBindless);
+			}
+			for (Pipeline* P : shaded) {
+				P->setAdvancedFeatures(VK_COMPARE_OP_EQUAL, VK_POLYGON_MODE_FILL,
+					VK_CULL_MODE_BACK_BIT, false);
+				P->setWriteMasks(false, true);
+			}
+		}
 
+		// GPU timings
+		gpShadow = addGpuPass("Spot shadow");
+		gpMonitor = addGpuPass("Monitor view");
+		gpPrepass = addGpuPass("Depth pre-pass");
+		gpMeshes = addGpuPass("Meshes");
+		gpLighting = addGpuPass("Deferred lighting");
+		gpProcedural = addGpuPass("Procedural mug");
+		gpOverlays = addGpuPass("Overlays");
+		statsText.init(this);
 	}
 	
 	// Here you create your pipelines and Descriptor Sets!
 	void pipelinesAndDescriptorSetsInit() {
 		// This creates a new pipeline (with the current surface), using its shaders
 		PMesh.create();
+		if (scene.bindless) PMeshBindless.create();
 		POverlay.create();
 		POverlayX.create();
 		PProcedural.create();
+		spotShadow.pipelinesAndDescriptorSetsInit();
+		monitorView.pipelinesAndDescriptorSetsInit();
+		if (deferredAvailable) {
+			PGBuffer.create();
+			if (scene.bindless) PGBufferBindless.create();
+			PLighting.create();
+		}
+		if (depthPrepass) {
+			PPrepass.create();
+			if (deferredAvailable) PPrepassGBuffer.create();
+		}
 
 		DSGubo.init(this, &DSLGubo, {
-			{0, UNIFORM, sizeof(GlobalUniformBufferObject), nullptr}
-			});
-
-		DSSpotLight.init(this, &DSLSpotLight, {
-			{0, UNIFORM, sizeof(SpotUniformBufferObject), nullptr}
-			});
-
-		DSTSP.init(this, &DSLMesh, {
-			{0, UNIFORM, sizeof(MeshUniformBlock), nullptr},
-			{1, TEXTURE, 0, &TTSP},
-			{2, TEXTURE, 0, &TMeshEmit},
-			});
-
-		DSDrawer.init(this, &DSLMesh, {
-			{0, UNIFORM, sizeof(MeshUniformBlock), nullptr},
-			{1, TEXTURE, 0, &TDrawer},
-			{2, TEXTURE, 0, &TMeshEmit},
-			});
-
-		DSClock.init(this, &DSLMesh, {
-			{0, UNIFORM, sizeof(MeshUniformBlock), nullptr},
-			{1, TEXTURE, 0, &TClock},
-			{2, TEXTURE, 0, &TMeshEmit},
-			});
-
-		DSArm.init(this, &DSLMesh, {
-			{0, UNIFORM, sizeof(MeshUniformBlock), nullptr},
-			{1, TEXTURE, 0, &TArm},
-			{2, TEXTURE, 0, &TMeshEmit},
-			});
-
-		DSChair.init(this, &DSLMesh, {
-			{0, UNIFORM, sizeof(MeshUniformBlock), nullptr},
-			{1, TEXTURE, 0, &TChair},
-			{2, TEXTURE, 0, &TMeshEmit},
-			});
-
-		DSPencil.init(this, &DSLMesh, {
-			{0, UNIFORM, sizeof(MeshUniformBlock), nullptr},
-			{1, TEXTURE, 0, &TPencil},
-			{2, TEXTURE, 0, &TMeshEmit},
-			});
-
-		DSPainting.init(this, &DSLMesh, {
-			{0, UNIFORM, sizeof(MeshUniformBlock), nullptr},
-			{1, TEXTURE, 0, &TPainting},
-			{2, TEXTURE, 0, &TMeshEmit},
-			});
-
-		DSPaperTray1.init(this, &DSLMesh, {
-			{0, UNIFORM, sizeof(MeshUniformBlock), nullptr},
-			{1, TEXTURE, 0, &TPaperTray1},
-			{2, TEXTURE, 0, &TMeshEmit},
-			});
-
-		DSPaperTray2.init(this, &DSLMesh, {
-			{0, UNIFORM, sizeof(MeshUniformBlock), nullptr},
-			{1, TEXTURE, 0, &TPaperTray2},
-			{2, TEXTURE, 0, &TMeshEmit},
+			{0, UNIFORM, sizeof(GlobalUniformBufferObject), nullptr},
+			{1, UNIFORM, sizeof(CameraUniformBlock), nullptr}
 			});
 
-		DSSharpener.init(this, &DSLMesh, {
-			{0, UNIFORM, sizeof(MeshUniformBlock), nullptr},
-			{1, TEXTURE, 0, &TSharpener},
-			{2, TEXTURE, 0, &TMeshEmit},
+		DSLights.init(this, &DSLLights, {
+			{0, UNIFORM, sizeof(SpotUniformBufferObject), nullptr},
+			{1, UNIFORM, sizeof(ClusterUniformBlock), nullptr},
+			{2, STORAGE, LightClusters::MAX_LIGHTS * sizeof(ClusterLight), nullptr},
+			{3, STORAGE, LightClusters::CLUSTERS * sizeof(glm::uvec2), nullptr},
+			{4, STORAGE, LightClusters::MAX_REFS * sizeof(uint32_t), nullptr},
+			{5, TEXTURE, 0, &spotShadow.map}
 			});
 
-		DSLamp.init(this, &DSLMesh, {
-			{0, UNIFORM, sizeof(MeshUniformBlock), nullptr},
-			{1, TEXTURE, 0, &TLamp},
-			{2, TEXTURE, 0, &TMeshEmit},
-			});
-
-		DSComputer1.init(this, &DSLMesh, {
-			{0, UNIFORM, sizeof(MeshUniformBlock), nullptr},
-			{1, TEXTURE, 0, &TComputer1},
-			{2, TEXTURE, 0, &TComputerEmit1},
-			});
-
-		DSComputer2.init(this, &DSLMesh, {
-			{0, UNIFORM, sizeof(MeshUniformBlock), nullptr},
-			{1, TEXTURE, 0, &TComputer2},
-			{2, TEXTURE, 0, &TComputerEmit2},
-			});
-
-		DSProcedural.init(this, &DSLProcedural, {
-			{0, UNIFORM, sizeof(MeshUniformBlock), nullptr},
-			{1, TEXTURE, 0, &TProcedural},
-			});
+		scene.initDescriptorSets();
 
 		DSTitle.init(this, &DSLOverlay, {
 					{0, UNIFORM, sizeof(OverlayUniformBlock), nullptr},
@@ -415,332 +587,256 @@ class ProjectTSP : public BaseProject {
 					{0, UNIFORM, sizeof(OverlayXUniformBlock), nullptr},
 					{1, TEXTURE, 0, &TPressX}
 			});
+
+		statsText.pipelinesAndDescriptorSetsInit();
 	}
 
 	// Here you destroy your pipelines and Descriptor Sets!
 	void pipelinesAndDescriptorSetsCleanup() {
 
 		PMesh.cleanup();
+		if (scene.bindless) PMeshBindless.cleanup();
 		POverlay.cleanup();
 		POverlayX.cleanup();
 		PProcedural.cleanup();
+		spotShadow.pipelinesAndDescriptorSetsCleanup();
+		monitorView.pipelinesAndDescriptorSetsCleanup();
+		if (deferredAvailable) {
+			PGBuffer.cleanup();
+			if (scene.bindless) PGBufferBindless.cleanup();
+			PLighting.cleanup();
+		}
+		if (depthPrepass) {
+			PPrepass.cleanup();
+			if (deferredAvailable) PPrepassGBuffer.cleanup();
+		}
 
 		DSGubo.cleanup();
-		DSSpotLight.cleanup();
-		DSTSP.cleanup();
-		DSDrawer.cleanup();
-		DSClock.cleanup();
-		DSArm.cleanup();
-		DSChair.cleanup();
-		DSPencil.cleanup();
-		DSPainting.cleanup();
-		DSPaperTray1.cleanup();
-		DSPaperTray2.cleanup();
-		DSSharpener.cleanup();
-		DSComputer1.cleanup();
-		DSComputer2.cleanup();
-		DSLamp.cleanup();
-		DSProcedural.cleanup();
+		DSLights.cleanup();
+		scene.cleanupDescriptorSets();
 		DSTitle.cleanup();
 		DSPressX.cleanup();
+
+		statsText.pipelinesAndDescriptorSetsCleanup();
 	}
 
 	// Here you destroy all the Models, Texture and Desc. Set Layouts you created!
 	// You also have to destroy the pipelines
 	void localCleanup() {
 
-		MTSP.cleanup();
-		MDrawer.cleanup();
-		MClock.cleanup();
-		MArm.cleanup();
-		MChair.cleanup();
-		MPencil.cleanup();
-		MPainting.cleanup();
-		MPaperTray1.cleanup();
-		MPaperTray2.cleanup();
-		MSharpener.cleanup();
-		MComputer1.cleanup();
-		MComputer2.cleanup();
-		MLamp.cleanup();
-		MProcedural.cleanup();
-		MTitle.cleanup();
+		scene.cleanup();
+		spotShadow.localCleanup();
+		monitorView.localCleanup();
 
-		TTSP.cleanup();
-		TDrawer.cleanup();
-		TClock.cleanup();
-		TArm.cleanup();
-		TChair.cleanup();
-		TPainting.cleanup();
-		TPaperTray1.cleanup();
-		TPaperTray2.cleanup();
-		TSharpener.cleanup();
-		TComputer1.cleanup();
-		TComputer2.cleanup();
-		TLamp.cleanup();
-		TPencil.cleanup();
-		TProcedural.cleanup();
-		TMeshEmit.cleanup();
-		TComputerEmit1.cleanup();
-		TComputerEmit2.cleanup();
+		MTitle.cleanup();
+		MPressX.cleanup();
 		TTitle.cleanup();
 		TPressX.cleanup();
 
 		DSLGubo.cleanup();
-		DSLSpotLight.cleanup();
+		DSLLights.cleanup();
 		DSLMesh.cleanup();
-		DSLProcedural.cleanup();
 		DSLOverlay.cleanup();
+		if (scene.bindless) DSLBindless.cleanup();
 
 		PMesh.destroy();
+		if (scene.bindless) PMeshBindless.destroy();
 		PProcedural.destroy();
 		POverlay.destroy();
 		POverlayX.destroy();
+		if (deferredAvailable) {
+			PGBuffer.destroy();
+			if (scene.bindless) PGBufferBindless.destroy();
+			PLighting.destroy();
+		}
+		if (depthPrepass) {
+			PPrepass.destroy();
+			if (deferredAvailable) PPrepassGBuffer.destroy();
+		}
+
+		statsText.localCleanup();
 	}
 	
 	// Here it is the creation of the command buffer:
 	// You send to the GPU all the objects you want to draw,
 	// with their buffers and textures
 	void populateCommandBuffer(VkCommandBuffer commandBuffer, int currentImage) {
+		PROFILE_FUNCTION();
 
-		DSGubo.bind(commandBuffer, PMesh, 0, currentImage);
-		DSSpotLight.bind(commandBuffer, PMesh, 1, currentImage);
-
-		DSGubo.bind(commandBuffer, PProcedural, 0, currentImage);
-		DSSpotLight.bind(commandBuffer, PProcedural, 1, currentImage);
-
-		PMesh.bind(commandBuffer);
-
-		MTSP.bind(commandBuffer);
-		DSTSP.bind(commandBuffer, PMesh, 2, currentImage);
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(MTSP.indices.size()), 1, 0, 0, 0);
-
-		MDrawer.bind(commandBuffer);
-		DSDrawer.bind(commandBuffer, PMesh, 2, currentImage);
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(MDrawer.indices.size()), 1, 0, 0, 0);
-
-		MClock.bind(commandBuffer);
-		DSClock.bind(commandBuffer, PMesh, 2, currentImage);
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(MClock.indices.size()), 1, 0, 0, 0);
-
-		MArm.bind(commandBuffer);
-		DSArm.bind(commandBuffer, PMesh, 2, currentImage);
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(MArm.indices.size()), 1, 0, 0, 0);
-
-		MChair.bind(commandBuffer);
-		DSChair.bind(commandBuffer, PMesh, 2, currentImage);
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(MChair.indices.size()), 1, 0, 0, 0);
-
-		MPencil.bind(commandBuffer);
-		DSPencil.bind(commandBuffer, PMesh, 2, currentImage);
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(MPencil.indices.size()), 1, 0, 0, 0);
-
-		MPainting.bind(commandBuffer);
-		DSPainting.bind(commandBuffer, PMesh, 2, currentImage);
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(MPainting.indices.size()), 1, 0, 0, 0);
-
-		MPaperTray1.bind(commandBuffer);
-		DSPaperTray1.bind(commandBuffer, PMesh, 2, currentImage);
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(MPaperTray1.indices.size()), 1, 0, 0, 0);
-
-		MPaperTray2.bind(commandBuffer);
-		DSPaperTray2.bind(commandBuffer, PMesh, 2, currentImage);
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(MPaperTray2.indices.size()), 1, 0, 0, 0);
-
-		MSharpener.bind(commandBuffer);
-		DSSharpener.bind(commandBuffer, PMesh, 2, currentImage);
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(MSharpener.indices.size()), 1, 0, 0, 0);
-
-		MComputer1.bind(commandBuffer);
-		DSComputer1.bind(commandBuffer, PMesh, 2, currentImage);
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(MComputer1.indices.size()), 1, 0, 0, 0);
-
-		MComputer2.bind(commandBuffer);
-		DSComputer2.bind(commandBuffer, PMesh, 2, currentImage);
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(MComputer2.indices.size()), 1, 0, 0, 0);
-
-		MLamp.bind(commandBuffer);
-		DSLamp.bind(commandBuffer, PMesh, 2, currentImage);
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(MLamp.indices.size()), 1, 0, 0, 0);
-
-		PProcedural.bind(commandBuffer);
-
-		MProcedural.bind(commandBuffer);
-		DSProcedural.bind(commandBuffer, PProcedural, 2, currentImage);
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(MProcedural.indices.size()), 1, 0, 0, 0);
+		if (depthPrepass && !deferredNow()) {
+			beginGpuPass(commandBuffer, gpPrepass, currentImage);
+			scene.drawPositions(commandBuffer, currentImage, PPrepass);
+			endGpuPass(commandBuffer, gpPrepass, currentImage);
+		}
 
+		if (!deferredNow()) {
+			beginGpuPass(commandBuffer, gpMeshes, currentImage);
+			scene.draw(commandBuffer, currentImage, spMesh);
+			endGpuPass(commandBuffer, gpMeshes, currentImage);
+		}
+
+		beginGpuPass(commandBuffer, gpProcedural, currentImage);
+		scene.draw(commandBuffer, currentImage, spProcedural);
+		endGpuPass(commandBuffer, gpProcedural, currentImage);
+	}
+
+	// Title, prompt and statistics, at full resolution
+	void populateOverlays(VkCommandBuffer commandBuffer, int currentImage) {
+		beginGpuPass(commandBuffer, gpOverlays, currentImage);
 		POverlay.bind(commandBuffer);
 		MTitle.bind(commandBuffer);
 		DSTitle.bind(commandBuffer, POverlay, 0, currentImage);
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(MTitle.indices.size()), 1, 0, 0, 0);
+		drawIndexed(commandBuffer, static_cast<uint32_t>(MTitle.indices.size()));
 
 		POverlayX.bind(commandBuffer);
 		MPressX.bind(commandBuffer);
 		DSPressX.bind(commandBuffer, POverlayX, 0, currentImage);
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(MPressX.indices.size()), 1, 0, 0, 0);
+		drawIndexed(commandBuffer, static_cast<uint32_t>(MPressX.indices.size()));
+		endGpuPass(commandBuffer, gpOverlays, currentImage);
+
+		if (showStats) {
+			statsText.draw(commandBuffer, currentImage);
+		}
+	}
+
+	// The shadow layers that changed and the monitor view, before the main render pass
+	void populateBeforeRenderPass(VkCommandBuffer commandBuffer, int currentImage) {
+		if (spotShadow.rendersThisFrame()) {
+			beginGpuPass(commandBuffer, gpShadow, currentImage);
+			spotShadow.record(commandBuffer);
+			endGpuPass(commandBuffer, gpShadow, currentImage);
+		}
+		if (monitorView.rendersThisFrame()) {
+			beginGpuPass(commandBuffer, gpMonitor, currentImage);
+			monitorView.record(commandBuffer, currentImage);
+			endGpuPass(commandBuffer, gpMonitor, currentImage);
+		}
+	}
+
+	// Deferred path: the props into the G-buffer...
+	void populateGBuffer(VkCommandBuffer commandBuffer, int currentImage) {
+		if (!deferredNow()) return;
+		// The mug too: the depth attachment carries over to its forward subpass
+		if (depthPrepass) {
+			beginGpuPass(commandBuffer, gpPrepass, currentImage);
+			scene.drawPositions(commandBuffer, currentImage, PPrepassGBuffer);
+			endGpuPass(commandBuffer, gpPrepass, currentImage);
+		}
+		beginGpuPass(commandBuffer, gpMeshes, currentImage);
+		scene.draw(commandBuffer, currentImage, spMesh, true);
+		endGpuPass(commandBuffer, gpMeshes, currentImage);
+	}
+
+	// ...then the spot and the clustered lights, once per covered sample
+	void populateLighting(VkCommandBuffer commandBuffer, int currentImage) {
+		if (!deferredNow()) return;
+		beginGpuPass(commandBuffer, gpLighting, currentImage);
+		PLighting.bind(commandBuffer, scene.frameVariant);
+		DSGubo.bind(commandBuffer, PLighting, 0, currentImage);
+		DSLights.bind(commandBuffer, PLighting, 1, currentImage);
+		bindGBuffer(commandBuffer, PLighting, 2);
+		drawVertices(commandBuffer, 3);
+		endGpuPass(commandBuffer, gpLighting, currentImage);
 	}
 
 	// Total Time Passed for Clock Arm
 	float spotActive = 1.0f;
-	int computerModel = 0;
 	float totalSeconds = 0;
+	int lastArmSecond = -1;
+	// Toggled with P: prints the scene counters every frame
+	bool printSceneStats = false;
+
+	// Render on demand: the title fades until 8.5 s (Overlay.frag), and a
+	// replay, the drifting --lights and the statistics text change every frame.
+	// So does the monitor view while it owes a render. Otherwise the next change
+	// is the clock arm ticking on the whole second or the next flipbook frame
+	// (the computer screens without the monitor view), after the frame on screen.
+	double nextFrameDue() {
+		if (replaying || showStats || !lightOrigins.empty() || totalSeconds < 8.5f) return 0.0;
+		if (monitorView.pending()) return 0.0;
+		const double elapsed =
+			std::chrono::duration<double>(std::chrono::steady_clock::now() - lastFrameStart).count();
+		const double armTick = std::floor(totalSeconds) + 1.0 - totalSeconds;
+		return std::min(armTick, (double)scene.nextFlipbookFrame()) - elapsed;
+	}
 
 	// Here is where you update the uniforms.
 	// Very likely this will be where you will be writing the logic of your application.
 	void updateUniformBuffer(uint32_t currentImage) {
+		PROFILE_FUNCTION();
 		static bool debounce = false;
 		static int curDebounce = 0;
 
-		if(glfwGetKey(window, GLFW_KEY_ESCAPE)) {
+		if(keyPressed(GLFW_KEY_ESCAPE)) {
 			glfwSetWindowShouldClose(window, GL_TRUE);
 		}
 
 		
 		GameLogic();
+		writeCamera(currentImage);
+		setTemporalViewPrj(ViewPrj * World);
 
 
 		// FILL AND SET GLOBAL UNIFORMS
 		// GUBO
-		gubo.DlightDir = glm::mat3(World) * glm::normalize(glm::vec3(1, 1, 1));
+		// Lights are in world space, like the mMat and nMat of the props
+		gubo.DlightDir = glm::normalize(glm::vec3(1, 1, 1));
 		gubo.DlightColor = glm::vec4(0.2f, 0.2f, 0.2f, 1);
 		gubo.AmbLightColor = glm::vec3(0.1f);
 		gubo.eyePos = Pos;
 		DSGubo.map(currentImage, &gubo, sizeof(gubo), 0);
 
 		// SPOT UBO
-		glm::vec3 lampPos = glm::vec3(4.5f, 4.1f, -2.5f); // Position of the lamp object
 		uboSpot.on = spotActive;
-		uboSpot.lightDir = glm::mat3(World) * glm::normalize(glm::vec3(-3, -1.5f, 0.0f));
+		scene.frameVariant = spotActive > 0 ? VARIANT_ALL : VARIANT_ALL & ~VARIANT_SPOT;
+		uboSpot.lightDir = glm::normalize(glm::vec3(-3, -1.5f, 0.0f));
 		uboSpot.lightColor = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
-		uboSpot.lightPos = World * glm::vec4(lampPos + glm::vec3(0.0f, 1.2f, 0.0f), 1.);
+		uboSpot.lightPos = lampPos + glm::vec3(0.0f, 1.2f, 0.0f);
 		uboSpot.eyePos = Pos;
-		DSSpotLight.map(currentImage, &uboSpot, sizeof(uboSpot), 0);
+		uboSpot.shadowViewPrj = spotLightViewPrj(uboSpot.lightPos, uboSpot.lightDir, 0.8f, 0.1f, 30.0f);
+		DSLights.map(currentImage, &uboSpot, sizeof(uboSpot), 0);
+
+		// Clustered lights
+		if (lightClusters.lights.empty()) {
+			scene.frameVariant &= ~VARIANT_LIGHTS;
+		}
+		updateLights();
+		if (!lateLatch) {
+			binLights(currentImage);
+		}
 
-		glm::mat4 objWorld;
 		// FILL AND SET OBJECTS UNIFORMS
-		uboTSP.amb = 1.0f; uboTSP.gamma = 180.0f; uboTSP.sColor = glm::vec3(0.0f);
-		uboTSP.mvpMat = ViewPrj * World;
-		uboTSP.mMat = World;
-		uboTSP.nMat = glm::inverse(glm::transpose(World));
-		DSTSP.map(currentImage, &uboTSP, sizeof(uboTSP), 0);
-
-		objWorld = World * (glm::translate(glm::mat4(1.0), glm::vec3(drawerPos+6.36f, 1.58f, 2.07f)) * glm::rotate(glm::mat4(1.0), glm::radians(90.0f), glm::vec3(1, 0, 0)) * glm::rotate(glm::mat4(1.0), glm::radians(90.0f), glm::vec3(0, 0, 1)) * glm::scale(glm::mat4(1.0), glm::vec3(1.03, 0.99, 1)));
-		uboDrawer.amb = 1.0f; uboDrawer.gamma = 180.0f; uboDrawer.sColor = glm::vec3(0.0f);
-		uboDrawer.mvpMat = ViewPrj * objWorld;
-		uboDrawer.mMat = objWorld;
-		uboDrawer.nMat = glm::inverse(glm::transpose(objWorld));
-		DSDrawer.map(currentImage, &uboDrawer, sizeof(uboDrawer), 0);
-
-		objWorld = World * (glm::translate(glm::mat4(1.0), glm::vec3(-6.2f, 6.1f, 2.3f)) * glm::rotate(glm::mat4(1.0), glm::radians(40.0f), glm::vec3(1, 0, 0)) * glm::rotate(glm::mat4(1.0), glm::radians(-90.0f), glm::vec3(0, 0, 1)) * glm::scale(glm::mat4(1.0), glm::vec3(2, 2, 2)));
-		uboClock.amb = 1.0f; uboClock.gamma = 180.0f; uboClock.sColor = glm::vec3(1.0f);
-		uboClock.mvpMat = ViewPrj * objWorld;
-		uboClock.mMat = objWorld;
-		uboClock.nMat = glm::inverse(glm::transpose(objWorld));
-		DSClock.map(currentImage, &uboClock, sizeof(uboClock), 0);
-
-		float armRotation = (((int)totalSeconds % 60) / 60.0f) * 360;
-		objWorld = World *
-			(glm::translate(glm::mat4(1.0), glm::vec3(-6.15f, 6.1f, 2.3f)) * glm::rotate(glm::mat4(1.0), glm::radians(-armRotation), glm::vec3(1, 0, 0)) * glm::rotate(glm::mat4(1.0), glm::radians(-90.0f), glm::vec3(0, 0, 1)) * glm::scale(glm::mat4(1.0), glm::vec3(7, 7, 5)));
-		uboArm.amb = 1.0f; uboArm.gamma = 180.0f; uboArm.sColor = glm::vec3(1.0f);
-		uboArm.mvpMat = ViewPrj * objWorld;
-		uboArm.mMat = objWorld;
-		uboArm.nMat = glm::inverse(glm::transpose(objWorld));
-		DSArm.map(currentImage, &uboArm, sizeof(uboArm), 0);
-
-		objWorld = World * (glm::translate(glm::mat4(1.0), glm::vec3(-3.75f, 0.6f, -0.6f)) * glm::rotate(glm::mat4(1.0), glm::radians(-75.0f), glm::vec3(0, 1, 0)) * glm::scale(glm::mat4(1.0), glm::vec3(2.7, 2.7, 2.7)));
-		uboChair.amb = 1.0f; uboChair.gamma = 10000.0f; uboChair.sColor = glm::vec3(0.0f);
-		uboChair.mvpMat = ViewPrj * objWorld;
-		uboChair.mMat = objWorld;
-		uboChair.nMat = glm::inverse(glm::transpose(objWorld));
-		DSChair.map(currentImage, &uboChair, sizeof(uboChair), 0);
-
-		objWorld = World * (glm::translate(glm::mat4(1.0), glm::vec3(-3.2f, 5.6f, -3.45f)) * glm::rotate(glm::mat4(1.0), glm::radians(180.0f), glm::vec3(0, 1, 0)) * glm::scale(glm::mat4(1.0), glm::vec3(1.5, 1.5, 1.5)));
-		uboPainting.amb = 1.0f; uboPainting.gamma = 180.0f; uboPainting.sColor = glm::vec3(1.0f);
-		uboPainting.mvpMat = ViewPrj * objWorld;
-		uboPainting.mMat = objWorld;
-		uboPainting.nMat = glm::inverse(glm::transpose(objWorld));
-		DSPainting.map(currentImage, &uboPainting, sizeof(uboPainting), 0);
-
-		objWorld = World * (glm::translate(glm::mat4(1.0), glm::vec3(-1.5f, 2.2f, -2.5f)) * glm::rotate(glm::mat4(1.0), glm::radians(-90.0f), glm::vec3(0, 1, 0)) * glm::scale(glm::mat4(1.0), glm::vec3(1.5, 1.5, 1.5)));
-		uboPaperTray1.amb = 1.0f; uboPaperTray1.gamma = 180.0f; uboPaperTray1.sColor = glm::vec3(0.0f);
-		uboPaperTray1.mvpMat = ViewPrj * objWorld;
-		uboPaperTray1.mMat = objWorld;
-		uboPaperTray1.nMat = glm::inverse(glm::transpose(objWorld));
-		DSPaperTray1.map(currentImage, &uboPaperTray1, sizeof(uboPaperTray1), 0);
-
-		objWorld = World * (glm::translate(glm::mat4(1.0), glm::vec3(-0.7f, 2.2f, -2.5f)) * glm::rotate(glm::mat4(1.0), glm::radians(-90.0f), glm::vec3(0, 1, 0)) * glm::scale(glm::mat4(1.0), glm::vec3(1.5, 1.5, 1.5)));
-		uboPaperTray2.amb = 1.0f; uboPaperTray2.gamma = 180.0f; uboPaperTray2.sColor = glm::vec3(0.0f);
-		uboPaperTray2.mvpMat = ViewPrj * objWorld;
-		uboPaperTray2.mMat = objWorld;
-		uboPaperTray2.nMat = glm::inverse(glm::transpose(objWorld));
-		DSPaperTray2.map(currentImage, &uboPaperTray2, sizeof(uboPaperTray2), 0);
-
-		objWorld = World * (glm::translate(glm::mat4(1.0), glm::vec3(1.5f, 2.1f, -2.1f)) * glm::rotate(glm::mat4(1.0), glm::radians(-115.0f), glm::vec3(0, 1, 0)) * glm::scale(glm::mat4(1.0), glm::vec3(1.5, 1.5, 1.5)));
-		uboSharpener.amb = 1.0f; uboSharpener.gamma = 180.0f; uboSharpener.sColor = glm::vec3(1.0f);
-		uboSharpener.mvpMat = ViewPrj * objWorld;
-		uboSharpener.mMat = objWorld;
-		uboSharpener.nMat = glm::inverse(glm::transpose(objWorld));
-		DSSharpener.map(currentImage, &uboSharpener, sizeof(uboSharpener), 0);
-
-		objWorld = World * (glm::translate(glm::mat4(1.0), lampPos) * glm::rotate(glm::mat4(1.0), glm::radians(-90.0f), glm::vec3(0, 1, 0)) * glm::scale(glm::mat4(1.0), glm::vec3(2.5, 2.5, 2.5)));
-		uboLamp.amb = 1.0f; uboLamp.gamma = 180.0f; uboLamp.sColor = glm::vec3(1.0f);
-		uboLamp.mvpMat = ViewPrj * objWorld;
-		uboLamp.mMat = objWorld;
-		uboLamp.nMat = glm::inverse(glm::transpose(objWorld));
-		DSLamp.map(currentImage, &uboLamp, sizeof(uboLamp), 0);
-
-		objWorld = World * (glm::translate(glm::mat4(1.0), glm::vec3(0.7f, 2.06f, -1.8f)) * glm::rotate(glm::mat4(1.0), glm::radians(40.0f), glm::vec3(0, 1, 0)) * glm::scale(glm::mat4(1.0), glm::vec3(4.5, 4.5, 4.5)));
-		uboPencil.amb = 1.0f; uboPencil.gamma = 180.0f; uboPencil.sColor = glm::vec3(0.0f);
-		uboPencil.mvpMat = ViewPrj * objWorld;
-		uboPencil.mMat = objWorld;
-		uboPencil.nMat = glm::inverse(glm::transpose(objWorld));
-		DSPencil.map(currentImage, &uboPencil, sizeof(uboPencil), 0);
-
-		// Computer Models
-		uboComputer.amb = 1.0f; uboComputer.gamma = 32.0f; uboComputer.sColor = glm::vec3(1.0f);
-		uboComputer.nMat = glm::inverse(glm::transpose(World));
-
-		float computerFlesh = ((int)(totalSeconds * 2) % 2);
-		glm::vec3 scaleComputer1, scaleComputer2;
-		if (computerFlesh == 0) scaleComputer1 = glm::vec3(2); else scaleComputer1 = glm::vec3(0);
-		if (computerFlesh == 1) scaleComputer2 = glm::vec3(2); else scaleComputer2 = glm::vec3(0);
-
-		// Computer 1
-		objWorld = World * (glm::translate(glm::mat4(1.0), glm::vec3(-5.0f, 2.3f, -2.4f)) * glm::rotate(glm::mat4(1.0), glm::radians(-55.0f), glm::vec3(0, 1, 0)) * glm::scale(glm::mat4(1.0), scaleComputer1));
-		
-		uboComputer.mvpMat = ViewPrj * objWorld;
-		uboComputer.mMat = objWorld;
-		DSComputer1.map(currentImage, &uboComputer, sizeof(uboComputer), 0);
+		// Animated props: touch the transforms only when they actually change
+		if (scene.position[eDrawer].x != drawerPos + 6.36f) {
+			scene.setPosition(eDrawer, glm::vec3(drawerPos + 6.36f, 1.58f, 2.07f));
+		}
+
+		int armSecond = (int)totalSeconds % 60;
+		if (armSecond != lastArmSecond) {
+			lastArmSecond = armSecond;
+			float armRotation = (armSecond / 60.0f) * 360;
+			scene.setRotation(eArmPivot, glm::angleAxis(glm::radians(-armRotation), glm::vec3(1, 0, 0)));
+		}
 
-		// Computer 2
-		objWorld = World * (glm::translate(glm::mat4(1.0), glm::vec3(-5.0f, 2.3f, -2.4f)) * glm::rotate(glm::mat4(1.0), glm::radians(-55.0f), glm::vec3(0, 1, 0)) * glm::scale(glm::mat4(1.0), scaleComputer2));
+		// Flipbooks (the computer screens) pick their frame from the scene time
+		scene.time = totalSeconds;
 
-		uboComputer.mvpMat = ViewPrj * objWorld;
-		uboComputer.mMat = objWorld;
-		DSComputer2.map(currentImage, &uboComputer, sizeof(uboComputer), 0);
+		scene.updateTransforms();
+		spotShadow.update(uboSpot.shadowViewPrj, spotActive > 0);
+		scene.cull(ViewPrj * World);
+		scene.updateUniforms(currentImage, ViewPrj * World);
+		monitorView.lightDir = gubo.DlightDir;
+		monitorView.update();
 
-		// Procedrual
-		objWorld = World * (glm::translate(glm::mat4(1.0), glm::vec3(-3.35f, 2.23f, -2.25f)));
-		uboProcedural.amb = 1.0f; uboProcedural.gamma = 180.0f; uboProcedural.sColor = glm::vec3(1.0f);
-		uboProcedural.mvpMat = ViewPrj * objWorld;
-		uboProcedural.mMat = objWorld;
-		uboProcedural.nMat = glm::inverse(glm::transpose(World));
-		DSProcedural.map(currentImage, &uboProcedural, sizeof(uboProcedural), 0);
+		PROFILE_COUNTER("Props drawn", scene.drawList.size());
+		PROFILE_COUNTER("World matrices", scene.stats.world);
+
+		if (printSceneStats) {
+			std::cout << "Matrices recomputed: " << scene.stats.local << " local, "
+				<< scene.stats.world << " world, " << scene.stats.normal << " normal ("
+				<< scene.stats.normalFast << " fast), " << scene.drawList.size() << "/"
+				<< scene.size() << " drawn\n";
+		}
 
 		/* Map the uniform data block to the GPU */
 		uboTitle.screenW = currentWidth;
@@ -752,11 +848,212 @@ class ProjectTSP : public BaseProject {
 		uboPressX.screenH = currentHeight;
 		DSPressX.map(currentImage, &uboPressX, sizeof(uboPressX), 0);
 
+		updateOverdraw();
+		if (replaying) {
+			renderScaleSum += renderScale;
+			renderScaleFrames++;
+		}
+		if (showStats) {
+			updateStats(currentImage);
+		}
+	}
+
+	// From the pipeline statistics of the last frame of this image
+	void updateOverdraw() {
+		if (!pipelineStatisticsSupported) return;
+		const double samples = (double)renderExtent.width * renderExtent.height * shadedSamplesPerPixel();
+		overdraw = (gpuPasses[gpMeshes].fragmentInvocations + gpuPasses[gpProcedural].fragmentInvocations) / samples;
+		PROFILE_COUNTER("Overdraw", overdraw);
+		if (replaying) {
+			overdrawSum += overdraw;
+			overdrawFrames++;
+		}
+	}
+
+	// GPU time and shader invocations of the passes of the last frame of this image.
+	// Without the text shaders the same lines go to the console, once per second.
+	void updateStats(uint32_t currentImage) {
+		std::ostringstream text;
+		text << std::fixed << std::setprecision(3);
+		text << "Renderer: " << (deferredNow() ? "deferred" : "forward")
+			<< (depthPrepass ? " with depth pre-pass" : "")
+			<< (scene.bindless ? ", bindless" : ", per prop descriptor sets") << "\n";
+		if (!timestampsSupported && !pipelineStatisticsSupported) {
+			text << "GPU queries not supported\n";
+		}
+		else {
+			text << "GPU passes (" << gpuFrameLag << " frames ago):\n";
+		}
+		for (const GpuPass& pass : gpuPasses) {
+			text << pass.name << ": ";
+			if (timestampsSupported) text << pass.ms << " ms";
+			if (pipelineStatisticsSupported) {
+				text << "  vs " << pass.vertexInvocations << "  fs " << pass.fragmentInvocations;
+			}
+			text << "\n";
+		}
+		if (pipelineStatisticsSupported) {
+			text << "Overdraw: " << overdraw << "\n";
+		}
+		text << "Anti-aliasing: " << aaTierName() << " (" << msaaSamples << "x, "
+			<< shadedSamplesPerPixel() << " shaded per pixel)\n";
+		if (dynamicResolution) {
+			text << "Render scale: " << renderScale << " (" << renderExtent.width << "x" << renderExtent.height
+				<< ", GPU target " << gpuTargetMs << " ms, " << scaleChanges << " changes)\n";
+		}
+		text << "Spot shadow: " << (int)(spotShadow.skipRate() * 100.0 + 0.5) << "% of layer renders skipped ("
+			<< spotShadow.stats.staticRenders << " static, " << spotShadow.stats.dynamicRenders << " dynamic in "
+			<< spotShadow.stats.frames << " frames)\n";
+		if (monitorView.available) {
+			text << "Monitor view: " << monitorView.stats.renders << " renders in " << monitorView.stats.frames
+				<< " frames, " << monitorView.stats.draws << " props drawn\n";
+		}
+		if (!lightClusters.lights.empty()) {
+			text << "Light binning: " << lightClusters.stats.ms << " ms, " << lightClusters.stats.visible << "/"
+				<< lightClusters.lights.size() << " lights, " << lightClusters.stats.refs << " refs\n";
+		}
+
+		if (statsText.available) {
+			statsText.setText(currentImage, text.str(), 16.0f, 16.0f, 0.6f);
+		}
+		else if (totalSeconds - lastStatsPrint >= 1.0f) {
+			lastStatsPrint = totalSeconds;
+			std::cout << text.str();
+		}
+	}
+
+	//   --replay=file      (benchmark along a replay file, then exit)
+	//   --bench-fps=N      (fixed time step of the replay, default 60)
+	//   --bench-out=file   (statistics, default bench.json)
+	//   --record=file      (write the camera path of this session)
+	// Both turn the late latch off: the camera recorded or replayed must be the
+	// one rendered.
+	void initBenchmark() {
+		replayFile = getOption("replay");
+		if (!replayFile.empty() && replay.load(replayFile)) {
+			replaying = true;
+			benchDt = 1.0f / std::max(1.0f, getOptionFloat("bench-fps", 60.0f));
+			benchOut = getOption("bench-out", "bench.json");
+			collectFrameStats = true;
+			lateLatch = lateLatchOption = false;
+			// The path decides when a headless run ends
+			if (getOption("frames").empty()) {
+				headlessFrames = INT_MAX;
+			}
+		}
+
+		const std::string recordFile = getOption("record");
+		if (!recordFile.empty() && !replaying && recorder.open(recordFile)) {
+			lateLatch = lateLatchOption = false;
+		}
+	}
+
+	void finishBenchmark() {
+		frameStats.writeJSON(benchOut, {
+			{ "replay", "\"" + replayFile + "\"" },
+			{ "fixedStepMs", std::to_string(benchDt * 1000.0f) },
+			{ "width", std::to_string(swapChainExtent.width) },
+			{ "height", std::to_string(swapChainExtent.height) },
+			{ "headless", headless ? "true" : "false" },
+			{ "presentMode", std::string("\"") + (headless ? "headless" : presentModeName(activePresentMode)) + "\"" },
+			{ "gpuTimestamps", timestampsSupported ? "true" : "false" },
+			{ "gpuLagFrames", std::to_string(gpuFrameLag) },
+			{ "lights", std::to_string(lightClusters.lights.size()) },
+			{ "renderer", deferredNow() ? "\"deferred\"" : "\"forward\"" },
+			{ "bindless", scene.bindless ? "true" : "false" },
+			{ "aa", std::string("\"") + aaTierName() + "\"" },
+			{ "gpuTargetMs", std::to_string(dynamicResolution ? gpuTargetMs : 0.0) },
+			{ "renderScale", std::to_string(renderScaleFrames > 0 ? renderScaleSum / renderScaleFrames : 1.0) },
+			{ "renderScaleChanges", std::to_string(scaleChanges) },
+			{ "depthPrepass", depthPrepass ? "true" : "false" },
+			{ "overdraw", std::to_string(overdrawFrames > 0 ? overdrawSum / overdrawFrames : 0.0) },
+			{ "shadowSkipRate", std::to_string(spotShadow.skipRate()) },
+			{ "monitorRenders", std::to_string(monitorView.stats.renders) }
+			});
+		replaying = false;
+		requestClose();
+	}
+
+	// Interactions, triggered by the keys or by replay events
+	void runEvent(const std::string& name) {
+		if (name == "lamp") {
+			spotActive = spotActive > 0 ? 0.0f : 1.0f;
+		}
+		else if (name == "drawer") {
+			drawerPos = drawerPos != 0 ? 0.0f : -1.5f;
+		}
+		else {
+			std::cout << "Unknown event <" << name << ">\n";
+			return;
+		}
+		recorder.event(benchTime, name);
+	}
+
+	// The camera block stays mapped, so the late latch is just a few stores
+	void writeCamera(uint32_t currentImage) {
+		CameraUniformBlock* cam = (CameraUniformBlock*)DSGubo.persistentMap(currentImage, 1);
+		const glm::mat4 viewPrj = ViewPrj * World;
+		const glm::vec2 size((float)renderExtent.width, (float)renderExtent.height);
+		// TAA: a different sub-pixel offset every frame
+		const glm::mat4 jittered = aaJitter() * viewPrj;
+		cam->viewPrj = jittered;
+		cam->view = World;
+		cam->eyePos = Pos;
+		cam->invViewPrj = glm::inverse(jittered);
+		cam->screen = glm::vec4(size, 1.0f / size);
+	}
+
+	// Called by drawFrame right before the submit: moves the camera by the input
+	// received since GameLogic ran. Culling and the other uniforms keep the
+	// earlier camera, which is at most a few milliseconds old.
+	void lateLatchUniforms(uint32_t currentImage) {
+		float deltaT;
+		glm::vec3 m = glm::vec3(0.0f), r = glm::vec3(0.0f);
+		bool fire = false;
+		getSixAxis(deltaT, m, r, fire);
+		totalSeconds += deltaT + sleptT;
+
+		updateCamera(deltaT, m, r);
+		writeCamera(currentImage);
+		binLights(currentImage);
+	}
+
+	// --lights=N: N point and spot lights scattered through the room, a stress
+	// test for the clustered lighting. They drift on small circles, so the
+	// froxel lists change every frame.
+	void initLights() {
+		const int n = std::min(std::max(0, getOptionInt("lights", 0)), (int)LightClusters::MAX_LIGHTS);
+		lightClusters.lights = randomLights(n, glm::vec3(-6.0f, 0.5f, -3.4f), glm::vec3(7.2f, 7.0f, 3.4f));
+		for (const ClusterLight& L : lightClusters.lights) {
+			lightOrigins.push_back(glm::vec3(L.posRadius));
+		}
+	}
+
+	void updateLights() {
+		for (size_t i = 0; i < lightOrigins.size(); i++) {
+			const float a = totalSeconds * 0.5f + i * 2.4f;
+			glm::vec4& L = lightClusters.lights[i].posRadius;
+			L = glm::vec4(lightOrigins[i] + 0.5f * glm::vec3(cos(a), 0.0f, sin(a)), L.w);
+		}
+	}
+
+	// The froxels follow the camera: with the late latch the lights are binned
+	// in lateLatchUniforms(), with the camera actually rendered
+	void binLights(uint32_t currentImage) {
+		if (lightClusters.lights.empty()) return;
+		lightClusters.bin(World, ViewPrj, nearPlane, farPlane, renderExtent.width, renderExtent.height,
+			(ClusterUniformBlock*)DSLights.persistentMap(currentImage, 1),
+			(ClusterLight*)DSLights.persistentMap(currentImage, 2),
+			(glm::uvec2*)DSLights.persistentMap(currentImage, 3),
+			(uint32_t*)DSLights.persistentMap(currentImage, 4));
+		PROFILE_COUNTER("Light binning us", lightClusters.stats.ms * 1000.0);
+		PROFILE_COUNTER("Light refs", lightClusters.stats.refs);
 	}
 	
 
 
 	void GameLogic() {
+		PROFILE_FUNCTION();
 
 		
 
@@ -779,17 +1076,28 @@ class ProjectTSP : public BaseProject {
 		bool fire = false;
 		getSixAxis(deltaT, m, r, fire);
 
+		// Replays run with a fixed time step and ignore the input. The clocks
+		// also count an on-demand sleep, which the camera motion leaves out.
+		const float lastBenchTime = benchTime;
+		float clockT = deltaT + sleptT;
+		if (replaying) {
+			deltaT = clockT = benchDt;
+			m = glm::vec3(0.0f);
+			r = glm::vec3(0.0f);
+		}
+		benchTime += clockT;
+
 		// Update time for clock
-		totalSeconds += deltaT;
+		totalSeconds += clockT;
 
 		// Change PC Model to simulate changing screen
 		static int curDebounce = 0;
 		static float debounce = false;
-		if (glfwGetKey(window, GLFW_KEY_L)) {
+		if (keyPressed(GLFW_KEY_L)) {
 			if (!debounce) {
 				debounce = true;
 				curDebounce = GLFW_KEY_L;
-				if (spotActive > 0) spotActive = 0.0f; else spotActive = 1.0f;
+				runEvent("lamp");
 			}
 		}
 		else {
@@ -798,13 +1106,95 @@ class ProjectTSP : public BaseProject {
 				curDebounce = 0;
 			}
 		}
+		if (keyPressed(GLFW_KEY_P)) {
+			if (!debounce) {
+				debounce = true;
+				curDebounce = GLFW_KEY_P;
+				printSceneStats = !printSceneStats;
+			}
+		}
+		else {
+			if ((curDebounce == GLFW_KEY_P) && debounce) {
+				debounce = false;
+				curDebounce = 0;
+			}
+		}
+		if (keyPressed(GLFW_KEY_G)) {
+			if (!debounce) {
+				debounce = true;
+				curDebounce = GLFW_KEY_G;
+				showStats = !showStats;
+			}
+		}
+		else {
+			if ((curDebounce == GLFW_KEY_G) && debounce) {
+				debounce = false;
+				curDebounce = 0;
+			}
+		}
+		if (keyPressed(GLFW_KEY_F12)) {
+			if (!debounce) {
+				debounce = true;
+				curDebounce = GLFW_KEY_F12;
+				exportProfile();
+			}
+		}
+		else {
+			if ((curDebounce == GLFW_KEY_F12) && debounce) {
+				debounce = false;
+				curDebounce = 0;
+			}
+		}
+		if (keyPressed(GLFW_KEY_M)) {
+			if (!debounce) {
+				debounce = true;
+				curDebounce = GLFW_KEY_M;
+				if (deferredAvailable) {
+					deferred = !deferred;
+					std::cout << "Renderer: " << (deferred ? "deferred" : "forward")
+						<< (deferred && !deferredNow() ? " (forward until an MSAA tier)" : "") << "\n";
+				}
+			}
+		}
+		else {
+			if ((curDebounce == GLFW_KEY_M) && debounce) {
+				debounce = false;
+				curDebounce = 0;
+			}
+		}
+		if (keyPressed(GLFW_KEY_V)) {
+			if (!debounce) {
+				debounce = true;
+				curDebounce = GLFW_KEY_V;
+				cyclePresentMode();
+			}
+		}
+		else {
+			if ((curDebounce == GLFW_KEY_V) && debounce) {
+				debounce = false;
+				curDebounce = 0;
+			}
+		}
+		if (keyPressed(GLFW_KEY_N)) {
+			if (!debounce) {
+				debounce = true;
+				curDebounce = GLFW_KEY_N;
+				cycleAATier();
+			}
+		}
+		else {
+			if ((curDebounce == GLFW_KEY_N) && debounce) {
+				debounce = false;
+				curDebounce = 0;
+			}
+		}
 		if (1.5f <= Pos.x && Pos.x <= 3.4f && 1.5f <= Pos.z && Pos.z <= 3.5f && angleBetweenVectors(forward, glm::normalize(glm::vec3(-1, -1, 0))) <= 45) {
 			uboPressX.visible = 1;
-			if (glfwGetKey(window, GLFW_KEY_X)) {
+			if (keyPressed(GLFW_KEY_X)) {
 				if (!debounce) {
 					debounce = true;
 					curDebounce = GLFW_KEY_X;
-					if (drawerPos != 0) drawerPos = 0.0f; else drawerPos = -1.5f;
+					runEvent("drawer");
 				}
 			}
 			else {
@@ -822,7 +1212,23 @@ class ProjectTSP : public BaseProject {
 
 		World = glm::mat4(1);
 
+		if (replaying) {
+			const CameraKey k = replay.sample(benchTime);
+			Pos = k.pos;
+			Yaw = k.yaw;
+			Pitch = k.pitch;
+			replay.forEachEvent(lastBenchTime, benchTime, [this](const std::string& e) { runEvent(e); });
+			if (benchTime >= replay.duration()) {
+				finishBenchmark();
+			}
+		}
+
+		updateCamera(deltaT, m, r);
+		recorder.key(benchTime, Pos, Yaw, Pitch);
+	}
 
+	// Moves and rotates the camera, then rebuilds World (the view matrix) and ViewPrj
+	void updateCamera(float deltaT, glm::vec3 m, glm::vec3 r) {
 
 		/////////////////////////// CAMERA ///////////////////////////
 
@@ -873,11 +1279,11 @@ class ProjectTSP : public BaseProject {
 
 
 // This is the main: probably you do not need to touch this!
-int main() {
+int main(int argc, char* argv[]) {
     ProjectTSP app;
 
     try {
-        app.run();
+        app.run(argc, argv);
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
         return EXIT_FAILURE;
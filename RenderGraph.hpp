@@ -0,0 +1,762 @@
+#pragma once
+// Frame graph. The passes of a frame are added in the order they run and
+// declare the images they write and read; compile() then works out:
+//  - which passes matter: those with side effects (flagged, or writing an
+//    imported image) and those whose results they read. The others are culled.
+//  - the layout of every image before and after each pass. Render passes make
+//    the transitions themselves, through the initial and final layouts of
+//    their attachments (initialLayout(), finalLayout()), and store only what a
+//    later pass reads (storeOp()); the other passes get pipeline barriers,
+//    recorded by execute().
+//  - the external subpass dependencies of every render pass (dependencies()),
+//    from the accesses before and after it. The first access of a frame
+//    depends on the last one of the frame before.
+//  - memory: the graph's own images, as large as the swap chain, become
+//    transient attachments in lazily allocated memory when their contents
+//    never leave the pass that writes them and the device has such memory;
+//    the others share memory with images whose lifetimes (in passes) do not
+//    overlap.
+// dump() lists the result and writeDot() writes it for Graphviz.
+//
+// Hazards are tracked per memory group: images aliased in memory are one
+// group, and so are imported images that take turns (importImage() with
+// sharesWith, e.g. a ping-pong history), so that writing one waits for the
+// reads of the other.
+
+#include <functional>
+
+enum RGAccess {
+	RG_COLOR_ATTACHMENT,	// written by a render pass, earlier contents discarded
+	RG_DEPTH_ATTACHMENT,	// written by a render pass, earlier contents discarded
+	RG_SAMPLED,				// read by fragment shaders (depth in the read-only depth layout)
+	RG_TRANSFER_SRC			// copied from
+};
+
+class RenderGraph {
+public:
+	typedef std::function<void(VkCommandBuffer, uint32_t)> RecordFunction;
+
+	void init(VkPhysicalDevice physicalDevice, VkDevice dev) {
+		device = dev;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+		lazySupported = false;
+		for (uint32_t t = 0; t < memoryProperties.memoryTypeCount; t++) {
+			lazySupported |= (memoryProperties.memoryTypes[t].propertyFlags &
+				VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
+		}
+	}
+
+	// Declaration, done again from reset() whenever the structure of the frame
+	// changes. Allocated images must have been released.
+	void reset() {
+		images.clear();
+		passes.clear();
+		blocks.clear();
+		compiled = false;
+	}
+
+	// Owned by the graph, as large as the swap chain. extraUsage: usage the
+	// accesses do not imply (e.g. input attachments of a subpass)
+	uint32_t createImage(const std::string& name, VkFormat format, VkSampleCountFlagBits samples,
+		VkImageAspectFlags aspect, VkImageUsageFlags extraUsage = 0) {
+		Image I;
+		I.name = name;
+		I.format = format;
+		I.samples = samples;
+		I.aspect = aspect;
+		I.usage = extraUsage;
+		I.group = (uint32_t)images.size();
+		images.push_back(I);
+		return I.group;
+	}
+
+	// Made elsewhere (setImported() gives the handles); left in restLayout
+	// between frames. sharesWith: an imported image this one takes turns with.
+	uint32_t importImage(const std::string& name, VkImageAspectFlags aspect, VkImageLayout restLayout,
+		uint32_t sharesWith = UINT32_MAX) {
+		Image I;
+		I.name = name;
+		I.aspect = aspect;
+		I.imported = true;
+		I.restLayout = restLayout;
+		I.group = sharesWith != UINT32_MAX ? images[sharesWith].group : (uint32_t)images.size();
+		images.push_back(I);
+		return (uint32_t)images.size() - 1;
+	}
+
+	// subpasses: of its render pass, 0 when the pass records no render pass
+	uint32_t addPass(const std::string& name, uint32_t subpasses, RecordFunction record) {
+		Pass P;
+		P.name = name;
+		P.subpasses = subpasses;
+		P.record = record;
+		passes.push_back(P);
+		return (uint32_t)passes.size() - 1;
+	}
+
+	// subpass: the last subpass of the render pass that accesses the image
+	// (default: the last one)
+	void use(uint32_t pass, uint32_t image, RGAccess access, uint32_t subpass = UINT32_MAX) {
+		Pass& P = passes[pass];
+		if (writes(access) && P.subpasses == 0) {
+			throw std::runtime_error("render graph: " + P.name + " writes " + images[image].name +
+				" outside a render pass");
+		}
+		Use U;
+		U.image = image;
+		U.access = access;
+		U.subpass = subpass == UINT32_MAX ? std::max(P.subpasses, 1u) - 1 : subpass;
+		P.uses.push_back(U);
+	}
+
+	// Never culled, even if nothing reads what it writes
+	void setSideEffect(uint32_t pass) {
+		passes[pass].sideEffect = true;
+	}
+
+	void compile() {
+		cull();
+		findUses();
+		assignLayouts();
+		planMemory();
+		synchronize();
+		compiled = true;
+	}
+
+	bool live(uint32_t pass) const {
+		return pass < passes.size() && passes[pass].live;
+	}
+	VkImageLayout initialLayout(uint32_t pass, uint32_t image) const {
+		return findUse(pass, image).before;
+	}
+	VkImageLayout finalLayout(uint32_t pass, uint32_t image) const {
+		return findUse(pass, image).after;
+	}
+	VkAttachmentStoreOp storeOp(uint32_t pass, uint32_t image) const {
+		return findUse(pass, image).store ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	}
+	// External subpass dependencies of a render pass
+	const std::vector<VkSubpassDependency>& dependencies(uint32_t pass) const {
+		return passes[pass].dependencies;
+	}
+
+	// One handle per swap chain image, or a single one for every image. Handles
+	// are needed only for barriers that change the layout.
+	void setImported(uint32_t image, const std::vector<VkImage>& handles, const std::vector<VkImageView>& views) {
+		images[image].handles = handles;
+		images[image].views = views;
+	}
+
+	// Creates the graph's images that a live pass uses, with their memory
+	void allocate(VkExtent2D extent) {
+		requestedBytes = allocatedBytes = 0;
+		for (Block& B : blocks) {
+			VkMemoryRequirements blockReq{};
+			blockReq.memoryTypeBits = ~0u;
+			std::vector<VkMemoryRequirements> reqs;
+			for (uint32_t i : B.images) {
+				Image& I = images[i];
+				VkImageCreateInfo imageInfo{};
+				imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+				imageInfo.imageType = VK_IMAGE_TYPE_2D;
+				imageInfo.extent = { extent.width, extent.height, 1 };
+				imageInfo.mipLevels = 1;
+				imageInfo.arrayLayers = 1;
+				imageInfo.format = I.format;
+				imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+				imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+				imageInfo.usage = I.usage;
+				imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+				imageInfo.samples = I.samples;
+				VkImage handle;
+				VkResult result = vkCreateImage(device, &imageInfo, nullptr, &handle);
+				if (result != VK_SUCCESS) {
+					PrintVkError(result);
+					throw std::runtime_error("failed to create render graph image " + I.name + "!");
+				}
+				I.handles = { handle };
+
+				VkMemoryRequirements req;
+				vkGetImageMemoryRequirements(device, handle, &req);
+				reqs.push_back(req);
+				requestedBytes += req.size;
+				blockReq.size = std::max(blockReq.size, req.size);
+				blockReq.memoryTypeBits &= req.memoryTypeBits;
+			}
+
+			const VkMemoryPropertyFlags flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+				(B.lazy ? VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT : 0);
+			uint32_t type = memoryType(blockReq.memoryTypeBits, flags);
+			if (type == UINT32_MAX && B.lazy) {
+				type = memoryType(blockReq.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			}
+			if (type != UINT32_MAX) {
+				B.memory.assign(1, allocateMemory(blockReq.size, type));
+				allocatedBytes += blockReq.size;
+				for (uint32_t i : B.images) {
+					vkBindImageMemory(device, images[i].handles[0], B.memory[0], 0);
+				}
+			}
+			else {
+				// The images cannot share one memory type: each gets its own
+				B.memory.clear();
+				for (size_t k = 0; k < B.images.size(); k++) {
+					const uint32_t t = memoryType(reqs[k].memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+					if (t == UINT32_MAX) {
+						throw std::runtime_error("failed to find a memory type for " + images[B.images[k]].name + "!");
+					}
+					B.memory.push_back(allocateMemory(reqs[k].size, t));
+					allocatedBytes += reqs[k].size;
+					vkBindImageMemory(device, images[B.images[k]].handles[0], B.memory.back(), 0);
+				}
+			}
+
+			for (uint32_t i : B.images) {
+				Image& I = images[i];
+				VkImageViewCreateInfo viewInfo{};
+				viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+				viewInfo.image = I.handles[0];
+				viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+				viewInfo.format = I.format;
+				viewInfo.subresourceRange = { I.aspect, 0, 1, 0, 1 };
+				VkImageView view;
+				VkResult result = vkCreateImageView(device, &viewInfo, nullptr, &view);
+				if (result != VK_SUCCESS) {
+					PrintVkError(result);
+					throw std::runtime_error("failed to create render graph image view " + I.name + "!");
+				}
+				I.views = { view };
+			}
+		}
+	}
+
+	void release() {
+		for (Block& B : blocks) {
+			for (uint32_t i : B.images) {
+				Image& I = images[i];
+				for (VkImageView V : I.views) vkDestroyImageView(device, V, nullptr);
+				for (VkImage H : I.handles) vkDestroyImage(device, H, nullptr);
+				I.views.clear();
+				I.handles.clear();
+			}
+			for (VkDeviceMemory M : B.memory) vkFreeMemory(device, M, nullptr);
+			B.memory.clear();
+		}
+	}
+
+	VkImageView view(uint32_t image, uint32_t index = 0) const {
+		const Image& I = images[image];
+		return I.views.empty() ? VK_NULL_HANDLE : I.views[I.views.size() > 1 ? index : 0];
+	}
+
+	// The live passes in order, each between the barriers compiled for it
+	void execute(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+		for (Pass& P : passes) {
+			if (!P.live) continue;
+			recordBarriers(commandBuffer, P.before, imageIndex);
+			P.record(commandBuffer, imageIndex);
+			recordBarriers(commandBuffer, P.after, imageIndex);
+		}
+	}
+
+	void dump(std::ostream& out) const {
+		uint32_t culled = 0;
+		for (const Pass& P : passes) culled += P.live ? 0 : 1;
+		out << "Render graph: " << passes.size() << " passes (" << culled << " culled), "
+			<< images.size() << " images\n";
+		for (size_t p = 0; p < passes.size(); p++) {
+			const Pass& P = passes[p];
+			out << "  pass " << p << " " << P.name;
+			if (P.subpasses > 0) out << ", render pass of " << P.subpasses << " subpasses";
+			if (P.sideEffect) out << ", side effect";
+			if (!P.live) out << ", CULLED";
+			out << "\n";
+			for (const Use& U : P.uses) {
+				out << "    " << (writes(U.access) ? "writes " : "reads  ") << images[U.image].name
+					<< ": " << layoutName(U.before) << " -> " << layoutName(U.layout) << " -> "
+					<< layoutName(U.after);
+				if (writes(U.access)) out << (U.store ? ", store" : ", don't care");
+				out << "\n";
+			}
+			for (const VkSubpassDependency& D : P.dependencies) {
+				out << "    dependency " << subpassName(D.srcSubpass) << " -> " << subpassName(D.dstSubpass)
+					<< std::hex << ": stages 0x" << D.srcStageMask << " -> 0x" << D.dstStageMask
+					<< ", access 0x" << D.srcAccessMask << " -> 0x" << D.dstAccessMask << std::dec << "\n";
+			}
+			for (const Barrier& B : P.before) {
+				out << "    barrier before, " << images[B.image].name << ": " << layoutName(B.oldLayout)
+					<< " -> " << layoutName(B.newLayout) << "\n";
+			}
+			for (const Barrier& B : P.after) {
+				out << "    barrier after, " << images[B.image].name << ": " << layoutName(B.oldLayout)
+					<< " -> " << layoutName(B.newLayout) << "\n";
+			}
+		}
+		for (size_t b = 0; b < blocks.size(); b++) {
+			const Block& B = blocks[b];
+			out << "  memory " << b << (B.lazy ? " (lazily allocated)" : "") << ":";
+			for (uint32_t i : B.images) {
+				out << " " << images[i].name << " [passes " << images[i].first << "-" << images[i].last << "]";
+			}
+			out << "\n";
+		}
+		if (requestedBytes > 0) {
+			out << "  " << (requestedBytes >> 20) << " MB of attachments in " << (allocatedBytes >> 20)
+				<< " MB of memory\n";
+		}
+	}
+
+	bool writeDot(const std::string& file) const {
+		std::ofstream out(file);
+		if (!out) return false;
+		out << "digraph RenderGraph {\n\trankdir=LR;\n";
+		for (size_t p = 0; p < passes.size(); p++) {
+			out << "\tp" << p << " [shape=box, label=\"" << passes[p].name << "\"" <<
+				(passes[p].live ? "" : ", style=dashed") << "];\n";
+		}
+		for (size_t i = 0; i < images.size(); i++) {
+			const Image& I = images[i];
+			out << "\ti" << i << " [shape=ellipse, label=\"" << I.name;
+			if (I.block != UINT32_MAX) out << "\\nmemory " << I.block << (blocks[I.block].lazy ? " (lazy)" : "");
+			out << "\"" << (I.imported ? ", style=bold" : "") << "];\n";
+		}
+		for (size_t p = 0; p < passes.size(); p++) {
+			for (const Use& U : passes[p].uses) {
+				if (writes(U.access)) out << "\tp" << p << " -> i" << U.image;
+				else out << "\ti" << U.image << " -> p" << p;
+				out << " [label=\"" << layoutName(U.layout) << "\"];\n";
+			}
+		}
+		out << "}\n";
+		return true;
+	}
+
+private:
+	struct Use {
+		uint32_t image;
+		RGAccess access;
+		uint32_t subpass;
+		// Compiled
+		VkImageLayout before = VK_IMAGE_LAYOUT_UNDEFINED;	// render pass attachments: initial layout
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;	// during the pass
+		VkImageLayout after = VK_IMAGE_LAYOUT_UNDEFINED;	// render pass attachments: final layout
+		bool store = false;
+	};
+
+	struct Barrier {
+		uint32_t image;
+		VkImageLayout oldLayout, newLayout;
+		VkPipelineStageFlags srcStage, dstStage;
+		VkAccessFlags srcAccess, dstAccess;
+	};
+
+	struct Pass {
+		std::string name;
+		uint32_t subpasses = 0;
+		RecordFunction record;
+		std::vector<Use> uses;
+		bool sideEffect = false;
+		bool live = false;
+		std::vector<VkSubpassDependency> dependencies;
+		std::vector<Barrier> before, after;
+	};
+
+	struct Image {
+		std::string name;
+		VkFormat format = VK_FORMAT_UNDEFINED;
+		VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+		VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+		VkImageUsageFlags usage = 0;
+		bool imported = false;
+		VkImageLayout restLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		uint32_t group = 0;
+		// Compiled: the uses by live passes, as (pass, use), and their span
+		std::vector<std::pair<uint32_t, uint32_t>> uses;
+		int first = -1, last = -1;
+		uint32_t block = UINT32_MAX;
+		// Allocated, or given by setImported()
+		std::vector<VkImage> handles;
+		std::vector<VkImageView> views;
+	};
+
+	// Graph images sharing one allocation (or lazily allocated alone)
+	struct Block {
+		std::vector<uint32_t> images;
+		bool lazy = false;
+		std::vector<VkDeviceMemory> memory;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties memoryProperties{};
+	bool lazySupported = false;
+	bool compiled = false;
+	std::vector<Image> images;
+	std::vector<Pass> passes;
+	std::vector<Block> blocks;
+	VkDeviceSize requestedBytes = 0, allocatedBytes = 0;
+
+	static bool writes(RGAccess a) {
+		return a == RG_COLOR_ATTACHMENT || a == RG_DEPTH_ATTACHMENT;
+	}
+	static VkImageLayout layoutOf(RGAccess a, VkImageAspectFlags aspect) {
+		switch (a) {
+		case RG_COLOR_ATTACHMENT: return VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		case RG_DEPTH_ATTACHMENT: return VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		case RG_SAMPLED: return (aspect & VK_IMAGE_ASPECT_DEPTH_BIT) ?
+			VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		default: return VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		}
+	}
+	static VkPipelineStageFlags stageOf(RGAccess a) {
+		switch (a) {
+		case RG_COLOR_ATTACHMENT: return VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		case RG_DEPTH_ATTACHMENT: return VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+			VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		case RG_SAMPLED: return VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		default: return VK_PIPELINE_STAGE_TRANSFER_BIT;
+		}
+	}
+	static VkAccessFlags accessOf(RGAccess a) {
+		switch (a) {
+		case RG_COLOR_ATTACHMENT: return VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		case RG_DEPTH_ATTACHMENT: return VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		case RG_SAMPLED: return VK_ACCESS_SHADER_READ_BIT;
+		default: return VK_ACCESS_TRANSFER_READ_BIT;
+		}
+	}
+	// Only writes have to be made available; reads need just the execution order
+	static VkAccessFlags writeAccessOf(RGAccess a) {
+		return a == RG_COLOR_ATTACHMENT ? VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT :
+			a == RG_DEPTH_ATTACHMENT ? VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT : 0;
+	}
+	static VkImageUsageFlags usageOf(RGAccess a) {
+		switch (a) {
+		case RG_COLOR_ATTACHMENT: return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+		case RG_DEPTH_ATTACHMENT: return VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+		case RG_SAMPLED: return VK_IMAGE_USAGE_SAMPLED_BIT;
+		default: return VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		}
+	}
+
+	const Use& findUse(uint32_t pass, uint32_t image) const {
+		for (const Use& U : passes[pass].uses) {
+			if (U.image == image) return U;
+		}
+		throw std::runtime_error("render graph: " + passes[pass].name + " does not use " + images[image].name);
+	}
+
+	// Live: side effects and writes of imported images, then, backwards, the
+	// last writer before each read of a live pass
+	void cull() {
+		for (Pass& P : passes) {
+			P.live = P.sideEffect;
+			for (const Use& U : P.uses) {
+				P.live |= writes(U.access) && images[U.image].imported;
+			}
+		}
+		for (int p = (int)passes.size() - 1; p >= 0; p--) {
+			if (!passes[p].live) continue;
+			for (const Use& U : passes[p].uses) {
+				if (writes(U.access)) continue;
+				for (int q = p - 1; q >= 0; q--) {
+					if (usesAs(q, U.image, true)) {
+						passes[q].live = true;
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	bool usesAs(int pass, uint32_t image, bool write) const {
+		for (const Use& U : passes[pass].uses) {
+			if (U.image == image && writes(U.access) == write) return true;
+		}
+		return false;
+	}
+
+	void findUses() {
+		for (Image& I : images) {
+			I.uses.clear();
+			I.first = I.last = -1;
+			I.block = UINT32_MAX;
+		}
+		for (uint32_t p = 0; p < passes.size(); p++) {
+			if (!passes[p].live) continue;
+			for (uint32_t u = 0; u < passes[p].uses.size(); u++) {
+				Image& I = images[passes[p].uses[u].image];
+				I.uses.push_back({ p, u });
+				if (I.first < 0) I.first = (int)p;
+				I.last = (int)p;
+			}
+		}
+		for (const Image& I : images) {
+			if (!I.imported && !I.uses.empty() && !writes(useOf(I.uses[0]).access)) {
+				throw std::runtime_error("render graph: " + I.name + " is read before it is written");
+			}
+		}
+	}
+
+	Use& useOf(std::pair<uint32_t, uint32_t> pu) {
+		return passes[pu.first].uses[pu.second];
+	}
+	const Use& useOf(std::pair<uint32_t, uint32_t> pu) const {
+		return passes[pu.first].uses[pu.second];
+	}
+
+	// Writes discard: a render pass starts them from UNDEFINED and leaves them
+	// in the layout of the next read, or of the frame's end if imported
+	void assignLayouts() {
+		for (Image& I : images) {
+			for (size_t k = 0; k < I.uses.size(); k++) {
+				Use& U = useOf(I.uses[k]);
+				const Use* next = k + 1 < I.uses.size() ? &useOf(I.uses[k + 1]) : nullptr;
+				U.layout = layoutOf(U.access, I.aspect);
+				if (writes(U.access)) {
+					U.before = VK_IMAGE_LAYOUT_UNDEFINED;
+					const bool nextReads = next != nullptr && !writes(next->access);
+					U.after = nextReads ? layoutOf(next->access, I.aspect) :
+						next == nullptr && I.imported ? I.restLayout : U.layout;
+					U.store = nextReads || (next == nullptr && I.imported);
+				}
+				else {
+					U.before = k > 0 ? useOf(I.uses[k - 1]).after : I.restLayout;
+					U.after = next == nullptr && I.imported ? I.restLayout : U.layout;
+				}
+			}
+		}
+	}
+
+	// Attachments that are never stored and only used as attachments go to
+	// lazily allocated memory; the rest share blocks, first fit by lifetime
+	void planMemory() {
+		blocks.clear();
+		for (uint32_t i = 0; i < images.size(); i++) {
+			Image& I = images[i];
+			if (I.imported || I.uses.empty()) continue;
+			bool attachmentOnly = (I.usage & ~VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT) == 0;
+			VkImageUsageFlags usage = I.usage;
+			for (const auto& pu : I.uses) {
+				const Use& U = useOf(pu);
+				usage |= usageOf(U.access);
+				attachmentOnly &= writes(U.access) && !U.store;
+			}
+			I.usage = usage;
+			if (attachmentOnly) {
+				I.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+			}
+
+			if (attachmentOnly && lazySupported) {
+				Block B;
+				B.lazy = true;
+				B.images.push_back(i);
+				I.block = (uint32_t)blocks.size();
+				blocks.push_back(B);
+				continue;
+			}
+			for (uint32_t b = 0; b < blocks.size() && I.block == UINT32_MAX; b++) {
+				if (blocks[b].lazy) continue;
+				bool overlaps = false;
+				for (uint32_t j : blocks[b].images) {
+					overlaps |= !(images[j].last < I.first || images[j].first > I.last);
+				}
+				if (!overlaps) {
+					I.block = b;
+					I.group = images[blocks[b].images[0]].group;
+					blocks[b].images.push_back(i);
+				}
+			}
+			if (I.block == UINT32_MAX) {
+				Block B;
+				B.images.push_back(i);
+				I.block = (uint32_t)blocks.size();
+				blocks.push_back(B);
+			}
+		}
+	}
+
+	// The uses of an image group by one pass, merged
+	bool groupAccess(uint32_t pass, uint32_t group, VkPipelineStageFlags& stages,
+		VkAccessFlags& writeAccess, VkAccessFlags& access) const {
+		bool found = false;
+		for (const Use& U : passes[pass].uses) {
+			if (images[U.image].group != group) continue;
+			found = true;
+			stages |= stageOf(U.access);
+			writeAccess |= writeAccessOf(U.access);
+			access |= accessOf(U.access);
+		}
+		return found;
+	}
+
+	// The live pass using the group before p, wrapping round to the last of the
+	// frame (p itself when it is the only one)
+	uint32_t previousUser(uint32_t p, uint32_t group) const {
+		for (uint32_t k = 1; k <= passes.size(); k++) {
+			const uint32_t q = (uint32_t)((p + passes.size() - k) % passes.size());
+			VkPipelineStageFlags s = 0;
+			VkAccessFlags w = 0, a = 0;
+			if (passes[q].live && groupAccess(q, group, s, w, a)) return q;
+		}
+		return p;
+	}
+
+	// The live pass using the group after p in the frame; wrapping round only
+	// if wrap (images that carry over to the next frame)
+	uint32_t nextUser(uint32_t p, uint32_t group, bool wrap) const {
+		for (uint32_t k = 1; k <= passes.size(); k++) {
+			const uint32_t q = p + k;
+			if (q >= passes.size() && !wrap) break;
+			VkPipelineStageFlags s = 0;
+			VkAccessFlags w = 0, a = 0;
+			if (passes[q % passes.size()].live && groupAccess(q % passes.size(), group, s, w, a)) {
+				return q % passes.size();
+			}
+		}
+		return UINT32_MAX;
+	}
+
+	void synchronize() {
+		for (uint32_t p = 0; p < passes.size(); p++) {
+			Pass& P = passes[p];
+			P.dependencies.clear();
+			P.before.clear();
+			P.after.clear();
+			if (!P.live) continue;
+
+			VkSubpassDependency in{};
+			in.srcSubpass = VK_SUBPASS_EXTERNAL;
+			in.dstSubpass = 0;
+			std::vector<VkSubpassDependency> out;
+			for (const Use& U : P.uses) {
+				const Image& I = images[U.image];
+				VkPipelineStageFlags srcStage = 0;
+				VkAccessFlags srcWrite = 0, srcAll = 0;
+				groupAccess(previousUser(p, I.group), I.group, srcStage, srcWrite, srcAll);
+
+				// Barriers: every use outside render passes, and sampled images
+				// that are not yet in their layout
+				const bool attachment = writes(U.access);
+				if (P.subpasses == 0 || (!attachment && U.before != U.layout)) {
+					P.before.push_back({ U.image, U.before, U.layout, srcStage, stageOf(U.access),
+						srcWrite, accessOf(U.access) });
+				}
+				if (!attachment && U.after != U.layout) {
+					VkPipelineStageFlags dstStage = 0;
+					VkAccessFlags w = 0, dstAll = 0;
+					groupAccess(nextUser(p, I.group, true), I.group, dstStage, w, dstAll);
+					P.after.push_back({ U.image, U.layout, U.after, stageOf(U.access), dstStage,
+						writeAccessOf(U.access), dstAll });
+				}
+				if (P.subpasses == 0) continue;
+
+				in.srcStageMask |= srcStage;
+				in.srcAccessMask |= srcWrite;
+				in.dstStageMask |= stageOf(U.access);
+				in.dstAccessMask |= accessOf(U.access);
+
+				// To the next use, if either side writes
+				const uint32_t next = nextUser(p, I.group, I.imported);
+				if (next == UINT32_MAX) continue;
+				VkPipelineStageFlags dstStage = 0;
+				VkAccessFlags dstWrite = 0, dstAll = 0;
+				groupAccess(next, I.group, dstStage, dstWrite, dstAll);
+				if (!attachment && dstWrite == 0) continue;
+				VkSubpassDependency* D = nullptr;
+				for (VkSubpassDependency& E : out) {
+					if (E.srcSubpass == U.subpass) D = &E;
+				}
+				if (D == nullptr) {
+					out.push_back({});
+					D = &out.back();
+					D->srcSubpass = U.subpass;
+					D->dstSubpass = VK_SUBPASS_EXTERNAL;
+				}
+				D->srcStageMask |= stageOf(U.access);
+				D->srcAccessMask |= writeAccessOf(U.access);
+				D->dstStageMask |= dstStage;
+				D->dstAccessMask |= dstAll;
+			}
+			if (P.subpasses > 0 && in.srcStageMask != 0) {
+				P.dependencies.push_back(in);
+			}
+			P.dependencies.insert(P.dependencies.end(), out.begin(), out.end());
+		}
+	}
+
+	void recordBarriers(VkCommandBuffer commandBuffer, const std::vector<Barrier>& barriers, uint32_t imageIndex) {
+		if (barriers.empty()) return;
+		VkPipelineStageFlags srcStage = 0, dstStage = 0;
+		VkMemoryBarrier memoryBarrier{};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		std::vector<VkImageMemoryBarrier> imageBarriers;
+		for (const Barrier& B : barriers) {
+			srcStage |= B.srcStage;
+			dstStage |= B.dstStage;
+			if (B.oldLayout == B.newLayout) {
+				memoryBarrier.srcAccessMask |= B.srcAccess;
+				memoryBarrier.dstAccessMask |= B.dstAccess;
+				continue;
+			}
+			const Image& I = images[B.image];
+			if (I.handles.empty()) {
+				throw std::runtime_error("render graph: no image for " + I.name);
+			}
+			VkImageMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.oldLayout = B.oldLayout;
+			barrier.newLayout = B.newLayout;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = I.handles[I.handles.size() > 1 ? imageIndex : 0];
+			barrier.subresourceRange = { I.aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS };
+			barrier.srcAccessMask = B.srcAccess;
+			barrier.dstAccessMask = B.dstAccess;
+			imageBarriers.push_back(barrier);
+		}
+		vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0,
+			memoryBarrier.srcAccessMask != 0 ? 1 : 0, &memoryBarrier, 0, nullptr,
+			static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+	}
+
+	uint32_t memoryType(uint32_t typeBits, VkMemoryPropertyFlags flags) const {
+		for (uint32_t t = 0; t < memoryProperties.memoryTypeCount; t++) {
+			if ((typeBits & (1u << t)) && (memoryProperties.memoryTypes[t].propertyFlags & flags) == flags) {
+				return t;
+			}
+		}
+		return UINT32_MAX;
+	}
+
+	VkDeviceMemory allocateMemory(VkDeviceSize size, uint32_t type) {
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = size;
+		allocInfo.memoryTypeIndex = type;
+		VkDeviceMemory memory;
+		VkResult result = vkAllocateMemory(device, &allocInfo, nullptr, &memory);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to allocate render graph memory!");
+		}
+		return memory;
+	}
+
+	static const char* layoutName(VkImageLayout layout) {
+		switch (layout) {
+		case VK_IMAGE_LAYOUT_UNDEFINED: return "UNDEFINED";
+		case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL: return "COLOR_ATTACHMENT";
+		case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL: return "DEPTH_ATTACHMENT";
+		case VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL: return "DEPTH_READ_ONLY";
+		case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL: return "SHADER_READ_ONLY";
+		case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL: return "TRANSFER_SRC";
+		case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR: return "PRESENT_SRC";
+		default: return "OTHER";
+		}
+	}
+
+	static std::string subpassName(uint32_t subpass) {
+		return subpass == VK_SUBPASS_EXTERNAL ? std::string("external") : std::to_string(subpass);
+	}
+};
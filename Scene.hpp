@@ -0,0 +1,824 @@
+#pragma once
+#include <cfloat>
+#include <deque>
+#include <numeric>
+#include <string>
+#include "MatrixKernels.hpp"
+
+// Data oriented scene: every prop is an index into a set of parallel arrays.
+// Meshes and textures are shared assets referenced by handle, so adding a prop
+// is a single addEntity() call instead of a new Model/Texture/DescriptorSet/UBO
+// member in the application.
+
+const uint32_t NO_TEXTURE = UINT32_MAX;
+const uint32_t NO_MESH = UINT32_MAX;
+const uint32_t NO_PARENT = UINT32_MAX;
+
+// Features of the mesh shaders that a pipeline variant can compile out.
+// Bit i is the bool specialization constant with constant_id i.
+const uint32_t VARIANT_EMISSION = 1;
+const uint32_t VARIANT_SPOT = 2;
+const uint32_t VARIANT_SPECULAR = 4;
+const uint32_t VARIANT_LIGHTS = 8;		// clustered lights
+const uint32_t VARIANT_ALL = VARIANT_EMISSION | VARIANT_SPOT | VARIANT_SPECULAR | VARIANT_LIGHTS;
+
+// Material pipeline: the pipeline plus the layout of its per entity set.
+// Sets below "entitySet" are the global ones, bound once per pipeline switch.
+// bindlessP, if any, draws the same material from the bindless set instead.
+// gbufferP and gbufferBindlessP write it to the G-buffer (deferred path).
+struct ScenePipeline {
+	Pipeline* P;
+	DescriptorSetLayout* DSL;
+	bool hasEmission;
+	Pipeline* bindlessP;
+	Pipeline* gbufferP = nullptr;
+	Pipeline* gbufferBindlessP = nullptr;
+};
+
+// Push constants of a bindless draw: the entity's element in the storage
+// buffer, and the image, layer and UV scale of its textures in the texture array
+struct BindlessDraw {
+	uint32_t entity;
+	uint32_t texture;
+	uint32_t emission;
+	uint32_t textureLayer;
+	uint32_t emissionLayer;
+	uint32_t pad;
+	glm::vec2 textureScale;
+	glm::vec2 emissionScale;
+};
+
+// Where a texture ended up in bindless mode: layer "layer" of the array texture
+// "image". Small textures are padded to a power of two, so their UVs are scaled.
+struct TextureSlot {
+	uint32_t image;
+	uint32_t layer;
+	glm::vec2 scale;
+};
+
+// Texture animation: the run of texture ids [first, first + frames), shown in
+// turn at fps frames per second. A still texture is a flipbook of one frame.
+struct Flipbook {
+	uint32_t first;
+	uint32_t frames;
+	float fps;
+};
+
+// Texture drawn at run time (e.g. by a SecondaryView) instead of loaded from a
+// file: plain is sampled by the per entity sets, array (a one layer 2D_ARRAY
+// view of the same image) through the bindless table
+struct RenderTexture {
+	uint32_t id;
+	Texture* plain;
+	Texture* array;
+};
+
+struct Scene {
+	BaseProject* BP;
+	VertexDescriptor* VD;
+
+	// Assets (deque: textures are referenced by pointer from the descriptor sets).
+	// Textures are loaded by loadTextures(), once the entities are known: those of
+	// the per entity sets as plain textures, those of the bindless draws packed
+	// into array textures.
+	std::deque<Model<VertexMesh>> meshes;
+	std::vector<glm::vec4> meshBounds;		// object space bounding sphere (center, radius)
+	std::vector<std::string> textureFiles;
+	std::deque<Texture> textures;
+	std::vector<uint32_t> textureImages;	// texture id -> textures, NO_TEXTURE if not loaded
+	std::deque<Texture> textureArrays;
+	std::vector<TextureSlot> textureSlots;	// texture id -> textureArrays
+	std::vector<uint8_t> blackTexture;		// texture id -> all texels black
+	std::vector<Flipbook> flipbooks;		// texture id -> the flipbook it is a frame of
+	std::vector<RenderTexture> renderTextures;	// owned by whoever draws them
+	uint32_t packMaxSize = 1024;			// larger textures get an array of their own, 0 packs nothing
+	std::vector<ScenePipeline> pipelines;
+	std::vector<DescriptorSet*> globalSets;
+	uint32_t entitySet;
+
+	// Entities, structure of arrays.
+	// Transforms are relative to the parent; change them with the set* functions
+	// so that the cached matrices are marked dirty. Parents always precede their
+	// children, so a single forward pass propagates the changes.
+	std::vector<uint32_t> parent;
+	std::vector<glm::vec3> position;
+	std::vector<glm::quat> rotation;
+	std::vector<glm::vec3> scale;
+	std::vector<uint8_t> dirty;				// local transform changed since last update
+	std::vector<uint8_t> worldChanged;		// world matrix recomputed in the last update
+	std::vector<glm::mat4> local;
+	std::vector<glm::mat4> world;
+	std::vector<glm::mat4> normal;
+	std::vector<float> worldScale;			// uniform world scale, 0 if not uniform
+	std::vector<glm::vec4> worldBounds;		// world space bounding sphere (center, radius)
+	std::vector<float> amb;
+	std::vector<float> gamma;
+	std::vector<glm::vec3> sColor;
+	std::vector<uint32_t> mesh;
+	std::vector<uint32_t> texture;
+	std::vector<uint32_t> emission;
+	std::vector<uint32_t> pipeline;
+	std::vector<uint32_t> variant;			// features the prop needs, set by loadTextures()
+	std::vector<uint8_t> visible;
+	std::vector<MeshUniformBlock> ubo;
+	std::vector<DescriptorSet> sets;
+	// Per entity sets of the flipbook frames after the first (sets[e] is frame 0)
+	std::vector<std::vector<DescriptorSet>> frameSets;
+
+	// Drives the flipbooks; the application sets it before updateUniforms()
+	float time = 0.0f;
+
+	// Bindless mode: one set per image holds the uniform blocks of all the
+	// entities (binding 0, storage buffer) and all the textures (binding 1,
+	// variable count array), so there is no per entity set to bind
+	bool bindless = false;
+	DescriptorSetLayout* bindlessDSL = nullptr;
+	DescriptorSet bindlessSet;
+
+	// Features of the current lighting state, e.g. no VARIANT_SPOT with the lamp
+	// off, no VARIANT_LIGHTS without clustered lights: each draw uses the variant
+	// variant[e] & frameVariant
+	uint32_t frameVariant = VARIANT_ALL;
+
+	// Entities sorted by (pipeline, variant, mesh), rebuilt only when entities are added
+	std::vector<uint32_t> order;
+	bool orderDirty = false;
+	// Entities surviving culling this frame, in draw order
+	std::vector<uint32_t> drawList;
+
+	// Scratch arrays for the batch matrix kernels
+	std::vector<glm::mat4> mvp;
+	std::vector<uint32_t> generalNormals;
+	std::vector<glm::mat4> normalScratch;
+
+	// Matrices recomputed by the last updateTransforms()
+	struct {
+		uint32_t local;
+		uint32_t world;
+		uint32_t normal;
+		uint32_t normalFast;	// of which via the rigid / uniform scale path
+	} stats = {};
+
+	void init(BaseProject* bp, VertexDescriptor* vd, std::vector<DescriptorSet*> G) {
+		BP = bp;
+		VD = vd;
+		globalSets = G;
+		entitySet = static_cast<uint32_t>(G.size());
+	}
+
+	size_t size() const {
+		return position.size();
+	}
+
+	uint32_t addPipeline(Pipeline* P, DescriptorSetLayout* DSL, bool hasEmission,
+		Pipeline* bindlessP = nullptr) {
+		pipelines.push_back({ P, DSL, hasEmission, bindlessP });
+		return static_cast<uint32_t>(pipelines.size() - 1);
+	}
+
+	// The G-buffer pipelines of material sp; same set layouts as its others
+	void setDeferred(uint32_t sp, Pipeline* gbufferP, Pipeline* gbufferBindlessP = nullptr) {
+		pipelines[sp].gbufferP = gbufferP;
+		pipelines[sp].gbufferBindlessP = gbufferBindlessP;
+	}
+
+	uint32_t addMesh(const std::string& file) {
+		meshes.emplace_back();
+		meshes.back().init(BP, VD, file, OBJ);
+		return registerMesh();
+	}
+
+	// For meshes whose vertices and indices have been filled by hand
+	uint32_t addMesh(std::vector<VertexMesh>& vertices, std::vector<uint32_t>& indices) {
+		meshes.emplace_back();
+		meshes.back().vertices.swap(vertices);
+		meshes.back().indices.swap(indices);
+		meshes.back().initMesh(BP, VD);
+		return registerMesh();
+	}
+
+	// Position only copies of the vertex buffers, for drawPositions()
+	void createPositionStreams() {
+		for (auto& M : meshes) {
+			M.createPositionBuffer();
+		}
+	}
+
+	uint32_t addTexture(const char* file) {
+		const uint32_t t = static_cast<uint32_t>(textureFiles.size());
+		textureFiles.push_back(file);
+		flipbooks.push_back({ t, 1, 0.0f });
+		return t;
+	}
+
+	// The returned id is used like that of addTexture(); plain and array must
+	// stay valid until the descriptor sets are cleaned up
+	uint32_t addRenderTexture(Texture* plain, Texture* array) {
+		const uint32_t t = addTexture("");
+		renderTextures.push_back({ t, plain, array });
+		return t;
+	}
+
+	// Animated texture: files are shown in turn, fps per second. The id is used
+	// like that of addTexture(), so any prop can play one with a single draw.
+	// Bindless draws find the frames in consecutive layers of one array texture
+	// and push the layer of the current frame; per entity sets get one set per
+	// frame. A prop's texture and emission flipbooks must share frames and rate.
+	uint32_t addFlipbook(const std::vector<const char*>& files, float fps) {
+		if (files.empty() || fps <= 0.0f) {
+			throw std::runtime_error("flipbook needs at least a frame and a positive rate!");
+		}
+		const uint32_t first = static_cast<uint32_t>(textureFiles.size());
+		for (const char* file : files) {
+			textureFiles.push_back(file);
+			flipbooks.push_back({ first, static_cast<uint32_t>(files.size()), fps });
+		}
+		return first;
+	}
+
+	void loadTextures() {
+		PROFILE_FUNCTION();
+		const size_t n = textureFiles.size();
+		std::vector<uint8_t> plain(n, bindless ? 0 : 1), packed(n, 0);
+		for (size_t e = 0; e < size(); e++) {
+			if (mesh[e] == NO_MESH) continue;
+			std::vector<uint8_t>& used = isBindless(e) ? packed : plain;
+			for (uint32_t t : { texture[e], emission[e] }) {
+				if (t == NO_TEXTURE) continue;
+				const Flipbook& F = flipbooks[t];
+				for (uint32_t f = 0; f < F.frames; f++) used[F.first + f] = 1;
+			}
+		}
+		for (const RenderTexture& R : renderTextures) {
+			plain[R.id] = packed[R.id] = 0;
+		}
+
+		textureImages.assign(n, NO_TEXTURE);
+		blackTexture.assign(n, 0);
+		for (size_t t = 0; t < n; t++) {
+			if (!plain[t]) continue;
+			textureImages[t] = static_cast<uint32_t>(textures.size());
+			textures.emplace_back();
+			textures.back().init(BP, textureFiles[t].c_str());
+			blackTexture[t] = textures.back().black;
+		}
+		if (bindless) {
+			packTextures(packed);
+			// Rendered textures follow the packed arrays in the bindless table
+			for (size_t r = 0; r < renderTextures.size(); r++) {
+				textureSlots[renderTextures[r].id] = {
+					static_cast<uint32_t>(textureArrays.size() + r), 0, glm::vec2(1.0f) };
+			}
+		}
+
+		// Cheapest variant of each prop: no emission without an emission texture
+		// or with one black in every frame, no specular highlight with a black
+		// specular color
+		for (size_t e = 0; e < size(); e++) {
+			variant[e] = VARIANT_SPOT | VARIANT_LIGHTS;
+			bool emits = false;
+			if (pipelines[pipeline[e]].hasEmission && emission[e] != NO_TEXTURE) {
+				const Flipbook& F = flipbooks[emission[e]];
+				for (uint32_t f = 0; f < F.frames; f++) emits |= !blackTexture[F.first + f];
+			}
+			if (emits) {
+				variant[e] |= VARIANT_EMISSION;
+			}
+			if (sColor[e] != glm::vec3(0.0f)) {
+				variant[e] |= VARIANT_SPECULAR;
+			}
+		}
+		orderDirty = true;
+	}
+
+	uint32_t addEntity(uint32_t meshId, uint32_t texId, uint32_t emitId, uint32_t pipelineId,
+		glm::vec3 pos, glm::quat rot = glm::quat(1, 0, 0, 0), glm::vec3 scl = glm::vec3(1),
+		float a = 1.0f, float g = 180.0f, glm::vec3 sc = glm::vec3(0.0f), uint32_t par = NO_PARENT) {
+		if (par != NO_PARENT && par >= size()) {
+			throw std::runtime_error("scene parent must be added before its children!");
+		}
+		if (texId != NO_TEXTURE && emitId != NO_TEXTURE) {
+			const Flipbook& T = flipbooks[texId];
+			const Flipbook& M = flipbooks[emitId];
+			if (T.frames > 1 && M.frames > 1 && (T.frames != M.frames || T.fps != M.fps)) {
+				throw std::runtime_error("texture and emission flipbooks of a prop must match!");
+			}
+		}
+		parent.push_back(par);
+		position.push_back(pos);
+		rotation.push_back(rot);
+		scale.push_back(scl);
+		dirty.push_back(1);
+		worldChanged.push_back(0);
+		local.push_back(glm::mat4(1));
+		world.push_back(glm::mat4(1));
+		normal.push_back(glm::mat4(1));
+		worldScale.push_back(1.0f);
+		worldBounds.push_back(glm::vec4(0));
+		amb.push_back(a);
+		gamma.push_back(g);
+		sColor.push_back(sc);
+		mesh.push_back(meshId);
+		texture.push_back(texId);
+		emission.push_back(emitId);
+		pipeline.push_back(pipelineId);
+		variant.push_back(VARIANT_ALL);
+		visible.push_back(1);
+		ubo.push_back({});
+		sets.emplace_back();
+		frameSets.emplace_back();
+		orderDirty = true;
+		return static_cast<uint32_t>(position.size() - 1);
+	}
+
+	// Transform only node, used as a pivot for its children
+	uint32_t addNode(glm::vec3 pos, glm::quat rot = glm::quat(1, 0, 0, 0),
+		glm::vec3 scl = glm::vec3(1), uint32_t par = NO_PARENT) {
+		uint32_t e = addEntity(NO_MESH, NO_TEXTURE, NO_TEXTURE, 0, pos, rot, scl,
+			0.0f, 0.0f, glm::vec3(0.0f), par);
+		visible[e] = 0;
+		return e;
+	}
+
+	void setPosition(uint32_t e, glm::vec3 p) {
+		position[e] = p;
+		dirty[e] = 1;
+	}
+
+	void setRotation(uint32_t e, glm::quat q) {
+		rotation[e] = q;
+		dirty[e] = 1;
+	}
+
+	void setScale(uint32_t e, glm::vec3 s) {
+		scale[e] = s;
+		dirty[e] = 1;
+	}
+
+	// Draws the pipelines that have a bindless version through L, which must have
+	// the storage buffer at binding 0 and the texture array at binding 1
+	bool enableBindless(DescriptorSetLayout* L) {
+		if (!BP->bindlessSupported) return false;
+		if (textureFiles.size() > BP->maxBindlessTextures) {
+			std::cout << "Bindless textures: " << textureFiles.size() << " textures, more than "
+				<< BP->maxBindlessTextures << ", using per entity sets\n";
+			return false;
+		}
+		bindless = true;
+		bindlessDSL = L;
+		return true;
+	}
+
+	bool isBindless(uint32_t e) const {
+		return bindless && pipelines[pipeline[e]].bindlessP != nullptr;
+	}
+
+	// Flipbook of prop e: that of its texture, or else that of its emission
+	const Flipbook& flipbookOf(uint32_t e) const {
+		const Flipbook& F = flipbooks[texture[e]];
+		return F.frames > 1 || emission[e] == NO_TEXTURE ? F : flipbooks[emission[e]];
+	}
+
+	// Frame of its flipbooks that prop e shows at "time"
+	uint32_t frameOf(uint32_t e) const {
+		const Flipbook& F = flipbookOf(e);
+		return F.frames > 1 ? static_cast<uint32_t>(time * F.fps) % F.frames : 0;
+	}
+
+	// Texture id of frame f of the flipbook starting at t (t itself if still)
+	uint32_t frameTexture(uint32_t t, uint32_t f) const {
+		const Flipbook& F = flipbooks[t];
+		return F.first + f % F.frames;
+	}
+
+	// Seconds from "time" to the next frame of a visible flipbook, FLT_MAX if none
+	float nextFlipbookFrame() const {
+		float next = FLT_MAX;
+		for (size_t e = 0; e < size(); e++) {
+			if (mesh[e] == NO_MESH || !visible[e]) continue;
+			const Flipbook& F = flipbookOf(static_cast<uint32_t>(e));
+			if (F.frames < 2) continue;
+			next = std::min(next, (std::floor(time * F.fps) + 1.0f) / F.fps - time);
+		}
+		return next;
+	}
+
+	// Per entity set of prop e for the frame it shows now
+	DescriptorSet& currentSet(uint32_t e) {
+		const uint32_t f = frameOf(e);
+		return f == 0 ? sets[e] : frameSets[e][f - 1];
+	}
+
+	// Descriptor sets depend on the swap chain, so they follow pipelinesAndDescriptorSetsInit()
+	void initDescriptorSets() {
+		for (size_t e = 0; e < size(); e++) {
+			if (mesh[e] != NO_MESH && !isBindless(e)) initEntitySet(e);
+		}
+		if (bindless) initBindlessSet();
+	}
+
+	void cleanupDescriptorSets() {
+		for (size_t e = 0; e < size(); e++) {
+			if (mesh[e] == NO_MESH || isBindless(e)) continue;
+			sets[e].cleanup();
+			for (DescriptorSet& S : frameSets[e]) S.cleanup();
+		}
+		if (bindless) bindlessSet.cleanup();
+	}
+
+	void cleanup() {
+		for (auto& M : meshes) M.cleanup();
+		for (auto& T : textures) T.cleanup();
+		for (auto& T : textureArrays) T.cleanup();
+	}
+
+	// Recomputes the cached matrices of the entities whose local transform,
+	// or the transform of one of their ancestors, changed since the last call
+	void updateTransforms() {
+		PROFILE_FUNCTION();
+		const size_t n = size();
+		stats = {};
+		generalNormals.clear();
+		for (size_t e = 0; e < n; e++) {
+			const uint32_t p = parent[e];
+			const bool parentChanged = p != NO_PARENT && worldChanged[p];
+			worldChanged[e] = dirty[e] || parentChanged;
+			if (!worldChanged[e]) continue;
+
+			const glm::vec3& s = scale[e];
+			if (dirty[e]) {
+				local[e] = glm::translate(glm::mat4(1), position[e]) *
+					glm::mat4_cast(rotation[e]) *
+					glm::scale(glm::mat4(1), s);
+				dirty[e] = 0;
+				stats.local++;
+			}
+
+			// Uniform world scale survives only if every node along the chain has one
+			const float ownScale = (s.x == s.y && s.y == s.z) ? s.x : 0.0f;
+			if (p == NO_PARENT) {
+				world[e] = local[e];
+				worldScale[e] = ownScale;
+			}
+			else {
+				world[e] = world[p] * local[e];
+				worldScale[e] = worldScale[p] * ownScale;
+			}
+			stats.world++;
+
+			// Rotation times uniform scale k: inverse transpose is the matrix itself over k^2
+			const glm::mat3 M(world[e]);
+			const float k = worldScale[e];
+			if (k != 0.0f) {
+				normal[e] = glm::mat4(k == 1.0f ? M : M * (1.0f / (k * k)));
+				stats.normalFast++;
+			}
+			else {
+				generalNormals.push_back(static_cast<uint32_t>(e));
+			}
+			stats.normal++;
+
+			if (mesh[e] != NO_MESH) {
+				const glm::vec4& b = meshBounds[mesh[e]];
+				const float r = std::max(glm::length(M[0]), std::max(glm::length(M[1]), glm::length(M[2])));
+				worldBounds[e] = glm::vec4(glm::vec3(world[e] * glm::vec4(glm::vec3(b), 1.0f)), b.w * r);
+			}
+		}
+
+		// Non uniform scales need the full inverse transpose: done in one batch
+		const size_t m = generalNormals.size();
+		if (m > 0) {
+			normalScratch.resize(m);
+			for (size_t i = 0; i < m; i++) normalScratch[i] = world[generalNormals[i]];
+			batchInverseTranspose3(normalScratch.data(), normalScratch.data(), m);
+			for (size_t i = 0; i < m; i++) normal[generalNormals[i]] = normalScratch[i];
+		}
+	}
+
+	// Frustum planes (Gribb-Hartmann), Vulkan clip space with z in [0, 1]
+	static void frustumPlanes(const glm::mat4& ViewPrj, glm::vec4 planes[6]) {
+		glm::vec4 rows[4];
+		for (int i = 0; i < 4; i++) {
+			rows[i] = glm::vec4(ViewPrj[0][i], ViewPrj[1][i], ViewPrj[2][i], ViewPrj[3][i]);
+		}
+		planes[0] = rows[3] + rows[0];
+		planes[1] = rows[3] - rows[0];
+		planes[2] = rows[3] + rows[1];
+		planes[3] = rows[3] - rows[1];
+		planes[4] = rows[2];
+		planes[5] = rows[3] - rows[2];
+		for (int i = 0; i < 6; i++) {
+			planes[i] /= glm::length(glm::vec3(planes[i]));
+		}
+	}
+
+	// Bounding sphere b (center, radius) against the planes of frustumPlanes()
+	static bool sphereInFrustum(const glm::vec4 planes[6], const glm::vec4& b) {
+		for (int i = 0; i < 6; i++) {
+			if (glm::dot(glm::vec3(planes[i]), glm::vec3(b)) + planes[i].w < -b.w) return false;
+		}
+		return true;
+	}
+
+	// Fills drawList with the visible entities intersecting the view frustum
+	void cull(const glm::mat4& ViewPrj) {
+		PROFILE_FUNCTION();
+		if (orderDirty) sortEntities();
+
+		glm::vec4 planes[6];
+		frustumPlanes(ViewPrj, planes);
+
+		drawList.clear();
+		for (uint32_t e : order) {
+			if (!visible[e]) continue;
+			if (sphereInFrustum(planes, worldBounds[e])) drawList.push_back(e);
+		}
+	}
+
+	// Fills and maps the uniform block of every entity that will be drawn
+	// Lighting is computed in world space: only the MVP matrix depends on the camera
+	void updateUniforms(int currentImage, const glm::mat4& ViewPrj) {
+		PROFILE_FUNCTION();
+		mvp.resize(size());
+		batchMVP(ViewPrj, world.data(), mvp.data(), size());
+		MeshUniformBlock* table = bindless ?
+			(MeshUniformBlock*)bindlessSet.persistentMap(currentImage, 0) : nullptr;
+		for (uint32_t e : drawList) {
+			MeshUniformBlock& U = ubo[e];
+			U.amb = amb[e];
+			U.gamma = gamma[e];
+			U.sColor = sColor[e];
+			U.mvpMat = mvp[e];
+			U.mMat = world[e];
+			U.nMat = normal[e];
+			if (isBindless(e)) {
+				table[e] = U;
+			}
+			else {
+				currentSet(e).map(currentImage, &U, sizeof(MeshUniformBlock), 0);
+			}
+		}
+	}
+
+	// Emits the draw calls of drawList, switching pipeline, variant and mesh only
+	// when needed. onlyPipeline restricts the draws to the props of one pipeline.
+	// Bindless draws only push the entity and texture indices. gbuffer draws
+	// with the G-buffer pipelines (see setDeferred()).
+	void draw(VkCommandBuffer commandBuffer, int currentImage, uint32_t onlyPipeline = UINT32_MAX,
+		bool gbuffer = false) {
+		uint32_t curPipeline = UINT32_MAX, curVariant = UINT32_MAX, curMesh = UINT32_MAX;
+		Pipeline* P = nullptr;
+		bool curBindless = false;
+		for (uint32_t e : drawList) {
+			if (onlyPipeline != UINT32_MAX && pipeline[e] != onlyPipeline) continue;
+			if (pipeline[e] != curPipeline) {
+				curPipeline = pipeline[e];
+				curVariant = variant[e] & frameVariant;
+				curBindless = isBindless(e);
+				const ScenePipeline& SP = pipelines[curPipeline];
+				P = gbuffer ? (curBindless ? SP.gbufferBindlessP : SP.gbufferP) :
+					(curBindless ? SP.bindlessP : SP.P);
+				P->bind(commandBuffer, curVariant);
+				for (uint32_t s = 0; s < globalSets.size(); s++) {
+					globalSets[s]->bind(commandBuffer, *P, s, currentImage);
+				}
+				if (curBindless) {
+					bindlessSet.bind(commandBuffer, *P, entitySet, currentImage);
+				}
+				curMesh = UINT32_MAX;
+			}
+			else if ((variant[e] & frameVariant) != curVariant) {
+				// Same layout: the bound sets stay valid
+				curVariant = variant[e] & frameVariant;
+				P->bind(commandBuffer, curVariant);
+			}
+			if (mesh[e] != curMesh) {
+				curMesh = mesh[e];
+				meshes[curMesh].bind(commandBuffer);
+			}
+			if (curBindless) {
+				const uint32_t f = frameOf(e);
+				const TextureSlot& T = textureSlots[frameTexture(texture[e], f)];
+				const TextureSlot& M = textureSlots[frameTexture(emission[e] != NO_TEXTURE ? emission[e] : texture[e], f)];
+				const BindlessDraw D = { e, T.image, M.image, T.layer, M.layer, 0, T.scale, M.scale };
+				vkCmdPushConstants(commandBuffer, P->pipelineLayout, P->pushConstantStages,
+					0, sizeof(BindlessDraw), &D);
+			}
+			else {
+				currentSet(e).bind(commandBuffer, *P, entitySet, currentImage);
+			}
+			BP->drawIndexed(commandBuffer, static_cast<uint32_t>(meshes[curMesh].indices.size()));
+		}
+	}
+
+	// Depth pre-pass: the props of drawList with P, a pipeline reading only the
+	// position stream, with set 0 of the global sets and the world matrix as
+	// push constant
+	void drawPositions(VkCommandBuffer commandBuffer, int currentImage, Pipeline& P) {
+		uint32_t curMesh = UINT32_MAX;
+		P.bind(commandBuffer);
+		globalSets[0]->bind(commandBuffer, P, 0, currentImage);
+		for (uint32_t e : drawList) {
+			if (mesh[e] != curMesh) {
+				curMesh = mesh[e];
+				meshes[curMesh].bindPositions(commandBuffer);
+			}
+			vkCmdPushConstants(commandBuffer, P.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+				0, sizeof(glm::mat4), &world[e]);
+			BP->drawIndexed(commandBuffer, static_cast<uint32_t>(meshes[curMesh].indices.size()));
+		}
+	}
+
+private:
+	uint32_t registerMesh() {
+		const auto& V = meshes.back().vertices;
+		glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+		for (const auto& v : V) {
+			lo = glm::min(lo, v.pos);
+			hi = glm::max(hi, v.pos);
+		}
+		glm::vec3 c = V.empty() ? glm::vec3(0) : (lo + hi) * 0.5f;
+		float r = 0.0f;
+		for (const auto& v : V) {
+			r = std::max(r, glm::length(v.pos - c));
+		}
+		meshBounds.push_back(glm::vec4(c, r));
+		return static_cast<uint32_t>(meshes.size() - 1);
+	}
+
+	Texture* plainTexture(uint32_t t) {
+		for (const RenderTexture& R : renderTextures) {
+			if (R.id == t) return R.plain;
+		}
+		return &textures[textureImages[t]];
+	}
+
+	// One set per flipbook frame: sets[e] for the first, frameSets[e] for the others
+	void initEntitySet(size_t e) {
+		const uint32_t frames = flipbookOf(static_cast<uint32_t>(e)).frames;
+		frameSets[e].resize(frames - 1);
+		for (uint32_t f = 0; f < frames; f++) {
+			initFrameSet(e, f, f == 0 ? sets[e] : frameSets[e][f - 1]);
+		}
+	}
+
+	void initFrameSet(size_t e, uint32_t f, DescriptorSet& S) {
+		const ScenePipeline& SP = pipelines[pipeline[e]];
+		Texture* T = plainTexture(frameTexture(texture[e], f));
+		std::vector<DescriptorSetElement> E = {
+			{0, UNIFORM, sizeof(MeshUniformBlock), nullptr},
+			{1, TEXTURE, 0, T}
+		};
+		if (SP.hasEmission) {
+			E.push_back({ 2, TEXTURE, 0, plainTexture(frameTexture(emission[e], f)) });
+		}
+		else if (SP.DSL->bindings.size() > 2) {
+			// The variant without emission never reads it, but it must be valid
+			E.push_back({ 2, TEXTURE, 0, T });
+		}
+		S.init(BP, SP.DSL, E);
+	}
+
+	// The storage buffer has one element per entity, indexed by entity id; the
+	// texture array is written once, textures never change after localInit()
+	// (rendered ones change their contents, not their views)
+	void initBindlessSet() {
+		const size_t packed = textureArrays.size();
+		const uint32_t n = static_cast<uint32_t>(packed + renderTextures.size());
+		bindlessSet.init(BP, bindlessDSL, {
+			{0, STORAGE, static_cast<int>(std::max<size_t>(size(), 1) * sizeof(MeshUniformBlock)), nullptr}
+			}, n);
+
+		std::vector<VkDescriptorImageInfo> imageInfo(n);
+		for (uint32_t t = 0; t < n; t++) {
+			const Texture& T = t < packed ? textureArrays[t] : *renderTextures[t - packed].array;
+			imageInfo[t].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			imageInfo[t].imageView = T.textureImageView;
+			imageInfo[t].sampler = T.textureSampler;
+		}
+		std::vector<VkWriteDescriptorSet> writes(bindlessSet.descriptorSets.size());
+		for (size_t i = 0; i < writes.size(); i++) {
+			writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[i].dstSet = bindlessSet.descriptorSets[i];
+			writes[i].dstBinding = 1;
+			writes[i].dstArrayElement = 0;
+			writes[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			writes[i].descriptorCount = n;
+			writes[i].pImageInfo = imageInfo.data();
+		}
+		if (n > 0) {
+			vkUpdateDescriptorSets(BP->device, static_cast<uint32_t>(writes.size()),
+				writes.data(), 0, nullptr);
+		}
+	}
+
+	// Textures up to packMaxSize are padded to the next power of two and grouped
+	// by that size into one array texture each. The textures repeat, and the
+	// shader wraps their UVs inside the layer: the padding continues each one
+	// periodically, its first texels after the last column (row) and its last
+	// texels before the first, so filtering across the seam sees the same
+	// neighbours as with a repeating sampler, not a clamped edge. A single
+	// texel of padding cannot be both, so those sizes take the power after.
+	// The frames of a flipbook follow its first one, whatever their size.
+	void packTextures(const std::vector<uint8_t>& used) {
+		struct Group {
+			int w, h;
+			bool shared;
+			std::vector<uint32_t> members;
+		};
+		struct Image {
+			stbi_uc* pixels = nullptr;
+			int w = 0, h = 0;
+		};
+		auto pow2 = [](int v) { int p = 1; while (p < v) p <<= 1; return p; };
+		auto padded = [&](int v) { const int p = pow2(v); return p - v == 1 ? p * 2 : p; };
+		// Texel of a size wide texture at x of its padded row (or column)
+		auto wrap = [](int x, int size, int padded) {
+			if (x < size) return x;
+			return x - size < (padded - size + 1) / 2 ? (x - size) % size : size - 1 - (padded - 1 - x) % size;
+		};
+
+		const size_t n = textureFiles.size();
+		std::vector<Image> images(n);
+		std::vector<Group> groups;
+		textureSlots.assign(n, { 0, 0, glm::vec2(1.0f) });
+		for (uint32_t t = 0; t < n; t++) {
+			if (!used[t]) continue;
+			Image& I = images[t];
+			int channels;
+			I.pixels = stbi_load(textureFiles[t].c_str(), &I.w, &I.h, &channels, STBI_rgb_alpha);
+			if (!I.pixels) {
+				std::cout << "Not found: " << textureFiles[t] << "\n";
+				throw std::runtime_error("failed to load texture image!");
+			}
+			bool black = true;
+			for (size_t p = 0; p < (size_t)I.w * I.h * 4 && black; p += 4) {
+				black = (I.pixels[p] | I.pixels[p + 1] | I.pixels[p + 2]) == 0;
+			}
+			blackTexture[t] = black;
+
+			const bool small = std::max(I.w, I.h) <= static_cast<int>(packMaxSize);
+			const int w = small ? padded(I.w) : I.w;
+			const int h = small ? padded(I.h) : I.h;
+			const Flipbook& F = flipbooks[t];
+			auto g = t != F.first ? groups.begin() + textureSlots[F.first].image :
+				std::find_if(groups.begin(), groups.end(),
+					[&](const Group& G) { return G.shared && G.w == w && G.h == h; });
+			if (t != F.first && (g->w != w || g->h != h)) {
+				std::cout << "Flipbook frame size differs: " << textureFiles[t] << "\n";
+				throw std::runtime_error("flipbook frames must have the same size!");
+			}
+			if (g == groups.end()) {
+				groups.push_back({ w, h, small, {} });
+				g = groups.end() - 1;
+			}
+			textureSlots[t] = { static_cast<uint32_t>(g - groups.begin()),
+				static_cast<uint32_t>(g->members.size()),
+				glm::vec2((float)I.w / w, (float)I.h / h) };
+			g->members.push_back(t);
+		}
+
+		size_t loaded = 0;
+		for (const Group& G : groups) {
+			std::vector<std::vector<stbi_uc>> layerData(G.members.size());
+			std::vector<const stbi_uc*> layers(G.members.size());
+			for (size_t l = 0; l < G.members.size(); l++) {
+				const Image& I = images[G.members[l]];
+				if (I.w == G.w && I.h == G.h) {
+					layers[l] = I.pixels;
+					continue;
+				}
+				std::vector<stbi_uc>& P = layerData[l];
+				P.resize((size_t)G.w * G.h * 4);
+				for (int y = 0; y < G.h; y++) {
+					const stbi_uc* src = I.pixels + (size_t)wrap(y, I.h, G.h) * I.w * 4;
+					stbi_uc* dst = P.data() + (size_t)y * G.w * 4;
+					memcpy(dst, src, (size_t)I.w * 4);
+					for (int x = I.w; x < G.w; x++) {
+						memcpy(dst + x * 4, src + wrap(x, I.w, G.w) * 4, 4);
+					}
+				}
+				layers[l] = P.data();
+			}
+			textureArrays.emplace_back();
+			textureArrays.back().initArray(BP, layers, G.w, G.h);
+			loaded += G.members.size();
+		}
+		for (Image& I : images) {
+			if (I.pixels) stbi_image_free(I.pixels);
+		}
+		std::cout << "Texture packing: " << loaded << " textures in " << textureArrays.size()
+			<< " array textures\n";
+	}
+
+	void sortEntities() {
+		order.resize(size());
+		std::iota(order.begin(), order.end(), 0u);
+		std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+			if (pipeline[a] != pipeline[b]) return pipeline[a] < pipeline[b];
+			if (variant[a] != variant[b]) return variant[a] < variant[b];
+			return mesh[a] < mesh[b];
+		});
+		orderDirty = false;
+	}
+};
@@ -0,0 +1,384 @@
+#pragma once
+// Secondary view: the scene seen from another camera, rendered into a texture
+// that props sample like any other (e.g. a monitor's emission map). It has a
+// resolution and an update rate of its own, culls against its own frustum, and
+// is rendered again only when something it shows changed and the surface
+// showing it is on screen. Props are shaded cheaply: albedo, one directional
+// light and the ambient; no shadows, emission or clustered lights.
+//
+// The image is laid out like the atlas of the surface's texture: the view fills
+// the pixel rectangle "screen" of an atlas of atlasSize pixels, scaled so that
+// it is "width" pixels across, and the rest of the image is black.
+//
+// Needs shaders/SecondaryViewVert.spv and shaders/SecondaryViewFrag.spv (glslc
+// shaders/SecondaryView.vert, shaders/SecondaryView.frag), and in bindless mode
+// shaders/SecondaryViewBindlessFrag.spv (the same with -DBINDLESS); without them
+// the view is not available and the surface keeps its own texture.
+
+// Push constants of one prop
+struct SecondaryViewDraw {
+	glm::mat4 mvp;		// view-projection of the view times the world matrix
+	glm::vec4 light;	// xyz: direction to the light in object space, w: ambient
+	uint32_t image;		// bindless: array texture and layer of the albedo
+	uint32_t layer;
+	glm::vec2 scale;
+};
+
+class SecondaryView {
+public:
+	Texture target;			// 2D view, for the per entity sets
+	Texture targetArray;	// one layer 2D_ARRAY view of the same image, for the bindless table
+	uint32_t texture = NO_TEXTURE;	// scene texture id of the view
+	bool available = false;
+
+	// Towards the light, world space; changing them renders the view again
+	glm::vec3 lightDir = glm::normalize(glm::vec3(1.0f));
+	float ambient = 0.35f;
+
+	// Frames seen by update(), renders, and props drawn by the renders
+	struct {
+		uint64_t frames;
+		uint64_t renders;
+		uint64_t draws;
+	} stats = {};
+
+	// Registers the view as a scene texture; entityDSL is the layout of the per
+	// entity sets (binding 1: albedo) of the props drawn without bindless.
+	// Call after Scene::enableBindless() and before Scene::loadTextures().
+	void init(BaseProject* bp, Scene* scene, VertexDescriptor* vd, DescriptorSetLayout* entityDSL,
+		glm::uvec2 atlasSize, glm::uvec4 screen, uint32_t width, uint32_t updateRate) {
+		BP = bp;
+		S = scene;
+		DSL = entityDSL;
+		rate = std::max(1u, updateRate);
+		sinceRender = rate;		// the first render is due at once
+		available = std::ifstream("shaders/SecondaryViewVert.spv").good() &&
+			std::ifstream("shaders/SecondaryViewFrag.spv").good() &&
+			(!S->bindless || std::ifstream("shaders/SecondaryViewBindlessFrag.spv").good());
+		if (!available) {
+			std::cout << "Secondary view disabled, its surface keeps its own textures: compile shaders/SecondaryView.vert "
+				"and shaders/SecondaryView.frag (also with -DBINDLESS) with glslc\n";
+			return;
+		}
+
+		const float k = (float)std::max(16u, width) / screen.z;
+		extent = { (uint32_t)std::ceil(atlasSize.x * k), (uint32_t)std::ceil(atlasSize.y * k) };
+		viewport = { (int32_t)(screen.x * k), (int32_t)(screen.y * k) };
+		viewportSize = { std::max(1u, (uint32_t)(screen.z * k)), std::max(1u, (uint32_t)(screen.w * k)) };
+		viewportSize.width = std::min(viewportSize.width, extent.width - viewport.x);
+		viewportSize.height = std::min(viewportSize.height, extent.height - viewport.y);
+
+		createRenderPass();
+		createImages();
+		P.init(BP, vd, "shaders/SecondaryViewVert.spv", "shaders/SecondaryViewFrag.spv", { DSL });
+		P.setRenderPass(renderPass, VK_SAMPLE_COUNT_1_BIT, 1);
+		P.setPushConstants(VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+			sizeof(SecondaryViewDraw));
+		if (S->bindless) {
+			PBindless.init(BP, vd, "shaders/SecondaryViewVert.spv", "shaders/SecondaryViewBindlessFrag.spv",
+				{ S->bindlessDSL });
+			PBindless.setRenderPass(renderPass, VK_SAMPLE_COUNT_1_BIT, 1);
+			PBindless.setPushConstants(VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+				sizeof(SecondaryViewDraw));
+		}
+		texture = S->addRenderTexture(&target, &targetArray);
+	}
+
+	// Camera of the view, vertical field of view in radians
+	void setCamera(glm::vec3 pos, glm::vec3 at, float fovY, float zNear = 0.1f, float zFar = 30.0f) {
+		glm::mat4 Prj = glm::perspective(fovY, (float)viewportSize.width / viewportSize.height, zNear, zFar);
+		Prj[1][1] *= -1;
+		viewPrj = Prj * glm::lookAt(pos, at, glm::vec3(0, 1, 0));
+		stale = true;
+	}
+
+	// The view is rendered only while prop e (the one showing it) is drawn
+	void setSurface(uint32_t e) {
+		surface = e;
+	}
+
+	void pipelinesAndDescriptorSetsInit() {
+		if (!available) return;
+		P.create();
+		if (S->bindless) PBindless.create();
+	}
+
+	void pipelinesAndDescriptorSetsCleanup() {
+		if (!available) return;
+		P.cleanup();
+		if (S->bindless) PBindless.cleanup();
+	}
+
+	void localCleanup() {
+		if (!available) return;
+		vkDestroyFramebuffer(BP->device, framebuffer, nullptr);
+		vkDestroyImageView(BP->device, targetArray.textureImageView, nullptr);
+		target.cleanup();
+		vkDestroyImageView(BP->device, depthView, nullptr);
+		vkDestroyImage(BP->device, depthImage, nullptr);
+		vkFreeMemory(BP->device, depthMemory, nullptr);
+		vkDestroyRenderPass(BP->device, renderPass, nullptr);
+		P.destroy();
+		if (S->bindless) PBindless.destroy();
+	}
+
+	// Once per frame, after Scene::cull(): decides whether the next recorded
+	// command buffer renders the view. It is stale when a prop moved in (or out
+	// of) its frustum, appeared, disappeared or turned a flipbook page, and it is
+	// rendered at most once every "rate" frames.
+	void update() {
+		stats.frames++;
+		render = false;
+		if (!available) return;
+		// Saturates at the rate, so an off screen surface never wraps it round
+		sinceRender = std::min(sinceRender + 1, rate);
+
+		glm::vec4 planes[6];
+		Scene::frustumPlanes(viewPrj, planes);
+		if (drawn.size() != S->size()) {
+			drawn.assign(S->size(), 0);
+			drawnFrame.assign(S->size(), 0);
+			stale = true;
+		}
+		if (lightDir != drawnLight || ambient != drawnAmbient) stale = true;
+		for (uint32_t e = 0; e < S->size() && !stale; e++) {
+			const bool inView = drawable(e) && Scene::sphereInFrustum(planes, S->worldBounds[e]);
+			stale = inView != (drawn[e] != 0) ||
+				(drawn[e] && (S->worldChanged[e] || S->frameOf(e) != drawnFrame[e]));
+		}
+
+		shown = surface == UINT32_MAX ||
+			std::find(S->drawList.begin(), S->drawList.end(), surface) != S->drawList.end();
+		if (!stale || !shown || sinceRender < rate) return;
+
+		// Culled draw list, in the scene's order (pipeline, mesh)
+		drawList.clear();
+		for (uint32_t e : S->order) {
+			drawn[e] = drawable(e) && Scene::sphereInFrustum(planes, S->worldBounds[e]);
+			drawnFrame[e] = drawn[e] ? S->frameOf(e) : 0;
+			if (drawn[e]) drawList.push_back(e);
+		}
+		drawnLight = lightDir;
+		drawnAmbient = ambient;
+		render = true;
+		stale = false;
+		sinceRender = 0;
+		stats.renders++;
+		stats.draws += drawList.size();
+		PROFILE_COUNTER("Secondary view props", drawList.size());
+	}
+
+	bool rendersThisFrame() const {
+		return render;
+	}
+
+	// Changes waiting for a render while the surface is on screen, for render on demand
+	bool pending() const {
+		return available && stale && shown;
+	}
+
+	// Before the main render pass. As for ShadowMap, queue order and the
+	// external dependencies keep the render after the reads of the frames before.
+	void record(VkCommandBuffer commandBuffer, int currentImage) {
+		if (!render) return;
+		std::array<VkClearValue, 2> clear{};
+		clear[0].color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
+		clear[1].depthStencil = { 1.0f, 0 };
+		VkRenderPassBeginInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = renderPass;
+		renderPassInfo.framebuffer = framebuffer;
+		renderPassInfo.renderArea.extent = extent;
+		renderPassInfo.clearValueCount = static_cast<uint32_t>(clear.size());
+		renderPassInfo.pClearValues = clear.data();
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+		VkViewport vp{};
+		vp.x = (float)viewport.x;
+		vp.y = (float)viewport.y;
+		vp.width = (float)viewportSize.width;
+		vp.height = (float)viewportSize.height;
+		vp.maxDepth = 1.0f;
+		vkCmdSetViewport(commandBuffer, 0, 1, &vp);
+		VkRect2D scissor{ viewport, viewportSize };
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+		Pipeline* curP = nullptr;
+		uint32_t curMesh = NO_MESH;
+		for (uint32_t e : drawList) {
+			const bool bindless = S->isBindless(e);
+			Pipeline* PE = bindless ? &PBindless : &P;
+			if (PE != curP) {
+				curP = PE;
+				curP->bind(commandBuffer);
+				if (bindless) S->bindlessSet.bind(commandBuffer, *curP, 0, currentImage);
+			}
+			if (S->mesh[e] != curMesh) {
+				curMesh = S->mesh[e];
+				S->meshes[curMesh].bind(commandBuffer);
+			}
+			SecondaryViewDraw D{};
+			D.mvp = viewPrj * S->world[e];
+			// dot(nMat n, l) = dot(n, transpose(nMat) l): exact up to the scale
+			D.light = glm::vec4(glm::normalize(glm::transpose(glm::mat3(S->normal[e])) * lightDir), ambient);
+			if (bindless) {
+				const TextureSlot& T = S->textureSlots[S->frameTexture(S->texture[e], S->frameOf(e))];
+				D.image = T.image;
+				D.layer = T.layer;
+				D.scale = T.scale;
+			}
+			else {
+				S->currentSet(e).bind(commandBuffer, *curP, 0, currentImage);
+			}
+			vkCmdPushConstants(commandBuffer, curP->pipelineLayout, curP->pushConstantStages,
+				0, sizeof(SecondaryViewDraw), &D);
+			BP->drawIndexed(commandBuffer, static_cast<uint32_t>(S->meshes[curMesh].indices.size()));
+		}
+
+		vkCmdEndRenderPass(commandBuffer);
+	}
+
+private:
+	BaseProject* BP;
+	Scene* S;
+	DescriptorSetLayout* DSL;
+	uint32_t rate = 1;
+	VkExtent2D extent;
+	VkOffset2D viewport;
+	VkExtent2D viewportSize;
+	VkRenderPass renderPass;
+	VkFramebuffer framebuffer;
+	VkImage depthImage;
+	VkDeviceMemory depthMemory;
+	VkImageView depthView;
+	Pipeline P, PBindless;
+	const VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;	// as the texture files
+	const VkFormat depthFormat = VK_FORMAT_D32_SFLOAT;
+
+	glm::mat4 viewPrj = glm::mat4(1.0f);
+	uint32_t surface = UINT32_MAX;		// none: always shown
+	std::vector<uint32_t> drawList;
+	std::vector<uint8_t> drawn;			// by entity, drawn by the last render
+	std::vector<uint32_t> drawnFrame;	// by entity, its flipbook frame then
+	glm::vec3 drawnLight = glm::vec3(0.0f);
+	float drawnAmbient = -1.0f;
+	uint32_t sinceRender = 1;
+	bool stale = true;
+	bool shown = false;
+	bool render = false;
+
+	// Props with a per entity set of layout DSL, or drawn bindless; not the
+	// surface, which would sample the image being rendered
+	bool drawable(uint32_t e) const {
+		return S->mesh[e] != NO_MESH && S->visible[e] && e != surface &&
+			(S->isBindless(e) || S->pipelines[S->pipeline[e]].DSL == DSL);
+	}
+
+	// Color and depth, the color left ready for sampling
+	void createRenderPass() {
+		std::array<VkAttachmentDescription, 2> attachments{};
+		attachments[0].format = format;
+		attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+		attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attachments[0].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		attachments[1].format = depthFormat;
+		attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+		attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+		VkAttachmentReference colorRef{ 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+		VkAttachmentReference depthRef{ 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+		VkSubpassDescription subpass{};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = 1;
+		subpass.pColorAttachments = &colorRef;
+		subpass.pDepthStencilAttachment = &depthRef;
+
+		// After the shaders of earlier frames have read the old view and the
+		// last render has written its depth; before the shaders of this frame
+		// read the new one
+		std::array<VkSubpassDependency, 2> dependencies{};
+		dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[0].dstSubpass = 0;
+		dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+			VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+			VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+		dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependencies[1].srcSubpass = 0;
+		dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+		VkRenderPassCreateInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+		renderPassInfo.pAttachments = attachments.data();
+		renderPassInfo.subpassCount = 1;
+		renderPassInfo.pSubpasses = &subpass;
+		renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+		renderPassInfo.pDependencies = dependencies.data();
+
+		VkResult result = vkCreateRenderPass(BP->device, &renderPassInfo, nullptr, &renderPass);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to create secondary view render pass!");
+		}
+	}
+
+	void createImages() {
+		target.BP = BP;
+		target.mipLevels = 1;
+		BP->createImage(extent.width, extent.height, 1, 1, VK_SAMPLE_COUNT_1_BIT, format,
+			VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, 0,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			target.textureImage, target.textureImageMemory);
+		target.textureImageView = BP->createImageView(target.textureImage, format,
+			VK_IMAGE_ASPECT_COLOR_BIT, 1, VK_IMAGE_VIEW_TYPE_2D, 1);
+		target.imgs = 1;
+		target.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		target.black = false;
+		target.createTextureSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR,
+			VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+			VK_SAMPLER_MIPMAP_MODE_NEAREST, VK_FALSE, 1.0f, 0.0f);
+
+		targetArray = target;
+		targetArray.textureImageView = BP->createImageView(target.textureImage, format,
+			VK_IMAGE_ASPECT_COLOR_BIT, 1, VK_IMAGE_VIEW_TYPE_2D_ARRAY, 1);
+		targetArray.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+
+		BP->createImage(extent.width, extent.height, 1, 1, VK_SAMPLE_COUNT_1_BIT, depthFormat,
+			VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, 0,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthMemory);
+		depthView = BP->createImageView(depthImage, depthFormat,
+			VK_IMAGE_ASPECT_DEPTH_BIT, 1, VK_IMAGE_VIEW_TYPE_2D, 1);
+
+		std::array<VkImageView, 2> views = { target.textureImageView, depthView };
+		VkFramebufferCreateInfo framebufferInfo{};
+		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebufferInfo.renderPass = renderPass;
+		framebufferInfo.attachmentCount = static_cast<uint32_t>(views.size());
+		framebufferInfo.pAttachments = views.data();
+		framebufferInfo.width = extent.width;
+		framebufferInfo.height = extent.height;
+		framebufferInfo.layers = 1;
+		VkResult result = vkCreateFramebuffer(BP->device, &framebufferInfo, nullptr, &framebuffer);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to create secondary view framebuffer!");
+		}
+	}
+};
@@ -0,0 +1,316 @@
+#pragma once
+// Cached shadow map of one light: a depth array texture with two layers, the
+// static casters in layer 0 and the dynamic ones in layer 1. A layer is rendered
+// again only when what it shows changes: both when the light moves or is
+// switched back on, the dynamic one when a dynamic caster moves inside (or out
+// of) the light frustum. Otherwise the maps of earlier frames are sampled as
+// they are. The shaders look up both layers and multiply the results.
+//
+// Needs shaders/ShadowVert.spv and shaders/ShadowFrag.spv (glslc shaders/Shadow.vert,
+// shaders/Shadow.frag); without them the layers are only cleared, i.e. nothing
+// is in shadow.
+
+// Projection of a spot light with outer cone cosine cosOut, for ShadowMap::update()
+inline glm::mat4 spotLightViewPrj(glm::vec3 pos, glm::vec3 dir, float cosOut, float zNear, float zFar) {
+	dir = glm::normalize(dir);
+	const glm::vec3 up = std::abs(dir.y) > 0.99f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+	glm::mat4 Prj = glm::perspective(2.0f * std::acos(glm::clamp(cosOut, 0.0f, 1.0f)) + 0.05f, 1.0f, zNear, zFar);
+	Prj[1][1] *= -1;
+	return Prj * glm::lookAt(pos, pos + dir, up);
+}
+
+class ShadowMap {
+public:
+	static const uint32_t LAYERS = 2;
+	static const uint32_t STATIC_LAYER = 0;
+	static const uint32_t DYNAMIC_LAYER = 1;
+
+	// Sampled with depth compare (sampler2DArrayShadow), in SHADER_READ_ONLY_OPTIMAL
+	Texture map;
+	bool available = false;
+
+	// Frames seen by update(), and how many of them rendered each layer
+	struct {
+		uint64_t frames;
+		uint64_t staticRenders;
+		uint64_t dynamicRenders;
+	} stats = {};
+
+	void init(BaseProject* bp, Scene* scene, VertexDescriptor* vd, uint32_t mapSize) {
+		BP = bp;
+		S = scene;
+		size = mapSize;
+		available = std::ifstream("shaders/ShadowVert.spv").good() &&
+			std::ifstream("shaders/ShadowFrag.spv").good();
+		if (!available) {
+			std::cout << "Shadows disabled: compile shaders/Shadow.vert and shaders/Shadow.frag with glslc\n";
+		}
+		createRenderPass();
+		createMap();
+		if (available) {
+			P.init(BP, vd, "shaders/ShadowVert.spv", "shaders/ShadowFrag.spv", {});
+			P.setRenderPass(renderPass, VK_SAMPLE_COUNT_1_BIT, 0);
+			P.setAdvancedFeatures(VK_COMPARE_OP_LESS, VK_POLYGON_MODE_FILL,
+				VK_CULL_MODE_NONE, false);
+			P.setDepthBias(1.25f, 1.75f);
+			P.setPushConstants(VK_SHADER_STAGE_VERTEX_BIT, sizeof(glm::mat4));
+		}
+		dynamicCaster.assign(S->size(), 0);
+		castsShadow.assign(S->size(), 1);
+	}
+
+	// Casters are static unless marked here; entities inside the light (e.g. the
+	// lamp itself) should not cast at all
+	void setDynamic(uint32_t e) {
+		dynamicCaster[e] = 1;
+		castBounds.push_back(glm::vec4(0.0f));
+		dynamicCasters.push_back(e);
+	}
+	void setNoShadow(uint32_t e) {
+		castsShadow[e] = 0;
+	}
+
+	void pipelinesAndDescriptorSetsInit() {
+		if (available) P.create();
+	}
+
+	void pipelinesAndDescriptorSetsCleanup() {
+		if (available) P.cleanup();
+	}
+
+	void localCleanup() {
+		for (uint32_t l = 0; l < LAYERS; l++) {
+			vkDestroyFramebuffer(BP->device, framebuffers[l], nullptr);
+			vkDestroyImageView(BP->device, layerViews[l], nullptr);
+		}
+		map.cleanup();
+		vkDestroyRenderPass(BP->device, renderPass, nullptr);
+		if (available) P.destroy();
+	}
+
+	// Once per frame, after Scene::updateTransforms(): decides which layers the
+	// next recorded command buffer renders. active: the light is on (off, the
+	// map is not read and nothing is rendered).
+	void update(const glm::mat4& lightViewPrj, bool active) {
+		stats.frames++;
+		renderStatic = renderDynamic = false;
+		const bool switchedOn = active && !wasActive;
+		wasActive = active;
+		if (!active) return;
+
+		glm::vec4 planes[6];
+		Scene::frustumPlanes(lightViewPrj, planes);
+		if (!valid || switchedOn || lightViewPrj != viewPrj) {
+			renderStatic = renderDynamic = true;
+		}
+		else {
+			// A caster counts where it was last drawn and where it is now
+			for (size_t i = 0; i < dynamicCasters.size() && !renderDynamic; i++) {
+				const uint32_t e = dynamicCasters[i];
+				renderDynamic = S->worldChanged[e] && (Scene::sphereInFrustum(planes, S->worldBounds[e]) ||
+					Scene::sphereInFrustum(planes, castBounds[i]));
+			}
+		}
+		viewPrj = lightViewPrj;
+		valid = true;
+
+		if (renderStatic) stats.staticRenders++;
+		if (renderDynamic) {
+			stats.dynamicRenders++;
+			for (size_t i = 0; i < dynamicCasters.size(); i++) {
+				castBounds[i] = S->worldBounds[dynamicCasters[i]];
+			}
+		}
+		PROFILE_COUNTER("Shadow layers rendered", (renderStatic ? 1 : 0) + (renderDynamic ? 1 : 0));
+	}
+
+	bool rendersThisFrame() const {
+		return renderStatic || renderDynamic;
+	}
+
+	// Share of the possible layer renders that the cache saved
+	double skipRate() const {
+		return stats.frames == 0 ? 0.0 :
+			1.0 - (double)(stats.staticRenders + stats.dynamicRenders) / (2.0 * stats.frames);
+	}
+
+	// Before the main render pass. Queue order, with the external dependencies of
+	// the render pass, keeps a re-render after the reads of the frames before.
+	void record(VkCommandBuffer commandBuffer) {
+		if (renderStatic) recordLayer(commandBuffer, STATIC_LAYER);
+		if (renderDynamic) recordLayer(commandBuffer, DYNAMIC_LAYER);
+	}
+
+private:
+	BaseProject* BP;
+	Scene* S;
+	uint32_t size;
+	VkRenderPass renderPass;
+	VkImageView layerViews[LAYERS];
+	VkFramebuffer framebuffers[LAYERS];
+	Pipeline P;
+	const VkFormat format = VK_FORMAT_D32_SFLOAT;
+
+	std::vector<uint8_t> dynamicCaster;		// by entity
+	std::vector<uint8_t> castsShadow;		// by entity
+	std::vector<uint32_t> dynamicCasters;
+	std::vector<glm::vec4> castBounds;		// of dynamicCasters, at the last render
+
+	glm::mat4 viewPrj = glm::mat4(1.0f);
+	bool valid = false;
+	bool wasActive = false;
+	bool renderStatic = false;
+	bool renderDynamic = false;
+
+	void recordLayer(VkCommandBuffer commandBuffer, uint32_t layer) {
+		VkClearValue clear{};
+		clear.depthStencil = { 1.0f, 0 };
+		VkRenderPassBeginInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = renderPass;
+		renderPassInfo.framebuffer = framebuffers[layer];
+		renderPassInfo.renderArea.extent = { size, size };
+		renderPassInfo.clearValueCount = 1;
+		renderPassInfo.pClearValues = &clear;
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+		if (available) {
+			VkViewport viewport{};
+			viewport.width = (float)size;
+			viewport.height = (float)size;
+			viewport.maxDepth = 1.0f;
+			vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+			VkRect2D scissor{};
+			scissor.extent = { size, size };
+			vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+			glm::vec4 planes[6];
+			Scene::frustumPlanes(viewPrj, planes);
+			P.bind(commandBuffer);
+			uint32_t curMesh = NO_MESH;
+			for (uint32_t e : S->order) {
+				if (S->mesh[e] == NO_MESH || !castsShadow[e] || dynamicCaster[e] != layer) continue;
+				if (!Scene::sphereInFrustum(planes, S->worldBounds[e])) continue;
+				if (S->mesh[e] != curMesh) {
+					curMesh = S->mesh[e];
+					S->meshes[curMesh].bind(commandBuffer);
+				}
+				const glm::mat4 mvp = viewPrj * S->world[e];
+				vkCmdPushConstants(commandBuffer, P.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+					0, sizeof(glm::mat4), &mvp);
+				BP->drawIndexed(commandBuffer, static_cast<uint32_t>(S->meshes[curMesh].indices.size()));
+			}
+		}
+
+		vkCmdEndRenderPass(commandBuffer);
+	}
+
+	// Depth only, the result left ready for sampling
+	void createRenderPass() {
+		VkAttachmentDescription depthAttachment{};
+		depthAttachment.format = format;
+		depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		depthAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		VkAttachmentReference depthAttachmentRef{};
+		depthAttachmentRef.attachment = 0;
+		depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+		VkSubpassDescription subpass{};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+		// After the shaders of earlier frames have read the old map; before the
+		// shaders of this frame read the new one
+		std::array<VkSubpassDependency, 2> dependencies{};
+		dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[0].dstSubpass = 0;
+		dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		dependencies[0].srcAccessMask = 0;
+		dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+			VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependencies[1].srcSubpass = 0;
+		dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+		VkRenderPassCreateInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		renderPassInfo.attachmentCount = 1;
+		renderPassInfo.pAttachments = &depthAttachment;
+		renderPassInfo.subpassCount = 1;
+		renderPassInfo.pSubpasses = &subpass;
+		renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+		renderPassInfo.pDependencies = dependencies.data();
+
+		VkResult result = vkCreateRenderPass(BP->device, &renderPassInfo, nullptr, &renderPass);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to create shadow render pass!");
+		}
+	}
+
+	void createMap() {
+		map.BP = BP;
+		BP->createImage(size, size, 1, LAYERS, VK_SAMPLE_COUNT_1_BIT, format,
+			VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, 0,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			map.textureImage, map.textureImageMemory);
+		map.textureImageView = BP->createImageView(map.textureImage, format,
+			VK_IMAGE_ASPECT_DEPTH_BIT, 1, VK_IMAGE_VIEW_TYPE_2D_ARRAY, LAYERS);
+		map.imgs = LAYERS;
+		map.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+		map.black = false;
+
+		for (uint32_t l = 0; l < LAYERS; l++) {
+			layerViews[l] = BP->createImageView(map.textureImage, format,
+				VK_IMAGE_ASPECT_DEPTH_BIT, 1, VK_IMAGE_VIEW_TYPE_2D, 1, l);
+
+			VkFramebufferCreateInfo framebufferInfo{};
+			framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			framebufferInfo.renderPass = renderPass;
+			framebufferInfo.attachmentCount = 1;
+			framebufferInfo.pAttachments = &layerViews[l];
+			framebufferInfo.width = size;
+			framebufferInfo.height = size;
+			framebufferInfo.layers = 1;
+			VkResult result = vkCreateFramebuffer(BP->device, &framebufferInfo, nullptr, &framebuffers[l]);
+			if (result != VK_SUCCESS) {
+				PrintVkError(result);
+				throw std::runtime_error("failed to create shadow framebuffer!");
+			}
+		}
+
+		// Hardware PCF where the format can be filtered; outside the map is lit
+		VkFormatProperties properties;
+		vkGetPhysicalDeviceFormatProperties(BP->physicalDevice, format, &properties);
+		const VkFilter filter = (properties.optimalTilingFeatures &
+			VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+		VkSamplerCreateInfo samplerInfo{};
+		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		samplerInfo.magFilter = filter;
+		samplerInfo.minFilter = filter;
+		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+		samplerInfo.compareEnable = VK_TRUE;
+		samplerInfo.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		VkResult result = vkCreateSampler(BP->device, &samplerInfo, nullptr, &map.textureSampler);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to create shadow sampler!");
+		}
+	}
+};
@@ -7,10 +7,22 @@
 #include <cstring>
 #include <optional>
 #include <set>
+#include <deque>
 #include <cstdint>
 #include <algorithm>
 #include <fstream>
 #include <array>
+#include <string>
+#include <cctype>
+#include <sstream>
+#include <iomanip>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <cstdio>
+#include <limits>
+#include <filesystem>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEFAULT_ALIGNED_GENTYPES
@@ -37,8 +49,10 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include "FramePacing.hpp"
+#include "Profiler.hpp"
+#include "Benchmark.hpp"
 
-const int MAX_FRAMES_IN_FLIGHT = 2;
 
 const std::vector<const char*> validationLayers = {
 	"VK_LAYER_KHRONOS_validation"
@@ -136,6 +150,8 @@ void PrintVkError(VkResult result) {
 	std::cout << "Error: " << result << ", " << meaning << "\n";
 }
 
+#include "RenderGraph.hpp"
+
 class BaseProject;
 
 struct VertexBindingDescriptorElement {
@@ -190,6 +206,9 @@ class Model {
 	VkDeviceMemory vertexBufferMemory;
 	VkBuffer indexBuffer;
 	VkDeviceMemory indexBufferMemory;
+	// Positions only (createPositionBuffer()), for depth only passes
+	VkBuffer positionBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory positionBufferMemory;
 	VertexDescriptor* VD;
 
 public:
@@ -199,11 +218,13 @@ public:
 	void loadModelGLTF(std::string file);
 	void createIndexBuffer();
 	void createVertexBuffer();
+	void createPositionBuffer();
 
 	void init(BaseProject* bp, VertexDescriptor* VD, std::string file, ModelType MT);
 	void initMesh(BaseProject* bp, VertexDescriptor* VD);
 	void cleanup();
 	void bind(VkCommandBuffer commandBuffer);
+	void bindPositions(VkCommandBuffer commandBuffer);
 };
 
 struct Texture {
@@ -214,9 +235,12 @@ struct Texture {
 	VkImageView textureImageView;
 	VkSampler textureSampler;
 	int imgs;
+	VkImageViewType viewType;
+	bool black;		// every texel has r = g = b = 0 (e.g. an empty emission map)
 	static const int maxImgs = 6;
 
 	void createTextureImage(const char* const files[], VkFormat Fmt);
+	void createTextureImage(const stbi_uc* const pixels[], int texWidth, int texHeight, VkFormat Fmt);
 	void createTextureImageView(VkFormat Fmt);
 	void createTextureSampler(VkFilter magFilter,
 		VkFilter minFilter,
@@ -230,6 +254,9 @@ struct Texture {
 
 	void init(BaseProject* bp, const char* file, VkFormat Fmt, bool initSampler);
 	void initCubic(BaseProject* bp, const char* files[6]);
+	// 2D array texture, one layer per image (RGBA, all of the same size)
+	void initArray(BaseProject* bp, const std::vector<const stbi_uc*>& layers,
+		int width, int height, VkFormat Fmt);
 	void cleanup();
 };
 
@@ -237,20 +264,44 @@ struct DescriptorSetLayoutBinding {
 	uint32_t binding;
 	VkDescriptorType type;
 	VkShaderStageFlags flags;
+	uint32_t count = 1;		// array size (the maximum with a variable count)
+	VkDescriptorBindingFlags bindingFlags = 0;
 };
 
 
+// One descriptor written through an update template
+union DescriptorData {
+	VkDescriptorBufferInfo buffer;
+	VkDescriptorImageInfo image;
+};
+
 struct DescriptorSetLayout {
 	BaseProject* BP;
 	VkDescriptorSetLayout descriptorSetLayout;
+	std::vector<DescriptorSetLayoutBinding> bindings;
+	// Update templates, by mask of the bindings they write
+	std::vector<std::pair<uint32_t, VkDescriptorUpdateTemplate>> updateTemplates;
 
 	void init(BaseProject* bp, std::vector<DescriptorSetLayoutBinding> B);
 	void cleanup();
+	int bindingIndex(uint32_t binding) const;
+	// Writes the bindings in mask (bit i is bindings[i]) from data[i]
+	void update(VkDescriptorSet set, uint32_t mask, const DescriptorData* data);
+};
+
+// A specialization constant by constant_id; floats are passed by their bits
+struct SpecializationConstant {
+	uint32_t id;
+	uint32_t value;
+
+	SpecializationConstant(uint32_t i, uint32_t v) : id(i), value(v) {}
+	SpecializationConstant(uint32_t i, int v) : id(i), value(static_cast<uint32_t>(v)) {}
+	SpecializationConstant(uint32_t i, float v) : id(i) { memcpy(&value, &v, sizeof(value)); }
 };
 
 struct Pipeline {
 	BaseProject* BP;
-	VkPipeline graphicsPipeline;
+	VkPipeline graphicsPipeline;	// the variant with every bit of variantMask set
 	VkPipelineLayout pipelineLayout;
 
 	VkShaderModule vertShaderModule;
@@ -261,24 +312,57 @@ struct Pipeline {
 	VkPolygonMode polyModel;
 	VkCullModeFlagBits CM;
 	bool transp;
-
-	VertexDescriptor* VD;
+	VkShaderStageFlags pushConstantStages;
+	uint32_t pushConstantSize;
+	// Subpass of the render pass (UINT32_MAX: the forward one), its number of
+	// color attachments, and additive blending (lighting)
+	uint32_t subpass;
+	uint32_t colorAttachments;
+	bool additive;
+	// Render pass and sample count, when not the main ones (VK_NULL_HANDLE)
+	VkRenderPass renderPass;
+	VkSampleCountFlagBits samples;
+	float depthBiasConstant, depthBiasSlope;
+	bool depthWrite, colorWrite;
+	// Drawn in populateOverlays(): the overlay subpass of the post pass when there
+	// is one, else the forward subpass
+	bool overlay;
+
+	// Specialization: the constants shared by every variant, and the bool
+	// constants that tell the variants apart. Bit i of variantMask is constant_id
+	// i; a variant key is a subset of the mask and sets those constants to true.
+	std::vector<SpecializationConstant> constants;
+	uint32_t variantMask;
+	std::vector<VkPipeline> variants;	// by key, VK_NULL_HANDLE where key is not a subset
+
+	VertexDescriptor* VD;	// nullptr: no vertex input
 
 	void init(BaseProject* bp, VertexDescriptor* vd,
 		const std::string& VertShader, const std::string& FragShader,
 		std::vector<DescriptorSetLayout*> D);
 	void setAdvancedFeatures(VkCompareOp _compareOp, VkPolygonMode _polyModel,
 		VkCullModeFlagBits _CM, bool _transp);
+	void setPushConstants(VkShaderStageFlags stages, uint32_t size);
+	void setSubpass(uint32_t subpass, uint32_t colorAttachments = 1, bool additive = false);
+	void setRenderPass(VkRenderPass renderPass, VkSampleCountFlagBits samples, uint32_t colorAttachments);
+	void setDepthBias(float constant, float slope);
+	void setWriteMasks(bool depthWrite, bool colorWrite);
+	void setOverlay();
+	void setConstants(std::vector<SpecializationConstant> C);
+	void setVariants(uint32_t mask);
 	void create();
+	void createLayout();
+	void build(uint32_t key);
 	void destroy();
-	void bind(VkCommandBuffer commandBuffer);
+	// key: the wanted features; bits outside variantMask are ignored
+	void bind(VkCommandBuffer commandBuffer, uint32_t key = UINT32_MAX);
 
 	VkShaderModule createShaderModule(const std::vector<char>& code);
 	static std::vector<char> readFile(const std::string& filename);
 	void cleanup();
 };
 
-enum DescriptorSetElementType { UNIFORM, TEXTURE };
+enum DescriptorSetElementType { UNIFORM, TEXTURE, STORAGE };
 
 struct DescriptorSetElement {
 	int binding;
@@ -293,14 +377,38 @@ struct DescriptorSet {
 	std::vector<std::vector<VkBuffer>> uniformBuffers;
 	std::vector<std::vector<VkDeviceMemory>> uniformBuffersMemory;
 	std::vector<VkDescriptorSet> descriptorSets;
+	std::vector<std::vector<void*>> persistentMaps;
 
 	std::vector<bool> toFree;
 
+	// variableCount: size of the layout's variable count array, if it has one
 	void init(BaseProject* bp, DescriptorSetLayout* L,
-		std::vector<DescriptorSetElement> E);
+		std::vector<DescriptorSetElement> E, uint32_t variableCount = 0);
 	void cleanup();
 	void bind(VkCommandBuffer commandBuffer, Pipeline& P, int setId, int currentImage);
 	void map(int currentImage, void* src, int size, int slot);
+	void* persistentMap(int currentImage, int slot);
+};
+
+// Descriptor sets come from a list of pools: when the current one is full a new
+// pool, twice as large, is added, so the number of sets need not be known in
+// advance. reset() frees every set at once and keeps the pools for reuse.
+struct DescriptorAllocator {
+	VkDevice device = VK_NULL_HANDLE;
+	uint32_t nextPoolSets = 64;
+	std::vector<VkDescriptorPool> usedPools;	// the current one is the last
+	std::vector<VkDescriptorPool> freePools;
+
+	void init(VkDevice dev, uint32_t initialSets);
+	void allocate(VkDescriptorSetLayout layout, uint32_t count, VkDescriptorSet* sets,
+		uint32_t variableCount = 0);
+	void reset();
+	void cleanup();
+
+	static const uint32_t MAX_POOL_SETS = 4096;
+
+private:
+	VkDescriptorPool nextPool(uint32_t extraSamplers);
 };
 
 
@@ -312,16 +420,37 @@ class BaseProject {
 	friend class Pipeline;
 	friend class DescriptorSetLayout;
 	friend class DescriptorSet;
+	friend class TextOverlay;
+	friend class ShadowMap;
+	friend class SecondaryView;
+	friend struct Scene;
 public:
 	virtual void setWindowParameters() = 0;
-	void run() {
+	void run(int argc = 0, char** argv = nullptr) {
 		windowResizable = GLFW_FALSE;
 
+		args.assign(argv ? argv + 1 : argv, argv ? argv + argc : argv);
+		initFramePacing();
+		initHeadless();
+		initPipelineOptions();
+
 		setWindowParameters();
-		initWindow();
+		applySizeOption();
+		if (!headless) {
+			initWindow();
+		}
 		initVulkan();
 		mainLoop();
 		cleanup();
+
+		if (!profileOutput.empty()) {
+			PROFILE_EXPORT(profileOutput);
+		}
+	}
+
+	// Writes the profiler trace now (to the --profile file, or trace.json)
+	void exportProfile() {
+		PROFILE_EXPORT(profileOutput.empty() ? std::string("trace.json") : profileOutput);
 	}
 
 protected:
@@ -330,14 +459,12 @@ protected:
 	bool windowResizable;
 	std::string windowTitle;
 	VkClearColorValue initialBackgroundColor;
-	int uniformBlocksInPool;
-	int texturesInPool;
-	int setsInPool;
 
-	GLFWwindow* window;
+	GLFWwindow* window = nullptr;
 	VkInstance instance;
+	bool validation = true;
 
-	VkSurfaceKHR surface;
+	VkSurfaceKHR surface = VK_NULL_HANDLE;
 	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
 	VkDevice device;
 	VkQueue graphicsQueue;
@@ -353,18 +480,117 @@ protected:
 
 	VkRenderPass renderPass;
 
-	VkDescriptorPool descriptorPool;
+	// Sets made in pipelinesAndDescriptorSetsInit(), and per frame slot sets
+	// that live for one frame (see allocateFrameSet())
+	DescriptorAllocator descriptorAllocator;
+	std::vector<DescriptorAllocator> frameDescriptorAllocators;
 
 	VkDebugUtilsMessengerEXT debugMessenger;
 
-	VkImage depthImage;
-	VkDeviceMemory depthImageMemory;
+	// The frame as a render graph (RenderGraph.hpp), declared by
+	// declareFrameGraph(): the passes before the main render pass, the main and
+	// post-process render passes and the headless readback, with the images they
+	// share. The render passes take their attachment layouts, store ops and
+	// external dependencies from it; it owns the size dependent attachments
+	// (color, depth, G-buffer, sceneColor) and records the frame.
+	RenderGraph frameGraph;
+	uint32_t rgSwap = UINT32_MAX, rgColor = UINT32_MAX, rgDepth = UINT32_MAX, rgTarget = UINT32_MAX;
+	uint32_t rgHistory = UINT32_MAX;	// TAA: the history written
+	uint32_t rgMain = UINT32_MAX, rgPost = UINT32_MAX;
+	std::string graphDumpFile;		// --dump-graph[=file]
+
 	VkImageView depthImageView;
 
 	VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
-	VkImage colorImage;
-	VkDeviceMemory colorImageMemory;
-	VkImageView colorImageView;
+	VkImageView colorImageView;		// only with more than one sample
+
+	// Anti-aliasing tiers (--aa=name, setAATier() or cycleAATier() at run time):
+	// the MSAA sample count, the fraction of the samples the fragment shader runs
+	// for (0: once per pixel), and an optional post-process pass. With a post
+	// pass the scene is rendered into sceneColor, and the pass writes the swap
+	// chain image: FXAA from sceneColor alone, TAA blending it with the history
+	// of the frames before, reprojected through the depth and clamped to the
+	// neighbourhood, while the projection is jittered a sub-pixel every frame.
+	// A tier change rebuilds the render pass, the attachments and the pipelines.
+	// AA_POST_UPSCALE is no tier's own: it stands for NONE under dynamic resolution.
+	enum AAPost { AA_POST_NONE, AA_POST_FXAA, AA_POST_TAA, AA_POST_UPSCALE };
+	struct AATier {
+		const char* name;
+		uint32_t samples;		// 0: the most the device supports
+		float sampleShading;
+		AAPost post;
+	};
+	static constexpr uint32_t AA_TIERS = 7;
+	static constexpr AATier aaTiers[AA_TIERS] = {
+		{ "off", 1, 0.0f, AA_POST_NONE },
+		{ "fxaa", 1, 0.0f, AA_POST_FXAA },
+		{ "taa", 1, 0.0f, AA_POST_TAA },
+		{ "msaa2", 2, 0.0f, AA_POST_NONE },
+		{ "msaa4", 4, 0.0f, AA_POST_NONE },
+		{ "msaa4-half", 4, 0.5f, AA_POST_NONE },
+		{ "max", 0, 1.0f, AA_POST_NONE }
+	};
+	uint32_t aaTier = AA_TIERS - 1;
+	uint32_t aaTierPending = UINT32_MAX;	// applied by the next swap chain rebuild
+	VkSampleCountFlagBits maxMsaaSamples = VK_SAMPLE_COUNT_1_BIT;
+	float sampleShading = 1.0f;
+	AAPost aaPost = AA_POST_NONE;
+	bool aaPostAvailable[4] = { true, false, false, false };	// the shaders of each post pass exist
+	bool lateLatchOption = true;	// TAA turns the late latch off while active
+
+	VkRenderPass aaRenderPass = VK_NULL_HANDLE;
+	VkImageView sceneColorImageView;
+	VkImage historyImages[2];
+	VkDeviceMemory historyImagesMemory[2];
+	VkImageView historyImageViews[2];
+	std::vector<VkFramebuffer> aaFramebuffers;	// per image, times two (history written) with TAA
+	DescriptorSetLayout aaDSL;
+	VkDescriptorSet aaSets[2] = {};				// aaSets[h] reads the history 1 - h
+	VkSampler aaSampler = VK_NULL_HANDLE;
+	VkSampler aaDepthSampler = VK_NULL_HANDLE;
+	Pipeline PFXAA, PTAA, PUpscale;
+	Pipeline* aaPipeline = nullptr;				// the one created for the current tier
+	uint32_t gpAA = UINT32_MAX;
+	uint32_t taaFrame = 0;
+	bool taaHistoryValid = false;
+	glm::mat4 taaViewPrj = glm::mat4(1.0f), taaPrevViewPrj = glm::mat4(1.0f);
+
+	struct AAPushConstants {
+		glm::mat4 reproject;	// current unjittered clip space to the previous one
+		glm::vec4 texel;		// 1 / width, 1 / height, width, height
+		glm::vec4 params;		// history weight, unused, jitter in NDC
+		glm::vec4 scene;		// rendered part of sceneColor: UV scale, size in texels
+	};
+
+	// Dynamic resolution (--gpu-target=ms): the scene is drawn into the top left
+	// renderExtent of attachments kept at the swap chain size, so the scale can
+	// change every frame without reallocating anything, and the post pass brings
+	// it to the full size: TAA accumulates the jittered frames at full resolution
+	// (temporal upscale), the other tiers sample it bilinearly and sharpen it
+	// (Upscale.frag). The overlays are drawn after it, at full resolution, in a
+	// second subpass of the post pass. updateRenderScale() picks the scale from
+	// the GPU time of the recent frames.
+	bool dynamicResolution = false;
+	double gpuTargetMs = 0.0;
+	float minRenderScale = 0.5f;
+	float renderScale = 1.0f;
+	VkExtent2D renderExtent = { 0, 0 };
+	double gpuMsFiltered = 0.0;		// since the last scale change, 0: none yet
+	uint32_t scaleHoldFrames = 0;	// readings still of frames at the previous scale
+	uint32_t scaleChanges = 0;
+
+	// Deferred shading (--deferred=0 disables): the render pass has three
+	// subpasses, G-buffer, lighting and forward. The G-buffer attachments
+	// (albedo, normal, material) follow the resolve one in the framebuffer; the
+	// lighting subpass reads them and the depth as input attachments, through
+	// gbufferSet. Without it the render pass has only the forward subpass.
+	static const uint32_t GBUFFER_ATTACHMENTS = 3;
+	bool deferredSupported = true;
+	uint32_t forwardSubpass = 0;
+	uint32_t rgGBuffer[GBUFFER_ATTACHMENTS];
+	VkImageView gbufferImageViews[GBUFFER_ATTACHMENTS];
+	DescriptorSetLayout gbufferDSL;
+	VkDescriptorSet gbufferSet = VK_NULL_HANDLE;
 
 	std::vector<VkFramebuffer> swapChainFramebuffers;
 	size_t currentFrame = 0;
@@ -372,8 +598,378 @@ protected:
 
 	std::vector<VkSemaphore> imageAvailableSemaphores;
 	std::vector<VkSemaphore> renderFinishedSemaphores;
-	std::vector<VkFence> inFlightFences;
-	std::vector<VkFence> imagesInFlight;
+
+	// Frame pacing. A single timeline semaphore counts submitted frames: each frame
+	// slot and each swap chain image remember the value of their last submission.
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+	VkPresentModeKHR activePresentMode = VK_PRESENT_MODE_FIFO_KHR;
+	int framesInFlight = 2;
+	FramePacer framePacer;
+	VkSemaphore frameTimeline;
+	uint64_t frameTimelineValue = 0;
+	std::vector<uint64_t> frameSlotValues;
+	std::vector<uint64_t> imageTimelineValues;
+	std::thread timelineWatcher;
+	std::atomic<bool> timelineWatcherStop{ false };
+
+	// Render on demand (--on-demand): the main loop draws a frame only when it
+	// would differ from the one on screen. Window events (resize, expose, keys,
+	// mouse buttons, scroll) and held input ask for one, and the application
+	// tells when its animations next change through nextFrameDue(). A change is
+	// followed by a few more frames (settleFrames), so that the key debounce of
+	// GameLogic and the TAA history catch up. Otherwise the loop blocks in
+	// glfwWaitEventsTimeout until the next animation tick.
+	bool renderOnDemand = false;
+	bool redrawRequested = true;
+	// Keys and mouse buttons down, counted from the press and release events:
+	// polling them would clear the sticky presses GameLogic has yet to read
+	int inputsHeld = 0;
+	int settleFrames = 0;
+	uint64_t framesDrawn = 0;
+	uint64_t framesSkipped = 0;		// wake-ups that found nothing to draw
+	double idleSeconds = 0.0;
+	std::chrono::steady_clock::time_point lastFrameStart = std::chrono::steady_clock::now();
+	// Seconds until the next frame differs from the last one without any input:
+	// 0 (or less) when it already does, infinity when nothing is scheduled
+	virtual double nextFrameDue() { return 0.0; }
+
+	// Late latch: the camera uniforms are rewritten from freshly sampled input
+	// just before the frame is submitted (option --late-latch, on by default)
+	bool lateLatch = true;
+	virtual void lateLatchUniforms(uint32_t) {}
+
+	// Chrome trace written at exit when --profile=file is given (Profiler.hpp)
+	std::string profileOutput;
+
+	// GPU timestamps and pipeline statistics, per pass (see addGpuPass). Every swap
+	// chain image has its own range of queries; they are read back when the image
+	// is acquired again, after the timeline wait, so reading never stalls.
+	struct GpuPass {
+		std::string name;
+		const char* timeCounter;		// profiler counter names, interned
+		const char* vertexCounter;
+		const char* fragmentCounter;
+		double ms = 0.0;
+		uint64_t vertexInvocations = 0;
+		uint64_t fragmentInvocations = 0;
+	};
+	static const uint32_t MAX_GPU_PASSES = 8;
+	std::deque<GpuPass> gpuPasses;
+	VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+	VkQueryPool statisticsQueryPool = VK_NULL_HANDLE;
+	std::vector<uint32_t> gpuPassesWritten;	// per image, bit mask of the passes recorded
+	bool timestampsSupported = false;
+	bool pipelineStatisticsSupported = false;
+	// Descriptor indexing: texture arrays of up to maxBindlessTextures
+	// elements, partially bound and with a variable count (--bindless=0 disables)
+	bool bindlessSupported = false;
+	uint32_t maxBindlessTextures = 0;
+	float timestampPeriod = 1.0f;
+	uint64_t timestampMask = ~0ull;
+
+	// Headless mode (--headless): no window and no surface, the frames are rendered
+	// into offscreen images that take the place of the swap chain ones. The run
+	// ends after headlessFrames frames; with --save-frames each one is written as PNG.
+	bool headless = false;
+	int headlessFrames = 600;
+	uint64_t headlessFrameCount = 0;
+	uint32_t headlessImage = 0;
+	std::string saveFramesPrefix;
+	std::vector<VkDeviceMemory> offscreenImagesMemory;
+	std::vector<VkBuffer> readbackBuffers;
+	std::vector<VkDeviceMemory> readbackBuffersMemory;
+	std::vector<void*> readbackMapped;
+	std::vector<int64_t> readbackFrames;	// frame number in each readback buffer, -1 if none
+
+	// Benchmark statistics (Benchmark.hpp), collected every frame when
+	// collectFrameStats is set. CPU time is drawFrame up to the submit, without
+	// the timeline waits; GPU time spans the passes measured with begin/endGpuPass.
+	bool collectFrameStats = false;
+	FrameStats frameStats;
+	CommandStats commandStats;	// of the command buffer recorded last
+	double gpuFrameMs = 0.0;
+	// The queries are read per swap chain image, so gpuFrameMs and the pass times
+	// are those of the frame submitted gpuFrameLag frames before the current one
+	uint32_t gpuFrameLag = 0;
+	double timelineWaitMs = 0.0;
+	std::chrono::steady_clock::time_point lastSubmit;
+	bool closeRequested = false;
+
+	// Pipeline creation. The cache is kept on disk between runs (--pipeline-cache),
+	// and the pipelines requested with Pipeline::create() during
+	// pipelinesAndDescriptorSetsInit() are built together on worker threads.
+	VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+	std::string pipelineCacheFile;
+	bool pipelineCacheWarm = false;
+	int pipelineThreads = 0;	// 0: one per hardware thread
+	bool deferPipelines = false;
+	std::vector<std::pair<Pipeline*, uint32_t>> pendingPipelines;	// pipeline and variant key
+
+	// Command line arguments, without the program name
+	std::vector<std::string> args;
+
+	// Runtime option lookup: --name=value (or just --name for "1") on the command
+	// line, then the TSP_NAME environment variable (dashes become underscores).
+	std::string getOption(const std::string& name, const std::string& def = "") {
+		const std::string key = "--" + name;
+		for (const std::string& a : args) {
+			if (a == key) {
+				return "1";
+			}
+			if (a.size() > key.size() && a.compare(0, key.size(), key) == 0 && a[key.size()] == '=') {
+				return a.substr(key.size() + 1);
+			}
+		}
+
+		std::string env = "TSP_";
+		for (char c : name) {
+			env += c == '-' ? '_' : (char)std::toupper((unsigned char)c);
+		}
+		const char* value = std::getenv(env.c_str());
+		return value ? std::string(value) : def;
+	}
+	int getOptionInt(const std::string& name, int def) {
+		const std::string v = getOption(name);
+		return v.empty() ? def : std::atoi(v.c_str());
+	}
+	float getOptionFloat(const std::string& name, float def) {
+		const std::string v = getOption(name);
+		return v.empty() ? def : (float)std::atof(v.c_str());
+	}
+	bool getOptionBool(const std::string& name, bool def) {
+		const std::string v = getOption(name);
+		if (v.empty()) return def;
+		return !(v == "0" || v == "false" || v == "off" || v == "no");
+	}
+
+	// Headless options, read before the device exists.
+	//   --headless           (render offscreen, without a window)
+	//   --frames=N           (frames rendered in headless mode, default 600)
+	//   --save-frames[=name] (headless: write name_00000.png, ... default "frame")
+	void initHeadless() {
+		headless = getOptionBool("headless", false);
+		headlessFrames = std::max(1, getOptionInt("frames", 600));
+		saveFramesPrefix = getOption("save-frames");
+		if (saveFramesPrefix == "1") {
+			saveFramesPrefix = "frame";
+		}
+		if (!headless && !saveFramesPrefix.empty()) {
+			std::cout << "--save-frames works only with --headless\n";
+			saveFramesPrefix.clear();
+		}
+	}
+
+	//   --pipeline-cache=file  (default pipeline_cache.bin, 0 to disable)
+	//   --pipeline-threads=N   (threads building pipelines, default one per core)
+	//   --deferred=0           (no G-buffer and lighting subpasses)
+	//   --aa=tier              (anti-aliasing tier, default max)
+	//   --gpu-target=ms        (dynamic resolution: GPU time per frame aimed at, 0: off)
+	//   --min-scale=f          (dynamic resolution: lowest render scale, default 0.5)
+	//   --dump-graph[=file]    (prints the compiled frame graph, writes it for
+	//                           Graphviz, default render_graph.dot)
+	void initPipelineOptions() {
+		pipelineCacheFile = getOption("pipeline-cache", "pipeline_cache.bin");
+		if (pipelineCacheFile == "0") {
+			pipelineCacheFile.clear();
+		}
+		pipelineThreads = std::max(0, getOptionInt("pipeline-threads", 0));
+		graphDumpFile = getOption("dump-graph");
+		if (graphDumpFile == "1") {
+			graphDumpFile = "render_graph.dot";
+		}
+		deferredSupported = getOptionBool("deferred", true);
+		forwardSubpass = deferredSupported ? 2 : 0;
+
+		aaPostAvailable[AA_POST_FXAA] = std::ifstream("shaders/FullscreenVert.spv").good() &&
+			std::ifstream("shaders/FXAAFrag.spv").good();
+		aaPostAvailable[AA_POST_TAA] = std::ifstream("shaders/FullscreenVert.spv").good() &&
+			std::ifstream("shaders/TAAFrag.spv").good();
+		aaPostAvailable[AA_POST_UPSCALE] = std::ifstream("shaders/FullscreenVert.spv").good() &&
+			std::ifstream("shaders/UpscaleFrag.spv").good();
+
+		gpuTargetMs = std::max(0.0f, getOptionFloat("gpu-target", 0.0f));
+		minRenderScale = std::min(std::max(getOptionFloat("min-scale", 0.5f), 0.25f), 1.0f);
+		dynamicResolution = gpuTargetMs > 0.0;
+		if (dynamicResolution && !aaPostAvailable[AA_POST_UPSCALE]) {
+			std::cout << "Dynamic resolution disabled: compile shaders/Fullscreen.vert and "
+				"shaders/Upscale.frag with glslc\n";
+			dynamicResolution = false;
+		}
+		const std::string aa = getOption("aa", "max");
+		aaTier = findAATier(aa);
+		if (aaTier == UINT32_MAX) {
+			std::cout << "Unknown anti-aliasing tier <" << aa << ">, using max\n";
+			aaTier = AA_TIERS - 1;
+		}
+		else if (!aaPostAvailable[aaTiers[aaTier].post]) {
+			std::cout << "Anti-aliasing " << aa << " disabled: compile shaders/Fullscreen.vert, "
+				"shaders/FXAA.frag and shaders/TAA.frag with glslc\n";
+			aaTier = AA_TIERS - 1;
+		}
+	}
+
+	uint32_t findAATier(const std::string& name) const {
+		for (uint32_t t = 0; t < AA_TIERS; t++) {
+			if (name == aaTiers[t].name) return t;
+		}
+		return UINT32_MAX;
+	}
+
+	// Needs the sample counts of the device; the attachments, render passes and
+	// pipelines built afterwards follow these settings
+	void applyAATier(uint32_t t) {
+		const AATier& T = aaTiers[t];
+		aaTier = t;
+		msaaSamples = VK_SAMPLE_COUNT_1_BIT;
+		while (msaaSamples < maxMsaaSamples && (T.samples == 0 || (uint32_t)msaaSamples < T.samples)) {
+			msaaSamples = (VkSampleCountFlagBits)(msaaSamples << 1);
+		}
+		sampleShading = msaaSamples == VK_SAMPLE_COUNT_1_BIT ? 0.0f : T.sampleShading;
+		aaPost = T.post == AA_POST_NONE && dynamicResolution ? AA_POST_UPSCALE : T.post;
+		// The TAA reprojection is recorded with the camera of the frame
+		lateLatch = lateLatchOption && aaPost != AA_POST_TAA;
+		taaHistoryValid = false;
+	}
+
+public:
+	// Switches anti-aliasing tier at the end of the current frame
+	void setAATier(uint32_t t) {
+		if (t >= AA_TIERS || t == aaTier) return;
+		if (!aaPostAvailable[aaTiers[t].post]) {
+			std::cout << "Anti-aliasing " << aaTiers[t].name << " not available\n";
+			return;
+		}
+		aaTierPending = t;
+		RebuildPipeline();
+	}
+
+	void cycleAATier() {
+		for (uint32_t i = 1; i < AA_TIERS; i++) {
+			const uint32_t t = (aaTier + i) % AA_TIERS;
+			if (aaPostAvailable[aaTiers[t].post]) {
+				std::cout << "Anti-aliasing: " << aaTiers[t].name << "\n";
+				setAATier(t);
+				return;
+			}
+		}
+	}
+
+	const char* aaTierName() const {
+		return aaTiers[aaTier].name;
+	}
+
+	// Fragment shader invocations per covered pixel of the main render pass
+	float shadedSamplesPerPixel() const {
+		return sampleShading > 0.0f ? std::max(1.0f, std::ceil(sampleShading * (float)msaaSamples)) : 1.0f;
+	}
+
+	// TAA: the sub-pixel offset of this frame, to add to the projection
+	// (translation by the returned NDC offset); identity in the other tiers
+	glm::mat4 aaJitter() const {
+		if (aaPost != AA_POST_TAA) return glm::mat4(1.0f);
+		return glm::translate(glm::mat4(1.0f), glm::vec3(jitterNDC(), 0.0f));
+	}
+
+	// TAA: the unjittered view-projection of the frame, once per frame
+	void setTemporalViewPrj(const glm::mat4& viewPrj) {
+		taaPrevViewPrj = taaViewPrj;
+		taaViewPrj = viewPrj;
+	}
+
+protected:
+	// Halton (2, 3) sequence, 8 positions
+	glm::vec2 jitterNDC() const {
+		auto halton = [](uint32_t i, uint32_t b) {
+			float f = 1.0f, r = 0.0f;
+			for (; i > 0; i /= b) {
+				f /= (float)b;
+				r += f * (float)(i % b);
+			}
+			return r;
+		};
+		const uint32_t i = taaFrame % 8 + 1;
+		return glm::vec2((halton(i, 2) - 0.5f) * 2.0f / (float)renderExtent.width,
+			(halton(i, 3) - 0.5f) * 2.0f / (float)renderExtent.height);
+	}
+
+	// Dynamic resolution controller, once per frame after readGpuQueries(). Over
+	// the target the scale drops at once to where the GPU time should meet it (the
+	// cost goes with the pixels, the square of the scale); it grows a step at a
+	// time, only while the larger frame is expected to stay under 90% of the
+	// target. Scales are multiples of 0.05. The GPU times are read per swap chain
+	// image (see gpuFrameLag), so after a change a swap chain length of readings
+	// still measures frames at the old scale and is skipped.
+	void updateRenderScale() {
+		if (dynamicResolution && gpuFrameMs > 0.0) {
+			if (scaleHoldFrames > 0) {
+				scaleHoldFrames--;
+			}
+			else {
+				gpuMsFiltered = gpuMsFiltered == 0.0 ? gpuFrameMs : gpuMsFiltered * 0.8 + gpuFrameMs * 0.2;
+				float next = renderScale;
+				if (gpuMsFiltered > gpuTargetMs) {
+					next = std::floor(renderScale * (float)std::sqrt(gpuTargetMs / gpuMsFiltered) * 20.0f) / 20.0f;
+				}
+				else {
+					const float up = std::round(renderScale * 20.0f + 1.0f) / 20.0f;
+					if (gpuMsFiltered * (up * up) / (renderScale * renderScale) < gpuTargetMs * 0.9) {
+						next = up;
+					}
+				}
+				next = std::min(std::max(next, minRenderScale), 1.0f);
+				if (next != renderScale) {
+					std::cout << "Render scale " << renderScale << " -> " << next << " (GPU "
+						<< std::fixed << std::setprecision(2) << gpuMsFiltered << " ms, target "
+						<< gpuTargetMs << " ms)\n" << std::defaultfloat;
+					renderScale = next;
+					gpuMsFiltered = 0.0;
+					scaleHoldFrames = static_cast<uint32_t>(swapChainImages.size());
+					scaleChanges++;
+				}
+			}
+		}
+		renderExtent.width = std::max(1u, (uint32_t)std::lround(swapChainExtent.width * renderScale));
+		renderExtent.height = std::max(1u, (uint32_t)std::lround(swapChainExtent.height * renderScale));
+		PROFILE_COUNTER("Render scale", renderScale);
+	}
+
+	// --size=WxH overrides the window (or offscreen image) size of setWindowParameters
+	void applySizeOption() {
+		const std::string size = getOption("size");
+		unsigned int w = 0, h = 0;
+		if (size.empty() || std::sscanf(size.c_str(), "%ux%u", &w, &h) != 2 || w == 0 || h == 0) {
+			return;
+		}
+		windowWidth = w;
+		windowHeight = h;
+		onWindowResize(w, h);
+	}
+
+	// True while the key is held; always false in headless mode
+	bool keyPressed(int key) {
+		return window != nullptr && glfwGetKey(window, key) == GLFW_PRESS;
+	}
+
+	void pollEvents() {
+		if (window != nullptr) {
+			glfwPollEvents();
+		}
+	}
+
+	// Ends the main loop after the current frame
+	void requestClose() {
+		closeRequested = true;
+	}
+
+	bool shouldClose() {
+		if (closeRequested) {
+			return true;
+		}
+		if (headless) {
+			return headlessFrameCount >= (uint64_t)headlessFrames;
+		}
+		return glfwWindowShouldClose(window);
+	}
 
 	void initWindow() {
 		glfwInit();
@@ -385,6 +981,14 @@ protected:
 
 		glfwSetWindowUserPointer(window, this);
 		glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+		if (renderOnDemand) {
+			// A key tapped while the loop sleeps still reads as pressed in the next frame
+			glfwSetInputMode(window, GLFW_STICKY_KEYS, GLFW_TRUE);
+			glfwSetWindowRefreshCallback(window, redrawCallback);
+			glfwSetKeyCallback(window, [](GLFWwindow* w, int, int, int action, int) { heldCallback(w, action); });
+			glfwSetMouseButtonCallback(window, [](GLFWwindow* w, int, int action, int) { heldCallback(w, action); });
+			glfwSetScrollCallback(window, [](GLFWwindow* w, double, double) { redrawCallback(w); });
+		}
 
 	}
 
@@ -397,30 +1001,62 @@ protected:
 		app->onWindowResize(width, height);
 	}
 
+	static void redrawCallback(GLFWwindow* window) {
+		reinterpret_cast<BaseProject*>(glfwGetWindowUserPointer(window))->redrawRequested = true;
+	}
+
+	static void heldCallback(GLFWwindow* window, int action) {
+		auto app = reinterpret_cast<BaseProject*>(glfwGetWindowUserPointer(window));
+		if (action == GLFW_PRESS) {
+			app->inputsHeld++;
+		}
+		else if (action == GLFW_RELEASE) {
+			app->inputsHeld = std::max(0, app->inputsHeld - 1);
+		}
+		app->redrawRequested = true;
+	}
+
 
 	virtual void localInit() = 0;
 	virtual void pipelinesAndDescriptorSetsInit() = 0;
 
 	void initVulkan() {
+		PROFILE_FUNCTION();
+		const auto start = std::chrono::steady_clock::now();
 		createInstance();
 		setupDebugMessenger();
-		createSurface();
+		if (!headless) {
+			createSurface();
+		}
 		pickPhysicalDevice();
 		createLogicalDevice();
+		createPipelineCache();
+		frameGraph.init(physicalDevice, device);
 		createSwapChain();
 		createImageViews();
 		createRenderPass();
 		createCommandPool();
-		createColorResources();
-		createDepthResources();
+		createDescriptorAllocators();
+		createGBufferLayout();
+		initAA();
+		createAttachments();
+		createGBufferSet();
 		createFramebuffers();
-		createDescriptorPool();
+		createAAResources();
 
 		localInit();
+		deferPipelines = true;
 		pipelinesAndDescriptorSetsInit();
+		createAAPipelines();
+		createPendingPipelines();
 
 		createCommandBuffers();
 		createSyncObjects();
+		createQueryPools();
+
+		std::cout << "Vulkan initialized in " << std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - start).count() << " ms (pipeline cache "
+			<< (pipelineCacheWarm ? "warm" : "cold") << ")\n";
 	}
 
 	void createInstance() {
@@ -431,21 +1067,23 @@ protected:
 		appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
 		appInfo.pEngineName = "No Engine";
 		appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-		appInfo.apiVersion = VK_API_VERSION_1_0;
+		appInfo.apiVersion = VK_API_VERSION_1_2;	// timeline semaphores
 
 		VkInstanceCreateInfo createInfo{};
 		createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 		createInfo.pApplicationInfo = &appInfo;
 
-		uint32_t glfwExtensionCount = 0;
-		const char** glfwExtensions;
-		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-		//		createInfo.enabledExtensionCount = glfwExtensionCount;
-		//		createInfo.ppEnabledExtensionNames = glfwExtensions;
-
 		createInfo.enabledLayerCount = 0;
 
+		// Build machines often have no validation layers: headless runs go on without
+		validation = checkValidationLayerSupport();
+		if (!validation) {
+			if (!headless) {
+				throw std::runtime_error("validation layers requested, but not available!");
+			}
+			std::cout << "Validation layers not available, running without them\n";
+		}
+
 		auto extensions = getRequiredExtensions();
 		createInfo.enabledExtensionCount =
 			static_cast<uint32_t>(extensions.size());
@@ -453,18 +1091,16 @@ protected:
 
 		createInfo.flags |= VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR;
 
-		if (!checkValidationLayerSupport()) {
-			throw std::runtime_error("validation layers requested, but not available!");
-		}
-
 		VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo;
-		createInfo.enabledLayerCount =
-			static_cast<uint32_t>(validationLayers.size());
-		createInfo.ppEnabledLayerNames = validationLayers.data();
-
-		populateDebugMessengerCreateInfo(debugCreateInfo);
-		createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*)
-			&debugCreateInfo;
+		if (validation) {
+			createInfo.enabledLayerCount =
+				static_cast<uint32_t>(validationLayers.size());
+			createInfo.ppEnabledLayerNames = validationLayers.data();
+
+			populateDebugMessengerCreateInfo(debugCreateInfo);
+			createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*)
+				&debugCreateInfo;
+		}
 
 		VkResult result = vkCreateInstance(&createInfo, nullptr, &instance);
 
@@ -474,16 +1110,20 @@ protected:
 		}
 	}
 
+	// Headless runs need no surface extensions, hence no GLFW
 	std::vector<const char*> getRequiredExtensions() {
-		uint32_t glfwExtensionCount = 0;
-		const char** glfwExtensions;
-		glfwExtensions =
-			glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-		std::vector<const char*> extensions(glfwExtensions,
-			glfwExtensions + glfwExtensionCount);
+		std::vector<const char*> extensions;
+		if (!headless) {
+			uint32_t glfwExtensionCount = 0;
+			const char** glfwExtensions;
+			glfwExtensions =
+				glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+			extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+		}
 
-		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+		if (validation) {
+			extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+		}
 
 		if (checkIfItHasExtension(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME)) {
 			extensions.push_back(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME);
@@ -585,6 +1225,7 @@ protected:
 	}
 
 	void setupDebugMessenger() {
+		if (!validation) return;
 
 		VkDebugUtilsMessengerCreateInfoEXT createInfo{};
 		populateDebugMessengerCreateInfo(createInfo);
@@ -609,6 +1250,7 @@ protected:
 		bool swapChainPresentModeSupport;
 		bool completeQueueFamily;
 		bool anisotropySupport;
+		bool timelineSemaphoreSupport;
 		bool extensionsSupported;
 		std::set<std::string> requiredExtensions;
 
@@ -618,6 +1260,7 @@ protected:
 			std::cout << "swapChainPresentModeSupport: " << swapChainPresentModeSupport << "\n";
 			std::cout << "completeQueueFamily: " << completeQueueFamily << "\n";
 			std::cout << "anisotropySupport: " << anisotropySupport << "\n";
+			std::cout << "timelineSemaphoreSupport: " << timelineSemaphoreSupport << "\n";
 			std::cout << "extensionsSupported: " << extensionsSupported << "\n";
 
 			for (const auto& ext : requiredExtensions) {
@@ -640,6 +1283,13 @@ protected:
 
 		std::cout << "Physical devices found: " << deviceCount << "\n";
 
+		// Offscreen images need no swap chain
+		if (headless) {
+			deviceExtensions.erase(std::remove_if(deviceExtensions.begin(), deviceExtensions.end(),
+				[](const char* ext) { return strcmp(ext, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0; }),
+				deviceExtensions.end());
+		}
+
 		for (const auto& device : devices) {
 			if (checkIfItHasDeviceExtension(device, "VK_KHR_portability_subset")) {
 				deviceExtensions.push_back("VK_KHR_portability_subset");
@@ -648,8 +1298,12 @@ protected:
 			bool suitable = isDeviceSuitable(device, devRep);
 			if (suitable) {
 				physicalDevice = device;
-				msaaSamples = getMaxUsableSampleCount();
-				std::cout << "\n\nMaximum samples for anti-aliasing: " << msaaSamples << "\n\n\n";
+				maxMsaaSamples = getMaxUsableSampleCount();
+				applyAATier(aaTier);
+				checkQuerySupport();
+				checkBindlessSupport();
+				std::cout << "\n\nMaximum samples for anti-aliasing: " << maxMsaaSamples
+					<< ", tier " << aaTierName() << ": " << msaaSamples << "\n\n\n";
 				break;
 			}
 			else {
@@ -668,8 +1322,8 @@ protected:
 
 		devRep.extensionsSupported = checkDeviceExtensionSupport(device, devRep);
 
-		devRep.swapChainAdequate = false;
-		if (devRep.extensionsSupported) {
+		devRep.swapChainAdequate = headless;	// nothing to present to
+		if (devRep.extensionsSupported && !headless) {
 			SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
 			devRep.swapChainFormatSupport = swapChainSupport.formats.empty();
 			devRep.swapChainPresentModeSupport = swapChainSupport.presentModes.empty();
@@ -683,8 +1337,22 @@ protected:
 		devRep.completeQueueFamily = indices.isComplete();
 		devRep.anisotropySupport = supportedFeatures.samplerAnisotropy;
 
+		// Frame pacing relies on Vulkan 1.2 timeline semaphores
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(device, &properties);
+		devRep.timelineSemaphoreSupport = false;
+		if (properties.apiVersion >= VK_API_VERSION_1_2) {
+			VkPhysicalDeviceVulkan12Features features12{};
+			features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+			VkPhysicalDeviceFeatures2 features2{};
+			features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+			features2.pNext = &features12;
+			vkGetPhysicalDeviceFeatures2(device, &features2);
+			devRep.timelineSemaphoreSupport = features12.timelineSemaphore;
+		}
+
 		return devRep.completeQueueFamily && devRep.extensionsSupported && devRep.swapChainAdequate &&
-			devRep.anisotropySupport;
+			devRep.anisotropySupport && devRep.timelineSemaphoreSupport;
 	}
 
 	QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device) {
@@ -704,9 +1372,15 @@ protected:
 				indices.graphicsFamily = i;
 			}
 
+			// Headless: the "present" queue only has to exist, take the graphics one
 			VkBool32 presentSupport = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
-				&presentSupport);
+			if (headless) {
+				presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+			}
+			else {
+				vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
+					&presentSupport);
+			}
 			if (presentSupport) {
 				indices.presentFamily = i;
 			}
@@ -807,9 +1481,21 @@ protected:
 		VkPhysicalDeviceFeatures deviceFeatures{};
 		deviceFeatures.samplerAnisotropy = VK_TRUE;
 		deviceFeatures.sampleRateShading = VK_TRUE;
+		deviceFeatures.pipelineStatisticsQuery = pipelineStatisticsSupported ? VK_TRUE : VK_FALSE;
+
+		VkPhysicalDeviceVulkan12Features features12{};
+		features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+		features12.timelineSemaphore = VK_TRUE;
+		if (bindlessSupported) {
+			deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+			features12.runtimeDescriptorArray = VK_TRUE;
+			features12.descriptorBindingPartiallyBound = VK_TRUE;
+			features12.descriptorBindingVariableDescriptorCount = VK_TRUE;
+		}
 
 		VkDeviceCreateInfo createInfo{};
 		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+		createInfo.pNext = &features12;
 
 		createInfo.pQueueCreateInfos = queueCreateInfos.data();
 		createInfo.queueCreateInfoCount =
@@ -820,9 +1506,11 @@ protected:
 			static_cast<uint32_t>(deviceExtensions.size());
 		createInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
-		createInfo.enabledLayerCount =
-			static_cast<uint32_t>(validationLayers.size());
-		createInfo.ppEnabledLayerNames = validationLayers.data();
+		if (validation) {
+			createInfo.enabledLayerCount =
+				static_cast<uint32_t>(validationLayers.size());
+			createInfo.ppEnabledLayerNames = validationLayers.data();
+		}
 
 		VkResult result = vkCreateDevice(physicalDevice, &createInfo, nullptr, &device);
 
@@ -835,7 +1523,155 @@ protected:
 		vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
 	}
 
-	void createSwapChain() {
+	// The file starts with our own header: the data is used only if it was written
+	// by the same device and driver, since drivers differ in how strictly they
+	// check the Vulkan cache header
+	struct PipelineCacheFileHeader {
+		char magic[4];
+		uint32_t vendorID;
+		uint32_t deviceID;
+		uint32_t driverVersion;
+		uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+		uint64_t dataSize;
+	};
+
+	PipelineCacheFileHeader pipelineCacheHeader() {
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		PipelineCacheFileHeader h{};
+		memcpy(h.magic, "TSPC", 4);
+		h.vendorID = properties.vendorID;
+		h.deviceID = properties.deviceID;
+		h.driverVersion = properties.driverVersion;
+		memcpy(h.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+		return h;
+	}
+
+	void createPipelineCache() {
+		std::vector<char> data;
+		if (!pipelineCacheFile.empty()) {
+			std::ifstream file(pipelineCacheFile, std::ios::ate | std::ios::binary);
+			const std::streamoff fileSize = file.is_open() ? (std::streamoff)file.tellg() : 0;
+			file.seekg(0);
+			PipelineCacheFileHeader h{};
+			const PipelineCacheFileHeader expected = pipelineCacheHeader();
+			if (file.read((char*)&h, sizeof(h))) {
+				// A corrupt size must not be trusted with an allocation: the data is
+				// exactly the rest of the file
+				if (memcmp(h.magic, expected.magic, 4) == 0 && h.vendorID == expected.vendorID &&
+					h.deviceID == expected.deviceID && h.driverVersion == expected.driverVersion &&
+					memcmp(h.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) == 0 &&
+					h.dataSize == (uint64_t)(fileSize - (std::streamoff)sizeof(h))) {
+					data.resize((size_t)h.dataSize);
+					if (!file.read(data.data(), data.size())) {
+						data.clear();
+					}
+				}
+				if (data.empty()) {
+					std::cout << "Pipeline cache <" << pipelineCacheFile << "> is stale, ignoring it\n";
+				}
+			}
+		}
+		pipelineCacheWarm = !data.empty();
+
+		VkPipelineCacheCreateInfo cacheInfo{};
+		cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		cacheInfo.initialDataSize = data.size();
+		cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+		VkResult result = vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache);
+		if (result != VK_SUCCESS && pipelineCacheWarm) {
+			// The driver refused the data after all: start empty
+			pipelineCacheWarm = false;
+			cacheInfo.initialDataSize = 0;
+			cacheInfo.pInitialData = nullptr;
+			result = vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache);
+		}
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to create pipeline cache!");
+		}
+	}
+
+	// Written to a temporary file first, then renamed over the old cache, so an
+	// interrupted run or a failed write leaves the old cache in place
+	void savePipelineCache() {
+		if (pipelineCacheFile.empty()) return;
+
+		size_t size = 0;
+		if (vkGetPipelineCacheData(device, pipelineCache, &size, nullptr) != VK_SUCCESS || size == 0) return;
+		std::vector<char> data(size);
+		if (vkGetPipelineCacheData(device, pipelineCache, &size, data.data()) != VK_SUCCESS) return;
+
+		PipelineCacheFileHeader h = pipelineCacheHeader();
+		h.dataSize = size;
+		const std::string tmp = pipelineCacheFile + ".tmp";
+		{
+			std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+			if (!file.write((const char*)&h, sizeof(h)) || !file.write(data.data(), size)) {
+				std::cout << "Cannot write pipeline cache <" << tmp << ">\n";
+				return;
+			}
+		}
+		// Unlike std::rename, this replaces an existing file on Windows too
+		std::error_code error;
+		std::filesystem::rename(tmp, pipelineCacheFile, error);
+		if (error) {
+			std::cout << "Cannot write pipeline cache <" << pipelineCacheFile << ">: " << error.message() << "\n";
+			std::remove(tmp.c_str());
+		}
+	}
+
+	// Builds the pipelines queued by Pipeline::create(). Pipeline caches are
+	// internally synchronized, so the workers share one.
+	void createPendingPipelines() {
+		PROFILE_FUNCTION();
+		deferPipelines = false;
+		if (pendingPipelines.empty()) return;
+
+		const auto start = std::chrono::steady_clock::now();
+		const size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+		const size_t threads = std::min(pendingPipelines.size(),
+			pipelineThreads > 0 ? (size_t)pipelineThreads : hardware);
+
+		std::atomic<size_t> next{ 0 };
+		std::exception_ptr error;
+		std::mutex errorMutex;
+		auto worker = [&]() {
+			for (size_t i = next++; i < pendingPipelines.size(); i = next++) {
+				try {
+					pendingPipelines[i].first->build(pendingPipelines[i].second);
+				}
+				catch (...) {
+					std::lock_guard<std::mutex> lock(errorMutex);
+					if (!error) error = std::current_exception();
+				}
+			}
+		};
+		std::vector<std::thread> workers;
+		for (size_t t = 1; t < threads; t++) {
+			workers.emplace_back(worker);
+		}
+		worker();
+		for (std::thread& t : workers) {
+			t.join();
+		}
+
+		std::cout << "Pipelines: " << pendingPipelines.size() << " built in "
+			<< std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+			<< " ms on " << threads << " threads\n";
+		pendingPipelines.clear();
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+
+	void createSwapChain(VkSwapchainKHR oldSwapChain = VK_NULL_HANDLE) {
+		if (headless) {
+			createOffscreenImages();
+			return;
+		}
+
 		SwapChainSupportDetails swapChainSupport =
 			querySwapChainSupport(physicalDevice);
 		VkSurfaceFormatKHR surfaceFormat =
@@ -879,7 +1715,7 @@ protected:
 		createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 		createInfo.presentMode = presentMode;
 		createInfo.clipped = VK_TRUE;
-		createInfo.oldSwapchain = VK_NULL_HANDLE;
+		createInfo.oldSwapchain = oldSwapChain;
 
 		VkResult result = vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain);
 		if (result != VK_SUCCESS) {
@@ -894,6 +1730,95 @@ protected:
 
 		swapChainImageFormat = surfaceFormat.format;
 		swapChainExtent = extent;
+		renderExtent = extent;	// scaled by the next updateRenderScale()
+	}
+
+	// Headless stand-in for the swap chain: one image per frame in flight plus one,
+	// like a mailbox swap chain. RGBA, so saved frames need no swizzle.
+	void createOffscreenImages() {
+		const uint32_t imageCount = (uint32_t)framesInFlight + 1;
+		swapChainImageFormat = VK_FORMAT_R8G8B8A8_SRGB;
+		swapChainExtent = { windowWidth, windowHeight };
+		renderExtent = swapChainExtent;
+		swapChainImages.resize(imageCount);
+		offscreenImagesMemory.resize(imageCount);
+		for (uint32_t i = 0; i < imageCount; i++) {
+			createImage(swapChainExtent.width, swapChainExtent.height, 1, 1,
+				VK_SAMPLE_COUNT_1_BIT, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+				VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, 0,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				swapChainImages[i], offscreenImagesMemory[i]);
+		}
+
+		readbackFrames.assign(saveFramesPrefix.empty() ? 0 : imageCount, -1);
+		readbackBuffers.resize(readbackFrames.size());
+		readbackBuffersMemory.resize(readbackFrames.size());
+		readbackMapped.resize(readbackFrames.size());
+		for (size_t i = 0; i < readbackFrames.size(); i++) {
+			createBuffer((VkDeviceSize)swapChainExtent.width * swapChainExtent.height * 4,
+				VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				readbackBuffers[i], readbackBuffersMemory[i]);
+			vkMapMemory(device, readbackBuffersMemory[i], 0, VK_WHOLE_SIZE, 0, &readbackMapped[i]);
+		}
+	}
+
+	// Needs an idle device: the frames still waiting for their PNG are written first
+	void destroyOffscreenImages() {
+		for (uint32_t i = 0; i < readbackFrames.size(); i++) {
+			saveFrame(i);
+		}
+		for (size_t i = 0; i < swapChainImages.size(); i++) {
+			vkDestroyImage(device, swapChainImages[i], nullptr);
+			vkFreeMemory(device, offscreenImagesMemory[i], nullptr);
+		}
+		for (size_t i = 0; i < readbackBuffers.size(); i++) {
+			vkUnmapMemory(device, readbackBuffersMemory[i]);
+			vkDestroyBuffer(device, readbackBuffers[i], nullptr);
+			vkFreeMemory(device, readbackBuffersMemory[i], nullptr);
+		}
+		readbackBuffers.clear();
+		readbackBuffersMemory.clear();
+		readbackMapped.clear();
+		readbackFrames.clear();
+	}
+
+	// Copies the resolved image to its readback buffer, after the render pass
+	void recordReadback(VkCommandBuffer commandBuffer, size_t i) {
+		VkBufferImageCopy region{};
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.layerCount = 1;
+		region.imageExtent = { swapChainExtent.width, swapChainExtent.height, 1 };
+		vkCmdCopyImageToBuffer(commandBuffer, swapChainImages[i], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			readbackBuffers[i], 1, &region);
+
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+	}
+
+	// Writes the frame waiting in readback buffer i, if any. The GPU must be done with it.
+	void saveFrame(uint32_t i) {
+		if (i >= readbackFrames.size() || readbackFrames[i] < 0) return;
+		PROFILE_ZONE("Save frame");
+
+		const uint32_t w = swapChainExtent.width, h = swapChainExtent.height;
+		unsigned char* pixels = (unsigned char*)readbackMapped[i];
+		// The overlays blend into the alpha channel too
+		for (size_t a = 3; a < (size_t)w * h * 4; a += 4) {
+			pixels[a] = 255;
+		}
+
+		char suffix[32];
+		std::snprintf(suffix, sizeof(suffix), "_%05lld.png", (long long)readbackFrames[i]);
+		const std::string file = saveFramesPrefix + suffix;
+		if (!stbi_write_png(file.c_str(), w, h, 4, pixels, w * 4)) {
+			std::cout << "Cannot write <" << file << ">\n";
+		}
+		readbackFrames[i] = -1;
 	}
 
 	VkSurfaceFormatKHR chooseSwapSurfaceFormat(
@@ -909,16 +1834,92 @@ protected:
 		return availableFormats[0];
 	}
 
+	// Uses the requested mode if the surface supports it, FIFO (always available) otherwise
 	VkPresentModeKHR chooseSwapPresentMode(
 		const std::vector<VkPresentModeKHR>& availablePresentModes) {
 		for (const auto& availablePresentMode : availablePresentModes) {
-			if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
+			if (availablePresentMode == presentMode) {
+				activePresentMode = availablePresentMode;
 				return availablePresentMode;
 			}
 		}
+		std::cout << "Present mode " << presentModeName(presentMode)
+			<< " not supported, using FIFO\n";
+		activePresentMode = VK_PRESENT_MODE_FIFO_KHR;
 		return VK_PRESENT_MODE_FIFO_KHR;
 	}
 
+	static const char* presentModeName(VkPresentModeKHR mode) {
+		switch (mode) {
+		case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+		case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo-relaxed";
+		case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+		case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+		default: return "unknown";
+		}
+	}
+
+	// Reads the pacing options; runs before the window and the device exist.
+	//   --present-mode=fifo|fifo-relaxed|mailbox|immediate  (default mailbox)
+	//   --frames-in-flight=N  (1 to 4, default 2)
+	//   --fps-cap=N           (0 = uncapped)
+	//   --pacing-stats        (print fps and latency once per second)
+	//   --late-latch=0        (disable the camera late latch)
+	//   --on-demand           (draw only frames that change, see renderOnDemand)
+	//   --profile[=file]      (write a Chrome trace at exit, default trace.json)
+	void initFramePacing() {
+		const std::string mode = getOption("present-mode", "mailbox");
+		const VkPresentModeKHR modes[] = { VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR,
+			VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR };
+		presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+		bool found = false;
+		for (VkPresentModeKHR m : modes) {
+			if (mode == presentModeName(m)) {
+				presentMode = m;
+				found = true;
+			}
+		}
+		if (!found) {
+			std::cout << "Unknown present mode <" << mode << ">, using mailbox\n";
+		}
+
+		framesInFlight = std::max(1, std::min(4, getOptionInt("frames-in-flight", 2)));
+		framePacer.setFpsCap(getOptionFloat("fps-cap", 0.0f));
+		framePacer.printStats = getOptionBool("pacing-stats", false);
+		lateLatch = getOptionBool("late-latch", true);
+		lateLatchOption = lateLatch;
+		renderOnDemand = getOptionBool("on-demand", false);
+
+		profileOutput = getOption("profile");
+		if (profileOutput == "1") {
+			profileOutput = "trace.json";
+		}
+	}
+
+	// Switches to the next present mode supported by the surface; the swap chain
+	// is rebuilt at the end of the current frame
+	void cyclePresentMode() {
+		if (headless) return;
+		const VkPresentModeKHR modes[] = { VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR,
+			VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR };
+		const std::vector<VkPresentModeKHR> available =
+			querySwapChainSupport(physicalDevice).presentModes;
+
+		int current = 0;
+		for (int i = 0; i < 4; i++) {
+			if (modes[i] == activePresentMode) current = i;
+		}
+		for (int i = 1; i <= 4; i++) {
+			const VkPresentModeKHR next = modes[(current + i) % 4];
+			if (std::find(available.begin(), available.end(), next) != available.end()) {
+				presentMode = next;
+				break;
+			}
+		}
+		std::cout << "Present mode: " << presentModeName(presentMode) << "\n";
+		RebuildPipeline();
+	}
+
 	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities) {
 		if (capabilities.currentExtent.width != UINT32_MAX) {
 			return capabilities.currentExtent;
@@ -952,7 +1953,7 @@ protected:
 
 	VkImageView createImageView(VkImage image, VkFormat format,
 		VkImageAspectFlags aspectFlags,
-		uint32_t mipLevels, VkImageViewType type, int layerCount
+		uint32_t mipLevels, VkImageViewType type, int layerCount, int baseLayer = 0
 	) {
 		VkImageViewCreateInfo viewInfo{};
 		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -962,7 +1963,7 @@ protected:
 		viewInfo.subresourceRange.aspectMask = aspectFlags;
 		viewInfo.subresourceRange.baseMipLevel = 0;
 		viewInfo.subresourceRange.levelCount = mipLevels;
-		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.baseArrayLayer = baseLayer;
 		viewInfo.subresourceRange.layerCount = layerCount;
 		VkImageView imageView;
 
@@ -975,16 +1976,123 @@ protected:
 		return imageView;
 	}
 
+	// The layout the swap chain images are left in: headless frames are copied
+	// out instead of presented
+	VkImageLayout outputLayout() const {
+		return headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	}
+
+	// With one sample there is nothing to resolve: the color attachment is the
+	// target itself. The target is the swap chain image, or sceneColor when a
+	// post-process pass follows; G-buffer attachments come after the target.
+	uint32_t gbufferAttachmentBase() const {
+		return msaaSamples != VK_SAMPLE_COUNT_1_BIT ? 3 : 2;
+	}
+
+	// The passes of a frame and the images they use, for the current tier and
+	// options. Compiled before the render passes are made from it.
+	void declareFrameGraph() {
+		RenderGraph& G = frameGraph;
+		G.reset();
+		const VkImageAspectFlags color = VK_IMAGE_ASPECT_COLOR_BIT;
+		const bool resolve = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+		const bool post = aaPost != AA_POST_NONE;
+
+		rgSwap = G.importImage("Swap chain image", color, outputLayout());
+		rgColor = resolve ? G.createImage("MSAA color", swapChainImageFormat, msaaSamples, color) : UINT32_MAX;
+		rgDepth = G.createImage("Depth", findDepthFormat(), msaaSamples, VK_IMAGE_ASPECT_DEPTH_BIT,
+			deferredSupported ? VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT : 0);
+		rgTarget = post ? G.createImage("Scene color", swapChainImageFormat, VK_SAMPLE_COUNT_1_BIT, color) : rgSwap;
+		static const char* gbufferNames[GBUFFER_ATTACHMENTS] = { "G-buffer albedo", "G-buffer normal",
+			"G-buffer material" };
+		for (uint32_t i = 0; i < GBUFFER_ATTACHMENTS; i++) {
+			rgGBuffer[i] = deferredSupported ? G.createImage(gbufferNames[i], gbufferFormats[i], msaaSamples,
+				color, VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT) : UINT32_MAX;
+		}
+
+		// Render passes of their own (shadow maps): synchronized by them
+		const uint32_t before = G.addPass("Before main pass", 0, [this](VkCommandBuffer cb, uint32_t i) {
+			populateBeforeRenderPass(cb, (int)i);
+			});
+		G.setSideEffect(before);
+
+		rgMain = G.addPass("Main", forwardSubpass + 1, [this](VkCommandBuffer cb, uint32_t i) {
+			recordMainPass(cb, i);
+			});
+		if (resolve) G.use(rgMain, rgColor, RG_COLOR_ATTACHMENT);
+		G.use(rgMain, rgDepth, RG_DEPTH_ATTACHMENT);
+		G.use(rgMain, rgTarget, RG_COLOR_ATTACHMENT);
+		for (uint32_t i = 0; i < GBUFFER_ATTACHMENTS && deferredSupported; i++) {
+			G.use(rgMain, rgGBuffer[i], RG_COLOR_ATTACHMENT, 1);
+		}
+
+		// Subpass 0 samples sceneColor (and with TAA the depth and the history,
+		// writing the next one); subpass 1 draws the overlays
+		rgPost = rgHistory = UINT32_MAX;
+		if (post) {
+			rgPost = G.addPass("Post-process", 2, [this](VkCommandBuffer cb, uint32_t i) {
+				recordAA(cb, i);
+				});
+			G.use(rgPost, rgTarget, RG_SAMPLED, 0);
+			G.use(rgPost, rgSwap, RG_COLOR_ATTACHMENT);
+			if (aaPost == AA_POST_TAA) {
+				const uint32_t historyRead = G.importImage("TAA history (read)", color,
+					VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+				rgHistory = G.importImage("TAA history (written)", color,
+					VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, historyRead);
+				G.use(rgPost, rgDepth, RG_SAMPLED, 0);
+				G.use(rgPost, historyRead, RG_SAMPLED, 0);
+				G.use(rgPost, rgHistory, RG_COLOR_ATTACHMENT, 0);
+			}
+		}
+
+		if (headless && !saveFramesPrefix.empty()) {
+			const uint32_t readback = G.addPass("Readback", 0, [this](VkCommandBuffer cb, uint32_t i) {
+				recordReadback(cb, i);
+				});
+			G.use(readback, rgSwap, RG_TRANSFER_SRC);
+			G.setSideEffect(readback);
+		}
+
+		G.compile();
+	}
+
+	// Size dependent: the graph's attachments, with the swap chain images it
+	// writes. Needs the image views of the swap chain.
+	void createAttachments() {
+		frameGraph.setImported(rgSwap, swapChainImages, swapChainImageViews);
+		frameGraph.allocate(swapChainExtent);
+		colorImageView = rgColor != UINT32_MAX ? frameGraph.view(rgColor) : VK_NULL_HANDLE;
+		depthImageView = frameGraph.view(rgDepth);
+		sceneColorImageView = aaPost != AA_POST_NONE ? frameGraph.view(rgTarget) : VK_NULL_HANDLE;
+		for (uint32_t i = 0; i < GBUFFER_ATTACHMENTS && deferredSupported; i++) {
+			gbufferImageViews[i] = frameGraph.view(rgGBuffer[i]);
+		}
+
+		if (!graphDumpFile.empty()) {
+			frameGraph.dump(std::cout);
+			if (!frameGraph.writeDot(graphDumpFile)) {
+				std::cout << "Cannot write <" << graphDumpFile << ">\n";
+			}
+		}
+	}
+
+	// Attachment layouts, store ops and external dependencies come from the
+	// frame graph; the dependencies between subpasses are written here.
 	void createRenderPass() {
+		declareFrameGraph();
+		const RenderGraph& G = frameGraph;
+		const bool resolve = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+
 		VkAttachmentDescription colorAttachmentResolve{};
 		colorAttachmentResolve.format = swapChainImageFormat;
 		colorAttachmentResolve.samples = VK_SAMPLE_COUNT_1_BIT;
 		colorAttachmentResolve.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		colorAttachmentResolve.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		colorAttachmentResolve.storeOp = G.storeOp(rgMain, rgTarget);
 		colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		colorAttachmentResolve.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		colorAttachmentResolve.initialLayout = G.initialLayout(rgMain, rgTarget);
+		colorAttachmentResolve.finalLayout = G.finalLayout(rgMain, rgTarget);
 
 		VkAttachmentReference colorAttachmentResolveRef{};
 		colorAttachmentResolveRef.attachment = 2;
@@ -995,12 +2103,11 @@ protected:
 		depthAttachment.format = findDepthFormat();
 		depthAttachment.samples = msaaSamples;
 		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depthAttachment.storeOp = G.storeOp(rgMain, rgDepth);
 		depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		depthAttachment.finalLayout =
-			VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		depthAttachment.initialLayout = G.initialLayout(rgMain, rgDepth);
+		depthAttachment.finalLayout = G.finalLayout(rgMain, rgDepth);
 
 		VkAttachmentReference depthAttachmentRef{};
 		depthAttachmentRef.attachment = 1;
@@ -1010,12 +2117,13 @@ protected:
 		VkAttachmentDescription colorAttachment{};
 		colorAttachment.format = swapChainImageFormat;
 		colorAttachment.samples = msaaSamples;
+		const uint32_t rgColorAttachment = resolve ? rgColor : rgTarget;
 		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		colorAttachment.storeOp = G.storeOp(rgMain, rgColorAttachment);
 		colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		colorAttachment.initialLayout = G.initialLayout(rgMain, rgColorAttachment);
+		colorAttachment.finalLayout = G.finalLayout(rgMain, rgColorAttachment);
 
 		VkAttachmentReference colorAttachmentRef{};
 		colorAttachmentRef.attachment = 0;
@@ -1027,28 +2135,98 @@ protected:
 		subpass.colorAttachmentCount = 1;
 		subpass.pColorAttachments = &colorAttachmentRef;
 		subpass.pDepthStencilAttachment = &depthAttachmentRef;
-		subpass.pResolveAttachments = &colorAttachmentResolveRef;
-
-		VkSubpassDependency dependency{};
-		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-		dependency.dstSubpass = 0;
-		dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.srcAccessMask = 0;
-		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		subpass.pResolveAttachments = resolve ? &colorAttachmentResolveRef : nullptr;
 
-		std::array<VkAttachmentDescription, 3> attachments =
-		{ colorAttachment, depthAttachment,
-		 colorAttachmentResolve };
+		std::vector<VkAttachmentDescription> attachments =
+		{ colorAttachment, depthAttachment };
+		if (resolve) {
+			attachments.push_back(colorAttachmentResolve);
+		}
+		std::vector<VkSubpassDescription> subpasses;
+
+		// Deferred: the G-buffer subpass writes the color (ambient and emission),
+		// the G-buffer and the depth; the lighting subpass adds the lights to the
+		// color, reading the others; the forward subpass is the one above. The
+		// G-buffer is neither loaded nor stored: only pixels covered in this frame
+		// are ever read.
+		std::array<VkAttachmentReference, 1 + GBUFFER_ATTACHMENTS> gbufferRefs{};
+		std::array<VkAttachmentReference, GBUFFER_ATTACHMENTS + 1> lightingInputRefs{};
+		if (deferredSupported) {
+			gbufferRefs[0] = colorAttachmentRef;
+			for (uint32_t i = 0; i < GBUFFER_ATTACHMENTS; i++) {
+				VkAttachmentDescription gbufferAttachment = colorAttachment;
+				gbufferAttachment.format = gbufferFormats[i];
+				gbufferAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+				gbufferAttachment.storeOp = G.storeOp(rgMain, rgGBuffer[i]);
+				gbufferAttachment.initialLayout = G.initialLayout(rgMain, rgGBuffer[i]);
+				gbufferAttachment.finalLayout = G.finalLayout(rgMain, rgGBuffer[i]);
+				attachments.push_back(gbufferAttachment);
+
+				const uint32_t a = gbufferAttachmentBase() + i;
+				gbufferRefs[1 + i] = { a, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+				lightingInputRefs[i] = { a, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+			}
+			lightingInputRefs[GBUFFER_ATTACHMENTS] = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+
+			VkSubpassDescription gbufferSubpass{};
+			gbufferSubpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+			gbufferSubpass.colorAttachmentCount = static_cast<uint32_t>(gbufferRefs.size());
+			gbufferSubpass.pColorAttachments = gbufferRefs.data();
+			gbufferSubpass.pDepthStencilAttachment = &depthAttachmentRef;
+			subpasses.push_back(gbufferSubpass);
+
+			VkSubpassDescription lightingSubpass{};
+			lightingSubpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+			lightingSubpass.inputAttachmentCount = static_cast<uint32_t>(lightingInputRefs.size());
+			lightingSubpass.pInputAttachments = lightingInputRefs.data();
+			lightingSubpass.colorAttachmentCount = 1;
+			lightingSubpass.pColorAttachments = &colorAttachmentRef;
+			subpasses.push_back(lightingSubpass);
+		}
+		subpasses.push_back(subpass);
+
+		std::vector<VkSubpassDependency> dependencies = G.dependencies(rgMain);
+
+		if (deferredSupported) {
+			// G-buffer and depth writes, then input attachment reads at the same pixel
+			VkSubpassDependency gbufferToLighting{};
+			gbufferToLighting.srcSubpass = 0;
+			gbufferToLighting.dstSubpass = 1;
+			gbufferToLighting.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+				VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+			gbufferToLighting.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+				VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+			gbufferToLighting.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+				VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+			gbufferToLighting.dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT |
+				VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+			gbufferToLighting.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+			dependencies.push_back(gbufferToLighting);
+
+			// Lit color and depth reads, then the forward draws on top
+			VkSubpassDependency lightingToForward{};
+			lightingToForward.srcSubpass = 1;
+			lightingToForward.dstSubpass = 2;
+			lightingToForward.srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+				VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+			lightingToForward.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+			lightingToForward.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+				VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+			lightingToForward.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+				VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+				VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+			lightingToForward.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+			dependencies.push_back(lightingToForward);
+		}
 
 		VkRenderPassCreateInfo renderPassInfo{};
 		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
 		renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());;
 		renderPassInfo.pAttachments = attachments.data();
-		renderPassInfo.subpassCount = 1;
-		renderPassInfo.pSubpasses = &subpass;
-		renderPassInfo.dependencyCount = 1;
-		renderPassInfo.pDependencies = &dependency;
+		renderPassInfo.subpassCount = static_cast<uint32_t>(subpasses.size());
+		renderPassInfo.pSubpasses = subpasses.data();
+		renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+		renderPassInfo.pDependencies = dependencies.data();
 
 		VkResult result = vkCreateRenderPass(device, &renderPassInfo, nullptr,
 			&renderPass);
@@ -1056,16 +2234,83 @@ protected:
 			PrintVkError(result);
 			throw std::runtime_error("failed to create render pass!");
 		}
+
+		if (aaPost != AA_POST_NONE) {
+			createAARenderPass();
+		}
+	}
+
+	// Post-process pass: the swap chain image and, with TAA, the next history.
+	// A second subpass draws the overlays onto the finished image. As for the
+	// main pass, the frame graph gives layouts and external dependencies.
+	void createAARenderPass() {
+		const RenderGraph& G = frameGraph;
+		std::vector<VkAttachmentDescription> attachments(aaPost == AA_POST_TAA ? 2 : 1);
+		std::vector<VkAttachmentReference> refs(attachments.size());
+		for (uint32_t a = 0; a < attachments.size(); a++) {
+			const uint32_t image = a == 0 ? rgSwap : rgHistory;
+			attachments[a].format = swapChainImageFormat;
+			attachments[a].samples = VK_SAMPLE_COUNT_1_BIT;
+			attachments[a].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+			attachments[a].storeOp = G.storeOp(rgPost, image);
+			attachments[a].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+			attachments[a].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			attachments[a].initialLayout = G.initialLayout(rgPost, image);
+			attachments[a].finalLayout = G.finalLayout(rgPost, image);
+			refs[a] = { a, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+		}
+
+		VkSubpassDescription subpass{};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = static_cast<uint32_t>(refs.size());
+		subpass.pColorAttachments = refs.data();
+
+		const uint32_t historyAttachment = 1;
+		VkSubpassDescription subpasses[2] = { subpass, subpass };
+		subpasses[1].colorAttachmentCount = 1;
+		subpasses[1].preserveAttachmentCount = aaPost == AA_POST_TAA ? 1 : 0;
+		subpasses[1].pPreserveAttachments = &historyAttachment;
+
+		std::vector<VkSubpassDependency> dependencies = G.dependencies(rgPost);
+		// The overlays blend over the image written by the post pass
+		VkSubpassDependency overlays{};
+		overlays.srcSubpass = 0;
+		overlays.dstSubpass = 1;
+		overlays.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		overlays.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		overlays.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		overlays.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		overlays.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+		dependencies.push_back(overlays);
+
+		VkRenderPassCreateInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+		renderPassInfo.pAttachments = attachments.data();
+		renderPassInfo.subpassCount = 2;
+		renderPassInfo.pSubpasses = subpasses;
+		renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+		renderPassInfo.pDependencies = dependencies.data();
+
+		VkResult result = vkCreateRenderPass(device, &renderPassInfo, nullptr, &aaRenderPass);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to create anti-aliasing render pass!");
+		}
 	}
 
 	void createFramebuffers() {
 		swapChainFramebuffers.resize(swapChainImageViews.size());
 		for (size_t i = 0; i < swapChainImageViews.size(); i++) {
-			std::array<VkImageView, 3> attachments = {
-				colorImageView,
-				depthImageView,
-				swapChainImageViews[i]
-			};
+			const VkImageView target = aaPost != AA_POST_NONE ? sceneColorImageView : swapChainImageViews[i];
+			std::vector<VkImageView> attachments = { colorImageView, depthImageView, target };
+			if (msaaSamples == VK_SAMPLE_COUNT_1_BIT) {
+				attachments = { target, depthImageView };
+			}
+			if (deferredSupported) {
+				attachments.insert(attachments.end(), gbufferImageViews,
+					gbufferImageViews + GBUFFER_ATTACHMENTS);
+			}
 
 			VkFramebufferCreateInfo framebufferInfo{};
 			framebufferInfo.sType =
@@ -1094,7 +2339,8 @@ protected:
 		VkCommandPoolCreateInfo poolInfo{};
 		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-		poolInfo.flags = 0; // Optional
+		// Command buffers are re-recorded every frame
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
 		VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
 		if (result != VK_SUCCESS) {
@@ -1103,33 +2349,214 @@ protected:
 		}
 	}
 
-	void createColorResources() {
-		VkFormat colorFormat = swapChainImageFormat;
-		createImage(swapChainExtent.width, swapChainExtent.height, 1, 1,
-			msaaSamples, colorFormat, VK_IMAGE_TILING_OPTIMAL,
-			VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT |
-			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, 0,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			colorImage, colorImageMemory);
-		colorImageView = createImageView(colorImage, colorFormat,
-			VK_IMAGE_ASPECT_COLOR_BIT, 1,
-			VK_IMAGE_VIEW_TYPE_2D, 1);
+	// Albedo and specular exponent, normal and gamma, specular color
+	const VkFormat gbufferFormats[GBUFFER_ATTACHMENTS] = { VK_FORMAT_R8G8B8A8_UNORM,
+		VK_FORMAT_R16G16B16A16_SFLOAT, VK_FORMAT_R8G8B8A8_UNORM };
+
+	// Input attachments of the lighting subpass: the G-buffer, then the depth
+	void createGBufferLayout() {
+		if (!deferredSupported) return;
+		gbufferDSL.init(this, {
+			{0, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_SHADER_STAGE_FRAGMENT_BIT},
+			{1, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_SHADER_STAGE_FRAGMENT_BIT},
+			{2, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_SHADER_STAGE_FRAGMENT_BIT},
+			{3, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_SHADER_STAGE_FRAGMENT_BIT}
+			});
 	}
 
-	void createDepthResources() {
-		VkFormat depthFormat = findDepthFormat();
+	// The G-buffer images are the frame graph's (transient: tile based GPUs keep
+	// them on chip). gbufferSet is allocated once and rewritten with the new
+	// views on a resize.
+	void createGBufferSet() {
+		if (!deferredSupported) return;
+		if (gbufferSet == VK_NULL_HANDLE) {
+			descriptorAllocator.allocate(gbufferDSL.descriptorSetLayout, 1, &gbufferSet);
+		}
+		DescriptorData data[GBUFFER_ATTACHMENTS + 1]{};
+		for (uint32_t i = 0; i < GBUFFER_ATTACHMENTS; i++) {
+			data[i].image = { VK_NULL_HANDLE, gbufferImageViews[i], VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+		}
+		data[GBUFFER_ATTACHMENTS].image = { VK_NULL_HANDLE, depthImageView,
+			VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+		gbufferDSL.update(gbufferSet, (1u << (GBUFFER_ATTACHMENTS + 1)) - 1, data);
+	}
 
-		createImage(swapChainExtent.width, swapChainExtent.height, 1, 1,
-			msaaSamples, depthFormat, VK_IMAGE_TILING_OPTIMAL,
-			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, 0,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			depthImage, depthImageMemory);
-		depthImageView = createImageView(depthImage, depthFormat,
-			VK_IMAGE_ASPECT_DEPTH_BIT, 1,
-			VK_IMAGE_VIEW_TYPE_2D, 1);
+	// Post-process pass: its samplers, the set layout (scene color, history,
+	// depth) and its pipelines, built only for the tier that uses them
+	void initAA() {
+		aaDSL.init(this, {
+			{0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT},
+			{1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT},
+			{2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT}
+			});
+
+		VkSamplerCreateInfo samplerInfo{};
+		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		samplerInfo.magFilter = VK_FILTER_LINEAR;
+		samplerInfo.minFilter = VK_FILTER_LINEAR;
+		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		VkResult result = vkCreateSampler(device, &samplerInfo, nullptr, &aaSampler);
+		if (result == VK_SUCCESS) {
+			samplerInfo.magFilter = VK_FILTER_NEAREST;
+			samplerInfo.minFilter = VK_FILTER_NEAREST;
+			result = vkCreateSampler(device, &samplerInfo, nullptr, &aaDepthSampler);
+		}
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to create anti-aliasing samplers!");
+		}
+
+		if (aaPostAvailable[AA_POST_FXAA]) {
+			PFXAA.init(this, nullptr, "shaders/FullscreenVert.spv", "shaders/FXAAFrag.spv", { &aaDSL });
+			PFXAA.setPushConstants(VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(AAPushConstants));
+			PFXAA.setAdvancedFeatures(VK_COMPARE_OP_ALWAYS, VK_POLYGON_MODE_FILL,
+				VK_CULL_MODE_NONE, false);
+		}
+		if (aaPostAvailable[AA_POST_TAA]) {
+			PTAA.init(this, nullptr, "shaders/FullscreenVert.spv", "shaders/TAAFrag.spv", { &aaDSL });
+			PTAA.setPushConstants(VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(AAPushConstants));
+			PTAA.setAdvancedFeatures(VK_COMPARE_OP_ALWAYS, VK_POLYGON_MODE_FILL,
+				VK_CULL_MODE_NONE, false);
+		}
+		if (dynamicResolution) {
+			PUpscale.init(this, nullptr, "shaders/FullscreenVert.spv", "shaders/UpscaleFrag.spv", { &aaDSL });
+			PUpscale.setPushConstants(VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(AAPushConstants));
+			PUpscale.setAdvancedFeatures(VK_COMPARE_OP_ALWAYS, VK_POLYGON_MODE_FILL,
+				VK_CULL_MODE_NONE, false);
+		}
+		gpAA = addGpuPass("Anti-aliasing");
+	}
 
-		transitionImageLayout(depthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED,
-			VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1, 1);
+	// With the pipelines of the application, after a render pass rebuild
+	void createAAPipelines() {
+		aaPipeline = aaPost == AA_POST_FXAA ? &PFXAA : aaPost == AA_POST_TAA ? &PTAA :
+			aaPost == AA_POST_UPSCALE ? &PUpscale : nullptr;
+		if (aaPipeline == nullptr) return;
+		aaPipeline->setRenderPass(aaRenderPass, VK_SAMPLE_COUNT_1_BIT, aaPost == AA_POST_TAA ? 2 : 1);
+		aaPipeline->create();
+	}
+
+	// Size dependent: the two history images, the framebuffers of the post pass
+	// and its sets (sceneColor is the frame graph's). The history starts empty.
+	void createAAResources() {
+		if (aaPost == AA_POST_NONE) return;
+		const VkImageUsageFlags usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
+		const uint32_t histories = aaPost == AA_POST_TAA ? 2 : 0;
+		for (uint32_t h = 0; h < histories; h++) {
+			createImage(swapChainExtent.width, swapChainExtent.height, 1, 1,
+				VK_SAMPLE_COUNT_1_BIT, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL, usage, 0,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				historyImages[h], historyImagesMemory[h]);
+			historyImageViews[h] = createImageView(historyImages[h], swapChainImageFormat,
+				VK_IMAGE_ASPECT_COLOR_BIT, 1, VK_IMAGE_VIEW_TYPE_2D, 1);
+			// Read before it is first written
+			transitionImageLayout(historyImages[h], swapChainImageFormat, VK_IMAGE_LAYOUT_UNDEFINED,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1, 1);
+		}
+		taaHistoryValid = false;
+
+		const uint32_t perImage = std::max(1u, histories);
+		aaFramebuffers.resize(swapChainImageViews.size() * perImage);
+		for (size_t i = 0; i < aaFramebuffers.size(); i++) {
+			const uint32_t h = (uint32_t)(i % perImage);
+			VkImageView attachments[2] = { swapChainImageViews[i / perImage], historyImageViews[h] };
+
+			VkFramebufferCreateInfo framebufferInfo{};
+			framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			framebufferInfo.renderPass = aaRenderPass;
+			framebufferInfo.attachmentCount = histories > 0 ? 2 : 1;
+			framebufferInfo.pAttachments = attachments;
+			framebufferInfo.width = swapChainExtent.width;
+			framebufferInfo.height = swapChainExtent.height;
+			framebufferInfo.layers = 1;
+			VkResult result = vkCreateFramebuffer(device, &framebufferInfo, nullptr, &aaFramebuffers[i]);
+			if (result != VK_SUCCESS) {
+				PrintVkError(result);
+				throw std::runtime_error("failed to create anti-aliasing framebuffer!");
+			}
+		}
+
+		for (uint32_t h = 0; h < perImage; h++) {
+			if (aaSets[h] == VK_NULL_HANDLE) {
+				descriptorAllocator.allocate(aaDSL.descriptorSetLayout, 1, &aaSets[h]);
+			}
+			DescriptorData data[3]{};
+			data[0].image = { aaSampler, sceneColorImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+			if (histories > 0) {
+				data[1].image = { aaSampler, historyImageViews[1 - h], VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+				data[2].image = { aaDepthSampler, depthImageView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+			}
+			aaDSL.update(aaSets[h], histories > 0 ? 7 : 1, data);
+		}
+	}
+
+	void cleanupAAResources() {
+		if (aaPost == AA_POST_NONE) return;
+		for (VkFramebuffer F : aaFramebuffers) {
+			vkDestroyFramebuffer(device, F, nullptr);
+		}
+		aaFramebuffers.clear();
+		if (aaPost == AA_POST_TAA) {
+			for (uint32_t h = 0; h < 2; h++) {
+				vkDestroyImageView(device, historyImageViews[h], nullptr);
+				vkDestroyImage(device, historyImages[h], nullptr);
+				vkFreeMemory(device, historyImagesMemory[h], nullptr);
+			}
+		}
+	}
+
+	// After the main render pass: sceneColor (and the history) to the swap chain
+	// image, then the overlays at full resolution
+	void recordAA(VkCommandBuffer commandBuffer, size_t i) {
+		const uint32_t h = aaPost == AA_POST_TAA ? taaFrame % 2 : 0;
+		const size_t perImage = aaPost == AA_POST_TAA ? 2 : 1;
+
+		VkRenderPassBeginInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = aaRenderPass;
+		renderPassInfo.framebuffer = aaFramebuffers[i * perImage + h];
+		renderPassInfo.renderArea.extent = swapChainExtent;
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+		beginGpuPass(commandBuffer, gpAA, (int)i);
+
+		VkViewport viewport{};
+		viewport.width = (float)swapChainExtent.width;
+		viewport.height = (float)swapChainExtent.height;
+		viewport.maxDepth = 1.0f;
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		VkRect2D scissor{};
+		scissor.extent = swapChainExtent;
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+		const glm::vec2 size((float)swapChainExtent.width, (float)swapChainExtent.height);
+		AAPushConstants C;
+		C.reproject = taaPrevViewPrj * glm::inverse(taaViewPrj);
+		C.texel = glm::vec4(1.0f / size, size);
+		C.params = glm::vec4(taaHistoryValid ? 0.9f : 0.0f, 0.0f, jitterNDC());
+		const glm::vec2 rendered((float)renderExtent.width, (float)renderExtent.height);
+		C.scene = glm::vec4(rendered / size, rendered);
+
+		aaPipeline->bind(commandBuffer);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			aaPipeline->pipelineLayout, 0, 1, &aaSets[h], 0, nullptr);
+		commandStats.descriptorSetBinds++;
+		vkCmdPushConstants(commandBuffer, aaPipeline->pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT,
+			0, sizeof(AAPushConstants), &C);
+		drawVertices(commandBuffer, 3);
+		endGpuPass(commandBuffer, gpAA, (int)i);
+
+		vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+		populateOverlays(commandBuffer, (int)i);
+		vkCmdEndRenderPass(commandBuffer);
+
+		if (aaPost == AA_POST_TAA) {
+			taaFrame++;
+			taaHistoryValid = true;
+		}
 	}
 
 	VkFormat findDepthFormat() {
@@ -1344,6 +2771,13 @@ protected:
 			sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
 			destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
 		}
+		else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
+			newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+			destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		}
 		else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
 			newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
 			barrier.srcAccessMask = 0;
@@ -1466,30 +2900,38 @@ protected:
 		throw std::runtime_error("failed to find suitable memory type!");
 	}
 
-	void createDescriptorPool() {
-		std::array<VkDescriptorPoolSize, 2> poolSizes{};
-		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		poolSizes[0].descriptorCount = static_cast<uint32_t>(uniformBlocksInPool *
-			swapChainImages.size());
-		poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		poolSizes[1].descriptorCount = static_cast<uint32_t>(texturesInPool *
-			swapChainImages.size());
-
-		VkDescriptorPoolCreateInfo poolInfo{};
-		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());;
-		poolInfo.pPoolSizes = poolSizes.data();
-		poolInfo.maxSets = static_cast<uint32_t>(setsInPool * swapChainImages.size());
-
-		VkResult result = vkCreateDescriptorPool(device, &poolInfo, nullptr,
-			&descriptorPool);
-		if (result != VK_SUCCESS) {
-			PrintVkError(result);
-			throw std::runtime_error("failed to create descriptor pool!");
+	void createDescriptorAllocators() {
+		descriptorAllocator.init(device, 16 * static_cast<uint32_t>(swapChainImages.size()));
+		frameDescriptorAllocators.resize(framesInFlight);
+		for (DescriptorAllocator& A : frameDescriptorAllocators) {
+			A.init(device, 16);
 		}
 	}
 
 	virtual void populateCommandBuffer(VkCommandBuffer commandBuffer, int i) = 0;
+	// Deferred only: the draws of the G-buffer and of the lighting subpasses.
+	// populateCommandBuffer() then records the forward subpass.
+	virtual void populateGBuffer(VkCommandBuffer, int) {}
+	virtual void populateLighting(VkCommandBuffer, int) {}
+	// Outside the main render pass, before it: passes of their own (e.g. shadow maps)
+	virtual void populateBeforeRenderPass(VkCommandBuffer, int) {}
+	// Screen space draws, at full resolution and after any post pass: at the end
+	// of the forward subpass, or in the overlay subpass of the post pass. Their
+	// pipelines call Pipeline::setOverlay().
+	virtual void populateOverlays(VkCommandBuffer, int) {}
+
+	// Binds gbufferSet as set setId of P (lighting subpass)
+	void bindGBuffer(VkCommandBuffer commandBuffer, Pipeline& P, uint32_t setId) {
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			P.pipelineLayout, setId, 1, &gbufferSet, 0, nullptr);
+		commandStats.descriptorSetBinds++;
+	}
+
+	// Draws without vertex buffers, e.g. a full screen triangle
+	void drawVertices(VkCommandBuffer commandBuffer, uint32_t vertexCount) {
+		vkCmdDraw(commandBuffer, vertexCount, 1, 0, 0);
+		commandStats.draws++;
+	}
 
 	void createCommandBuffers() {
 		commandBuffers.resize(swapChainFramebuffers.size());
@@ -1508,94 +2950,414 @@ protected:
 		}
 
 		for (size_t i = 0; i < commandBuffers.size(); i++) {
-			VkCommandBufferBeginInfo beginInfo{};
-			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			beginInfo.flags = 0; // Optional
-			beginInfo.pInheritanceInfo = nullptr; // Optional
-
-			if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) !=
-				VK_SUCCESS) {
-				throw std::runtime_error("failed to begin recording command buffer!");
-			}
-
-			VkRenderPassBeginInfo renderPassInfo{};
-			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-			renderPassInfo.renderPass = renderPass;
-			renderPassInfo.framebuffer = swapChainFramebuffers[i];
-			renderPassInfo.renderArea.offset = { 0, 0 };
-			renderPassInfo.renderArea.extent = swapChainExtent;
+			recordCommandBuffer(i);
+		}
+	}
 
-			std::array<VkClearValue, 2> clearValues{};
-			clearValues[0].color = initialBackgroundColor;
-			clearValues[1].depthStencil = { 1.0f, 0 };
+	// Records the render pass of swap chain image i. Called again every frame
+	// after updateUniformBuffer(), so the application can change what it draws
+	// (e.g. after culling) without rebuilding the command buffers.
+	void recordCommandBuffer(size_t i) {
+		PROFILE_FUNCTION();
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = 0; // Optional
+		beginInfo.pInheritanceInfo = nullptr; // Optional
 
-			renderPassInfo.clearValueCount =
-				static_cast<uint32_t>(clearValues.size());
-			renderPassInfo.pClearValues = clearValues.data();
+		if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) !=
+			VK_SUCCESS) {
+			throw std::runtime_error("failed to begin recording command buffer!");
+		}
 
-			vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo,
-				VK_SUBPASS_CONTENTS_INLINE);
+		resetGpuQueries(commandBuffers[i], i);
+		commandStats = CommandStats();
 
+		frameGraph.execute(commandBuffers[i], (uint32_t)i);
 
-			populateCommandBuffer(commandBuffers[i], i);
+		if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record command buffer!");
+		}
+	}
 
+	// The main render pass, pass "Main" of the frame graph
+	void recordMainPass(VkCommandBuffer commandBuffer, uint32_t i) {
+		VkRenderPassBeginInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = renderPass;
+		renderPassInfo.framebuffer = swapChainFramebuffers[i];
+		renderPassInfo.renderArea.offset = { 0, 0 };
+		renderPassInfo.renderArea.extent = renderExtent;
+
+		std::array<VkClearValue, 2> clearValues{};
+		clearValues[0].color = initialBackgroundColor;
+		clearValues[1].depthStencil = { 1.0f, 0 };
+
+		renderPassInfo.clearValueCount =
+			static_cast<uint32_t>(clearValues.size());
+		renderPassInfo.pClearValues = clearValues.data();
+
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
+			VK_SUBPASS_CONTENTS_INLINE);
+
+		// The scene covers renderExtent, smaller than the attachments under
+		// dynamic resolution
+		VkViewport viewport{};
+		viewport.width = (float)renderExtent.width;
+		viewport.height = (float)renderExtent.height;
+		viewport.maxDepth = 1.0f;
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		VkRect2D scissor{};
+		scissor.extent = renderExtent;
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+
+		if (deferredSupported) {
+			populateGBuffer(commandBuffer, i);
+			vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+			populateLighting(commandBuffer, i);
+			vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+		}
+		populateCommandBuffer(commandBuffer, i);
+		if (aaPost == AA_POST_NONE) {
+			populateOverlays(commandBuffer, i);
+		}
 
-			vkCmdEndRenderPass(commandBuffers[i]);
 
-			if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-				throw std::runtime_error("failed to record command buffer!");
-			}
-		}
+		vkCmdEndRenderPass(commandBuffer);
 	}
 
 	void createSyncObjects() {
-		imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-		renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-		inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-		imagesInFlight.resize(swapChainImages.size(), VK_NULL_HANDLE);
+		imageAvailableSemaphores.resize(framesInFlight);
+		renderFinishedSemaphores.resize(framesInFlight);
+		frameSlotValues.assign(framesInFlight, 0);
+		imageTimelineValues.assign(swapChainImages.size(), 0);
 
 		VkSemaphoreCreateInfo semaphoreInfo{};
 		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-		VkFenceCreateInfo fenceInfo{};
-		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		for (int i = 0; i < framesInFlight; i++) {
 			VkResult result1 = vkCreateSemaphore(device, &semaphoreInfo, nullptr,
 				&imageAvailableSemaphores[i]);
 			VkResult result2 = vkCreateSemaphore(device, &semaphoreInfo, nullptr,
 				&renderFinishedSemaphores[i]);
-			VkResult result3 = vkCreateFence(device, &fenceInfo, nullptr,
-				&inFlightFences[i]);
 			if (result1 != VK_SUCCESS ||
-				result2 != VK_SUCCESS ||
-				result3 != VK_SUCCESS) {
+				result2 != VK_SUCCESS) {
 				PrintVkError(result1);
 				PrintVkError(result2);
-				PrintVkError(result3);
 				throw std::runtime_error("failed to create synchronization objects for a frame!!");
 			}
 		}
+
+		VkSemaphoreTypeCreateInfo timelineInfo{};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+		timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+		timelineInfo.initialValue = 0;
+		semaphoreInfo.pNext = &timelineInfo;
+
+		VkResult result = vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frameTimeline);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to create frame timeline semaphore!");
+		}
+
+		timelineWatcherStop = false;
+		timelineWatcher = std::thread(&BaseProject::watchTimeline, this);
+	}
+
+	// Follows the frame timeline from a separate thread, so the moment the GPU
+	// finishes each frame is seen when it happens and not when drawFrame next looks.
+	// Waiting on values that have not been submitted yet is allowed for timelines.
+	void watchTimeline() {
+		uint64_t done = 0;
+		while (!timelineWatcherStop) {
+			const uint64_t next = done + 1;
+			VkSemaphoreWaitInfo waitInfo{};
+			waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+			waitInfo.semaphoreCount = 1;
+			waitInfo.pSemaphores = &frameTimeline;
+			waitInfo.pValues = &next;
+
+			VkResult result = vkWaitSemaphores(device, &waitInfo, 100000000);	// 100 ms
+			if (result == VK_TIMEOUT) {
+				continue;
+			}
+			if (result != VK_SUCCESS ||
+				vkGetSemaphoreCounterValue(device, frameTimeline, &done) != VK_SUCCESS) {
+				PrintVkError(result);
+				return;
+			}
+			framePacer.frameCompleted(done);
+		}
+	}
+
+	// Blocks until the GPU has finished the frame that signalled value
+	void waitTimeline(uint64_t value) {
+		if (value == 0) return;
+		PROFILE_ZONE("Timeline wait");
+		const auto start = std::chrono::steady_clock::now();
+
+		VkSemaphoreWaitInfo waitInfo{};
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &frameTimeline;
+		waitInfo.pValues = &value;
+
+		VkResult result = vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to wait for frame timeline!");
+		}
+		timelineWaitMs += std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - start).count();
+	}
+
+	void checkQuerySupport() {
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+		pipelineStatisticsSupported = supportedFeatures.pipelineStatisticsQuery;
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		timestampPeriod = properties.limits.timestampPeriod;
+
+		uint32_t queueFamilyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
+			queueFamilies.data());
+		const uint32_t bits =
+			queueFamilies[findQueueFamilies(physicalDevice).graphicsFamily.value()].timestampValidBits;
+		timestampsSupported = bits > 0;
+		timestampMask = bits >= 64 ? ~0ull : ((1ull << bits) - 1);
+
+		std::cout << "GPU timestamps: " << timestampsSupported
+			<< ", pipeline statistics: " << pipelineStatisticsSupported << "\n";
+	}
+
+	void checkBindlessSupport() {
+		bindlessSupported = false;
+		maxBindlessTextures = 0;
+		if (!getOptionBool("bindless", true)) return;
+
+		VkPhysicalDeviceVulkan12Features features12{};
+		features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+		VkPhysicalDeviceFeatures2 features2{};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = &features12;
+		vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		const VkPhysicalDeviceLimits& L = properties.limits;
+		// The array shares the fragment stage with a few other samplers
+		const uint32_t limit = std::min({ L.maxPerStageDescriptorSamplers,
+			L.maxPerStageDescriptorSampledImages, L.maxDescriptorSetSamplers,
+			L.maxDescriptorSetSampledImages });
+		maxBindlessTextures = std::min(4096u, limit > 8 ? limit - 8 : 0u);
+
+		bindlessSupported = features2.features.shaderSampledImageArrayDynamicIndexing &&
+			features12.runtimeDescriptorArray && features12.descriptorBindingPartiallyBound &&
+			features12.descriptorBindingVariableDescriptorCount && maxBindlessTextures > 0;
+		std::cout << "Bindless textures: " << bindlessSupported
+			<< " (up to " << maxBindlessTextures << ")\n";
+	}
+
+	// Sized on the swap chain, so they are rebuilt with it
+	void createQueryPools() {
+		destroyQueryPools();
+		const uint32_t images = static_cast<uint32_t>(swapChainImages.size());
+		gpuPassesWritten.assign(images, 0);
+
+		VkQueryPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		if (timestampsSupported) {
+			poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+			poolInfo.queryCount = images * MAX_GPU_PASSES * 2;
+			VkResult result = vkCreateQueryPool(device, &poolInfo, nullptr, &timestampQueryPool);
+			if (result != VK_SUCCESS) {
+				PrintVkError(result);
+				throw std::runtime_error("failed to create timestamp query pool!");
+			}
+		}
+		if (pipelineStatisticsSupported) {
+			poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+			poolInfo.queryCount = images * MAX_GPU_PASSES;
+			poolInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+				VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+			VkResult result = vkCreateQueryPool(device, &poolInfo, nullptr, &statisticsQueryPool);
+			if (result != VK_SUCCESS) {
+				PrintVkError(result);
+				throw std::runtime_error("failed to create pipeline statistics query pool!");
+			}
+		}
+	}
+
+	void destroyQueryPools() {
+		if (timestampQueryPool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(device, timestampQueryPool, nullptr);
+			timestampQueryPool = VK_NULL_HANDLE;
+		}
+		if (statisticsQueryPool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(device, statisticsQueryPool, nullptr);
+			statisticsQueryPool = VK_NULL_HANDLE;
+		}
+	}
+
+	// Queries must be reset outside of the render pass
+	void resetGpuQueries(VkCommandBuffer commandBuffer, size_t currentImage) {
+		const uint32_t image = static_cast<uint32_t>(currentImage);
+		if (timestampQueryPool != VK_NULL_HANDLE) {
+			vkCmdResetQueryPool(commandBuffer, timestampQueryPool,
+				image * MAX_GPU_PASSES * 2, MAX_GPU_PASSES * 2);
+		}
+		if (statisticsQueryPool != VK_NULL_HANDLE) {
+			vkCmdResetQueryPool(commandBuffer, statisticsQueryPool,
+				image * MAX_GPU_PASSES, MAX_GPU_PASSES);
+		}
+		gpuPassesWritten[image] = 0;
+	}
+
+	// Collects the results of the last frame rendered to this image; its commands
+	// are known to be complete, so this never waits. That frame is usually a swap
+	// chain length old: gpuFrameLag counts how many.
+	void readGpuQueries(uint32_t currentImage) {
+		const uint32_t written = gpuPassesWritten[currentImage];
+		gpuFrameLag = written == 0 ? 0 :
+			static_cast<uint32_t>(frameTimelineValue + 1 - imageTimelineValues[currentImage]);
+		uint64_t frameBegin = UINT64_MAX, frameEnd = 0;
+		for (uint32_t p = 0; p < gpuPasses.size(); p++) {
+			if (!(written & (1u << p))) continue;
+			GpuPass& pass = gpuPasses[p];
+
+			if (timestampQueryPool != VK_NULL_HANDLE) {
+				uint64_t ts[2];
+				if (vkGetQueryPoolResults(device, timestampQueryPool,
+					(currentImage * MAX_GPU_PASSES + p) * 2, 2, sizeof(ts), ts, sizeof(uint64_t),
+					VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+					pass.ms = ((ts[1] - ts[0]) & timestampMask) * timestampPeriod / 1000000.0;
+					PROFILE_COUNTER(pass.timeCounter, pass.ms);
+					frameBegin = std::min(frameBegin, ts[0]);
+					frameEnd = std::max(frameEnd, ts[1]);
+				}
+			}
+			if (statisticsQueryPool != VK_NULL_HANDLE) {
+				uint64_t stats[2];	// in the order of the flag bits: vertex, fragment
+				if (vkGetQueryPoolResults(device, statisticsQueryPool,
+					currentImage * MAX_GPU_PASSES + p, 1, sizeof(stats), stats, sizeof(stats),
+					VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+					pass.vertexInvocations = stats[0];
+					pass.fragmentInvocations = stats[1];
+					PROFILE_COUNTER(pass.vertexCounter, pass.vertexInvocations);
+					PROFILE_COUNTER(pass.fragmentCounter, pass.fragmentInvocations);
+				}
+			}
+		}
+		gpuFrameMs = frameEnd > frameBegin ?
+			((frameEnd - frameBegin) & timestampMask) * timestampPeriod / 1000000.0 : 0.0;
 	}
 
 	void mainLoop() {
-		while (!glfwWindowShouldClose(window)) {
-			glfwPollEvents();
+		const auto startTime = std::chrono::steady_clock::now();
+		while (!shouldClose()) {
+			PROFILE_FRAME();
+			// Cap the frame rate before polling, so the input is as fresh as possible
+			{
+				PROFILE_ZONE("Frame cap");
+				framePacer.waitForNextFrame();
+			}
+			pollEvents();
+			if (renderOnDemand && window != nullptr && !waitForChange()) {
+				break;
+			}
+			framePacer.inputSampled();
 			drawFrame();
+			framesDrawn++;
 		}
 
 		vkDeviceWaitIdle(device);
+		if (renderOnDemand && window != nullptr) {
+			const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+				startTime).count();
+			std::cout << "Render on demand: " << framesDrawn << " frames drawn, " << framesSkipped
+				<< " skipped, idle " << idleSeconds << " s of " << seconds << " s ("
+				<< 100.0 * idleSeconds / std::max(seconds, 0.001) << "%)\n";
+		}
+	}
+
+	// Whether the next frame would differ from the last one
+	bool frameDue() {
+		glm::vec3 m(0.0f), r(0.0f);
+		bool held = inputsHeld > 0;
+		for (int j = GLFW_JOYSTICK_1; j <= GLFW_JOYSTICK_4; j++) {
+			handleGamePad(j, m, r, held);
+		}
+		held |= m != glm::vec3(0.0f) || r != glm::vec3(0.0f);
+
+		if (held || redrawRequested || framebufferResized || aaTierPending != UINT32_MAX ||
+			nextFrameDue() <= 0.0) {
+			redrawRequested = false;
+			settleFrames = aaPost == AA_POST_TAA ? 32 : framesInFlight + 1;
+			return true;
+		}
+		if (settleFrames > 0) {
+			settleFrames--;
+			return true;
+		}
+		return false;
+	}
+
+	// Render on demand: blocks while the next frame would repeat the last one.
+	// False if the window is closed meanwhile.
+	bool waitForChange() {
+		if (frameDue()) return true;
+		PROFILE_ZONE("Idle");
+		const auto start = std::chrono::steady_clock::now();
+		uint64_t skipped = 0;
+		do {
+			skipped++;
+			// Gamepads send no events: poll them every 50 ms while one is connected
+			double timeout = nextFrameDue();
+			for (int j = GLFW_JOYSTICK_1; j <= GLFW_JOYSTICK_4; j++) {
+				if (glfwJoystickIsGamepad(j)) timeout = std::min(timeout, 0.05);
+			}
+			if (timeout == std::numeric_limits<double>::infinity()) {
+				glfwWaitEvents();
+			}
+			else {
+				glfwWaitEventsTimeout(std::max(timeout, 0.001));
+			}
+		} while (!shouldClose() && !frameDue());
+
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		idleSeconds += seconds;
+		idleSinceInput += (float)seconds;
+		framesSkipped += skipped;
+		framePacer.idled(seconds, skipped);
+		// The mouse may have moved meanwhile: rotate only by what follows
+		glfwGetCursorPos(window, &cursorX, &cursorY);
+		return !shouldClose();
 	}
 
 	void drawFrame() {
-		vkWaitForFences(device, 1, &inFlightFences[currentFrame],
-			VK_TRUE, UINT64_MAX);
+		PROFILE_FUNCTION();
+		const auto frameStart = std::chrono::steady_clock::now();
+		lastFrameStart = frameStart;
+		timelineWaitMs = 0.0;
+		// The frame that last used this slot must be done with its semaphores
+		waitTimeline(frameSlotValues[currentFrame]);
+		frameDescriptorAllocators[currentFrame].reset();
 
 		uint32_t imageIndex;
-
-		VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX,
-			imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+		VkResult result = VK_SUCCESS;
+		if (headless) {
+			imageIndex = headlessImage;
+			headlessImage = (headlessImage + 1) % swapChainImages.size();
+		}
+		else {
+			PROFILE_ZONE("Acquire");
+			result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX,
+				imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+		}
 
 		if (result == VK_ERROR_OUT_OF_DATE_KHR) {
 			recreateSwapChain();
@@ -1605,33 +3367,84 @@ protected:
 			throw std::runtime_error("failed to acquire swap chain image!");
 		}
 
-		if (imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
-			vkWaitForFences(device, 1, &imagesInFlight[imageIndex],
-				VK_TRUE, UINT64_MAX);
-		}
-		imagesInFlight[imageIndex] = inFlightFences[currentFrame];
+		// ... and the last frame rendered to this image with its command buffer and uniforms
+		waitTimeline(imageTimelineValues[imageIndex]);
+		readGpuQueries(imageIndex);
+		saveFrame(imageIndex);
+		updateRenderScale();
 
 		updateUniformBuffer(imageIndex);
 
+		// The timeline wait above guarantees this buffer is no longer in use
+		vkResetCommandBuffer(commandBuffers[imageIndex], 0);
+		recordCommandBuffer(imageIndex);
+
 		VkSubmitInfo submitInfo{};
 		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 		VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[currentFrame] };
 		VkPipelineStageFlags waitStages[] =
 		{ VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-		submitInfo.waitSemaphoreCount = 1;
+		submitInfo.waitSemaphoreCount = headless ? 0 : 1;
 		submitInfo.pWaitSemaphores = waitSemaphores;
 		submitInfo.pWaitDstStageMask = waitStages;
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
-		VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame] };
-		submitInfo.signalSemaphoreCount = 1;
-		submitInfo.pSignalSemaphores = signalSemaphores;
+		// Everything but the camera was computed from the input sampled at the start
+		// of the frame: sample it again and let the application update the camera,
+		// since the GPU reads those uniforms only after the submit
+		if (lateLatch) {
+			PROFILE_ZONE("Late latch");
+			pollEvents();
+			framePacer.inputSampled();
+			lateLatchUniforms(imageIndex);
+		}
 
-		vkResetFences(device, 1, &inFlightFences[currentFrame]);
+		// The binary semaphore is for the present, the timeline for the CPU.
+		// Headless frames are not presented and signal only the timeline.
+		const uint64_t frameValue = frameTimelineValue + 1;
+		VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame], frameTimeline };
+		uint64_t signalValues[] = { 0, frameValue };
+		const uint32_t firstSignal = headless ? 1 : 0;
+		submitInfo.signalSemaphoreCount = 2 - firstSignal;
+		submitInfo.pSignalSemaphores = signalSemaphores + firstSignal;
+
+		VkTimelineSemaphoreSubmitInfo timelineInfo{};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.signalSemaphoreValueCount = 2 - firstSignal;
+		timelineInfo.pSignalSemaphoreValues = signalValues + firstSignal;
+		submitInfo.pNext = &timelineInfo;
+
+		{
+			PROFILE_ZONE("Submit");
+			if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+				throw std::runtime_error("failed to submit draw command buffer!");
+			}
+		}
+		frameTimelineValue = frameValue;
+		frameSlotValues[currentFrame] = frameValue;
+		imageTimelineValues[imageIndex] = frameValue;
+		framePacer.frameSubmitted(frameValue);
+		if (collectFrameStats) {
+			const auto now = std::chrono::steady_clock::now();
+			const double cpuMs = std::chrono::duration<double, std::milli>(now - frameStart).count() - timelineWaitMs;
+			const double frameMs = lastSubmit.time_since_epoch().count() == 0 ? 0.0 :
+				std::chrono::duration<double, std::milli>(now - lastSubmit).count();
+			frameStats.add(cpuMs, gpuFrameMs, frameMs, commandStats);
+			lastSubmit = now;
+		}
 
-		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo,
-			inFlightFences[currentFrame]) != VK_SUCCESS) {
-			throw std::runtime_error("failed to submit draw command buffer!");
+		if (headless) {
+			if (!readbackFrames.empty()) {
+				readbackFrames[imageIndex] = (int64_t)headlessFrameCount;
+			}
+			headlessFrameCount++;
+			if (framebufferResized) {
+				framebufferResized = false;
+				recreateSwapChain();
+			}
+			currentFrame = (currentFrame + 1) % framesInFlight;
+			framePacer.report("headless", framesInFlight);
+			return;
 		}
 
 		VkPresentInfoKHR presentInfo{};
@@ -1645,7 +3458,10 @@ protected:
 		presentInfo.pImageIndices = &imageIndex;
 		presentInfo.pResults = nullptr; // Optional
 
-		result = vkQueuePresentKHR(presentQueue, &presentInfo);
+		{
+			PROFILE_ZONE("Present");
+			result = vkQueuePresentKHR(presentQueue, &presentInfo);
+		}
 
 		if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR ||
 			framebufferResized) {
@@ -1656,7 +3472,8 @@ protected:
 			throw std::runtime_error("failed to present swap chain image!");
 		}
 
-		currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+		currentFrame = (currentFrame + 1) % framesInFlight;
+		framePacer.report(presentModeName(activePresentMode), framesInFlight);
 	}
 
 	virtual void updateUniformBuffer(uint32_t currentImage) = 0;
@@ -1665,58 +3482,118 @@ protected:
 	virtual void localCleanup() = 0;
 
 	void recreateSwapChain() {
+		PROFILE_FUNCTION();
+		const auto start = std::chrono::steady_clock::now();
+		// Wait while the window is minimized
 		int width = 0, height = 0;
-		glfwGetFramebufferSize(window, &width, &height);
-
-		while (width == 0 || height == 0) {
+		while (!headless && (width == 0 || height == 0)) {
 			glfwGetFramebufferSize(window, &width, &height);
-			glfwWaitEvents();
+			if (width == 0 || height == 0) {
+				glfwWaitEvents();
+			}
 		}
 
 		vkDeviceWaitIdle(device);
 
-		cleanupSwapChain();
+		// The new swap chain is created from the old one, then only the size
+		// dependent resources are rebuilt. The render pass, the pipelines (their
+		// viewport and scissor are dynamic), the descriptor sets and the uniform
+		// buffers stay, unless the image count or format changed.
+		const size_t oldImageCount = swapChainImages.size();
+		const VkFormat oldFormat = swapChainImageFormat;
+		cleanupSizeDependent();
+		// A new anti-aliasing tier changes the render passes and the pipelines
+		const bool aaChanged = aaTierPending != UINT32_MAX;
+		if (aaChanged) {
+			cleanupPerImage();
+			applyAATier(aaTierPending);
+			aaTierPending = UINT32_MAX;
+		}
+		if (headless) {
+			destroyOffscreenImages();
+			createSwapChain();
+		}
+		else {
+			VkSwapchainKHR oldSwapChain = swapChain;
+			createSwapChain(oldSwapChain);
+			vkDestroySwapchainKHR(device, oldSwapChain, nullptr);
+		}
+		imageTimelineValues.assign(swapChainImages.size(), 0);
+
+		const bool keepPipelines = swapChainImages.size() == oldImageCount &&
+			swapChainImageFormat == oldFormat && !aaChanged;
+		if (!keepPipelines) {
+			if (!aaChanged) cleanupPerImage();
+			createRenderPass();
+		}
 
-		createSwapChain();
 		createImageViews();
-		createRenderPass();
-		createColorResources();
-		createDepthResources();
+		createAttachments();
+		createGBufferSet();
 		createFramebuffers();
-		createDescriptorPool();
+		createAAResources();
 
-		pipelinesAndDescriptorSetsInit();
+		if (!keepPipelines) {
+			deferPipelines = true;
+			pipelinesAndDescriptorSetsInit();
+			createAAPipelines();
+			createPendingPipelines();
 
-		createCommandBuffers();
-	}
+			createCommandBuffers();
+			createQueryPools();
+		}
 
-	void cleanupSwapChain() {
-		vkDestroyImageView(device, colorImageView, nullptr);
-		vkDestroyImage(device, colorImage, nullptr);
-		vkFreeMemory(device, colorImageMemory, nullptr);
+		std::cout << "Swap chain recreated in " << std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - start).count() << " ms ("
+			<< (keepPipelines ? "pipelines and descriptor sets kept" : "full rebuild") << ")\n";
+	}
 
-		vkDestroyImageView(device, depthImageView, nullptr);
-		vkDestroyImage(device, depthImage, nullptr);
-		vkFreeMemory(device, depthImageMemory, nullptr);
+	// What depends on the window size: attachments, framebuffers and image views
+	void cleanupSizeDependent() {
+		cleanupAAResources();
+		frameGraph.release();
 
 		for (size_t i = 0; i < swapChainFramebuffers.size(); i++) {
 			vkDestroyFramebuffer(device, swapChainFramebuffers[i], nullptr);
 		}
 
+		for (size_t i = 0; i < swapChainImageViews.size(); i++) {
+			vkDestroyImageView(device, swapChainImageViews[i], nullptr);
+		}
+	}
+
+	// What depends on the number of swap chain images or on their format
+	void cleanupPerImage() {
 		vkFreeCommandBuffers(device, commandPool,
 			static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
 
 		pipelinesAndDescriptorSetsCleanup();
+		if (aaPipeline != nullptr) {
+			aaPipeline->cleanup();
+			aaPipeline = nullptr;
+		}
 
 		vkDestroyRenderPass(device, renderPass, nullptr);
-
-		for (size_t i = 0; i < swapChainImageViews.size(); i++) {
-			vkDestroyImageView(device, swapChainImageViews[i], nullptr);
+		if (aaRenderPass != VK_NULL_HANDLE) {
+			vkDestroyRenderPass(device, aaRenderPass, nullptr);
+			aaRenderPass = VK_NULL_HANDLE;
 		}
 
-		vkDestroySwapchainKHR(device, swapChain, nullptr);
+		descriptorAllocator.reset();
+		gbufferSet = VK_NULL_HANDLE;
+		aaSets[0] = aaSets[1] = VK_NULL_HANDLE;
+	}
+
+	void cleanupSwapChain() {
+		cleanupSizeDependent();
+		cleanupPerImage();
 
-		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+		if (headless) {
+			destroyOffscreenImages();
+		}
+		else {
+			vkDestroySwapchainKHR(device, swapChain, nullptr);
+		}
 	}
 
 	void cleanup() {
@@ -1724,24 +3601,50 @@ protected:
 
 		localCleanup();
 
-		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		timelineWatcherStop = true;
+		timelineWatcher.join();
+		vkDestroySemaphore(device, frameTimeline, nullptr);
+		destroyQueryPools();
+
+		for (int i = 0; i < framesInFlight; i++) {
 			vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
 			vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-			vkDestroyFence(device, inFlightFences[i], nullptr);
 		}
 
 		vkDestroyCommandPool(device, commandPool, nullptr);
 
+		descriptorAllocator.cleanup();
+		for (DescriptorAllocator& A : frameDescriptorAllocators) {
+			A.cleanup();
+		}
+		if (deferredSupported) {
+			gbufferDSL.cleanup();
+		}
+		aaDSL.cleanup();
+		vkDestroySampler(device, aaSampler, nullptr);
+		vkDestroySampler(device, aaDepthSampler, nullptr);
+		if (aaPostAvailable[AA_POST_FXAA]) PFXAA.destroy();
+		if (aaPostAvailable[AA_POST_TAA]) PTAA.destroy();
+		if (dynamicResolution) PUpscale.destroy();
+
+		savePipelineCache();
+		vkDestroyPipelineCache(device, pipelineCache, nullptr);
+
 		vkDestroyDevice(device, nullptr);
 
-		DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+		if (validation) {
+			DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+		}
 
-		vkDestroySurfaceKHR(instance, surface, nullptr);
+		if (surface != VK_NULL_HANDLE) {
+			vkDestroySurfaceKHR(instance, surface, nullptr);
+		}
 		vkDestroyInstance(instance, nullptr);
 
-		glfwDestroyWindow(window);
-
-		glfwTerminate();
+		if (window != nullptr) {
+			glfwDestroyWindow(window);
+			glfwTerminate();
+		}
 	}
 
 	void RebuildPipeline() {
@@ -1782,6 +3685,13 @@ protected:
 		}
 	}
 
+	double cursorX = 0.0, cursorY = 0.0;	// at the last getSixAxis()
+	// Render on demand: the sleep since the last getSixAxis(), which leaves it out
+	// of deltaT so that a key pressed while idle does not move the camera by the
+	// whole sleep, and reports it in sleptT for the clocks
+	float idleSinceInput = 0.0f;
+	float sleptT = 0.0f;
+
 	void getSixAxis(float& deltaT, glm::vec3& m, glm::vec3& r, bool& fire) {
 		static auto startTime = std::chrono::high_resolution_clock::now();
 		static float lastTime = 0.0f;
@@ -1791,13 +3701,18 @@ protected:
 			(currentTime - startTime).count();
 		deltaT = time - lastTime;
 		lastTime = time;
+		sleptT = std::min(idleSinceInput, deltaT);
+		deltaT -= sleptT;
+		idleSinceInput = 0.0f;
+
+		// No input devices without a window
+		if (window == nullptr) return;
 
-		static double old_xpos = 0, old_ypos = 0;
 		double xpos, ypos;
 		glfwGetCursorPos(window, &xpos, &ypos);
-		double m_dx = xpos - old_xpos;
-		double m_dy = ypos - old_ypos;
-		old_xpos = xpos; old_ypos = ypos;
+		double m_dx = xpos - cursorX;
+		double m_dy = ypos - cursorY;
+		cursorX = xpos; cursorY = ypos;
 
 		const float MOUSE_RES = 10.0f;
 		glfwSetInputMode(window, GLFW_STICKY_MOUSE_BUTTONS, GLFW_TRUE);
@@ -1806,45 +3721,45 @@ protected:
 			r.x = -m_dy / MOUSE_RES;
 		}
 
-		if (glfwGetKey(window, GLFW_KEY_LEFT)) {
+		if (keyPressed(GLFW_KEY_LEFT)) {
 			r.y = -1.0f;
 		}
-		if (glfwGetKey(window, GLFW_KEY_RIGHT)) {
+		if (keyPressed(GLFW_KEY_RIGHT)) {
 			r.y = 1.0f;
 		}
-		if (glfwGetKey(window, GLFW_KEY_UP)) {
+		if (keyPressed(GLFW_KEY_UP)) {
 			r.x = -1.0f;
 		}
-		if (glfwGetKey(window, GLFW_KEY_DOWN)) {
+		if (keyPressed(GLFW_KEY_DOWN)) {
 			r.x = 1.0f;
 		}
-		if (glfwGetKey(window, GLFW_KEY_Q)) {
+		if (keyPressed(GLFW_KEY_Q)) {
 			r.z = 1.0f;
 		}
-		if (glfwGetKey(window, GLFW_KEY_E)) {
+		if (keyPressed(GLFW_KEY_E)) {
 			r.z = -1.0f;
 		}
 
-		if (glfwGetKey(window, GLFW_KEY_A)) {
+		if (keyPressed(GLFW_KEY_A)) {
 			m.x = -1.0f;
 		}
-		if (glfwGetKey(window, GLFW_KEY_D)) {
+		if (keyPressed(GLFW_KEY_D)) {
 			m.x = 1.0f;
 		}
-		if (glfwGetKey(window, GLFW_KEY_S)) {
+		if (keyPressed(GLFW_KEY_S)) {
 			m.z = -1.0f;
 		}
-		if (glfwGetKey(window, GLFW_KEY_W)) {
+		if (keyPressed(GLFW_KEY_W)) {
 			m.z = 1.0f;
 		}
-		if (glfwGetKey(window, GLFW_KEY_R)) {
+		if (keyPressed(GLFW_KEY_R)) {
 			m.y = 1.0f;
 		}
-		if (glfwGetKey(window, GLFW_KEY_F)) {
+		if (keyPressed(GLFW_KEY_F)) {
 			m.y = -1.0f;
 		}
 
-		fire = glfwGetKey(window, GLFW_KEY_SPACE) | glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS;
+		fire = keyPressed(GLFW_KEY_SPACE) | glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS;
 		handleGamePad(GLFW_JOYSTICK_1, m, r, fire);
 		handleGamePad(GLFW_JOYSTICK_2, m, r, fire);
 		handleGamePad(GLFW_JOYSTICK_3, m, r, fire);
@@ -1853,6 +3768,58 @@ protected:
 
 	// Public part of the base class
 public:
+	// Registers a pass measured with begin/endGpuPass, returns its id
+	uint32_t addGpuPass(const std::string& name) {
+		if (gpuPasses.size() >= MAX_GPU_PASSES) {
+			throw std::runtime_error("too many GPU passes!");
+		}
+		gpuPasses.emplace_back();
+		GpuPass& pass = gpuPasses.back();
+		pass.name = name;
+		pass.timeCounter = PROFILE_INTERN("GPU " + name + " (ms)");
+		pass.vertexCounter = PROFILE_INTERN("GPU " + name + " vertex invocations");
+		pass.fragmentCounter = PROFILE_INTERN("GPU " + name + " fragment invocations");
+		return static_cast<uint32_t>(gpuPasses.size() - 1);
+	}
+
+	// vkCmdDrawIndexed of a whole index buffer, counted in commandStats
+	void drawIndexed(VkCommandBuffer commandBuffer, uint32_t indexCount) {
+		vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
+		commandStats.draws++;
+	}
+
+	// A descriptor set for the command buffer being recorded only. It comes from
+	// the pool of the current frame slot, which is reset when the slot is reused.
+	// Write it with L.update().
+	VkDescriptorSet allocateFrameSet(DescriptorSetLayout& L) {
+		VkDescriptorSet set;
+		frameDescriptorAllocators[currentFrame].allocate(L.descriptorSetLayout, 1, &set);
+		return set;
+	}
+
+	// Timestamps are taken at the top and bottom of the pipeline, so passes that
+	// overlap on the GPU share part of their time
+	void beginGpuPass(VkCommandBuffer commandBuffer, uint32_t pass, int currentImage) {
+		if (timestampQueryPool != VK_NULL_HANDLE) {
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool,
+				(currentImage * MAX_GPU_PASSES + pass) * 2);
+		}
+		if (statisticsQueryPool != VK_NULL_HANDLE) {
+			vkCmdBeginQuery(commandBuffer, statisticsQueryPool, currentImage * MAX_GPU_PASSES + pass, 0);
+		}
+	}
+
+	void endGpuPass(VkCommandBuffer commandBuffer, uint32_t pass, int currentImage) {
+		if (timestampQueryPool != VK_NULL_HANDLE) {
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool,
+				(currentImage * MAX_GPU_PASSES + pass) * 2 + 1);
+		}
+		if (statisticsQueryPool != VK_NULL_HANDLE) {
+			vkCmdEndQuery(commandBuffer, statisticsQueryPool, currentImage * MAX_GPU_PASSES + pass);
+		}
+		gpuPassesWritten[currentImage] |= 1u << pass;
+	}
+
 	// Debug commands
 	void printFloat(const char* Name, float v) {
 		std::cout << "float " << Name << " = " << v << ";\n";
@@ -2011,6 +3978,7 @@ std::vector<VkVertexInputAttributeDescription> VertexDescriptor::getAttributeDes
 
 template <class Vert>
 void Model<Vert>::loadModelOBJ(std::string file) {
+	PROFILE_FUNCTION();
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
 	std::vector<tinyobj::material_t> materials;
@@ -2079,6 +4047,7 @@ void Model<Vert>::loadModelOBJ(std::string file) {
 
 template <class Vert>
 void Model<Vert>::loadModelGLTF(std::string file) {
+	PROFILE_FUNCTION();
 	tinygltf::Model model;
 	tinygltf::TinyGLTF loader;
 	std::string warn, err;
@@ -2280,8 +4249,31 @@ void Model<Vert>::createIndexBuffer() {
 	vkUnmapMemory(BP->device, indexBufferMemory);
 }
 
+// A vec3 per vertex, taken from the POSITION element of the vertex format: a
+// depth only pass reads a third (or less) of the vertex data
+template <class Vert>
+void Model<Vert>::createPositionBuffer() {
+	if (!VD->Position.hasIt) {
+		throw std::runtime_error("position stream of a vertex format without positions!");
+	}
+	VkDeviceSize bufferSize = sizeof(glm::vec3) * vertices.size();
+
+	BP->createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		positionBuffer, positionBufferMemory);
+
+	glm::vec3* data;
+	vkMapMemory(BP->device, positionBufferMemory, 0, bufferSize, 0, (void**)&data);
+	for (size_t i = 0; i < vertices.size(); i++) {
+		memcpy(&data[i], (const char*)&vertices[i] + VD->Position.offset, sizeof(glm::vec3));
+	}
+	vkUnmapMemory(BP->device, positionBufferMemory);
+}
+
 template <class Vert>
 void Model<Vert>::initMesh(BaseProject* bp, VertexDescriptor* vd) {
+	PROFILE_ZONE("Model::initMesh");
 	BP = bp;
 	VD = vd;
 	std::cout << "[Manual] Vertices: " << vertices.size()
@@ -2310,6 +4302,10 @@ void Model<Vert>::cleanup() {
 	vkFreeMemory(BP->device, indexBufferMemory, nullptr);
 	vkDestroyBuffer(BP->device, vertexBuffer, nullptr);
 	vkFreeMemory(BP->device, vertexBufferMemory, nullptr);
+	if (positionBuffer != VK_NULL_HANDLE) {
+		vkDestroyBuffer(BP->device, positionBuffer, nullptr);
+		vkFreeMemory(BP->device, positionBufferMemory, nullptr);
+	}
 }
 
 template <class Vert>
@@ -2321,6 +4317,16 @@ void Model<Vert>::bind(VkCommandBuffer commandBuffer) {
 	// property .indexBuffer of models, contains the VkBuffer handle to its index buffer
 	vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0,
 		VK_INDEX_TYPE_UINT32);
+	BP->commandStats.vertexBufferBinds++;
+}
+
+template <class Vert>
+void Model<Vert>::bindPositions(VkCommandBuffer commandBuffer) {
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &positionBuffer, &offset);
+	vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0,
+		VK_INDEX_TYPE_UINT32);
+	BP->commandStats.vertexBufferBinds++;
 }
 
 
@@ -2329,6 +4335,7 @@ void Model<Vert>::bind(VkCommandBuffer commandBuffer) {
 
 
 void Texture::createTextureImage(const char* const files[], VkFormat Fmt = VK_FORMAT_R8G8B8A8_SRGB) {
+	PROFILE_ZONE("Texture::createTextureImage");
 	int texWidth, texHeight, texChannels;
 	int curWidth = -1, curHeight = -1, curChannels = -1;
 	stbi_uc* pixels[maxImgs];
@@ -2357,8 +4364,23 @@ void Texture::createTextureImage(const char* const files[], VkFormat Fmt = VK_FO
 		}
 	}
 
+	createTextureImage(pixels, texWidth, texHeight, Fmt);
+	for (int i = 0; i < imgs; i++) {
+		stbi_image_free(pixels[i]);
+	}
+}
+
+// Uploads imgs layers of texWidth x texHeight RGBA pixels and builds the mip chain
+void Texture::createTextureImage(const stbi_uc* const pixels[], int texWidth, int texHeight,
+	VkFormat Fmt) {
 	VkDeviceSize imageSize = texWidth * texHeight * 4;
 	VkDeviceSize totalImageSize = texWidth * texHeight * 4 * imgs;
+	black = true;
+	for (int i = 0; i < imgs && black; i++) {
+		for (VkDeviceSize t = 0; t < imageSize && black; t += 4) {
+			black = (pixels[i][t] | pixels[i][t + 1] | pixels[i][t + 2]) == 0;
+		}
+	}
 	mipLevels = static_cast<uint32_t>(std::floor(
 		std::log2(std::max(texWidth, texHeight)))) + 1;
 
@@ -2373,7 +4395,6 @@ void Texture::createTextureImage(const char* const files[], VkFormat Fmt = VK_FO
 	vkMapMemory(BP->device, stagingBufferMemory, 0, totalImageSize, 0, &data);
 	for (int i = 0; i < imgs; i++) {
 		memcpy(static_cast<char*>(data) + imageSize * i, pixels[i], static_cast<size_t>(imageSize));
-		stbi_image_free(pixels[i]);
 	}
 	vkUnmapMemory(BP->device, stagingBufferMemory);
 
@@ -2381,7 +4402,7 @@ void Texture::createTextureImage(const char* const files[], VkFormat Fmt = VK_FO
 	BP->createImage(texWidth, texHeight, mipLevels, imgs, VK_SAMPLE_COUNT_1_BIT, Fmt,
 		VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
 		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-		imgs == 6 ? VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : 0,
+		viewType == VK_IMAGE_VIEW_TYPE_CUBE ? VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : 0,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage,
 		textureImageMemory);
 
@@ -2402,7 +4423,7 @@ void Texture::createTextureImageView(VkFormat Fmt = VK_FORMAT_R8G8B8A8_SRGB) {
 		Fmt,
 		VK_IMAGE_ASPECT_COLOR_BIT,
 		mipLevels,
-		imgs == 6 ? VK_IMAGE_VIEW_TYPE_CUBE : VK_IMAGE_VIEW_TYPE_2D,
+		viewType,
 		imgs);
 }
 
@@ -2448,6 +4469,7 @@ void Texture::init(BaseProject* bp, const char* file, VkFormat Fmt = VK_FORMAT_R
 	const char* files[1] = { file };
 	BP = bp;
 	imgs = 1;
+	viewType = VK_IMAGE_VIEW_TYPE_2D;
 	createTextureImage(files, Fmt);
 	createTextureImageView(Fmt);
 	if (initSampler) {
@@ -2459,12 +4481,24 @@ void Texture::init(BaseProject* bp, const char* file, VkFormat Fmt = VK_FORMAT_R
 void Texture::initCubic(BaseProject* bp, const char* files[6]) {
 	BP = bp;
 	imgs = 6;
+	viewType = VK_IMAGE_VIEW_TYPE_CUBE;
 	createTextureImage(files);
 	createTextureImageView();
 	createTextureSampler();
 }
 
 
+void Texture::initArray(BaseProject* bp, const std::vector<const stbi_uc*>& layers,
+	int width, int height, VkFormat Fmt = VK_FORMAT_R8G8B8A8_SRGB) {
+	BP = bp;
+	imgs = static_cast<int>(layers.size());
+	viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+	createTextureImage(layers.data(), width, height, Fmt);
+	createTextureImageView(Fmt);
+	createTextureSampler();
+}
+
+
 void Texture::cleanup() {
 	vkDestroySampler(BP->device, textureSampler, nullptr);
 	vkDestroyImageView(BP->device, textureImageView, nullptr);
@@ -2479,6 +4513,7 @@ void Texture::cleanup() {
 void Pipeline::init(BaseProject* bp, VertexDescriptor* vd,
 	const std::string& VertShader, const std::string& FragShader,
 	std::vector<DescriptorSetLayout*> d) {
+	PROFILE_ZONE("Pipeline::init");
 	BP = bp;
 	VD = vd;
 
@@ -2498,6 +4533,20 @@ void Pipeline::init(BaseProject* bp, VertexDescriptor* vd,
 	polyModel = VK_POLYGON_MODE_FILL;
 	CM = VK_CULL_MODE_BACK_BIT;
 	transp = false;
+	pushConstantStages = 0;
+	pushConstantSize = 0;
+	subpass = UINT32_MAX;
+	colorAttachments = 1;
+	additive = false;
+	renderPass = VK_NULL_HANDLE;
+	samples = VK_SAMPLE_COUNT_1_BIT;
+	depthBiasConstant = 0.0f;
+	depthBiasSlope = 0.0f;
+	depthWrite = true;
+	colorWrite = true;
+	overlay = false;
+	constants.clear();
+	variantMask = 0;
 
 	D = d;
 }
@@ -2510,14 +4559,130 @@ void Pipeline::setAdvancedFeatures(VkCompareOp _compareOp, VkPolygonMode _polyMo
 	transp = _transp;
 }
 
+// One push constant range from offset 0, shared by the given stages
+void Pipeline::setPushConstants(VkShaderStageFlags stages, uint32_t size) {
+	pushConstantStages = stages;
+	pushConstantSize = size;
+}
+
+void Pipeline::setSubpass(uint32_t _subpass, uint32_t _colorAttachments, bool _additive) {
+	subpass = _subpass;
+	colorAttachments = _colorAttachments;
+	additive = _additive;
+}
+
+// Subpass 0 of a render pass of its own, e.g. a depth only one (no color attachments)
+void Pipeline::setRenderPass(VkRenderPass _renderPass, VkSampleCountFlagBits _samples, uint32_t _colorAttachments) {
+	renderPass = _renderPass;
+	samples = _samples;
+	subpass = 0;
+	colorAttachments = _colorAttachments;
+}
+
+// Depth offset of the rasterized triangles, e.g. against shadow acne
+void Pipeline::setDepthBias(float constant, float slope) {
+	depthBiasConstant = constant;
+	depthBiasSlope = slope;
+}
+
+// Depth pre-pass: the pre-pass writes only the depth, the shading pass only
+// the color (with VK_COMPARE_OP_EQUAL)
+void Pipeline::setWriteMasks(bool _depthWrite, bool _colorWrite) {
+	depthWrite = _depthWrite;
+	colorWrite = _colorWrite;
+}
+
+// Screen space draws recorded in populateOverlays(), at full resolution
+void Pipeline::setOverlay() {
+	overlay = true;
+}
+
+// Given to both stages: ids a shader does not declare are ignored
+void Pipeline::setConstants(std::vector<SpecializationConstant> C) {
+	constants = C;
+}
+
+// One pipeline is built for every subset of mask (2^popcount variants)
+void Pipeline::setVariants(uint32_t mask) {
+	if (mask >= 256) {
+		throw std::runtime_error("pipeline variants use constant ids 0 to 7!");
+	}
+	variantMask = mask;
+}
 
+
+// Inside pipelinesAndDescriptorSetsInit() the variants are only queued: BaseProject
+// builds all of them in parallel right after. Elsewhere they are built at once.
 void Pipeline::create() {
+	createLayout();
+	variants.assign(variantMask + 1, VK_NULL_HANDLE);
+	for (uint32_t key = variantMask;; key = (key - 1) & variantMask) {
+		if (BP->deferPipelines) {
+			BP->pendingPipelines.push_back({ this, key });
+		}
+		else {
+			build(key);
+		}
+		if (key == 0) break;
+	}
+}
+
+void Pipeline::createLayout() {
+	std::vector<VkDescriptorSetLayout> DSL(D.size());
+	for (int i = 0; i < D.size(); i++) {
+		DSL[i] = D[i]->descriptorSetLayout;
+	}
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType =
+		VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = DSL.size();
+	pipelineLayoutInfo.pSetLayouts = DSL.data();
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = pushConstantStages;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = pushConstantSize;
+	pipelineLayoutInfo.pushConstantRangeCount = pushConstantSize > 0 ? 1 : 0;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	VkResult result = vkCreatePipelineLayout(BP->device, &pipelineLayoutInfo, nullptr,
+		&pipelineLayout);
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to create pipeline layout!");
+	}
+}
+
+// Builds the variant "key". Called from the worker threads, so it only writes
+// its own element of variants.
+void Pipeline::build(uint32_t key) {
+	PROFILE_ZONE("Pipeline::build");
+	std::vector<VkSpecializationMapEntry> entries;
+	std::vector<uint32_t> values;
+	for (const SpecializationConstant& C : constants) {
+		if (C.id < 32 && (variantMask & (1u << C.id))) continue;
+		entries.push_back({ C.id, static_cast<uint32_t>(values.size() * sizeof(uint32_t)), sizeof(uint32_t) });
+		values.push_back(C.value);
+	}
+	for (uint32_t b = 0; b < 32; b++) {
+		if (!(variantMask & (1u << b))) continue;
+		entries.push_back({ b, static_cast<uint32_t>(values.size() * sizeof(uint32_t)), sizeof(uint32_t) });
+		values.push_back((key >> b) & 1);	// VkBool32
+	}
+	VkSpecializationInfo specializationInfo{};
+	specializationInfo.mapEntryCount = static_cast<uint32_t>(entries.size());
+	specializationInfo.pMapEntries = entries.data();
+	specializationInfo.dataSize = values.size() * sizeof(uint32_t);
+	specializationInfo.pData = values.data();
+	const VkSpecializationInfo* specialization = entries.empty() ? nullptr : &specializationInfo;
+
 	VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
 	vertShaderStageInfo.sType =
 		VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
 	vertShaderStageInfo.module = vertShaderModule;
 	vertShaderStageInfo.pName = "main";
+	vertShaderStageInfo.pSpecializationInfo = specialization;
 
 	VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
 	fragShaderStageInfo.sType =
@@ -2525,6 +4690,7 @@ void Pipeline::create() {
 	fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
 	fragShaderStageInfo.module = fragShaderModule;
 	fragShaderStageInfo.pName = "main";
+	fragShaderStageInfo.pSpecializationInfo = specialization;
 
 	VkPipelineShaderStageCreateInfo shaderStages[] =
 	{ vertShaderStageInfo, fragShaderStageInfo };
@@ -2532,8 +4698,12 @@ void Pipeline::create() {
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
 	vertexInputInfo.sType =
 		VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	auto bindingDescription = VD->getBindingDescription();
-	auto attributeDescriptions = VD->getAttributeDescriptions();
+	std::vector<VkVertexInputBindingDescription> bindingDescription;
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+	if (VD != nullptr) {
+		bindingDescription = VD->getBindingDescription();
+		attributeDescriptions = VD->getAttributeDescriptions();
+	}
 
 	vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescription.size());
 	vertexInputInfo.vertexAttributeDescriptionCount =
@@ -2548,25 +4718,19 @@ void Pipeline::create() {
 	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 	inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-	VkViewport viewport{};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = (float)BP->swapChainExtent.width;
-	viewport.height = (float)BP->swapChainExtent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-
-	VkRect2D scissor{};
-	scissor.offset = { 0, 0 };
-	scissor.extent = BP->swapChainExtent;
-
+	// Viewport and scissor are set in the command buffer, so the pipeline
+	// does not depend on the window size
 	VkPipelineViewportStateCreateInfo viewportState{};
 	viewportState.sType =
 		VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 	viewportState.viewportCount = 1;
-	viewportState.pViewports = &viewport;
 	viewportState.scissorCount = 1;
-	viewportState.pScissors = &scissor;
+
+	VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	VkPipelineDynamicStateCreateInfo dynamicState{};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = 2;
+	dynamicState.pDynamicStates = dynamicStates;
 
 	VkPipelineRasterizationStateCreateInfo rasterizer{};
 	rasterizer.sType =
@@ -2577,23 +4741,26 @@ void Pipeline::create() {
 	rasterizer.lineWidth = 1.0f;
 	rasterizer.cullMode = CM;
 	rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-	rasterizer.depthBiasEnable = VK_FALSE;
-	rasterizer.depthBiasConstantFactor = 0.0f; // Optional
+	rasterizer.depthBiasEnable = depthBiasConstant != 0.0f || depthBiasSlope != 0.0f;
+	rasterizer.depthBiasConstantFactor = depthBiasConstant;
 	rasterizer.depthBiasClamp = 0.0f; // Optional
-	rasterizer.depthBiasSlopeFactor = 0.0f; // Optional
+	rasterizer.depthBiasSlopeFactor = depthBiasSlope;
 
 	VkPipelineMultisampleStateCreateInfo multisampling{};
 	multisampling.sType =
 		VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-	multisampling.sampleShadingEnable = VK_TRUE;
-	multisampling.rasterizationSamples = BP->msaaSamples;
-	multisampling.minSampleShading = 1.0f; // Optional
+	// The anti-aliasing tier sets how many samples the main passes shade
+	const bool postOverlay = overlay && BP->aaRenderPass != VK_NULL_HANDLE;
+	const bool mainPass = renderPass == VK_NULL_HANDLE && !postOverlay;
+	multisampling.sampleShadingEnable = mainPass && BP->sampleShading > 0.0f ? VK_TRUE : VK_FALSE;
+	multisampling.rasterizationSamples = mainPass ? BP->msaaSamples : samples;
+	multisampling.minSampleShading = mainPass ? BP->sampleShading : 0.0f;
 	multisampling.pSampleMask = nullptr; // Optional
 	multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
 	multisampling.alphaToOneEnable = VK_FALSE; // Optional
 
 	VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-	colorBlendAttachment.colorWriteMask =
+	colorBlendAttachment.colorWriteMask = !colorWrite ? 0 :
 		VK_COLOR_COMPONENT_R_BIT |
 		VK_COLOR_COMPONENT_G_BIT |
 		VK_COLOR_COMPONENT_B_BIT |
@@ -2611,44 +4778,36 @@ void Pipeline::create() {
 		VK_BLEND_FACTOR_ZERO; // Optional
 	colorBlendAttachment.alphaBlendOp =
 		VK_BLEND_OP_ADD; // Optional
+	if (additive) {
+		colorBlendAttachment.blendEnable = VK_TRUE;
+		colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+		colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	}
+	// The G-buffer targets are written as they are
+	std::vector<VkPipelineColorBlendAttachmentState> colorBlendAttachments(colorAttachments, colorBlendAttachment);
+	for (uint32_t i = 1; i < colorAttachments; i++) {
+		colorBlendAttachments[i].blendEnable = VK_FALSE;
+	}
 
 	VkPipelineColorBlendStateCreateInfo colorBlending{};
 	colorBlending.sType =
 		VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
 	colorBlending.logicOpEnable = VK_FALSE;
 	colorBlending.logicOp = VK_LOGIC_OP_COPY; // Optional
-	colorBlending.attachmentCount = 1;
-	colorBlending.pAttachments = &colorBlendAttachment;
+	colorBlending.attachmentCount = colorAttachments;
+	colorBlending.pAttachments = colorBlendAttachments.data();
 	colorBlending.blendConstants[0] = 0.0f; // Optional
 	colorBlending.blendConstants[1] = 0.0f; // Optional
 	colorBlending.blendConstants[2] = 0.0f; // Optional
 	colorBlending.blendConstants[3] = 0.0f; // Optional
 
-	std::vector<VkDescriptorSetLayout> DSL(D.size());
-	for (int i = 0; i < D.size(); i++) {
-		DSL[i] = D[i]->descriptorSetLayout;
-	}
-
-	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-	pipelineLayoutInfo.sType =
-		VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = DSL.size();
-	pipelineLayoutInfo.pSetLayouts = DSL.data();
-	pipelineLayoutInfo.pushConstantRangeCount = 0; // Optional
-	pipelineLayoutInfo.pPushConstantRanges = nullptr; // Optional
-
-	VkResult result = vkCreatePipelineLayout(BP->device, &pipelineLayoutInfo, nullptr,
-		&pipelineLayout);
-	if (result != VK_SUCCESS) {
-		PrintVkError(result);
-		throw std::runtime_error("failed to create pipeline layout!");
-	}
-
 	VkPipelineDepthStencilStateCreateInfo depthStencil{};
 	depthStencil.sType =
 		VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
 	depthStencil.depthTestEnable = VK_TRUE;
-	depthStencil.depthWriteEnable = VK_TRUE;
+	depthStencil.depthWriteEnable = depthWrite ? VK_TRUE : VK_FALSE;
 	depthStencil.depthCompareOp = compareOp;
 	depthStencil.depthBoundsTestEnable = VK_FALSE;
 	depthStencil.minDepthBounds = 0.0f; // Optional
@@ -2669,19 +4828,26 @@ void Pipeline::create() {
 	pipelineInfo.pMultisampleState = &multisampling;
 	pipelineInfo.pDepthStencilState = &depthStencil;
 	pipelineInfo.pColorBlendState = &colorBlending;
-	pipelineInfo.pDynamicState = nullptr; // Optional
+	pipelineInfo.pDynamicState = &dynamicState;
 	pipelineInfo.layout = pipelineLayout;
-	pipelineInfo.renderPass = BP->renderPass;
-	pipelineInfo.subpass = 0;
+	pipelineInfo.renderPass = renderPass != VK_NULL_HANDLE ? renderPass : BP->renderPass;
+	pipelineInfo.subpass = subpass == UINT32_MAX ? BP->forwardSubpass : subpass;
+	if (postOverlay) {
+		pipelineInfo.renderPass = BP->aaRenderPass;
+		pipelineInfo.subpass = 1;
+	}
 	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
 	pipelineInfo.basePipelineIndex = -1; // Optional
 
-	result = vkCreateGraphicsPipelines(BP->device, VK_NULL_HANDLE, 1,
-		&pipelineInfo, nullptr, &graphicsPipeline);
+	VkResult result = vkCreateGraphicsPipelines(BP->device, BP->pipelineCache, 1,
+		&pipelineInfo, nullptr, &variants[key]);
 	if (result != VK_SUCCESS) {
 		PrintVkError(result);
 		throw std::runtime_error("failed to create graphics pipeline!");
 	}
+	if (key == variantMask) {
+		graphicsPipeline = variants[key];
+	}
 
 }
 
@@ -2690,10 +4856,11 @@ void Pipeline::destroy() {
 	vkDestroyShaderModule(BP->device, vertShaderModule, nullptr);
 }
 
-void Pipeline::bind(VkCommandBuffer commandBuffer) {
+void Pipeline::bind(VkCommandBuffer commandBuffer, uint32_t key) {
 	vkCmdBindPipeline(commandBuffer,
 		VK_PIPELINE_BIND_POINT_GRAPHICS,
-		graphicsPipeline);
+		variants[key & variantMask]);
+	BP->commandStats.pipelineBinds++;
 
 }
 
@@ -2734,25 +4901,45 @@ VkShaderModule Pipeline::createShaderModule(const std::vector<char>& code) {
 }
 
 void Pipeline::cleanup() {
-	vkDestroyPipeline(BP->device, graphicsPipeline, nullptr);
+	for (VkPipeline P : variants) {
+		if (P != VK_NULL_HANDLE) vkDestroyPipeline(BP->device, P, nullptr);
+	}
+	variants.clear();
 	vkDestroyPipelineLayout(BP->device, pipelineLayout, nullptr);
 }
 
 void DescriptorSetLayout::init(BaseProject* bp, std::vector<DescriptorSetLayoutBinding> B) {
 	BP = bp;
+	if (B.size() > 32) {
+		throw std::runtime_error("too many bindings in a descriptor set layout!");
+	}
+	bindings = B;
+	updateTemplates.clear();
 
 	std::vector<VkDescriptorSetLayoutBinding> bindings;
 	bindings.resize(B.size());
 	for (int i = 0; i < B.size(); i++) {
 		bindings[i].binding = B[i].binding;
 		bindings[i].descriptorType = B[i].type;
-		bindings[i].descriptorCount = 1;
+		bindings[i].descriptorCount = B[i].count;
 		bindings[i].stageFlags = B[i].flags;
 		bindings[i].pImmutableSamplers = nullptr;
 	}
 
+	std::vector<VkDescriptorBindingFlags> flags(B.size());
+	bool hasFlags = false;
+	for (int i = 0; i < B.size(); i++) {
+		flags[i] = B[i].bindingFlags;
+		hasFlags = hasFlags || flags[i] != 0;
+	}
+	VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo{};
+	flagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	flagsInfo.bindingCount = static_cast<uint32_t>(flags.size());
+	flagsInfo.pBindingFlags = flags.data();
+
 	VkDescriptorSetLayoutCreateInfo layoutInfo{};
 	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = hasFlags ? &flagsInfo : nullptr;
 	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());;
 	layoutInfo.pBindings = bindings.data();
 
@@ -2765,24 +4952,79 @@ void DescriptorSetLayout::init(BaseProject* bp, std::vector<DescriptorSetLayoutB
 }
 
 void DescriptorSetLayout::cleanup() {
+	for (auto& T : updateTemplates) {
+		vkDestroyDescriptorUpdateTemplate(BP->device, T.second, nullptr);
+	}
+	updateTemplates.clear();
 	vkDestroyDescriptorSetLayout(BP->device, descriptorSetLayout, nullptr);
 }
 
+int DescriptorSetLayout::bindingIndex(uint32_t binding) const {
+	for (int i = 0; i < bindings.size(); i++) {
+		if (bindings[i].binding == binding) return i;
+	}
+	throw std::runtime_error("binding not in the descriptor set layout!");
+}
+
+// A template writes all its descriptors in one call, reading them straight from
+// data, instead of going through one VkWriteDescriptorSet each
+void DescriptorSetLayout::update(VkDescriptorSet set, uint32_t mask, const DescriptorData* data) {
+	VkDescriptorUpdateTemplate T = VK_NULL_HANDLE;
+	for (auto& t : updateTemplates) {
+		if (t.first == mask) T = t.second;
+	}
+
+	if (T == VK_NULL_HANDLE) {
+		std::vector<VkDescriptorUpdateTemplateEntry> entries;
+		for (int i = 0; i < bindings.size(); i++) {
+			if (!(mask & (1u << i))) continue;
+			VkDescriptorUpdateTemplateEntry entry{};
+			entry.dstBinding = bindings[i].binding;
+			entry.dstArrayElement = 0;
+			entry.descriptorCount = 1;
+			entry.descriptorType = bindings[i].type;
+			entry.offset = i * sizeof(DescriptorData);
+			entry.stride = sizeof(DescriptorData);
+			entries.push_back(entry);
+		}
+
+		VkDescriptorUpdateTemplateCreateInfo templateInfo{};
+		templateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+		templateInfo.descriptorUpdateEntryCount = static_cast<uint32_t>(entries.size());
+		templateInfo.pDescriptorUpdateEntries = entries.data();
+		templateInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+		templateInfo.descriptorSetLayout = descriptorSetLayout;
+
+		VkResult result = vkCreateDescriptorUpdateTemplate(BP->device, &templateInfo,
+			nullptr, &T);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to create descriptor update template!");
+		}
+		updateTemplates.push_back({ mask, T });
+	}
+
+	vkUpdateDescriptorSetWithTemplate(BP->device, set, T, data);
+}
+
 void DescriptorSet::init(BaseProject* bp, DescriptorSetLayout* DSL,
-	std::vector<DescriptorSetElement> E) {
+	std::vector<DescriptorSetElement> E, uint32_t variableCount) {
 	BP = bp;
 
 	uniformBuffers.resize(E.size());
 	uniformBuffersMemory.resize(E.size());
+	persistentMaps.assign(E.size(), std::vector<void*>());
 	toFree.resize(E.size());
 
 	for (int j = 0; j < E.size(); j++) {
 		uniformBuffers[j].resize(BP->swapChainImages.size());
 		uniformBuffersMemory[j].resize(BP->swapChainImages.size());
-		if (E[j].type == UNIFORM) {
+		persistentMaps[j].assign(BP->swapChainImages.size(), nullptr);
+		if (E[j].type == UNIFORM || E[j].type == STORAGE) {
 			for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
 				VkDeviceSize bufferSize = E[j].size;
-				BP->createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+				BP->createBuffer(bufferSize, E[j].type == UNIFORM ?
+					VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT : VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
 					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
 					VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 					uniformBuffers[j][i], uniformBuffersMemory[j][i]);
@@ -2794,59 +5036,33 @@ void DescriptorSet::init(BaseProject* bp, DescriptorSetLayout* DSL,
 		}
 	}
 
-	std::vector<VkDescriptorSetLayout> layouts(BP->swapChainImages.size(),
-		DSL->descriptorSetLayout);
-	VkDescriptorSetAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	allocInfo.descriptorPool = BP->descriptorPool;
-	allocInfo.descriptorSetCount = static_cast<uint32_t>(BP->swapChainImages.size());
-	allocInfo.pSetLayouts = layouts.data();
-
 	descriptorSets.resize(BP->swapChainImages.size());
+	BP->descriptorAllocator.allocate(DSL->descriptorSetLayout,
+		static_cast<uint32_t>(descriptorSets.size()), descriptorSets.data(), variableCount);
 
-	VkResult result = vkAllocateDescriptorSets(BP->device, &allocInfo,
-		descriptorSets.data());
-	if (result != VK_SUCCESS) {
-		PrintVkError(result);
-		throw std::runtime_error("failed to allocate descriptor sets!");
+	uint32_t mask = 0;
+	std::vector<int> index(E.size());
+	for (int j = 0; j < E.size(); j++) {
+		index[j] = DSL->bindingIndex(E[j].binding);
+		mask |= 1u << index[j];
 	}
 
+	std::vector<DescriptorData> data(DSL->bindings.size());
 	for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
-		std::vector<VkWriteDescriptorSet> descriptorWrites(E.size());
-		std::vector<VkDescriptorBufferInfo> bufferInfo(E.size());
-		std::vector<VkDescriptorImageInfo> imageInfo(E.size());
 		for (int j = 0; j < E.size(); j++) {
-			if (E[j].type == UNIFORM) {
-				bufferInfo[j].buffer = uniformBuffers[j][i];
-				bufferInfo[j].offset = 0;
-				bufferInfo[j].range = E[j].size;
-
-				descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-				descriptorWrites[j].dstSet = descriptorSets[i];
-				descriptorWrites[j].dstBinding = E[j].binding;
-				descriptorWrites[j].dstArrayElement = 0;
-				descriptorWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-				descriptorWrites[j].descriptorCount = 1;
-				descriptorWrites[j].pBufferInfo = &bufferInfo[j];
+			DescriptorData& D = data[index[j]];
+			if (E[j].type == UNIFORM || E[j].type == STORAGE) {
+				D.buffer.buffer = uniformBuffers[j][i];
+				D.buffer.offset = 0;
+				D.buffer.range = E[j].size;
 			}
 			else if (E[j].type == TEXTURE) {
-				imageInfo[j].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-				imageInfo[j].imageView = E[j].tex->textureImageView;
-				imageInfo[j].sampler = E[j].tex->textureSampler;
-
-				descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-				descriptorWrites[j].dstSet = descriptorSets[i];
-				descriptorWrites[j].dstBinding = E[j].binding;
-				descriptorWrites[j].dstArrayElement = 0;
-				descriptorWrites[j].descriptorType =
-					VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-				descriptorWrites[j].descriptorCount = 1;
-				descriptorWrites[j].pImageInfo = &imageInfo[j];
+				D.image.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+				D.image.imageView = E[j].tex->textureImageView;
+				D.image.sampler = E[j].tex->textureSampler;
 			}
 		}
-		vkUpdateDescriptorSets(BP->device,
-			static_cast<uint32_t>(descriptorWrites.size()),
-			descriptorWrites.data(), 0, nullptr);
+		DSL->update(descriptorSets[i], mask, data.data());
 	}
 }
 
@@ -2854,6 +5070,9 @@ void DescriptorSet::cleanup() {
 	for (int j = 0; j < uniformBuffers.size(); j++) {
 		if (toFree[j]) {
 			for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
+				if (persistentMaps[j][i] != nullptr) {
+					vkUnmapMemory(BP->device, uniformBuffersMemory[j][i]);
+				}
 				vkDestroyBuffer(BP->device, uniformBuffers[j][i], nullptr);
 				vkFreeMemory(BP->device, uniformBuffersMemory[j][i], nullptr);
 			}
@@ -2867,6 +5086,7 @@ void DescriptorSet::bind(VkCommandBuffer commandBuffer, Pipeline& P, int setId,
 		VK_PIPELINE_BIND_POINT_GRAPHICS,
 		P.pipelineLayout, setId, 1, &descriptorSets[currentImage],
 		0, nullptr);
+	BP->commandStats.descriptorSetBinds++;
 }
 
 void DescriptorSet::map(int currentImage, void* src, int size, int slot) {
@@ -2877,3 +5097,108 @@ void DescriptorSet::map(int currentImage, void* src, int size, int slot) {
 	memcpy(data, src, size);
 	vkUnmapMemory(BP->device, uniformBuffersMemory[slot][currentImage]);
 }
+
+// Maps the uniform buffer on first use and keeps it mapped until cleanup, for
+// data written every frame. The memory is host coherent, so plain writes are
+// visible to the next submission. Do not mix with map() on the same slot.
+void* DescriptorSet::persistentMap(int currentImage, int slot) {
+	void*& data = persistentMaps[slot][currentImage];
+	if (data == nullptr) {
+		VkResult result = vkMapMemory(BP->device, uniformBuffersMemory[slot][currentImage], 0,
+			VK_WHOLE_SIZE, 0, &data);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to map uniform buffer!");
+		}
+	}
+	return data;
+}
+
+void DescriptorAllocator::init(VkDevice dev, uint32_t initialSets) {
+	device = dev;
+	nextPoolSets = std::max(initialSets, 1u);
+}
+
+void DescriptorAllocator::allocate(VkDescriptorSetLayout layout, uint32_t count,
+	VkDescriptorSet* sets, uint32_t variableCount) {
+	std::vector<VkDescriptorSetLayout> layouts(count, layout);
+	std::vector<uint32_t> variableCounts(count, variableCount);
+	VkDescriptorSetVariableDescriptorCountAllocateInfo variableInfo{};
+	variableInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO;
+	variableInfo.descriptorSetCount = count;
+	variableInfo.pDescriptorCounts = variableCounts.data();
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.pNext = variableCount > 0 ? &variableInfo : nullptr;
+	allocInfo.descriptorSetCount = count;
+	allocInfo.pSetLayouts = layouts.data();
+
+	VkResult result = VK_ERROR_OUT_OF_POOL_MEMORY;
+	if (!usedPools.empty()) {
+		allocInfo.descriptorPool = usedPools.back();
+		result = vkAllocateDescriptorSets(device, &allocInfo, sets);
+	}
+	// The current pool is full: retry once in the next one. Variable count
+	// arrays (texture tables) are taken as samplers on top of the usual sizes.
+	if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) {
+		allocInfo.descriptorPool = nextPool(count * variableCount);
+		result = vkAllocateDescriptorSets(device, &allocInfo, sets);
+	}
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to allocate descriptor sets!");
+	}
+}
+
+void DescriptorAllocator::reset() {
+	for (VkDescriptorPool pool : usedPools) {
+		vkResetDescriptorPool(device, pool, 0);
+		freePools.push_back(pool);
+	}
+	usedPools.clear();
+}
+
+void DescriptorAllocator::cleanup() {
+	reset();
+	for (VkDescriptorPool pool : freePools) {
+		vkDestroyDescriptorPool(device, pool, nullptr);
+	}
+	freePools.clear();
+}
+
+VkDescriptorPool DescriptorAllocator::nextPool(uint32_t extraSamplers) {
+	if (!freePools.empty() && extraSamplers == 0) {
+		usedPools.push_back(freePools.back());
+		freePools.pop_back();
+		return usedPools.back();
+	}
+
+	// Descriptors per set, by type: enough for the largest layouts in use
+	const uint32_t sets = std::min(nextPoolSets, MAX_POOL_SETS);
+	std::array<VkDescriptorPoolSize, 4> poolSizes{};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	poolSizes[0].descriptorCount = 2 * sets;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[1].descriptorCount = 3 * sets + extraSamplers;
+	poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[2].descriptorCount = 3 * sets;
+	poolSizes[3].type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+	poolSizes[3].descriptorCount = std::max(sets, 4u);
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = sets;
+
+	VkDescriptorPool pool;
+	VkResult result = vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool);
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to create descriptor pool!");
+	}
+	nextPoolSets = sets * 2;
+	usedPools.push_back(pool);
+	return pool;
+}
@@ -0,0 +1,185 @@
+#pragma once
+// Screen space text, used for the statistics overlay. The glyphs come from the
+// 30 px font of textures/Fonts.png (same metrics as the old TextMaker.hpp).
+// The vertices are rebuilt on the CPU whenever the text changes, into a host
+// visible buffer per swap chain image.
+
+struct TextVertex {
+	glm::vec2 pos;
+	glm::vec2 UV;
+};
+
+struct GlyphData {
+	int x, y, width, height, xoffset, yoffset, xadvance;
+};
+
+// Characters 32 to 127
+const GlyphData TEXT_FONT[96] = {
+	{512,0,0,0,0,0,9}, {740,149,11,28,0,0,9}, {723,80,16,15,-2,0,11}, {600,58,25,28,-3,0,17}, {631,103,22,34,-2,-2,17}, {512,59,32,28,-2,1,27}, {542,147,26,29,-2,0,21}, {740,235,11,15,-1,0,6},
+	{723,96,15,34,-1,0,10}, {723,131,15,34,-2,0,10}, {599,239,17,16,-2,0,12}, {600,125,24,22,-2,6,18}, {740,35,12,15,-1,18,9}, {700,242,16,9,-2,12,10}, {740,51,12,10,-1,18,9}, {700,213,17,28,-3,0,9},
+	{655,0,22,28,-2,1,17}, {655,228,16,27,0,1,17}, {631,228,22,27,-2,1,17}, {655,29,22,28,-2,1,17}, {631,0,23,27,-2,1,17}, {655,58,22,28,-2,1,17}, {655,87,22,28,-2,1,17}, {631,28,23,27,-2,1,17},
+	{655,116,22,28,-2,1,17}, {655,145,22,28,-2,1,17}, {754,0,11,22,0,6,9}, {740,207,11,27,0,6,9}, {573,116,26,23,-3,6,18}, {600,148,24,15,-2,10,18}, {573,140,26,23,-3,6,18}, {678,195,21,28,-1,0,17},
+	{512,29,32,29,0,0,31}, {545,59,27,28,-3,0,21}, {573,194,25,28,-1,0,21}, {545,29,27,29,-2,0,22}, {542,177,26,28,-1,0,22}, {600,96,24,28,-1,0,21}, {599,210,23,28,-1,0,19}, {512,224,28,29,-2,0,24},
+	{573,223,25,28,-1,0,22}, {740,120,11,28,0,0,9}, {678,107,21,29,-3,0,15}, {542,206,26,28,-1,0,21}, {655,174,22,28,-1,0,17}, {512,149,29,28,-1,0,25}, {605,0,25,28,-1,0,22}, {512,119,29,29,-2,0,24},
+	{600,29,25,28,-1,0,21}, {512,88,29,30,-2,0,24}, {578,0,26,28,-1,0,22}, {542,117,26,29,-2,0,21}, {573,29,26,28,-3,0,19}, {573,164,25,29,-1,0,22}, {573,58,26,28,-2,0,21}, {512,0,36,28,-3,0,29},
+	{542,88,27,28,-3,0,21}, {549,0,28,28,-3,0,21}, {573,87,26,28,-3,0,19}, {740,0,13,34,-1,0,9}, {700,184,18,28,-4,0,9}, {723,202,14,34,-3,0,9}, {700,94,20,19,-1,0,15}, {600,87,25,8,-3,24,17},
+	{723,237,14,11,-3,0,10}, {631,56,23,23,-2,6,17}, {678,47,21,29,-1,0,17}, {678,224,21,24,-2,5,15}, {631,138,22,29,-2,0,17}, {678,0,22,23,-2,6,17}, {723,0,16,28,-3,0,9}, {631,168,22,29,-2,6,17},
+	{678,137,21,28,-1,0,17}, {740,62,11,28,-1,0,7}, {723,166,14,35,-4,0,7}, {678,166,21,28,-1,0,15}, {740,91,11,28,-1,0,7}, {512,178,29,22,-1,6,25}, {701,24,21,22,-1,6,17}, {655,203,22,24,-2,5,17},
+	{678,77,21,29,-1,6,17}, {631,198,22,29,-2,6,17}, {723,57,16,22,-1,6,10}, {701,0,21,23,-2,6,15}, {723,29,16,27,-3,2,9}, {700,70,20,23,-1,6,17}, {631,80,23,22,-3,6,15}, {512,201,29,22,-3,6,22},
+	{678,24,22,22,-3,6,15}, {599,180,23,29,-3,6,15}, {700,47,21,22,-2,6,15}, {700,149,18,34,-4,0,11}, {740,178,11,28,-1,0,8}, {700,114,19,34,-3,0,11}, {542,235,26,13,-3,11,18}, {599,164,24,15,-2,10,18},
+};
+const int TEXT_FONT_LINE_HEIGHT = 30;
+const float TEXT_FONT_TEX_W = 1024.0f;
+const float TEXT_FONT_TEX_H = 512.0f;
+
+class TextOverlay {
+public:
+	static const uint32_t MAX_CHARS = 2048;
+
+	// False when the text shaders have not been compiled: the overlay then draws nothing
+	bool available = false;
+
+	void init(BaseProject* bp) {
+		BP = bp;
+		available = std::ifstream("shaders/TextVert.spv").good() &&
+			std::ifstream("shaders/TextFrag.spv").good();
+		if (!available) {
+			std::cout << "Text overlay disabled, the statistics (G) are printed to the console instead: "
+				"compile shaders/Text.vert and shaders/Text.frag to shaders/TextVert.spv and shaders/TextFrag.spv with glslc\n";
+			return;
+		}
+
+		DSL.init(BP, {
+			{0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT}
+			});
+		VD.init(BP, {
+				{0, sizeof(TextVertex), VK_VERTEX_INPUT_RATE_VERTEX}
+			}, {
+				{0, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(TextVertex, pos), sizeof(glm::vec2), OTHER},
+				{0, 1, VK_FORMAT_R32G32_SFLOAT, offsetof(TextVertex, UV), sizeof(glm::vec2), UV}
+			});
+		P.init(BP, &VD, "shaders/TextVert.spv", "shaders/TextFrag.spv", { &DSL });
+		P.setAdvancedFeatures(VK_COMPARE_OP_ALWAYS, VK_POLYGON_MODE_FILL,
+			VK_CULL_MODE_NONE, true);
+		P.setOverlay();
+		T.init(BP, "textures/Fonts.png");
+
+		// Every glyph is a quad, so the indices never change
+		BP->createBuffer(MAX_CHARS * 6 * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			indexBuffer, indexBufferMemory);
+		uint32_t* idx;
+		vkMapMemory(BP->device, indexBufferMemory, 0, VK_WHOLE_SIZE, 0, (void**)&idx);
+		for (uint32_t k = 0; k < MAX_CHARS; k++) {
+			const uint32_t q[6] = { 0, 1, 2, 1, 3, 2 };
+			for (int i = 0; i < 6; i++) {
+				idx[6 * k + i] = 4 * k + q[i];
+			}
+		}
+		vkUnmapMemory(BP->device, indexBufferMemory);
+	}
+
+	void pipelinesAndDescriptorSetsInit() {
+		if (!available) return;
+		P.create();
+		DS.init(BP, &DSL, {
+			{0, TEXTURE, 0, &T}
+			});
+
+		const size_t images = BP->swapChainImages.size();
+		vertexBuffers.resize(images);
+		vertexBuffersMemory.resize(images);
+		mappedVertices.resize(images);
+		charCount.assign(images, 0);
+		for (size_t i = 0; i < images; i++) {
+			BP->createBuffer(MAX_CHARS * 4 * sizeof(TextVertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				vertexBuffers[i], vertexBuffersMemory[i]);
+			vkMapMemory(BP->device, vertexBuffersMemory[i], 0, VK_WHOLE_SIZE, 0,
+				(void**)&mappedVertices[i]);
+		}
+	}
+
+	void pipelinesAndDescriptorSetsCleanup() {
+		if (!available) return;
+		P.cleanup();
+		DS.cleanup();
+		for (size_t i = 0; i < vertexBuffers.size(); i++) {
+			vkUnmapMemory(BP->device, vertexBuffersMemory[i]);
+			vkDestroyBuffer(BP->device, vertexBuffers[i], nullptr);
+			vkFreeMemory(BP->device, vertexBuffersMemory[i], nullptr);
+		}
+	}
+
+	void localCleanup() {
+		if (!available) return;
+		vkDestroyBuffer(BP->device, indexBuffer, nullptr);
+		vkFreeMemory(BP->device, indexBufferMemory, nullptr);
+		T.cleanup();
+		DSL.cleanup();
+		P.destroy();
+	}
+
+	// Lays out text (lines separated by '\n') with its top left corner at (x, y)
+	// pixels. Call it from updateUniformBuffer: the previous frame that used this
+	// image is complete by then, so its vertex buffer can be rewritten.
+	void setText(int currentImage, const std::string& text, float x, float y, float scale) {
+		if (!available) return;
+		const float sx = 2.0f * scale / BP->swapChainExtent.width;
+		const float sy = 2.0f * scale / BP->swapChainExtent.height;
+		const float x0 = 2.0f * x / BP->swapChainExtent.width - 1.0f;
+		const float y0 = 2.0f * y / BP->swapChainExtent.height - 1.0f;
+
+		TextVertex* v = mappedVertices[currentImage];
+		uint32_t k = 0;
+		int tpx = 0, tpy = 0;
+		for (char ch : text) {
+			if (ch == '\n') {
+				tpx = 0;
+				tpy += TEXT_FONT_LINE_HEIGHT;
+				continue;
+			}
+			const int c = (int)(unsigned char)ch - 32;
+			if (c < 0 || c >= 96 || k >= MAX_CHARS) continue;
+			const GlyphData& d = TEXT_FONT[c];
+
+			const float left = x0 + (tpx + d.xoffset) * sx, right = left + d.width * sx;
+			const float top = y0 + (tpy + d.yoffset) * sy, bottom = top + d.height * sy;
+			const float u0 = d.x / TEXT_FONT_TEX_W, u1 = (d.x + d.width) / TEXT_FONT_TEX_W;
+			const float v0 = d.y / TEXT_FONT_TEX_H, v1 = (d.y + d.height) / TEXT_FONT_TEX_H;
+			v[4 * k + 0] = { {left, top}, {u0, v0} };
+			v[4 * k + 1] = { {right, top}, {u1, v0} };
+			v[4 * k + 2] = { {left, bottom}, {u0, v1} };
+			v[4 * k + 3] = { {right, bottom}, {u1, v1} };
+			tpx += d.xadvance;
+			k++;
+		}
+		charCount[currentImage] = k;
+	}
+
+	void draw(VkCommandBuffer commandBuffer, int currentImage) {
+		if (!available || charCount[currentImage] == 0) return;
+		P.bind(commandBuffer);
+		VkDeviceSize offset = 0;
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffers[currentImage], &offset);
+		vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+		BP->commandStats.vertexBufferBinds++;
+		DS.bind(commandBuffer, P, 0, currentImage);
+		BP->drawIndexed(commandBuffer, charCount[currentImage] * 6);
+	}
+
+private:
+	BaseProject* BP;
+	DescriptorSetLayout DSL;
+	VertexDescriptor VD;
+	Pipeline P;
+	Texture T;
+	DescriptorSet DS;
+
+	VkBuffer indexBuffer;
+	VkDeviceMemory indexBufferMemory;
+	std::vector<VkBuffer> vertexBuffers;
+	std::vector<VkDeviceMemory> vertexBuffersMemory;
+	std::vector<TextVertex*> mappedVertices;
+	std::vector<uint32_t> charCount;
+};
@@ -0,0 +1,120 @@
+// Microbenchmark of the batch matrix kernels against per-object glm calls.
+// Does not need Vulkan; build from the repository root with e.g.
+//   g++ -O2 -std=c++17 -Iheaders benchmarks/MatrixKernelsBench.cpp -o MatrixKernelsBench
+//   cl /O2 /std:c++17 /Iheaders benchmarks\MatrixKernelsBench.cpp
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <functional>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEFAULT_ALIGNED_GENTYPES
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "../MatrixKernels.hpp"
+
+// Random TRS transforms, like the ones of the scene props
+static std::vector<glm::mat4> randomTransforms(size_t n, std::mt19937& rng) {
+	std::uniform_real_distribution<float> pos(-10.0f, 10.0f), ang(-3.14f, 3.14f), scl(0.5f, 3.0f);
+	std::vector<glm::mat4> M(n);
+	for (auto& m : M) {
+		glm::vec3 axis = glm::normalize(glm::vec3(pos(rng), pos(rng), pos(rng)) + glm::vec3(0.01f));
+		m = glm::translate(glm::mat4(1), glm::vec3(pos(rng), pos(rng), pos(rng))) *
+			glm::mat4_cast(glm::angleAxis(ang(rng), axis)) *
+			glm::scale(glm::mat4(1), glm::vec3(scl(rng), scl(rng), scl(rng)));
+	}
+	return M;
+}
+
+static float maxError(const std::vector<glm::mat4>& A, const std::vector<glm::mat4>& B) {
+	float e = 0.0f;
+	for (size_t i = 0; i < A.size(); i++) {
+		for (int c = 0; c < 4; c++) {
+			for (int r = 0; r < 4; r++) {
+				e = std::max(e, std::abs(A[i][c][r] - B[i][c][r]) / std::max(1.0f, std::abs(B[i][c][r])));
+			}
+		}
+	}
+	return e;
+}
+
+// Nanoseconds per matrix, best of a few runs of about the same total work
+static double timeIt(size_t n, const std::function<void()>& f) {
+	const size_t reps = std::max<size_t>(1, 2000000 / n);
+	double best = 1e30;
+	for (int run = 0; run < 5; run++) {
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for (size_t r = 0; r < reps; r++) f();
+		auto t1 = std::chrono::high_resolution_clock::now();
+		best = std::min(best, std::chrono::duration<double, std::nano>(t1 - t0).count() / (double)(reps * n));
+	}
+	return best;
+}
+
+int main() {
+	std::mt19937 rng(1234);
+	const MatrixISA best = MatrixKernels::detectISA();
+	std::cout << "Best instruction set: " << MatrixKernels::isaName(best) << "\n\n";
+
+	std::cout << std::left << std::setw(18) << "kernel" << std::setw(10) << "objects"
+		<< std::setw(10) << "isa" << std::setw(12) << "ns/matrix" << std::setw(10) << "speedup"
+		<< "max rel. error\n";
+
+	for (size_t n : { (size_t)10, (size_t)1000, (size_t)100000 }) {
+		const std::vector<glm::mat4> A = randomTransforms(n, rng), B = randomTransforms(n, rng);
+		const glm::mat4 VP = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f) *
+			glm::lookAt(glm::vec3(3, 4, 5), glm::vec3(0), glm::vec3(0, 1, 0));
+		std::vector<glm::mat4> ref(n), out(n);
+
+		struct Kernel {
+			const char* name;
+			std::function<void(std::vector<glm::mat4>&)> glmLoop;
+			std::function<void(std::vector<glm::mat4>&)> batch;
+		};
+		std::vector<Kernel> kernels = {
+			{ "mul",
+				[&](std::vector<glm::mat4>& C) { for (size_t i = 0; i < n; i++) C[i] = A[i] * B[i]; },
+				[&](std::vector<glm::mat4>& C) { batchMul(A.data(), B.data(), C.data(), n); } },
+			{ "mvp",
+				[&](std::vector<glm::mat4>& C) { for (size_t i = 0; i < n; i++) C[i] = VP * A[i]; },
+				[&](std::vector<glm::mat4>& C) { batchMVP(VP, A.data(), C.data(), n); } },
+			{ "affineInverse",
+				[&](std::vector<glm::mat4>& C) { for (size_t i = 0; i < n; i++) C[i] = glm::inverse(A[i]); },
+				[&](std::vector<glm::mat4>& C) { batchAffineInverse(A.data(), C.data(), n); } },
+			{ "inverseTranspose3",
+				[&](std::vector<glm::mat4>& C) {
+					for (size_t i = 0; i < n; i++) C[i] = glm::mat4(glm::inverse(glm::transpose(glm::mat3(A[i]))));
+				},
+				[&](std::vector<glm::mat4>& C) { batchInverseTranspose3(A.data(), C.data(), n); } },
+		};
+
+		for (auto& K : kernels) {
+			K.glmLoop(ref);
+			const double glmNs = timeIt(n, [&]() { K.glmLoop(out); });
+			std::cout << std::setw(18) << K.name << std::setw(10) << n << std::setw(10) << "glm"
+				<< std::setw(12) << std::fixed << std::setprecision(2) << glmNs << std::setw(10) << "1.00" << "-\n";
+
+			for (int isa = MATRIX_ISA_SCALAR; isa <= best; isa++) {
+				MatrixKernels::setISA((MatrixISA)isa);
+				std::fill(out.begin(), out.end(), glm::mat4(0));
+				K.batch(out);
+				const float err = maxError(out, ref);
+				const double ns = timeIt(n, [&]() { K.batch(out); });
+				std::cout << std::setw(18) << K.name << std::setw(10) << n
+					<< std::setw(10) << MatrixKernels::isaName((MatrixISA)isa)
+					<< std::setw(12) << ns << std::setw(10) << glmNs / ns
+					<< std::scientific << std::setprecision(1) << err
+					<< std::fixed << std::setprecision(2) << "\n";
+			}
+			MatrixKernels::setISA(best);
+		}
+		std::cout << "\n";
+	}
+	return 0;
+}
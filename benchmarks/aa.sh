@@ -0,0 +1,25 @@
+#!/bin/sh
+# Cost of each anti-aliasing tier. Runs the flythrough replay headless once
+# per tier, then prints the average CPU and GPU time per frame of each run.
+#   benchmarks/aa.sh [executable] [replay]
+# Extra options go through the environment, e.g. TSP_SIZE=2560x1440.
+
+EXE=${1:-./ProjectTSP}
+REPLAY=${2:-benchmarks/flythrough.txt}
+OUT=${OUT:-bench_aa}
+mkdir -p "$OUT"
+
+avg() {
+	sed -n "s/.*\"$1\": {\"avg\": \([0-9.]*\).*/\1/p" "$2"
+}
+
+printf "%-11s %10s %10s\n" tier cpuMs gpuMs
+for tier in off fxaa taa msaa2 msaa4 msaa4-half max; do
+	json="$OUT/$tier.json"
+	"$EXE" --headless --replay="$REPLAY" --aa=$tier \
+		--bench-out="$json" > "$OUT/$tier.log" 2>&1 || {
+		echo "$tier: failed, see $OUT/$tier.log"
+		continue
+	}
+	printf "%-11s %10s %10s\n" $tier "$(avg cpuMs "$json")" "$(avg gpuMs "$json")"
+done
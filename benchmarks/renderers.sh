@@ -0,0 +1,28 @@
+#!/bin/sh
+# Forward against deferred shading as the number of clustered lights grows.
+# Runs the flythrough replay headless once per renderer and light count, then
+# prints the average CPU and GPU time per frame of each run.
+#   benchmarks/renderers.sh [executable] [replay]
+# Extra options go through the environment, e.g. TSP_SIZE=2560x1440.
+
+EXE=${1:-./ProjectTSP}
+REPLAY=${2:-benchmarks/flythrough.txt}
+OUT=${OUT:-bench_renderers}
+mkdir -p "$OUT"
+
+avg() {
+	sed -n "s/.*\"$1\": {\"avg\": \([0-9.]*\).*/\1/p" "$2"
+}
+
+printf "%-8s %-9s %10s %10s\n" lights renderer cpuMs gpuMs
+for lights in 0 16 64 256 1024; do
+	for renderer in forward deferred; do
+		json="$OUT/${renderer}_$lights.json"
+		"$EXE" --headless --replay="$REPLAY" --lights=$lights --renderer=$renderer \
+			--bench-out="$json" > "$OUT/${renderer}_$lights.log" 2>&1 || {
+			echo "$renderer, $lights lights: failed, see $OUT/${renderer}_$lights.log"
+			continue
+		}
+		printf "%-8s %-9s %10s %10s\n" $lights $renderer "$(avg cpuMs "$json")" "$(avg gpuMs "$json")"
+	done
+done
@@ -0,0 +1,138 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Deferred path, lighting subpass: the spot light and the clustered lights of
+// Mesh.frag, with the surface read back from the G-buffer (GBuffer.frag) and
+// its position rebuilt from the depth. The attachments are multisampled, so
+// this runs once per sample and the result is blended onto the color written
+// by the G-buffer subpass.
+
+layout(location = 0) out vec4 outColor;
+
+layout(set = 0, binding = 1) uniform CameraUniformBufferObject {
+	mat4 viewPrj;		// written just before submit (late latch)
+	mat4 view;
+	vec3 eyePos;
+	mat4 invViewPrj;
+	vec4 screen;		// width, height, 1 / width, 1 / height
+} cam;
+
+layout(set = 1, binding = 0) uniform SpotUniformBufferObject {
+	float on;
+	vec3 lightPos;
+	vec3 lightDir;
+	vec4 lightColor;
+	vec3 eyePos;
+	mat4 shadowViewPrj;	// light frustum of the shadow map
+} spot;
+
+// Clustered lights (ClusteredLights.hpp), as in Mesh.frag
+layout(set = 1, binding = 1) uniform ClusterUniformBufferObject {
+	uvec4 grid;		// tiles x, tiles y, depth slices, lights
+	vec4 scale;		// tile = fragCoord.xy * scale.xy, slice = log(depth) * scale.z + scale.w
+} clusters;
+
+struct Light {
+	vec4 posRadius;		// world space position, radius of influence
+	vec4 color;			// w: cosine of the inner cone angle
+	vec4 direction;		// spot direction, w: cosine of the outer cone angle (-2: point light)
+};
+
+layout(std430, set = 1, binding = 2) readonly buffer Lights {
+	Light lights[];
+};
+
+layout(std430, set = 1, binding = 3) readonly buffer Clusters {
+	uvec2 clusterRanges[];
+};
+
+layout(std430, set = 1, binding = 4) readonly buffer LightIndices {
+	uint lightIndices[];
+};
+
+// Spot shadow map (ShadowMap.hpp): static casters in layer 0, dynamic ones in layer 1
+layout(set = 1, binding = 5) uniform sampler2DArrayShadow spotShadowMap;
+
+float spotShadow(vec3 p) {
+	vec4 c = spot.shadowViewPrj * vec4(p, 1.0);
+	if (c.w <= 0.0) return 1.0;
+	vec3 s = c.xyz / c.w;
+	vec2 uv = s.xy * 0.5 + 0.5;
+	return texture(spotShadowMap, vec4(uv, 0.0, s.z)) * texture(spotShadowMap, vec4(uv, 1.0, s.z));
+}
+
+layout(input_attachment_index = 0, set = 2, binding = 0) uniform subpassInputMS gAlbedo;
+layout(input_attachment_index = 1, set = 2, binding = 1) uniform subpassInputMS gNormal;
+layout(input_attachment_index = 2, set = 2, binding = 2) uniform subpassInputMS gMaterial;
+layout(input_attachment_index = 3, set = 2, binding = 3) uniform subpassInputMS gDepth;
+
+// Same ids as Mesh.frag; the lighting state picks the variant
+layout(constant_id = 1) const bool SPOT = true;
+layout(constant_id = 2) const bool SPECULAR = true;
+layout(constant_id = 3) const bool LIGHTS = true;
+
+layout(constant_id = 4) const float beta = 1.5f;
+layout(constant_id = 5) const float g = 7.5;
+layout(constant_id = 6) const float cosout = 0.8;
+layout(constant_id = 7) const float cosin  = 1.0;
+
+void main() {
+	float z = subpassLoad(gDepth, gl_SampleID).r;
+	if (z >= 1.0) {
+		// Background, or drawn later in the forward subpass
+		outColor = vec4(0.0f);
+		return;
+	}
+	vec4 ndc = vec4(gl_FragCoord.xy * cam.screen.zw * 2.0 - 1.0, z, 1.0);
+	vec4 world = cam.invViewPrj * ndc;
+	vec3 fragPos = world.xyz / world.w;
+
+	vec3 MD = subpassLoad(gAlbedo, gl_SampleID).rgb;
+	vec4 normalGamma = subpassLoad(gNormal, gl_SampleID);
+	vec3 MS = subpassLoad(gMaterial, gl_SampleID).rgb;
+	vec3 N = normalGamma.xyz;
+	float gamma = normalGamma.w;
+	vec3 V = normalize(cam.eyePos - fragPos);
+
+	float directLightPerc = 0.025f;
+	float spotLightPerc = (1.00f - directLightPerc) * spot.on;
+
+	vec3 spotColor = vec3(0.0f);
+	if (SPOT) {
+		vec3 spotLightDir = normalize(spot.lightPos - fragPos);
+		vec3 spotLightColor = vec3(spot.lightColor) * pow(g / length(spot.lightPos - fragPos), beta) *
+		                      clamp(((dot(spotLightDir, -spot.lightDir)) - cosout) / (cosin - cosout), 0.0, 1.0) *
+		                      spotShadow(fragPos);
+
+		spotColor = 0.99 * spotLightColor * MD * clamp(dot(N, spotLightDir), 0.0, 1.0) * spotLightPerc;
+		if (SPECULAR) {
+			spotColor += spotLightColor * MS * pow(clamp(dot(N, normalize(spotLightDir + V)), 0.01, 1.0), gamma) * spotLightPerc;
+		}
+		spotColor += 0.01f * vec3(spot.lightColor) * MD * spotLightPerc;
+	}
+
+	vec3 lightsColor = vec3(0.0f);
+	if (LIGHTS) {
+		float depth = -(cam.view * vec4(fragPos, 1.0)).z;
+		uvec3 c = uvec3(gl_FragCoord.xy * clusters.scale.xy,
+		                clamp(log(depth) * clusters.scale.z + clusters.scale.w, 0.0, float(clusters.grid.z - 1)));
+		c = min(c, clusters.grid.xyz - 1u);
+		uvec2 range = clusterRanges[(c.z * clusters.grid.y + c.y) * clusters.grid.x + c.x];
+		for (uint i = range.x; i < range.x + range.y; i++) {
+			Light l = lights[lightIndices[i]];
+			vec3 toLight = l.posRadius.xyz - fragPos;
+			float dist = length(toLight);
+			vec3 lightDir = toLight / dist;
+			float window = clamp(1.0 - pow(dist / l.posRadius.w, 4.0), 0.0, 1.0);
+			float cone = clamp((dot(lightDir, -l.direction.xyz) - l.direction.w) / max(l.color.w - l.direction.w, 0.0001), 0.0, 1.0);
+			vec3 lightColor = l.color.rgb * window * window * cone / (1.0 + dist * dist);
+
+			lightsColor += lightColor * MD * clamp(dot(N, lightDir), 0.0, 1.0);
+			if (SPECULAR) {
+				lightsColor += lightColor * MS * pow(clamp(dot(N, normalize(lightDir + V)), 0.01, 1.0), gamma);
+			}
+		}
+	}
+
+	outColor = vec4(clamp(spotColor + lightsColor, 0.0f, 1.0f), 0.0f);
+}
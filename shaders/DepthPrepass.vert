@@ -0,0 +1,21 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Depth pre-pass: positions only, with the same transform as Mesh.vert, so that
+// the shading pass finds exactly this depth (VK_COMPARE_OP_EQUAL)
+
+layout(set = 0, binding = 1) uniform CameraUniformBufferObject {
+	mat4 viewPrj;		// written just before submit (late latch)
+} cam;
+
+layout(push_constant) uniform Prop {
+	mat4 mMat;
+} prop;
+
+layout(location = 0) in vec3 inPosition;
+
+invariant gl_Position;
+
+void main() {
+	gl_Position = cam.viewPrj * prop.mMat * vec4(inPosition, 1.0);
+}
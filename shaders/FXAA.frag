@@ -0,0 +1,57 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Anti-aliasing tier "fxaa": FXAA style edge smoothing of the single sample
+// scene. Where the luma contrast of the pixel and its diagonal neighbours is
+// high, the color is blurred along the edge, found from the luma gradient;
+// the wider blur is kept unless it brings in a luma from outside the
+// neighbourhood. Under dynamic resolution the scene covers only the top left
+// of its image: the filtered samples scale it up at the same time.
+
+layout(location = 0) out vec4 outColor;
+
+layout(set = 0, binding = 0) uniform sampler2D scene;
+
+layout(push_constant) uniform AA {
+	mat4 reproject;		// TAA only
+	vec4 texel;			// 1 / width, 1 / height, width, height
+	vec4 params;		// TAA only
+	vec4 scene;			// rendered part of the scene image: UV scale, size in texels
+} aa;
+
+const float EDGE_THRESHOLD = 0.125;
+const float EDGE_THRESHOLD_MIN = 0.0312;
+const float SPAN_MAX = 8.0;
+
+float luma(vec3 c) {
+	return dot(c, vec3(0.299, 0.587, 0.114));
+}
+
+void main() {
+	vec2 uv = min(gl_FragCoord.xy * aa.texel.xy * aa.scene.xy, aa.scene.xy - 0.5 * aa.texel.xy);
+	vec3 rgbM = texture(scene, uv).rgb;
+	float lM = luma(rgbM);
+	float lNW = luma(textureOffset(scene, uv, ivec2(-1, -1)).rgb);
+	float lNE = luma(textureOffset(scene, uv, ivec2(1, -1)).rgb);
+	float lSW = luma(textureOffset(scene, uv, ivec2(-1, 1)).rgb);
+	float lSE = luma(textureOffset(scene, uv, ivec2(1, 1)).rgb);
+
+	float lMin = min(lM, min(min(lNW, lNE), min(lSW, lSE)));
+	float lMax = max(lM, max(max(lNW, lNE), max(lSW, lSE)));
+	if (lMax - lMin < max(EDGE_THRESHOLD_MIN, lMax * EDGE_THRESHOLD)) {
+		outColor = vec4(rgbM, 1.0);
+		return;
+	}
+
+	// Along the edge, scaled so that the smaller component is one texel
+	vec2 dir = vec2(-((lNW + lNE) - (lSW + lSE)), (lNW + lSW) - (lNE + lSE));
+	float reduce = max((lNW + lNE + lSW + lSE) * 0.25 * 0.125, 1.0 / 128.0);
+	dir = clamp(dir / (min(abs(dir.x), abs(dir.y)) + reduce), -SPAN_MAX, SPAN_MAX) * aa.texel.xy;
+
+	vec3 rgbA = 0.5 * (texture(scene, uv + dir * (1.0 / 3.0 - 0.5)).rgb +
+	                   texture(scene, uv + dir * (2.0 / 3.0 - 0.5)).rgb);
+	vec3 rgbB = rgbA * 0.5 + 0.25 * (texture(scene, uv - dir * 0.5).rgb +
+	                                 texture(scene, uv + dir * 0.5).rgb);
+	float lB = luma(rgbB);
+	outColor = vec4((lB < lMin || lB > lMax) ? rgbA : rgbB, 1.0);
+}
@@ -0,0 +1,96 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Deferred path, G-buffer subpass: writes the material of the visible surface
+// for DeferredLight.frag, and straight to the color the terms that need no
+// light loop (direct light, ambient, emission). Same inputs as Mesh.frag;
+// compiled a second time with -DBINDLESS for the bindless set, like
+// MeshBindless.frag.
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : enable
+#endif
+
+layout(location = 0) in vec3 fragPos;
+layout(location = 1) in vec3 fragNorm;
+layout(location = 2) in vec2 fragUV;
+
+layout(location = 0) out vec4 outColor;
+layout(location = 1) out vec4 outAlbedo;	// rgb: albedo
+layout(location = 2) out vec4 outNormal;	// xyz: world space normal, w: specular exponent
+layout(location = 3) out vec4 outMaterial;	// rgb: specular color
+
+layout(set = 0, binding = 0) uniform GlobalUniformBufferObject {
+	vec3 DlightDir;		// direction of the direct light
+	vec3 DlightColor;	// color of the direct light
+	vec3 AmbLightColor;	// ambient light
+	vec3 eyePos;		// position of the viewer
+} gubo;
+
+#ifdef BINDLESS
+struct Entity {
+	float amb;
+	float gamma;
+	vec3 sColor;
+	mat4 mvpMat;
+	mat4 mMat;
+	mat4 nMat;
+};
+
+layout(std430, set = 2, binding = 0) readonly buffer Entities {
+	Entity entities[];
+};
+
+layout(set = 2, binding = 1) uniform sampler2DArray textures[];
+
+layout(push_constant) uniform Draw {
+	uint entity;
+	uint texId;
+	uint emitId;
+	uint texLayer;
+	uint emitLayer;
+	uint pad;
+	vec2 texScale;
+	vec2 emitScale;
+} draw;
+
+// As in MeshBindless.frag
+vec3 sampleLayer(uint image, uint layer, vec2 scale) {
+	vec2 uv = fragUV * scale;
+	return textureGrad(textures[image], vec3(fract(fragUV) * scale, layer), dFdx(uv), dFdy(uv)).rgb;
+}
+#else
+layout(set = 2, binding = 0) uniform UniformBufferObject {
+	float amb;
+	float gamma;
+	vec3 sColor;
+	mat4 mvpMat;
+	mat4 mMat;
+	mat4 nMat;
+} ubo;
+
+layout(set = 2, binding = 1) uniform sampler2D tex;
+layout(set = 2, binding = 2) uniform sampler2D texEmit;
+#endif
+
+layout(constant_id = 0) const bool EMISSION = true;
+
+void main() {
+#ifdef BINDLESS
+	Entity ubo = entities[draw.entity];
+	vec3 albedo = sampleLayer(draw.texId, draw.texLayer, draw.texScale);
+	vec3 emission = EMISSION ? sampleLayer(draw.emitId, draw.emitLayer, draw.emitScale) : vec3(0.0f);
+#else
+	vec3 albedo = texture(tex, fragUV).rgb;
+	vec3 emission = EMISSION ? texture(texEmit, fragUV).rgb : vec3(0.0f);
+#endif
+	vec3 N = normalize(fragNorm);
+	float directLightPerc = 0.025f;
+
+	vec3 guboDiffuse = albedo * 0.95f * clamp(dot(N, gubo.DlightDir), 0.0, 1.0) * directLightPerc;
+	vec3 guboAmbient = albedo * ubo.amb * gubo.AmbLightColor * 0.05f * directLightPerc;
+
+	outColor = vec4(clamp(guboDiffuse + guboAmbient + emission, 0.0f, 1.0f), 1.0f);
+	outAlbedo = vec4(albedo, 1.0f);
+	outNormal = vec4(N, ubo.gamma);
+	outMaterial = vec4(ubo.sColor, 1.0f);
+}
@@ -1 +1 @@
-#version 450#extension GL_ARB_separate_shader_objects : enablelayout(location = 0) in vec3 fragPos;layout(location = 1) in vec3 fragNorm;layout(location = 2) in vec2 fragUV;layout(location = 0) out vec4 outColor;layout(set = 0, binding = 0) uniform GlobalUniformBufferObject {	vec3 DlightDir;		// direction of the direct light	vec3 DlightColor;	// color of the direct light	vec3 AmbLightColor;	// ambient light	vec3 eyePos;		// position of the viewer} gubo;layout(set = 1, binding = 0) uniform SpotUniformBufferObject {	float on;	vec3 lightPos;	vec3 lightDir;	vec4 lightColor;	vec3 eyePos;} spot;layout(set = 2, binding = 0) uniform UniformBufferObject {	float amb;	float gamma;	vec3 sColor;	mat4 mvpMat;	mat4 mMat;	mat4 nMat;} ubo;layout(set = 2, binding = 1) uniform sampler2D tex;layout(set = 2, binding = 2) uniform sampler2D texEmit;// SPOT LIGHT CONSTANTSconst float beta = 1.5f;const float g = 7.5;const float cosout = 0.8;const float cosin  = 1.0;void main() {	vec3 N = normalize(fragNorm);				// surface normal	vec3 V = normalize(gubo.eyePos - fragPos);	// viewer direction	vec3 L = normalize(gubo.DlightDir);			// light direction	vec3 albedo = texture(tex, fragUV).rgb;		// main color	vec3 MD = albedo;	vec3 MS = ubo.sColor;	vec3 MA = albedo * ubo.amb;	vec3 LA = gubo.AmbLightColor;	float directLightPerc = 0.025f;	float spotLightPerc = (1.00f - directLightPerc) * spot.on;	// Gubo Shader	vec3 guboLightDir = gubo.DlightDir;	vec3 guboLightColor = vec3(gubo.DlightColor);	vec3 guboDiffuse = MD * 0.95f * clamp(dot(N, guboLightDir), 0.0, 1.0) * directLightPerc;	vec3 guboSpecular = vec3(0.0f) * directLightPerc;	vec3 guboAmbient = MA * LA * 0.05f * directLightPerc;	// SpotLight Shader	vec3 spotLightDir = normalize(spot.lightPos - fragPos);	vec3 spotLightColor = vec3(spot.lightColor) * pow(g / length(spot.lightPos - fragPos), beta) *                      clamp(((dot(spotLightDir, -spot.lightDir)) - cosout) / (cosin - cosout), 0.0, 1.0);	vec3 spotDiffuse = 0.99 * spotLightColor * MD * clamp(dot(N, spotLightDir), 0.0, 1.0) * spotLightPerc;  // Lambert	vec3 spotSpecular = spotLightColor * MS * pow(clamp(dot(N, normalize(spotLightDir + V)), 0.01, 1.0), ubo.gamma) * spotLightPerc;  // Blinn TODO	vec3 spotAmbient = 0.01f * vec3(spot.lightColor) * MD * spotLightPerc;		// Final Vector	vec3 Diffuse = spotDiffuse + guboDiffuse;	vec3 Specular = spotSpecular + guboSpecular;	vec3 Ambient = spotAmbient + guboAmbient;	vec3 Emission = texture(texEmit, fragUV).rgb;		// Final output	outColor = vec4(clamp(Diffuse + Specular + Ambient + Emission, 0.0f, 1.0f), 1.0f);}
\ No newline at end of file
+#version 450#extension GL_ARB_separate_shader_objects : enablelayout(location = 0) in vec3 fragPos;layout(location = 1) in vec3 fragNorm;layout(location = 2) in vec2 fragUV;layout(location = 0) out vec4 outColor;layout(set = 0, binding = 0) uniform GlobalUniformBufferObject {	vec3 DlightDir;		// direction of the direct light	vec3 DlightColor;	// color of the direct light	vec3 AmbLightColor;	// ambient light	vec3 eyePos;		// position of the viewer} gubo;layout(set = 0, binding = 1) uniform CameraUniformBufferObject {	mat4 viewPrj;		// written just before submit (late latch)	mat4 view;	vec3 eyePos;} cam;layout(set = 1, binding = 0) uniform SpotUniformBufferObject {	float on;	vec3 lightPos;	vec3 lightDir;	vec4 lightColor;	vec3 eyePos;	mat4 shadowViewPrj;	// light frustum of the shadow map} spot;// Clustered lights (ClusteredLights.hpp): the lights of the froxel of this// fragment are lightIndices[clusterRanges[froxel].x ..+ clusterRanges[froxel].y]layout(set = 1, binding = 1) uniform ClusterUniformBufferObject {	uvec4 grid;		// tiles x, tiles y, depth slices, lights	vec4 scale;		// tile = fragCoord.xy * scale.xy, slice = log(depth) * scale.z + scale.w} clusters;struct Light {	vec4 posRadius;		// world space position, radius of influence	vec4 color;			// w: cosine of the inner cone angle	vec4 direction;		// spot direction, w: cosine of the outer cone angle (-2: point light)};layout(std430, set = 1, binding = 2) readonly buffer Lights {	Light lights[];};layout(std430, set = 1, binding = 3) readonly buffer Clusters {	uvec2 clusterRanges[];};layout(std430, set = 1, binding = 4) readonly buffer LightIndices {	uint lightIndices[];};// Spot shadow map (ShadowMap.hpp): static casters in layer 0, dynamic ones in layer 1layout(set = 1, binding = 5) uniform sampler2DArrayShadow spotShadowMap;float spotShadow(vec3 p) {	vec4 c = spot.shadowViewPrj * vec4(p, 1.0);	if (c.w <= 0.0) return 1.0;	vec3 s = c.xyz / c.w;	vec2 uv = s.xy * 0.5 + 0.5;	return texture(spotShadowMap, vec4(uv, 0.0, s.z)) * texture(spotShadowMap, vec4(uv, 1.0, s.z));}layout(set = 2, binding = 0) uniform UniformBufferObject {	float amb;	float gamma;	vec3 sColor;	mat4 mvpMat;	mat4 mMat;	mat4 nMat;} ubo;layout(set = 2, binding = 1) uniform sampler2D tex;layout(set = 2, binding = 2) uniform sampler2D texEmit;// Variants: features compiled out when the prop or the lighting state does not// need them (see VARIANT_* in Scene.hpp)layout(constant_id = 0) const bool EMISSION = true;layout(constant_id = 1) const bool SPOT = true;layout(constant_id = 2) const bool SPECULAR = true;layout(constant_id = 3) const bool LIGHTS = true;// SPOT LIGHT CONSTANTS, set per pipelinelayout(constant_id = 4) const float beta = 1.5f;layout(constant_id = 5) const float g = 7.5;layout(constant_id = 6) const float cosout = 0.8;layout(constant_id = 7) const float cosin  = 1.0;void main() {	vec3 N = normalize(fragNorm);				// surface normal	vec3 V = normalize(cam.eyePos - fragPos);	// viewer direction	vec3 L = normalize(gubo.DlightDir);			// light direction	vec3 albedo = texture(tex, fragUV).rgb;		// main color	vec3 MD = albedo;	vec3 MS = ubo.sColor;	vec3 MA = albedo * ubo.amb;	vec3 LA = gubo.AmbLightColor;	float directLightPerc = 0.025f;	float spotLightPerc = (1.00f - directLightPerc) * spot.on;	// Gubo Shader	vec3 guboLightDir = gubo.DlightDir;	vec3 guboLightColor = vec3(gubo.DlightColor);	vec3 guboDiffuse = MD * 0.95f * clamp(dot(N, guboLightDir), 0.0, 1.0) * directLightPerc;	vec3 guboSpecular = vec3(0.0f) * directLightPerc;	vec3 guboAmbient = MA * LA * 0.05f * directLightPerc;	// SpotLight Shader	vec3 spotDiffuse = vec3(0.0f);	vec3 spotSpecular = vec3(0.0f);	vec3 spotAmbient = vec3(0.0f);	if (SPOT) {		vec3 spotLightDir = normalize(spot.lightPos - fragPos);		vec3 spotLightColor = vec3(spot.lightColor) * pow(g / length(spot.lightPos - fragPos), beta) *		                      clamp(((dot(spotLightDir, -spot.lightDir)) - cosout) / (cosin - cosout), 0.0, 1.0) *		                      spotShadow(fragPos);		spotDiffuse = 0.99 * spotLightColor * MD * clamp(dot(N, spotLightDir), 0.0, 1.0) * spotLightPerc;  // Lambert		if (SPECULAR) {			spotSpecular = spotLightColor * MS * pow(clamp(dot(N, normalize(spotLightDir + V)), 0.01, 1.0), ubo.gamma) * spotLightPerc;  // Blinn TODO		}		spotAmbient = 0.01f * vec3(spot.lightColor) * MD * spotLightPerc;	}	// Clustered lights: only those whose sphere touches this froxel	vec3 lightsDiffuse = vec3(0.0f);	vec3 lightsSpecular = vec3(0.0f);	if (LIGHTS) {		float depth = -(cam.view * vec4(fragPos, 1.0)).z;		uvec3 c = uvec3(gl_FragCoord.xy * clusters.scale.xy,		                clamp(log(depth) * clusters.scale.z + clusters.scale.w, 0.0, float(clusters.grid.z - 1)));		c = min(c, clusters.grid.xyz - 1u);		uvec2 range = clusterRanges[(c.z * clusters.grid.y + c.y) * clusters.grid.x + c.x];		for (uint i = range.x; i < range.x + range.y; i++) {			Light l = lights[lightIndices[i]];			vec3 toLight = l.posRadius.xyz - fragPos;			float dist = length(toLight);			vec3 lightDir = toLight / dist;			float window = clamp(1.0 - pow(dist / l.posRadius.w, 4.0), 0.0, 1.0);			float cone = clamp((dot(lightDir, -l.direction.xyz) - l.direction.w) / max(l.color.w - l.direction.w, 0.0001), 0.0, 1.0);			vec3 lightColor = l.color.rgb * window * window * cone / (1.0 + dist * dist);			lightsDiffuse += lightColor * MD * clamp(dot(N, lightDir), 0.0, 1.0);			if (SPECULAR) {				lightsSpecular += lightColor * MS * pow(clamp(dot(N, normalize(lightDir + V)), 0.01, 1.0), ubo.gamma);			}		}	}		// Final Vector	vec3 Diffuse = spotDiffuse + guboDiffuse + lightsDiffuse;	vec3 Specular = spotSpecular + guboSpecular + lightsSpecular;	vec3 Ambient = spotAmbient + guboAmbient;	vec3 Emission = EMISSION ? texture(texEmit, fragUV).rgb : vec3(0.0f);		// Final output	outColor = vec4(clamp(Diffuse + Specular + Ambient + Emission, 0.0f, 1.0f), 1.0f);}
\ No newline at end of file
@@ -8,6 +8,12 @@ layout(set = 0, binding = 0) uniform GlobalUniformBufferObject {
 	vec3 eyePos;		// position of the viewer
 } gubo;
 
+layout(set = 0, binding = 1) uniform CameraUniformBufferObject {
+	mat4 viewPrj;		// written just before submit (late latch)
+	mat4 view;
+	vec3 eyePos;
+} cam;
+
 layout(set = 1, binding = 0) uniform SpotUniformBufferObject {
 	vec3 lightPos;
 	vec3 lightDir;
@@ -28,12 +34,16 @@ layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inNorm;
 layout(location = 2) in vec2 inUV;
 
+// Same expression as DepthPrepass.vert: the depth must match exactly for
+// the EQUAL test after the depth pre-pass
+invariant gl_Position;
+
 layout(location = 0) out vec3 fragPos;
 layout(location = 1) out vec3 fragNorm;
 layout(location = 2) out vec2 outUV;
 
 void main() {
-	gl_Position = ubo.mvpMat * vec4(inPosition, 1.0);
+	gl_Position = cam.viewPrj * ubo.mMat * vec4(inPosition, 1.0);
 	fragPos = (ubo.mMat * vec4(inPosition, 1.0)).xyz;
 	fragNorm = (ubo.nMat * vec4(inNorm, 0.0)).xyz;
 	outUV = inUV;
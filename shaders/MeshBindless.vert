@@ -0,0 +1,54 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Same as Mesh.vert, with the uniform blocks of all the entities in one buffer
+
+layout(set = 0, binding = 1) uniform CameraUniformBufferObject {
+	mat4 viewPrj;		// written just before submit (late latch)
+	mat4 view;
+	vec3 eyePos;
+} cam;
+
+struct Entity {
+	float amb;
+	float gamma;
+	vec3 sColor;
+	mat4 mvpMat;
+	mat4 mMat;
+	mat4 nMat;
+};
+
+layout(std430, set = 2, binding = 0) readonly buffer Entities {
+	Entity entities[];
+};
+
+layout(push_constant) uniform Draw {
+	uint entity;
+	uint texId;
+	uint emitId;
+	uint texLayer;
+	uint emitLayer;
+	uint pad;
+	vec2 texScale;
+	vec2 emitScale;
+} draw;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNorm;
+layout(location = 2) in vec2 inUV;
+
+// Same expression as DepthPrepass.vert: the depth must match exactly for
+// the EQUAL test after the depth pre-pass
+invariant gl_Position;
+
+layout(location = 0) out vec3 fragPos;
+layout(location = 1) out vec3 fragNorm;
+layout(location = 2) out vec2 outUV;
+
+void main() {
+	mat4 mMat = entities[draw.entity].mMat;
+	gl_Position = cam.viewPrj * mMat * vec4(inPosition, 1.0);
+	fragPos = (mMat * vec4(inPosition, 1.0)).xyz;
+	fragNorm = (entities[draw.entity].nMat * vec4(inNorm, 0.0)).xyz;
+	outUV = inUV;
+}
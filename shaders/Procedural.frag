@@ -1 +0,0 @@
-#version 450#extension GL_ARB_separate_shader_objects : enablelayout(location = 0) in vec3 fragPos;layout(location = 1) in vec3 fragNorm;layout(location = 2) in vec2 fragUV;layout(location = 0) out vec4 outColor;layout(set = 0, binding = 0) uniform GlobalUniformBufferObject {	vec3 DlightDir;		// direction of the direct light	vec3 DlightColor;	// color of the direct light	vec3 AmbLightColor;	// ambient light	vec3 eyePos;		// position of the viewer} gubo;layout(set = 1, binding = 0) uniform SpotUniformBufferObject {	float on;	vec3 lightPos;	vec3 lightDir;	vec4 lightColor;	vec3 eyePos;} spot;layout(set = 2, binding = 0) uniform UniformBufferObject {	float amb;	float gamma;	vec3 sColor;	mat4 mvpMat;	mat4 mMat;	mat4 nMat;} ubo;layout(set = 2, binding = 1) uniform sampler2D tex;// SPOT LIGHT CONSTANTSconst float beta = 1.5f;const float g = 10;const float cosout = 0.85;const float cosin  = 0.95;void main() {	vec3 N = normalize(fragNorm);				// surface normal	vec3 V = normalize(gubo.eyePos - fragPos);	// viewer direction	vec3 L = normalize(gubo.DlightDir);			// light direction	vec3 albedo = texture(tex, fragUV).rgb;		// main color	vec3 MD = albedo;	vec3 MS = ubo.sColor;	vec3 MA = albedo * ubo.amb;	vec3 LA = gubo.AmbLightColor;	float directLightPerc = 0.025f;	float spotLightPerc = (1.00f - directLightPerc) * spot.on;	// Gubo Shader	vec3 guboLightDir = gubo.DlightDir;	vec3 guboLightColor = vec3(gubo.DlightColor);	vec3 guboDiffuse = MD * 0.95f * clamp(dot(N, guboLightDir), 0.0, 1.0) * directLightPerc;	vec3 guboSpecular = vec3(0.0f) * directLightPerc;	vec3 guboAmbient = MA * LA * 0.05f * directLightPerc;	// SpotLight Shader	vec3 spotLightDir = normalize(spot.lightPos - fragPos);	vec3 spotLightColor = vec3(spot.lightColor) * pow(g / length(spot.lightPos - fragPos), beta) *                      clamp(((dot(spotLightDir, -spot.lightDir)) - cosout) / (cosin - cosout), 0.0, 1.0);	vec3 spotDiffuse = 0.99 * spotLightColor * MD * clamp(dot(N, spotLightDir), 0.0, 1.0) * spotLightPerc;  // Lambert	vec3 spotSpecular = spotLightColor * MS * pow(clamp(dot(N, normalize(spotLightDir + V)), 0.01, 1.0), ubo.gamma) * spotLightPerc;  // Blinn TODO	vec3 spotAmbient = 0.01f * vec3(spot.lightColor) * MD * spotLightPerc;		// Final Vector	vec3 Diffuse = spotDiffuse + guboDiffuse;	vec3 Specular = spotSpecular + guboSpecular;	vec3 Ambient = spotAmbient + guboAmbient;		// Final output	outColor = vec4(clamp(Diffuse + Specular + Ambient, 0.0f, 1.0f), 1.0f);}
\ No newline at end of file
@@ -1,40 +0,0 @@
-#version 450
-#extension GL_ARB_separate_shader_objects : enable
-
-layout(set = 0, binding = 0) uniform GlobalUniformBufferObject {
-	vec3 DlightDir;		// direction of the direct light
-	vec3 DlightColor;	// color of the direct light
-	vec3 AmbLightColor;	// ambient light
-	vec3 eyePos;		// position of the viewer
-} gubo;
-
-layout(set = 1, binding = 0) uniform SpotUniformBufferObject {
-	vec3 lightPos;
-	vec3 lightDir;
-	vec4 lightColor;
-	vec3 eyePos;
-} spot;
-
-layout(set = 2, binding = 0) uniform UniformBufferObject {
-	float amb;
-	float gamma;
-	vec3 sColor;
-	mat4 mvpMat;
-	mat4 mMat;
-	mat4 nMat;
-} ubo;
-
-layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inNorm;
-layout(location = 2) in vec2 inUV;
-
-layout(location = 0) out vec3 fragPos;
-layout(location = 1) out vec3 fragNorm;
-layout(location = 2) out vec2 outUV;
-
-void main() {
-	gl_Position = ubo.mvpMat * vec4(inPosition, 1.0);
-	fragPos = (ubo.mMat * vec4(inPosition, 1.0)).xyz;
-	fragNorm = (ubo.nMat * vec4(inNorm, 0.0)).xyz;
-	outUV = inUV;
-}
\ No newline at end of file
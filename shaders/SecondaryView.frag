@@ -0,0 +1,44 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Secondary view (SecondaryView.hpp): albedo lit by one directional light and
+// the ambient. The normal stays in object space, the light comes in that space.
+// Compiled a second time with -DBINDLESS for the bindless set, like GBuffer.frag.
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : enable
+#endif
+
+layout(location = 0) in vec3 fragNorm;
+layout(location = 1) in vec2 fragUV;
+
+layout(location = 0) out vec4 outColor;
+
+layout(push_constant) uniform Draw {
+	mat4 mvp;
+	vec4 light;		// xyz: direction to the light in object space, w: ambient
+	uint texId;		// bindless: array texture, layer and UV scale of the albedo
+	uint texLayer;
+	vec2 texScale;
+} draw;
+
+#ifdef BINDLESS
+layout(set = 0, binding = 1) uniform sampler2DArray textures[];
+
+// As in MeshBindless.frag
+vec3 albedo() {
+	vec2 uv = fragUV * draw.texScale;
+	return textureGrad(textures[draw.texId], vec3(fract(fragUV) * draw.texScale, draw.texLayer),
+		dFdx(uv), dFdy(uv)).rgb;
+}
+#else
+layout(set = 0, binding = 1) uniform sampler2D tex;
+
+vec3 albedo() {
+	return texture(tex, fragUV).rgb;
+}
+#endif
+
+void main() {
+	float diffuse = max(dot(normalize(fragNorm), draw.light.xyz), 0.0);
+	outColor = vec4(albedo() * mix(diffuse, 1.0, draw.light.w), 1.0);
+}
@@ -0,0 +1,25 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Secondary view (SecondaryView.hpp): the props seen from another camera
+
+layout(push_constant) uniform Draw {
+	mat4 mvp;		// view-projection of the view times the world matrix
+	vec4 light;		// xyz: direction to the light in object space, w: ambient
+	uint texId;
+	uint texLayer;
+	vec2 texScale;
+} draw;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNorm;
+layout(location = 2) in vec2 inUV;
+
+layout(location = 0) out vec3 fragNorm;
+layout(location = 1) out vec2 fragUV;
+
+void main() {
+	gl_Position = draw.mvp * vec4(inPosition, 1.0);
+	fragNorm = inNorm;
+	fragUV = inUV;
+}
@@ -0,0 +1,7 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Depth only passes (shadow map, depth pre-pass): nothing but the depth is written
+
+void main() {
+}
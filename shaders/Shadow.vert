@@ -0,0 +1,14 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Shadow map (ShadowMap.hpp): depth only, seen from the light
+
+layout(push_constant) uniform Caster {
+	mat4 lightMvp;		// light view-projection times the caster's world matrix
+} caster;
+
+layout(location = 0) in vec3 inPosition;
+
+void main() {
+	gl_Position = caster.lightMvp * vec4(inPosition, 1.0);
+}
@@ -0,0 +1,58 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Anti-aliasing tier "taa": the scene is rendered with a different sub-pixel
+// jitter every frame and blended with the history, the result of the frames
+// before. The history is reprojected with the depth (camera motion only) and
+// clamped to the color range of the 3x3 neighbourhood, so that what moved or
+// got uncovered does not ghost. The result goes both to the screen and to the
+// next history. Under dynamic resolution the scene covers only the top left of
+// its image and the history stays at full resolution, so the jittered frames
+// add up to more detail than any one of them (temporal upscale).
+
+layout(location = 0) out vec4 outColor;
+layout(location = 1) out vec4 outHistory;
+
+layout(set = 0, binding = 0) uniform sampler2D scene;
+layout(set = 0, binding = 1) uniform sampler2D history;
+layout(set = 0, binding = 2) uniform sampler2D depth;
+
+layout(push_constant) uniform AA {
+	mat4 reproject;		// unjittered clip space of this frame to that of the last one
+	vec4 texel;			// 1 / width, 1 / height, width, height
+	vec4 params;		// history weight (0: no history yet), unused, jitter in NDC
+	vec4 scene;			// rendered part of the scene image: UV scale, size in texels
+} aa;
+
+void main() {
+	vec2 uv = gl_FragCoord.xy * aa.texel.xy;
+	ivec2 p = ivec2(uv * aa.scene.zw);	// scene texel under this pixel
+	ivec2 last = ivec2(aa.scene.zw) - 1;
+	vec3 current = texture(scene, min(uv * aa.scene.xy, aa.scene.xy - 0.5 * aa.texel.xy)).rgb;
+
+	// Neighbourhood color range, and the nearest depth: edges keep the motion
+	// of the foreground
+	vec3 lo = current, hi = current;
+	float z = texelFetch(depth, p, 0).r;
+	for (int y = -1; y <= 1; y++) {
+		for (int x = -1; x <= 1; x++) {
+			ivec2 q = clamp(p + ivec2(x, y), ivec2(0), last);
+			vec3 c = texelFetch(scene, q, 0).rgb;
+			lo = min(lo, c);
+			hi = max(hi, c);
+			z = min(z, texelFetch(depth, q, 0).r);
+		}
+	}
+
+	vec4 prev = aa.reproject * vec4(uv * 2.0 - 1.0 - aa.params.zw, z, 1.0);
+	vec2 prevUV = prev.xy / prev.w * 0.5 + 0.5;
+	float weight = aa.params.x;
+	if (any(lessThan(prevUV, vec2(0.0))) || any(greaterThan(prevUV, vec2(1.0)))) {
+		weight = 0.0;
+	}
+
+	vec3 h = clamp(texture(history, prevUV).rgb, lo, hi);
+	vec3 result = mix(current, h, weight);
+	outColor = vec4(result, 1.0);
+	outHistory = vec4(result, 1.0);
+}
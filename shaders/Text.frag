@@ -0,0 +1,16 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec2 fragUV;
+
+layout(location = 0) out vec4 outColor;
+
+layout(binding = 0) uniform sampler2D tex;
+
+void main() {
+	vec4 color = texture(tex, fragUV);
+	if (color.a < 0.01)
+		discard;
+
+	outColor = color;
+}
@@ -0,0 +1,36 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Dynamic resolution, tiers without a post pass of their own: the scene, drawn
+// into the top left of its image, scaled up bilinearly to the full size, then
+// sharpened against the blur of the scaling, the more the lower the scale.
+
+layout(location = 0) out vec4 outColor;
+
+layout(set = 0, binding = 0) uniform sampler2D scene;
+
+layout(push_constant) uniform AA {
+	mat4 reproject;		// TAA only
+	vec4 texel;			// 1 / width, 1 / height, width, height
+	vec4 params;		// TAA only
+	vec4 scene;			// rendered part of the scene image: UV scale, size in texels
+} aa;
+
+const float SHARPNESS = 0.5;
+
+void main() {
+	vec2 uv = min(gl_FragCoord.xy * aa.texel.xy * aa.scene.xy, aa.scene.xy - 0.5 * aa.texel.xy);
+	vec3 c = texture(scene, uv).rgb;
+
+	// Unsharp mask over the four neighbours one scene texel away, kept within
+	// their range so that edges do not ring
+	vec3 n = texture(scene, uv + vec2(0.0, -aa.texel.y)).rgb;
+	vec3 s = texture(scene, min(uv + vec2(0.0, aa.texel.y), aa.scene.xy - 0.5 * aa.texel.xy)).rgb;
+	vec3 w = texture(scene, uv + vec2(-aa.texel.x, 0.0)).rgb;
+	vec3 e = texture(scene, min(uv + vec2(aa.texel.x, 0.0), aa.scene.xy - 0.5 * aa.texel.xy)).rgb;
+	vec3 lo = min(c, min(min(n, s), min(w, e)));
+	vec3 hi = max(c, max(max(n, s), max(w, e)));
+	float amount = SHARPNESS * (1.0 - aa.scene.x);
+	vec3 sharpened = c + amount * (4.0 * c - n - s - w - e);
+	outColor = vec4(clamp(sharpened, lo, hi), 1.0);
+}